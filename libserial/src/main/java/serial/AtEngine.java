@@ -0,0 +1,237 @@
+package serial;
+
+import java.io.Closeable;
+
+/**
+ * Sends AT commands to a modem or GNSS module over an open {@link Serial}
+ * port, and routes its unsolicited result codes.
+ *
+ * A native thread reads the port line by line and matches each line to a
+ * command or a handler, so nobody has to poll
+ * {@link Serial#readline(int, String)}.  A line goes, in this order:
+ * <ul>
+ * <li>nowhere, if it echoes a command in flight;</li>
+ * <li>to that command, if it starts with the command's response prefix;</li>
+ * <li>to that command as its final result code, if it is one (OK,
+ * CONNECT, ERROR, +CME ERROR, +CMS ERROR, NO CARRIER, ...);</li>
+ * <li>to the {@link UrcListener} with the longest matching prefix; a
+ * listener for "" catches every line no one else takes;</li>
+ * <li>to the oldest command in flight as an information line.</li>
+ * </ul>
+ *
+ * Commands are sent in submission order, one at a time by default.
+ * Modules that buffer commands can be given several at once with
+ * {@link #setMaxInFlight(int)}.  The engine must be the only reader of the
+ * port while it is open.
+ */
+public class AtEngine implements Closeable {
+
+    static {
+        System.loadLibrary("serial");
+    }
+
+    private final Serial mPort;
+    // Guards mNativeEngine and mCallsInProgress
+    private final Object mLock = new Object();
+    private long mNativeEngine;
+    // Native calls using mNativeEngine, which close() waits for
+    private int mCallsInProgress;
+
+    /**
+     * Starts an engine that sends one command at a time.
+     *
+     * @param port The port, which must stay open while the engine is used.
+     */
+    public AtEngine(Serial port) throws SerialIOException {
+        this(port, 1);
+    }
+
+    /**
+     * Starts an engine.
+     *
+     * @param port The port, which must stay open while the engine is used.
+     * @param maxInFlight Commands sent before the oldest has finished.
+     * @throws IllegalArgumentException maxInFlight is not positive.
+     * @throws SerialIOException The engine's thread could not be started.
+     */
+    public AtEngine(Serial port, int maxInFlight) throws SerialIOException {
+        if (maxInFlight <= 0)
+            throw new IllegalArgumentException("maxInFlight");
+        mPort = port;
+        mNativeEngine = native_create(port.getNativePointer(), maxInFlight);
+        port.attachEngine(this);
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        close();
+        super.finalize();
+    }
+
+    /**
+     * Stops the engine.  Commands not finished are reported as
+     * {@link AtStatus#Cancelled}.  The port is left open.  Calls in progress
+     * on other threads, such as {@link #execute(String, int, String)}, are
+     * finished first.  An engine still running when its port is finalized
+     * is closed first.
+     */
+    @Override
+    public void close() {
+        long ptr;
+        boolean interrupted = false;
+        synchronized (mLock) {
+            ptr = mNativeEngine;
+            // No new calls from here on
+            mNativeEngine = 0;
+            while (mCallsInProgress > 0) {
+                try {
+                    mLock.wait();
+                } catch (InterruptedException e) {
+                    interrupted = true;
+                }
+            }
+        }
+        if (ptr != 0) {
+            native_destroy(ptr);
+            mPort.detachEngine(this);
+        }
+        if (interrupted)
+            Thread.currentThread().interrupt();
+    }
+
+    // Pins the native engine until release(), so close() cannot free it
+    // under a running call
+    private long acquire() {
+        synchronized (mLock) {
+            if (0 == mNativeEngine)
+                throw new IllegalStateException("AtEngine is closed");
+            ++mCallsInProgress;
+            return mNativeEngine;
+        }
+    }
+
+    private void release() {
+        synchronized (mLock) {
+            if (--mCallsInProgress == 0)
+                mLock.notifyAll();
+        }
+    }
+
+    /**
+     * @return the port this engine talks on.
+     */
+    public Serial getPort() {
+        return mPort;
+    }
+
+    /**
+     * Sets how many commands may be in flight at once.  Final result codes
+     * are matched to the commands oldest first, so after a timeout a late
+     * answer may be taken for the next command's.
+     */
+    public void setMaxInFlight(int maxInFlight) {
+        if (maxInFlight <= 0)
+            throw new IllegalArgumentException("maxInFlight");
+        long ptr = acquire();
+        try {
+            native_setMaxInFlight(ptr, maxInFlight);
+        } finally {
+            release();
+        }
+    }
+
+    public int getMaxInFlight() {
+        long ptr = acquire();
+        try {
+            return native_getMaxInFlight(ptr);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Queues a command.
+     *
+     * @param command The command without its line end, e.g. "AT+CSQ".
+     * @param timeoutMs Time allowed for the final result code, counted from
+     * when the command is sent.
+     * @param responsePrefix Prefix of the information lines the command
+     * answers with, e.g. "+CSQ:", so they are not taken for unsolicited
+     * codes; null or empty if it has none.
+     * @param listener Told the response, or null.
+     * @return The id of the command, passed to the listener.
+     */
+    public long submit(String command, int timeoutMs, String responsePrefix, AtResponseListener listener) {
+        if (timeoutMs < 0)
+            throw new IllegalArgumentException("timeoutMs");
+        long ptr = acquire();
+        try {
+            return native_submit(ptr, this, command, timeoutMs,
+                    responsePrefix == null ? "" : responsePrefix, listener);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Sends a command and waits for its response.  Must not be called from
+     * a listener.
+     *
+     * @see #submit(String, int, String, AtResponseListener)
+     */
+    public AtResponse execute(String command, int timeoutMs, String responsePrefix) {
+        if (timeoutMs < 0)
+            throw new IllegalArgumentException("timeoutMs");
+        long ptr = acquire();
+        try {
+            return native_execute(ptr, command, timeoutMs,
+                    responsePrefix == null ? "" : responsePrefix);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Sends a command without information lines of its own and waits for
+     * its response.
+     */
+    public AtResponse execute(String command, int timeoutMs) {
+        return execute(command, timeoutMs, "");
+    }
+
+    /**
+     * Routes the unsolicited lines starting with prefix, e.g. "+CREG:" or
+     * "RING", to listener, in place of any listener the prefix had.
+     */
+    public void setUrcHandler(String prefix, UrcListener listener) {
+        if (listener == null)
+            throw new IllegalArgumentException("listener");
+        long ptr = acquire();
+        try {
+            native_setUrcHandler(ptr, this, prefix, listener);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Stops routing the lines starting with prefix.
+     */
+    public void removeUrcHandler(String prefix) {
+        long ptr = acquire();
+        try {
+            native_removeUrcHandler(ptr, prefix);
+        } finally {
+            release();
+        }
+    }
+
+    private static native long native_create(long serialPtr, int maxInFlight) throws SerialIOException;
+    private static native void native_destroy(long nativePtr);
+    private static native void native_setMaxInFlight(long nativePtr, int maxInFlight);
+    private static native int native_getMaxInFlight(long nativePtr);
+    private static native long native_submit(long nativePtr, AtEngine engine, String command, int timeoutMs, String responsePrefix, AtResponseListener listener);
+    private static native AtResponse native_execute(long nativePtr, String command, int timeoutMs, String responsePrefix);
+    private static native void native_setUrcHandler(long nativePtr, AtEngine engine, String prefix, UrcListener listener);
+    private static native void native_removeUrcHandler(long nativePtr, String prefix);
+}
@@ -0,0 +1,39 @@
+package serial;
+
+/**
+ * What a module answered to a command sent through {@link AtEngine}.
+ */
+public final class AtResponse {
+
+    private final AtStatus mStatus;
+    private final String[] mLines;
+    private final String mFinalLine;
+
+    AtResponse(AtStatus status, String[] lines, String finalLine) {
+        mStatus = status;
+        mLines = lines;
+        mFinalLine = finalLine;
+    }
+
+    /** How the command ended. */
+    public AtStatus getStatus() {
+        return mStatus;
+    }
+
+    /** Whether the module answered OK or CONNECT. */
+    public boolean isOk() {
+        return mStatus == AtStatus.Ok;
+    }
+
+    /** The information lines before the final result code, without line
+     *  ends. */
+    public String[] getLines() {
+        return mLines;
+    }
+
+    /** The final result code, e.g. "OK" or "+CME ERROR: 10"; empty when
+     *  the module gave none. */
+    public String getFinalLine() {
+        return mFinalLine;
+    }
+}
@@ -0,0 +1,20 @@
+package serial;
+
+/**
+ * Receives the responses to commands queued with
+ * {@link AtEngine#submit(String, int, String, AtResponseListener)}.
+ *
+ * Callbacks run on a single native thread shared by all engines, so they
+ * should return quickly.
+ */
+public interface AtResponseListener {
+
+    /**
+     * Called once for every submitted command.
+     *
+     * @param engine The engine the command was submitted to.
+     * @param id The id submit returned.
+     * @param response The response.
+     */
+    void onResponse(AtEngine engine, long id, AtResponse response);
+}
@@ -0,0 +1,30 @@
+package serial;
+
+/**
+ * Enumeration defines how an AT command sent through {@link AtEngine}
+ * ended.
+ */
+public enum AtStatus {
+    /**
+     * The module answered OK, or CONNECT.
+     */
+    Ok,
+    /**
+     * The module answered ERROR, +CME ERROR, +CMS ERROR or a call failure
+     * such as NO CARRIER.
+     */
+    Error,
+    /**
+     * No final result code arrived within the command's timeout.
+     */
+    TimedOut,
+    /**
+     * The command could not be sent, or the port failed while it was in
+     * flight.
+     */
+    Failed,
+    /**
+     * The engine was closed before the command finished.
+     */
+    Cancelled;
+}
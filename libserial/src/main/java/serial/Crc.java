@@ -0,0 +1,128 @@
+package serial;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Native CRC computation.
+ *
+ * The common models are available as constants.  The native code uses
+ * slicing-by-8 tables, or the CPU's CRC32 or carry-less multiply
+ * instructions when it has them, see {@link #implementation()}.
+ *
+ * Instances may be shared by threads.
+ */
+public final class Crc {
+
+    static {
+        System.loadLibrary("serial");
+    }
+
+    /** CRC-8/SMBUS, polynomial 0x07. */
+    public static final Crc CRC8 = new Crc(native_predefined(0), false);
+    /** CRC-8/MAXIM-DOW (1-Wire), polynomial 0x31 reflected. */
+    public static final Crc CRC8_MAXIM = new Crc(native_predefined(1), false);
+    /** CRC-16/MODBUS, sent least significant byte first. */
+    public static final Crc CRC16_MODBUS = new Crc(native_predefined(2), false);
+    /** CRC-16/CCITT-FALSE (IBM-3740), polynomial 0x1021, init 0xFFFF. */
+    public static final Crc CRC16_CCITT_FALSE = new Crc(native_predefined(3), false);
+    /** CRC-16/KERMIT, the reflected CCITT CRC. */
+    public static final Crc CRC16_KERMIT = new Crc(native_predefined(4), false);
+    /** CRC-16/XMODEM, polynomial 0x1021, init 0. */
+    public static final Crc CRC16_XMODEM = new Crc(native_predefined(5), false);
+    /** CRC-32 as used by zlib and Ethernet. */
+    public static final Crc CRC32 = new Crc(native_predefined(6), false);
+    /** CRC-32C (Castagnoli). */
+    public static final Crc CRC32C = new Crc(native_predefined(7), false);
+
+    private long mNativeCrc;
+    private final boolean mOwned;
+
+    private Crc(long nativeCrc, boolean owned) {
+        mNativeCrc = nativeCrc;
+        mOwned = owned;
+    }
+
+    /**
+     * Creates a CRC from its Rocksoft model parameters, with the input and
+     * output reflected alike.
+     *
+     * @param width Width of the CRC in bits, 1 to 32.
+     * @param poly The generator polynomial, without the top bit.
+     * @param init Initial register value.
+     * @param reflected Whether input bytes and the result are bit reflected.
+     * @param xorout Value XORed into the final register.
+     * @return The CRC.
+     *
+     * @throws IllegalArgumentException if width is out of range.
+     */
+    public static Crc create(int width, int poly, int init, boolean reflected, int xorout) {
+        return new Crc(native_create(width, poly, init, reflected, xorout), true);
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        if (mOwned && mNativeCrc != 0) {
+            native_destroy(mNativeCrc);
+            mNativeCrc = 0;
+        }
+        super.finalize();
+    }
+
+    /** The native object, for {@link Framer}. */
+    long getNativePointer() {
+        return mNativeCrc;
+    }
+
+    /** Width of the CRC in bits. */
+    public int width() {
+        return native_width(mNativeCrc);
+    }
+
+    /** Name of the native implementation picked for this CPU. */
+    public String implementation() {
+        return native_implementation(mNativeCrc);
+    }
+
+    /**
+     * Computes the CRC of part of an array.
+     *
+     * @return The CRC, as an unsigned value.
+     *
+     * @throws IllegalArgumentException if the range is out of bounds.
+     */
+    public long compute(byte[] data, int offset, int size) {
+        return native_compute(mNativeCrc, data, offset, size);
+    }
+
+    /** Computes the CRC of an array. */
+    public long compute(byte[] data) {
+        return native_compute(mNativeCrc, data, 0, data.length);
+    }
+
+    /**
+     * Computes the CRC of the bytes between a buffer's position and limit,
+     * without moving the position.  Direct buffers are read by the native
+     * code without copying.
+     *
+     * @return The CRC, as an unsigned value.
+     */
+    public long compute(ByteBuffer buffer) {
+        int position = buffer.position();
+        int size = buffer.remaining();
+        if (buffer.isDirect())
+            return native_computeDirect(mNativeCrc, buffer, position, size);
+        if (buffer.hasArray())
+            return native_compute(mNativeCrc, buffer.array(), buffer.arrayOffset() + position, size);
+        byte[] data = new byte[size];
+        buffer.duplicate().get(data);
+        return native_compute(mNativeCrc, data, 0, size);
+    }
+
+    private static native long native_predefined(int id);
+    private static native long native_create(int width, int poly, int init, boolean reflected, int xorout) throws IllegalArgumentException;
+    private static native void native_destroy(long nativePtr);
+    private static native int native_width(long nativePtr);
+    private static native String native_implementation(long nativePtr);
+    private static native long native_compute(long nativePtr, byte[] data, int offset, int size) throws IllegalArgumentException;
+    private static native long native_computeDirect(long nativePtr, ByteBuffer buffer, int offset, int size) throws IllegalArgumentException;
+}
@@ -0,0 +1,136 @@
+package serial;
+
+import java.nio.ByteOrder;
+
+/**
+ * Describes how the bytes received by a port are split into frames.
+ *
+ * Set one with {@link Serial#setFramer(Framer)}, then
+ * {@link Serial#readFrame()} returns exactly one complete frame per call and
+ * {@link Serial#writeFrame(byte[], int, int)} sends one.  The splitting is
+ * done natively, Java only sees whole frames.
+ */
+public final class Framer {
+
+    /**
+     * Default for the largest frame on the wire, in bytes.
+     */
+    public static final int MAX_FRAME_DEFAULT = 65536;
+
+    // Keep in sync with framer_jni.cc
+    static final int TYPE_FIXED_LENGTH = 1;
+    static final int TYPE_LENGTH_FIELD = 2;
+    static final int TYPE_DELIMITER = 3;
+    static final int TYPE_SLIP = 4;
+    static final int TYPE_COBS = 5;
+
+    final int type;
+    final int[] params;
+    final byte[] delimiter;
+    final Crc crc;
+    final boolean crcLittleEndian;
+
+    private Framer(int type, int[] params, byte[] delimiter) {
+        this(type, params, delimiter, null, false);
+    }
+
+    private Framer(int type, int[] params, byte[] delimiter, Crc crc, boolean crcLittleEndian) {
+        this.type = type;
+        this.params = params;
+        this.delimiter = delimiter;
+        this.crc = crc;
+        this.crcLittleEndian = crcLittleEndian;
+    }
+
+    /**
+     * Returns a framer that also checks a CRC at the end of every frame.
+     *
+     * Frames whose CRC does not match are dropped, the CRC is removed from
+     * frames that pass.  {@link Serial#writeFrame(byte[], int, int)} appends
+     * the CRC to the payload before framing it.
+     *
+     * @param crc The CRC, which covers the frame as this framer returns it.
+     * @param order Byte order of the CRC on the wire.
+     * @return The framer.
+     */
+    public Framer withCrc(Crc crc, ByteOrder order) {
+        return new Framer(type, params, delimiter, crc, order == ByteOrder.LITTLE_ENDIAN);
+    }
+
+    /**
+     * Frames of a fixed number of bytes.
+     *
+     * @param length The frame length.
+     * @return The framer.
+     */
+    public static Framer fixedLength(int length) {
+        return new Framer(TYPE_FIXED_LENGTH, new int[] { length }, null);
+    }
+
+    /**
+     * Frames that carry their length in a header field.
+     *
+     * The frame on the wire is offset bytes of header, the length field, then
+     * value + adjustment more bytes.  The first strip bytes of that are
+     * removed from the frames returned by {@link Serial#readFrame()}.
+     *
+     * @param offset Bytes before the length field.
+     * @param fieldSize Width of the length field: 1, 2, 3 or 4 bytes.
+     * @param order Byte order of the length field.
+     * @param adjustment Added to the field value to get the number of bytes
+     * that follow the field, e.g. the size of a trailing CRC.
+     * @param strip Bytes to remove from the start of returned frames.
+     * @param maxFrame Largest frame on the wire.
+     * @return The framer.
+     */
+    public static Framer lengthField(int offset, int fieldSize, ByteOrder order,
+                                     int adjustment, int strip, int maxFrame) {
+        return new Framer(TYPE_LENGTH_FIELD, new int[] {
+                offset, fieldSize, order == ByteOrder.LITTLE_ENDIAN ? 1 : 0,
+                adjustment, strip, maxFrame }, null);
+    }
+
+    /**
+     * Frames with a big endian length field that counts the bytes after it.
+     *
+     * @see #lengthField(int, int, ByteOrder, int, int, int)
+     */
+    public static Framer lengthField(int offset, int fieldSize) {
+        return lengthField(offset, fieldSize, ByteOrder.BIG_ENDIAN, 0, 0, MAX_FRAME_DEFAULT);
+    }
+
+    /**
+     * Frames terminated by a delimiter.
+     *
+     * @param delimiter The bytes ending each frame.
+     * @param includeDelimiter Whether returned frames keep the delimiter.
+     * @param maxFrame Largest frame, including the delimiter.
+     * @return The framer.
+     */
+    public static Framer delimiter(byte[] delimiter, boolean includeDelimiter, int maxFrame) {
+        if (delimiter == null)
+            throw new NullPointerException("delimiter");
+        return new Framer(TYPE_DELIMITER, new int[] { includeDelimiter ? 1 : 0, maxFrame },
+                delimiter.clone());
+    }
+
+    /**
+     * SLIP framing (RFC 1055).
+     *
+     * @param maxFrame Largest frame on the wire.
+     * @return The framer.
+     */
+    public static Framer slip(int maxFrame) {
+        return new Framer(TYPE_SLIP, new int[] { maxFrame }, null);
+    }
+
+    /**
+     * Consistent Overhead Byte Stuffing, with a zero byte ending each frame.
+     *
+     * @param maxFrame Largest frame on the wire.
+     * @return The framer.
+     */
+    public static Framer cobs(int maxFrame) {
+        return new Framer(TYPE_COBS, new int[] { maxFrame }, null);
+    }
+}
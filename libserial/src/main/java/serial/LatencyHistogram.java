@@ -0,0 +1,107 @@
+package serial;
+
+import java.io.Closeable;
+
+/**
+ * A latency distribution, in nanoseconds.
+ *
+ * Values are kept in log-linear buckets, each within about 3% of the values
+ * it holds.  Fill one with {@link Serial#getLatency(LatencyOp, LatencyHistogram, boolean)},
+ * and merge the histograms of several ports with {@link #add(LatencyHistogram)}.
+ */
+public class LatencyHistogram implements Closeable {
+
+    static {
+        System.loadLibrary("serial");
+    }
+
+    private long mNativeHistogram;
+
+    /**
+     * Creates an empty histogram.
+     */
+    public LatencyHistogram() {
+        mNativeHistogram = native_create();
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        close();
+        super.finalize();
+    }
+
+    /**
+     * Frees the native histogram.
+     */
+    @Override
+    public synchronized void close() {
+        if (mNativeHistogram != 0) {
+            native_destroy(mNativeHistogram);
+            mNativeHistogram = 0;
+        }
+    }
+
+    /** The native object, for {@link Serial}. */
+    long getNativePointer() {
+        if (0 == mNativeHistogram)
+            throw new IllegalStateException("LatencyHistogram is closed");
+        return mNativeHistogram;
+    }
+
+    /**
+     * Adds all values of another histogram to this one.
+     *
+     * @param other The histogram to add.
+     */
+    public void add(LatencyHistogram other) {
+        native_add(getNativePointer(), other.getNativePointer());
+    }
+
+    /**
+     * Forgets all values.
+     */
+    public void reset() {
+        native_reset(getNativePointer());
+    }
+
+    /** Number of values. */
+    public long count() {
+        return native_count(getNativePointer());
+    }
+
+    /** Smallest value, 0 if empty. */
+    public long min() {
+        return native_min(getNativePointer());
+    }
+
+    /** Largest value, 0 if empty. */
+    public long max() {
+        return native_max(getNativePointer());
+    }
+
+    /** Mean of the values, 0 if empty. */
+    public double mean() {
+        return native_mean(getNativePointer());
+    }
+
+    /**
+     * Returns the value below or at which a percentage of the values lie.
+     *
+     * @param percent The percentile, e.g. 99.9.
+     * @return The highest value of the bucket the percentile falls in, never
+     * more than {@link #max()}; 0 if empty.
+     */
+    public long percentile(double percent) {
+        return native_percentile(getNativePointer(), percent);
+    }
+
+    private static native long native_create();
+    private static native void native_destroy(long nativePtr);
+    private static native void native_add(long nativePtr, long otherPtr);
+    private static native void native_reset(long nativePtr);
+    private static native long native_count(long nativePtr);
+    private static native long native_min(long nativePtr);
+    private static native long native_max(long nativePtr);
+    private static native double native_mean(long nativePtr);
+    private static native long native_percentile(long nativePtr, double percent);
+}
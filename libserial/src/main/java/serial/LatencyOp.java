@@ -0,0 +1,25 @@
+package serial;
+
+/**
+ * Enumeration defines the calls whose latency a port keeps.
+ *
+ * @see Serial#getLatency(LatencyOp, boolean)
+ */
+public enum LatencyOp {
+    /**
+     * The read methods.
+     */
+    Read,
+    /**
+     * The write methods.
+     */
+    Write,
+    /**
+     * The readline methods.
+     */
+    Readline,
+    /**
+     * {@link Serial#flush()}, which waits for the output to drain.
+     */
+    Flush;
+}
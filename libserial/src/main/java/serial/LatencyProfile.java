@@ -0,0 +1,23 @@
+package serial;
+
+/**
+ * Enumeration defines the receive latency profiles for the serial port.
+ *
+ * @see Serial#setLatencyProfile(LatencyProfile)
+ */
+public enum LatencyProfile {
+    /**
+     * Leave the driver's low latency flag as it is.
+     *
+     * This is the default.
+     */
+    Default,
+    /**
+     * Deliver received bytes as soon as possible.
+     */
+    Low,
+    /**
+     * Batch received bytes into fewer, larger reads.
+     */
+    Throughput;
+}
@@ -0,0 +1,37 @@
+package serial;
+
+/**
+ * Thrown when a Modbus slave answers a request with an exception response.
+ */
+public class ModbusException extends SerialException {
+
+    private final int mFunction;
+    private final int mExceptionCode;
+
+    /**
+     * Constructs a new {@code ModbusException}.
+     *
+     * @param detailMessage the detail message for this exception.
+     * @param function the function code of the failed request.
+     * @param exceptionCode the exception code returned by the slave.
+     */
+    public ModbusException(String detailMessage, int function, int exceptionCode) {
+        super(detailMessage);
+        mFunction = function;
+        mExceptionCode = exceptionCode;
+    }
+
+    /**
+     * @return the function code of the failed request.
+     */
+    public int getFunction() {
+        return mFunction;
+    }
+
+    /**
+     * @return the exception code, e.g. 2 for an illegal data address.
+     */
+    public int getExceptionCode() {
+        return mExceptionCode;
+    }
+}
@@ -0,0 +1,322 @@
+package serial;
+
+import java.io.Closeable;
+
+/**
+ * Polls Modbus RTU slaves over an open {@link Serial} port.
+ *
+ * Framing, CRC checks, matching responses to requests and retries are all
+ * done natively.  Frame ends are detected from the silence between
+ * characters, derived from the port's baud rate, so a round trip takes as
+ * long as the wire needs.  Every request holds the port's read and write
+ * locks until its response arrives, so a master may be used from several
+ * threads and the port may be shared.
+ *
+ * Reads and writes throw {@link ModbusException} when the slave returns an
+ * exception response, and {@link SerialIOException} when no valid response
+ * arrives within the retries.
+ */
+public class ModbusRtuMaster implements Closeable {
+
+    static {
+        System.loadLibrary("serial");
+    }
+
+    private static final int READ_COILS = 0x01;
+    private static final int READ_DISCRETE_INPUTS = 0x02;
+    private static final int READ_HOLDING_REGISTERS = 0x03;
+    private static final int READ_INPUT_REGISTERS = 0x04;
+
+    private final Serial mPort;
+    // Guards mNativeMaster and mCallsInProgress
+    private final Object mLock = new Object();
+    private long mNativeMaster;
+    // Native calls using mNativeMaster, which close() waits for
+    private int mCallsInProgress;
+    private int mResponseTimeout = 1000;
+    private int mRetries = 2;
+
+    /**
+     * Creates a master on a port, which must stay open while it is used.
+     *
+     * @param port The port.
+     */
+    public ModbusRtuMaster(Serial port) {
+        mPort = port;
+        mNativeMaster = native_create(port.getNativePointer());
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        close();
+        super.finalize();
+    }
+
+    /**
+     * Frees the native master.  The port is left open.  Requests in
+     * progress on other threads are finished first.
+     */
+    @Override
+    public void close() {
+        long ptr;
+        boolean interrupted = false;
+        synchronized (mLock) {
+            ptr = mNativeMaster;
+            // No new calls from here on
+            mNativeMaster = 0;
+            while (mCallsInProgress > 0) {
+                try {
+                    mLock.wait();
+                } catch (InterruptedException e) {
+                    interrupted = true;
+                }
+            }
+        }
+        if (ptr != 0)
+            native_destroy(ptr);
+        if (interrupted)
+            Thread.currentThread().interrupt();
+    }
+
+    // Pins the native master until release(), so close() cannot free it
+    // under a running call
+    private long acquire() {
+        synchronized (mLock) {
+            if (0 == mNativeMaster)
+                throw new IllegalStateException("ModbusRtuMaster is closed");
+            ++mCallsInProgress;
+            return mNativeMaster;
+        }
+    }
+
+    private void release() {
+        synchronized (mLock) {
+            if (--mCallsInProgress == 0)
+                mLock.notifyAll();
+        }
+    }
+
+    /**
+     * @return the port this master talks on.
+     */
+    public Serial getPort() {
+        return mPort;
+    }
+
+    /**
+     * Sets how long to wait for a response, in milliseconds.  Defaults to
+     * 1000.
+     */
+    public void setResponseTimeout(int timeoutMs) {
+        if (timeoutMs < 0)
+            throw new IllegalArgumentException("timeoutMs");
+        long ptr = acquire();
+        try {
+            native_setResponseTimeout(ptr, timeoutMs);
+        } finally {
+            release();
+        }
+        mResponseTimeout = timeoutMs;
+    }
+
+    public int getResponseTimeout() {
+        return mResponseTimeout;
+    }
+
+    /**
+     * Sets how many times a request is sent again when no valid response
+     * arrives.  Defaults to 2.
+     */
+    public void setRetries(int retries) {
+        if (retries < 0)
+            throw new IllegalArgumentException("retries");
+        long ptr = acquire();
+        try {
+            native_setRetries(ptr, retries);
+        } finally {
+            release();
+        }
+        mRetries = retries;
+    }
+
+    public int getRetries() {
+        return mRetries;
+    }
+
+    /**
+     * Sets how long to wait after a broadcast, in milliseconds.  Defaults to
+     * 100.
+     */
+    public void setTurnaroundDelay(int delayMs) {
+        if (delayMs < 0)
+            throw new IllegalArgumentException("delayMs");
+        long ptr = acquire();
+        try {
+            native_setTurnaroundDelay(ptr, delayMs);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Sets a lower bound for the silence that ends a frame, in
+     * microseconds.
+     *
+     * USB adapters deliver data in bursts a few milliseconds apart, which
+     * can look like the end of a frame.  Raise this to the adapter's latency
+     * when responses get cut short.  Defaults to 0.
+     */
+    public void setMinimumSilence(int silenceUs) {
+        if (silenceUs < 0)
+            throw new IllegalArgumentException("silenceUs");
+        long ptr = acquire();
+        try {
+            native_setMinimumSilence(ptr, silenceUs);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Makes a gap of more than 1.5 character times inside a frame invalidate
+     * it, as the specification requires.  Off by default.
+     */
+    public void setStrictTiming(boolean strict) {
+        long ptr = acquire();
+        try {
+            native_setStrictTiming(ptr, strict);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Sends a raw request and returns the raw response.
+     *
+     * @param slave The slave address, 0 broadcasts and returns an empty
+     * array.
+     * @param pdu The function code followed by its data, at most 253 bytes.
+     * @return The function code and data of the response.
+     */
+    public byte[] transact(int slave, byte[] pdu) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            return native_transact(ptr, slave, pdu);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Reads coils (function 0x01) into values[0, count).
+     */
+    public void readCoils(int slave, int address, boolean[] values, int count) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_readBits(ptr, READ_COILS, slave, address, values, count);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Reads discrete inputs (function 0x02) into values[0, count).
+     */
+    public void readDiscreteInputs(int slave, int address, boolean[] values, int count) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_readBits(ptr, READ_DISCRETE_INPUTS, slave, address, values, count);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Reads holding registers (function 0x03) into values[0, count), as
+     * unsigned values.
+     */
+    public void readHoldingRegisters(int slave, int address, int[] values, int count) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_readRegisters(ptr, READ_HOLDING_REGISTERS, slave, address, values, count);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Reads input registers (function 0x04) into values[0, count), as
+     * unsigned values.
+     */
+    public void readInputRegisters(int slave, int address, int[] values, int count) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_readRegisters(ptr, READ_INPUT_REGISTERS, slave, address, values, count);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Writes a single coil (function 0x05).
+     */
+    public void writeSingleCoil(int slave, int address, boolean value) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_writeSingleCoil(ptr, slave, address, value);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Writes a single holding register (function 0x06).
+     */
+    public void writeSingleRegister(int slave, int address, int value) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_writeSingleRegister(ptr, slave, address, value);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Writes values[0, count) to coils (function 0x0F).
+     */
+    public void writeMultipleCoils(int slave, int address, boolean[] values, int count) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_writeMultipleCoils(ptr, slave, address, values, count);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Writes values[0, count) to holding registers (function 0x10).
+     */
+    public void writeMultipleRegisters(int slave, int address, int[] values, int count) throws SerialIOException {
+        long ptr = acquire();
+        try {
+            native_writeMultipleRegisters(ptr, slave, address, values, count);
+        } finally {
+            release();
+        }
+    }
+
+    private static native long native_create(long serialPtr);
+    private static native void native_destroy(long nativePtr);
+    private static native void native_setResponseTimeout(long nativePtr, int timeoutMs);
+    private static native void native_setRetries(long nativePtr, int retries);
+    private static native void native_setTurnaroundDelay(long nativePtr, int delayMs);
+    private static native void native_setMinimumSilence(long nativePtr, int silenceUs);
+    private static native void native_setStrictTiming(long nativePtr, boolean strict);
+    private static native byte[] native_transact(long nativePtr, int slave, byte[] pdu) throws SerialIOException;
+    private static native void native_readBits(long nativePtr, int function, int slave, int address, boolean[] values, int count) throws SerialIOException;
+    private static native void native_readRegisters(long nativePtr, int function, int slave, int address, int[] values, int count) throws SerialIOException;
+    private static native void native_writeSingleCoil(long nativePtr, int slave, int address, boolean value) throws SerialIOException;
+    private static native void native_writeSingleRegister(long nativePtr, int slave, int address, int value) throws SerialIOException;
+    private static native void native_writeMultipleCoils(long nativePtr, int slave, int address, boolean[] values, int count) throws SerialIOException;
+    private static native void native_writeMultipleRegisters(long nativePtr, int slave, int address, int[] values, int count) throws SerialIOException;
+}
@@ -0,0 +1,32 @@
+package serial;
+
+/**
+ * Outcome of {@link Serial#readUntilAny(PatternSet, int)}.
+ */
+public final class PatternMatch {
+
+    private final int mIndex;
+    private final byte[] mBefore;
+
+    PatternMatch(int index, byte[] before) {
+        mIndex = index;
+        mBefore = before;
+    }
+
+    /** Whether a pattern arrived before the deadline. */
+    public boolean isMatched() {
+        return mIndex >= 0;
+    }
+
+    /** Index of the pattern that matched, in the order given to
+     *  {@link PatternSet}, or -1 if the deadline passed first. */
+    public int getIndex() {
+        return mIndex;
+    }
+
+    /** The bytes that came before the match, or everything that was read
+     *  if the deadline passed first. */
+    public byte[] getBefore() {
+        return mBefore;
+    }
+}
@@ -0,0 +1,79 @@
+package serial;
+
+import java.io.Closeable;
+import java.nio.charset.Charset;
+
+/**
+ * Patterns for {@link Serial#readUntilAny(PatternSet, int)} to wait for,
+ * e.g. the final result codes of a modem.
+ *
+ * The patterns are compiled once into a native automaton that matches all
+ * of them in a single pass over the received bytes.  A set may be shared by
+ * threads and ports.
+ */
+public class PatternSet implements Closeable {
+
+    static {
+        System.loadLibrary("serial");
+    }
+
+    private static final Charset UTF_8 = Charset.forName("UTF-8");
+
+    private long mNativePatternSet;
+
+    /**
+     * Compiles a set of byte patterns.
+     *
+     * @param patterns The patterns, none empty.
+     * @throws IllegalArgumentException There are no patterns, one is empty,
+     * or they are too long.
+     */
+    public PatternSet(byte[]... patterns) {
+        mNativePatternSet = native_create(patterns);
+    }
+
+    /**
+     * Compiles a set of text patterns, encoded as UTF-8.
+     *
+     * @param patterns The patterns, none empty.
+     * @throws IllegalArgumentException There are no patterns, one is empty,
+     * or they are too long.
+     */
+    public PatternSet(String... patterns) {
+        this(encode(patterns));
+    }
+
+    private static byte[][] encode(String[] patterns) {
+        byte[][] encoded = new byte[patterns.length][];
+        for (int i = 0; i < patterns.length; i++)
+            encoded[i] = patterns[i].getBytes(UTF_8);
+        return encoded;
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        close();
+        super.finalize();
+    }
+
+    /**
+     * Frees the native automaton.
+     */
+    @Override
+    public synchronized void close() {
+        if (mNativePatternSet != 0) {
+            native_destroy(mNativePatternSet);
+            mNativePatternSet = 0;
+        }
+    }
+
+    /** The native object, for {@link Serial}. */
+    long getNativePointer() {
+        if (0 == mNativePatternSet)
+            throw new IllegalStateException("PatternSet is closed");
+        return mNativePatternSet;
+    }
+
+    private static native long native_create(byte[][] patterns) throws IllegalArgumentException;
+    private static native void native_destroy(long nativePtr);
+}
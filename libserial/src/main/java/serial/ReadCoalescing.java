@@ -0,0 +1,24 @@
+package serial;
+
+/**
+ * Enumeration defines how multi-byte reads wait for the rest of their data.
+ *
+ * @see Serial#setReadCoalescing(ReadCoalescing, int)
+ */
+public enum ReadCoalescing {
+    /**
+     * Wait one character time per missing byte.
+     *
+     * This is the default.
+     */
+    Fixed,
+    /**
+     * Never wait, read whatever has arrived.
+     */
+    None,
+    /**
+     * Wait in short steps timed by the observed arrival rate, and stop once
+     * the device goes quiet.
+     */
+    Adaptive;
+}
@@ -0,0 +1,32 @@
+package serial;
+
+/**
+ * Receives data pushed from a serial port.
+ *
+ * Callbacks run on a single native thread shared by all ports, so they
+ * should return quickly.  A callback may still be running when
+ * {@link Serial#close()} or removing the listener returns, neither waits
+ * for it.
+ *
+ * @see Serial#setReceiveListener(ReceiveListener, int, int)
+ */
+public interface ReceiveListener {
+
+    /**
+     * Called with data received by a port.  Several reads may be merged into
+     * one call.
+     *
+     * @param port The port the data came from.
+     * @param data The received bytes, owned by the listener.
+     */
+    void onReceive(Serial port, byte[] data);
+
+    /**
+     * Called once when the port hangs up or reading from it fails.  No more
+     * data is delivered for the port afterwards.
+     *
+     * @param port The failed port.
+     * @param message What went wrong.
+     */
+    void onReceiveError(Serial port, String message);
+}
@@ -2,9 +2,13 @@ package serial;
 
 import java.io.Closeable;
 import java.io.IOException;
+import java.nio.BufferOverflowException;
 import java.nio.ByteBuffer;
 import java.nio.CharBuffer;
+import java.nio.ReadOnlyBufferException;
 import java.nio.charset.Charset;
+import java.util.ArrayList;
+import java.util.List;
 import java.util.regex.Pattern;
 
 /**
@@ -155,6 +159,10 @@ public class Serial implements Closeable {
     /**
      * List available ports on this device.
      *
+     * The ports are enumerated once and then kept current by watching
+     * {@code /dev}, so this is cheap enough to call on every refresh.  A
+     * device that was just attached may take a moment to show up.
+     *
      * @return an array of available ports.
      */
     public static PortInfo[] listPorts() {
@@ -173,6 +181,28 @@ public class Serial implements Closeable {
         return ports;
     }
 
+    /**
+     * Turns systrace/Perfetto markers for all ports on or off. Open, reconfigure,
+     * read, write, waitReadable, flush and the copies between Java arrays and
+     * native memory show up as sections, bytes moved as counters. Off by default,
+     * and free while off.
+     *
+     * @param enabled whether to emit markers.
+     * @return whether markers are now emitted; false if tracing was asked for but
+     * is not available on this device.
+     */
+    public static boolean setTracingEnabled(boolean enabled) {
+        return native_setTracingEnabled(enabled);
+    }
+
+    /**
+     * @return whether trace markers are being emitted.
+     * @see #setTracingEnabled(boolean)
+     */
+    public static boolean isTracingEnabled() {
+        return native_isTracingEnabled();
+    }
+
     /**
      * Builder for {@link Serial}.
      */
@@ -337,9 +367,40 @@ public class Serial implements Closeable {
     private boolean mOpened;
     private long mNativeSerial;
     private Timeout mTimeout;
+    private ReceiveListener mReceiveListener;
+    // Engines whose threads read the native port, stopped before it is freed
+    private final List<AtEngine> mAtEngines = new ArrayList<AtEngine>();
+
+    /** The native object, for {@link SerialMultiplexer}. */
+    long getNativePointer() {
+        checkValid();
+        return mNativeSerial;
+    }
+
+    /** Called by {@link AtEngine} once its thread reads this port. */
+    void attachEngine(AtEngine engine) {
+        synchronized (mAtEngines) {
+            mAtEngines.add(engine);
+        }
+    }
+
+    /** Called by {@link AtEngine} once its thread has stopped. */
+    void detachEngine(AtEngine engine) {
+        synchronized (mAtEngines) {
+            mAtEngines.remove(engine);
+        }
+    }
 
     @Override
     protected void finalize() throws Throwable {
+        // An engine that became unreachable with the port may not have been
+        // finalized yet, and its thread would read the freed port
+        AtEngine[] engines;
+        synchronized (mAtEngines) {
+            engines = mAtEngines.toArray(new AtEngine[mAtEngines.size()]);
+        }
+        for (AtEngine engine : engines)
+            engine.close();
         if (mNativeSerial != 0) {
             native_close(mNativeSerial);
             native_destory(mNativeSerial);
@@ -423,6 +484,8 @@ public class Serial implements Closeable {
     public void close () throws IOException {
         if (mNativeSerial == 0 || !mOpened)
             return;
+        if (mReceiveListener != null)
+            setReceiveListener(null, 0, 0);
         native_close(mNativeSerial);
         mOpened = false;
     }
@@ -519,21 +582,64 @@ public class Serial implements Closeable {
         return  buffer;
     }
 
+    /**
+     * Read whatever data can be had without waiting.
+     *
+     * Unlike {@link #read(byte[], int, int)}, this never waits for data and
+     * ignores the timeouts.  It is meant for ports reported ready by
+     * {@link SerialMultiplexer#select(int)}.
+     *
+     * @param buffer An array of at least the requested size.
+     * @param offset the offset of the buffer to receive data.
+     * @param size the most bytes to be read.
+     *
+     * @return The number of bytes read, possibly 0.
+     *
+     * @throws SerialIOException I/O Error.
+     */
+    public int readAvailable (byte[] buffer, int offset, int size) throws SerialIOException {
+        checkOpened();
+        if (offset < 0 || size < 0 || offset > buffer.length - size)
+            throw new IndexOutOfBoundsException();
+        return native_readAvailable(mNativeSerial, buffer, offset, size);
+    }
+
     /** Read a given amount of bytes from the serial port into a give buffer.
      *
-     * @param buffer A reference to a std::vector of uint8_t.
+     * The data is stored at the buffer's position, which is advanced by the
+     * number of bytes read.  Direct buffers are filled by the native code in
+     * place, heap buffers through their backing array, so no temporary copy
+     * is made in either case.
+     *
+     * @param buffer A buffer with at least size bytes remaining.
      * @param size A size_t defining how many bytes to be read.
      *
      * @return A size_t representing the number of bytes read as a result of the
      *         call to read.
      *
      * @throws SerialIOException I/O Error.
+     * @throws BufferOverflowException if size is greater than the bytes
+     *         remaining in the buffer.
+     * @throws ReadOnlyBufferException if the buffer is read-only.  Nothing
+     *         is read then.
      */
     public int read (ByteBuffer buffer, int size /*= 1*/) throws SerialIOException {
         checkOpened();
-        byte[] buf = new byte[size];
-        int bytesRead = read(buf, 0, buf.length);
-        buffer.put(buf, 0, bytesRead);
+        // Before reading, or the bytes would be taken from the port and lost
+        if (buffer.isReadOnly())
+            throw new ReadOnlyBufferException();
+        if (size > buffer.remaining())
+            throw new BufferOverflowException();
+        int position = buffer.position();
+        int bytesRead;
+        if (buffer.isDirect()) {
+            bytesRead = native_readDirect(mNativeSerial, buffer, position, size);
+        } else {
+            // A writable heap buffer always has an accessible array
+            bytesRead = native_read(mNativeSerial, buffer.array(), buffer.arrayOffset() + position, size);
+        }
+        if (bytesRead > 0)
+            buffer.position(position + bytesRead);
         return bytesRead;
     }
 
@@ -638,6 +744,127 @@ public class Serial implements Closeable {
         return native_readlines(mNativeSerial, size, eol);
     }
 
+    /** Sets how received data is split into frames.
+     *
+     * @param framer The framer used by {@link #readFrame()} and
+     * {@link #writeFrame(byte[], int, int)}, or null to remove it.
+     *
+     * @throws IllegalArgumentException The framer's parameters are invalid.
+     */
+    public void setFramer (Framer framer) {
+        checkValid();
+        if (framer == null)
+            native_setFramer(mNativeSerial, 0, null, null, 0, false);
+        else
+            native_setFramer(mNativeSerial, framer.type, framer.params, framer.delimiter,
+                    framer.crc != null ? framer.crc.getNativePointer() : 0, framer.crcLittleEndian);
+    }
+
+    /** Reads exactly one complete frame.
+     *
+     * Data is read in bulk and split natively, bytes past the end of the
+     * frame are kept for the next read and malformed input is skipped.  Like
+     * {@link #readline(int, String)}, this gives up when reading the next
+     * chunk times out; a partial frame is kept for a later call.
+     *
+     * @return The decoded frame, or null on timeout.
+     *
+     * @throws SerialException No framer is set.
+     * @throws SerialIOException I/O Error.
+     */
+    public byte[] readFrame () throws SerialIOException {
+        checkOpened();
+        return native_readFrame(mNativeSerial);
+    }
+
+    /** Writes a request and reads its response in one call.
+     *
+     * Both of the port's locks are held for the whole exchange, so no other
+     * reader or writer gets between the request and its response.  The
+     * response is read in bulk and split natively by the matcher, like
+     * {@link #readFrame()} does: {@link Framer#delimiter} waits for a
+     * terminator, {@link Framer#fixedLength} or {@link Framer#lengthField}
+     * for a length.  Bytes past the end of the response are kept for the
+     * next read.
+     *
+     * @param request The bytes to send.
+     * @param offset The offset of the request in the array.
+     * @param size The number of bytes to send.
+     * @param matcher Decides when the response is complete, or null for the
+     * framer set with {@link #setFramer(Framer)}.
+     * @param deadlineMs Time from the call until the response must be
+     * complete.  It replaces the read timeout, the write timeout still
+     * applies to the request.
+     * @param flushInput Whether to drop any input received before the
+     * request, e.g. a late response to an earlier one.
+     *
+     * @return The response, which is incomplete if the deadline passed
+     * first, and when each step of the exchange happened.
+     *
+     * @throws IllegalArgumentException The matcher's parameters are invalid.
+     * @throws SerialException No matcher is given and no framer is set.
+     * @throws SerialIOException The request could not be sent in time, or
+     * an I/O error.
+     */
+    public TransactResult transact (byte[] request, int offset, int size, Framer matcher, int deadlineMs, boolean flushInput) throws SerialIOException {
+        checkOpened();
+        long[] timing = new long[TransactResult.VALUE_COUNT];
+        byte[] response;
+        if (matcher == null)
+            response = native_transact(mNativeSerial, request, offset, size, 0, null, null, 0, false,
+                    deadlineMs, flushInput, timing);
+        else
+            response = native_transact(mNativeSerial, request, offset, size, matcher.type, matcher.params,
+                    matcher.delimiter, matcher.crc != null ? matcher.crc.getNativePointer() : 0,
+                    matcher.crcLittleEndian, deadlineMs, flushInput, timing);
+        return new TransactResult(response, timing);
+    }
+
+    /** Reads until one of several patterns arrives.
+     *
+     * Data is read in bulk and matched natively against all patterns in
+     * one pass, so this replaces a loop of {@link #readline(int, String)}
+     * calls and string comparisons.  The match starting first wins, and of
+     * those the longest, so "+CME ERROR:" wins over "ERROR" in the same
+     * input.  A match that a longer one may still extend is only reported
+     * when the next bytes rule that out or the deadline passes.  Bytes
+     * after the match are kept for the next read.
+     *
+     * @param patterns The patterns to wait for.
+     * @param deadlineMs Time from the call until a pattern must have
+     * arrived.  It replaces the read timeout.  With 0, only data that has
+     * already arrived is searched.
+     *
+     * @return Which pattern matched and the bytes before it.  If the
+     * deadline passed first, the bytes read are also kept for the next
+     * read.
+     *
+     * @throws SerialIOException I/O Error.
+     */
+    public PatternMatch readUntilAny (PatternSet patterns, int deadlineMs) throws SerialIOException {
+        checkOpened();
+        int[] index = new int[1];
+        byte[] before = native_readUntilAny(mNativeSerial, patterns.getNativePointer(), deadlineMs, index);
+        return new PatternMatch(index[0], before);
+    }
+
+    /** Encodes a payload with the framer and writes the frame.
+     *
+     * @param payload The frame contents.
+     * @param offset The offset of the contents in payload.
+     * @param size The number of bytes of contents.
+     *
+     * @return The number of bytes written to the port, including framing.
+     *
+     * @throws IllegalArgumentException The framer cannot encode the payload.
+     * @throws SerialException No framer is set.
+     * @throws SerialIOException I/O Error.
+     */
+    public int writeFrame (byte[] payload, int offset, int size) throws SerialIOException {
+        checkOpened();
+        return native_writeFrame(mNativeSerial, payload, offset, size);
+    }
+
     /** Write a string to the serial port.
      *
      * @param data A const reference containing the data to be written
@@ -653,7 +880,40 @@ public class Serial implements Closeable {
      */
     public int write (byte[] data, int size) throws SerialIOException {
         checkOpened();
-        return native_write(mNativeSerial, data, size);
+        return native_write(mNativeSerial, data, 0, size);
+    }
+
+    /** Write the remaining bytes of a buffer to the serial port.
+     *
+     * Writing starts at the buffer's position, which is advanced by the
+     * number of bytes actually written.  Direct buffers are handed to the
+     * native code without copying.
+     *
+     * @param data A buffer holding the data to be written between its
+     * position and limit.
+     *
+     * @return A size_t representing the number of bytes actually written to
+     * the serial port.
+     *
+     * @throws SerialIOException I/O Error.
+     */
+    public int write (ByteBuffer data) throws SerialIOException {
+        checkOpened();
+        int position = data.position();
+        int size = data.remaining();
+        int bytesWritten;
+        if (data.isDirect()) {
+            bytesWritten = native_writeDirect(mNativeSerial, data, position, size);
+        } else if (data.hasArray()) {
+            bytesWritten = native_write(mNativeSerial, data.array(), data.arrayOffset() + position, size);
+        } else {
+            byte[] buf = new byte[size];
+            data.duplicate().get(buf);
+            bytesWritten = native_write(mNativeSerial, buf, 0, size);
+        }
+        if (bytesWritten > 0)
+            data.position(position + bytesWritten);
+        return bytesWritten;
     }
 
     /** Write a string to the serial port.
@@ -669,7 +929,7 @@ public class Serial implements Closeable {
     public int write (String s) throws SerialIOException {
         checkOpened();
         byte[] data = s.getBytes();
-        return native_write(mNativeSerial, data, data.length);
+        return native_write(mNativeSerial, data, 0, data.length);
     }
 
     /** Sets the serial port identifier.
@@ -695,6 +955,43 @@ public class Serial implements Closeable {
         return native_getPort(mNativeSerial);
     }
 
+    /**
+     * Makes the port play back a capture file instead of opening a device.
+     *
+     * The port then reads the received data of the capture (see
+     * {@link #startCapture(String)}) chunk by chunk as it was recorded, and
+     * everything written to it is dropped, so parsers can be tested and
+     * benchmarked without hardware and with the same input every time.
+     * Once the last chunk has been read the port sees a hangup, as if the
+     * adapter was unplugged.  Each open starts the capture over, and
+     * {@link #setPort(String)} goes back to a device.
+     *
+     * Like {@link #setPort(String)}, this closes the port if it is open and
+     * reopens it with the capture.
+     *
+     * @param capture Path of the capture file.
+     * @param speed 1 to keep the recorded gaps between chunks, 2 to halve
+     * them and so on, 0 to send every chunk as soon as the port can take it.
+     *
+     * @throws SerialIOException The port was reopened and the file is not a
+     * capture.
+     * @throws IllegalArgumentException speed is negative.
+     */
+    public void setReplay (String capture, double speed) throws SerialIOException {
+        checkValid();
+        native_setReplay(mNativeSerial, capture, speed);
+    }
+
+    /**
+     * Returns true if the port plays back a capture.
+     *
+     * @see #setReplay(String, double)
+     */
+    public boolean isReplay () {
+        checkValid();
+        return native_isReplay(mNativeSerial);
+    }
+
     /** Sets the timeout for reads and writes using the Timeout struct.
      *
      * There are two timeout conditions described here:
@@ -900,6 +1197,360 @@ public class Serial implements Closeable {
         return FlowControl.values()[native_getFlowcontrol(mNativeSerial)];
     }
 
+    /**
+     * Trades receive latency against system calls and interrupt load.
+     *
+     * {@link LatencyProfile#Low} sets the driver's low latency flag and lets
+     * the kernel time multi-byte reads with an inter-byte timeout of 100 ms
+     * or more, so a read returns as soon as its bytes are in.
+     * {@link LatencyProfile#Throughput} clears the flag and waits for
+     * multi-byte reads to fill up.
+     *
+     * @param profile The profile, default is {@link LatencyProfile#Default}.
+     *
+     * @throws SerialIOException I/O Error.
+     */
+    public void setLatencyProfile (LatencyProfile profile) throws SerialIOException {
+        checkValid();
+        if (null == profile)
+            profile = LatencyProfile.Default;
+        native_setLatencyProfile(mNativeSerial, profile.ordinal());
+    }
+
+    /**
+     * Gets the receive latency profile.
+     *
+     * @see #setLatencyProfile(LatencyProfile)
+     */
+    public LatencyProfile getLatencyProfile () {
+        checkValid();
+        return LatencyProfile.values()[native_getLatencyProfile(mNativeSerial)];
+    }
+
+    /**
+     * Sets how a read without an inter-byte timeout waits for the rest of
+     * its data once the first bytes are in.
+     *
+     * Waiting saves reads, but adds latency when the device pauses before
+     * the read is satisfied.  {@link ReadCoalescing#Adaptive} waits in short
+     * steps timed by the observed arrival rate and stops as soon as the
+     * device goes quiet.  Has no effect with {@link LatencyProfile#Low}.
+     *
+     * @param policy The policy, default is {@link ReadCoalescing#Fixed}.
+     * @param maxWaitUs Upper bound for one wait in microseconds, 0 for none.
+     */
+    public void setReadCoalescing (ReadCoalescing policy, int maxWaitUs) {
+        checkValid();
+        if (null == policy)
+            policy = ReadCoalescing.Fixed;
+        if (maxWaitUs < 0)
+            throw new IllegalArgumentException("maxWaitUs must not be negative");
+        native_setReadCoalescing(mNativeSerial, policy.ordinal(), maxWaitUs);
+    }
+
+    /**
+     * Gets the read coalescing policy.
+     *
+     * @see #setReadCoalescing(ReadCoalescing, int)
+     */
+    public ReadCoalescing getReadCoalescing () {
+        checkValid();
+        return ReadCoalescing.values()[native_getReadCoalescing(mNativeSerial)];
+    }
+
+    /**
+     * Gets the bound for one coalescing wait in microseconds, 0 for none.
+     *
+     * @see #setReadCoalescing(ReadCoalescing, int)
+     */
+    public int getReadCoalescingMaxWait () {
+        checkValid();
+        return native_getReadCoalescingMaxWait(mNativeSerial);
+    }
+
+    /**
+     * Queues small writes and sends them to the port in batches.
+     *
+     * <p>While batching is on, {@code write} appends its bytes to a native
+     * queue and returns at once. The queue goes out in one system call once it
+     * holds {@code maxBytes}, {@code deadlineUs} after its first byte was
+     * queued, or on {@link #flushWrites()} or {@link #flush()}. Writes of
+     * {@code maxBytes} or more go out directly, after the queue. Useful when
+     * several threads send many short messages.</p>
+     *
+     * <p>The write timeout applies to each batch. When a batch sent for its
+     * deadline fails, its bytes are dropped and the next write or
+     * {@link #flushWrites()} throws.</p>
+     *
+     * @param maxBytes Queue size that triggers a batch, 0 to turn batching off
+     *                 (the default). Bytes still queued are sent first.
+     * @param deadlineUs Longest time a byte waits in the queue in microseconds,
+     *                   0 to wait for {@code maxBytes} or {@link #flushWrites()}.
+     * @throws SerialIOException if sending the queued bytes fails.
+     */
+    public void setWriteBatching (int maxBytes, int deadlineUs) throws SerialIOException {
+        checkValid();
+        if (maxBytes < 0)
+            throw new IllegalArgumentException("maxBytes must not be negative");
+        if (deadlineUs < 0)
+            throw new IllegalArgumentException("deadlineUs must not be negative");
+        native_setWriteBatching(mNativeSerial, maxBytes, deadlineUs);
+    }
+
+    /**
+     * Gets the queue size that triggers a batch, 0 when batching is off.
+     *
+     * @see #setWriteBatching(int, int)
+     */
+    public int getWriteBatchSize () {
+        checkValid();
+        return native_getWriteBatchSize(mNativeSerial);
+    }
+
+    /**
+     * Gets the longest time a byte waits in the write queue, in microseconds.
+     *
+     * @see #setWriteBatching(int, int)
+     */
+    public int getWriteBatchDeadline () {
+        checkValid();
+        return native_getWriteBatchDeadline(mNativeSerial);
+    }
+
+    /**
+     * Sends the bytes queued by write batching now, within the write timeout.
+     * Does nothing when batching is off.
+     *
+     * @throws SerialIOException if sending fails, or if a batch sent for its
+     * deadline failed since the last write.
+     * @see #setWriteBatching(int, int)
+     */
+    public void flushWrites () throws SerialIOException {
+        checkOpened();
+        native_flushWrites(mNativeSerial);
+    }
+
+    /**
+     * Queues a write and returns without waiting for the port.
+     *
+     * The bytes are copied to native memory and sent by a native writer
+     * thread, so the calling thread never blocks on a slow or flow
+     * controlled port.  The writer always takes the oldest write of the
+     * most urgent priority next, so {@link WritePriority#Control} frames
+     * overtake queued bulk data; a write that has started is finished
+     * first, writes are never split.  Each write is a regular write with
+     * the write timeout and stays whole with respect to other writers.
+     *
+     * Closing the port cancels the writes that have not started yet.
+     *
+     * @param data The bytes to write.
+     * @param offset Index of the first byte in data.
+     * @param size Number of bytes to write.
+     * @param priority Where the write goes in the queue.
+     * @param listener Told when the write is finished, or null.
+     * @return The id of the write, passed to the listener.
+     *
+     * @throws SerialIOException The writer thread could not be started.
+     */
+    public long submitWrite (byte[] data, int offset, int size, WritePriority priority, WriteListener listener) throws SerialIOException {
+        checkOpened();
+        if (offset < 0 || size < 0 || offset > data.length - size)
+            throw new IndexOutOfBoundsException();
+        if (priority == null)
+            priority = WritePriority.Normal;
+        return native_submitWrite(mNativeSerial, this, data, offset, size, priority.ordinal(), listener);
+    }
+
+    /**
+     * Cancels every queued write that has not started yet.  Their listeners
+     * are told {@link WriteStatus#Cancelled}.
+     */
+    public void cancelWrites () {
+        checkValid();
+        native_cancelWrites(mNativeSerial);
+    }
+
+    /**
+     * Returns the number of queued writes that have not started yet.
+     */
+    public int getQueuedWrites () {
+        checkValid();
+        return native_getQueuedWrites(mNativeSerial);
+    }
+
+    /**
+     * Returns a snapshot of the port's activity counters.
+     *
+     * The counters are always on and cost a relaxed atomic add each, the
+     * snapshot is a single native call.
+     *
+     * @return The counters.
+     */
+    public SerialStats getStats () {
+        checkValid();
+        return new SerialStats(native_getStats(mNativeSerial));
+    }
+
+    /**
+     * Copies the latency distribution of a kind of call.
+     *
+     * Every read, write, readline and flush records how long it took in
+     * nanoseconds, waiting for the port's lock included.
+     *
+     * @param op The kind of call.
+     * @param snapshot Receives the distribution, replacing its contents.
+     * @param reset Whether to empty the port's histogram as it is copied, so
+     * that consecutive snapshots cover back to back time windows.
+     */
+    public void getLatency (LatencyOp op, LatencyHistogram snapshot, boolean reset) {
+        checkValid();
+        native_getLatency(mNativeSerial, op.ordinal(), snapshot.getNativePointer(), reset);
+    }
+
+    /**
+     * Returns the latency distribution of a kind of call.
+     *
+     * @see #getLatency(LatencyOp, LatencyHistogram, boolean)
+     */
+    public LatencyHistogram getLatency (LatencyOp op, boolean reset) {
+        LatencyHistogram snapshot = new LatencyHistogram();
+        getLatency(op, snapshot, reset);
+        return snapshot;
+    }
+
+    /**
+     * Forgets the recorded latencies of all calls.
+     */
+    public void resetLatency () {
+        checkValid();
+        native_resetLatency(mNativeSerial);
+    }
+
+    /**
+     * Starts recording the port's traffic to a capture file.
+     *
+     * Every chunk the port reads or writes is recorded natively with a
+     * monotonic timestamp, as is the configuration now and whenever it
+     * changes.  Records are written to the file in batches by a native
+     * thread, so recording does not slow the port down; if storage cannot
+     * keep up, records are dropped and the gap is marked in the file.
+     * Recording works in release builds and survives reopening the port.
+     *
+     * @param path The capture file, created if needed, appended to if it
+     * already is one.
+     * @throws SerialException Already recording.
+     * @throws SerialIOException The file cannot be used.
+     */
+    public void startCapture (String path) throws SerialIOException {
+        checkValid();
+        native_startCapture(mNativeSerial, path);
+    }
+
+    /**
+     * Writes out the records still in memory and stops recording.  Does
+     * nothing if not recording.
+     *
+     * @throws SerialIOException Writing the file failed since
+     * {@link #startCapture(String)}; recording stopped at that point.
+     */
+    public void stopCapture () throws SerialIOException {
+        checkValid();
+        native_stopCapture(mNativeSerial);
+    }
+
+    /**
+     * @return whether traffic is being recorded.
+     * @see #startCapture(String)
+     */
+    public boolean isCapturing () {
+        checkValid();
+        return native_isCapturing(mNativeSerial);
+    }
+
+    /**
+     * Enables or disables continuous receive mode.
+     *
+     * In continuous receive mode a dedicated native thread drains the port
+     * into a ring buffer as soon as data arrives, so the kernel buffer does
+     * not overrun while the reading thread is busy (or paused by GC).
+     * {@link #read(byte[], int, int)}, {@link #readline(int, String)},
+     * {@link #available()} and {@link #waitReadable()} are then served from
+     * that ring, with the same timeout semantics.
+     *
+     * The mode survives {@link #close()} and {@link #open()}, the thread only
+     * runs while the port is open.
+     *
+     * @param enabled true to start the receive thread, false to stop it.
+     * @param bufferSize Capacity of the ring buffer in bytes.
+     *
+     * @throws SerialIOException I/O Error.
+     * @throws IllegalArgumentException bufferSize is not positive.
+     */
+    public void setContinuousReceive (boolean enabled, int bufferSize) throws SerialIOException {
+        checkValid();
+        native_setContinuousReceive(mNativeSerial, enabled, bufferSize);
+    }
+
+    /**
+     * Returns true if continuous receive mode is enabled.
+     *
+     * @see #setContinuousReceive(boolean, int)
+     */
+    public boolean isContinuousReceive () {
+        checkValid();
+        return native_isContinuousReceive(mNativeSerial);
+    }
+
+    /**
+     * Default for the maximum delivery latency, in milliseconds.
+     */
+    public static final int RECEIVE_LATENCY_DEFAULT = 10;
+    /**
+     * Default for the batch size, in bytes.
+     */
+    public static final int RECEIVE_BATCH_DEFAULT = 4096;
+
+    /**
+     * Sets a listener that data received by this port is pushed to.
+     *
+     * Received data is collected natively and handed to the listener once
+     * batchSize bytes are buffered or the oldest buffered byte has waited
+     * maxLatencyMs, whichever comes first.  All ports share one native
+     * thread for this.
+     *
+     * While a listener is set, do not read from the port yourself, and do
+     * not enable continuous receive mode.  {@link #close()} removes the
+     * listener.  Removing it does not wait for a callback that is already
+     * running, which may still finish after this returns; no further
+     * callbacks start.
+     *
+     * @param listener The listener, or null to stop delivering.
+     * @param maxLatencyMs How long received data may be held back to batch
+     * it with more, 0 delivers after every read.
+     * @param batchSize Deliver as soon as this many bytes are buffered.
+     *
+     * @throws SerialIOException I/O Error.
+     * @throws IllegalArgumentException The port is in continuous receive
+     * mode, or maxLatencyMs is negative or batchSize is not positive.
+     */
+    public void setReceiveListener (ReceiveListener listener, int maxLatencyMs, int batchSize) throws SerialIOException {
+        if (listener != null)
+            checkOpened();
+        else if (mNativeSerial == 0)
+            return;
+        native_setReceiveListener(mNativeSerial, this, listener, maxLatencyMs, batchSize);
+        mReceiveListener = listener;
+    }
+
+    /**
+     * Sets a listener with the default latency and batch size.
+     *
+     * @see #setReceiveListener(ReceiveListener, int, int)
+     */
+    public void setReceiveListener (ReceiveListener listener) throws SerialIOException {
+        setReceiveListener(listener, RECEIVE_LATENCY_DEFAULT, RECEIVE_BATCH_DEFAULT);
+    }
+
     /** Flush the input and output buffers */
     public void flush () {
         checkOpened();
@@ -1015,12 +1666,23 @@ public class Serial implements Closeable {
     private static native boolean native_waitReadable(long nativePtr) throws SerialIOException;
     private static native void native_waitByteTimes(long nativePtr, int count);
     private static native int native_read(long nativePtr, byte[] buffer, int offset, int size) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native int native_readDirect(long nativePtr, ByteBuffer buffer, int offset, int size) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native int native_readAvailable(long nativePtr, byte[] buffer, int offset, int size) throws SerialException, SerialIOException;
+    private static native void native_setReceiveListener(long nativePtr, Serial serial, ReceiveListener listener, int maxLatencyMs, int batchSize) throws IllegalArgumentException, SerialException, SerialIOException;
     private static native String native_readline(long nativePtr, int size, String eol) throws IllegalArgumentException, SerialException, SerialIOException;
     private static native String[] native_readlines(long nativePtr, int size, String eol) throws IllegalArgumentException, SerialException, SerialIOException;
-    private static native int native_write(long nativePtr, byte[] buffer,int size) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native int native_write(long nativePtr, byte[] buffer, int offset, int size) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native int native_writeDirect(long nativePtr, ByteBuffer buffer, int offset, int size) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native void native_setFramer(long nativePtr, int type, int[] params, byte[] delimiter, long crcPtr, boolean crcLittleEndian) throws IllegalArgumentException;
+    private static native byte[] native_readFrame(long nativePtr) throws SerialException, SerialIOException;
+    private static native byte[] native_readUntilAny(long nativePtr, long patternsPtr, int deadlineMs, int[] index) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native byte[] native_transact(long nativePtr, byte[] request, int offset, int size, int type, int[] params, byte[] delimiter, long crcPtr, boolean crcLittleEndian, int deadlineMs, boolean flushInput, long[] timing) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native int native_writeFrame(long nativePtr, byte[] payload, int offset, int size) throws IllegalArgumentException, SerialException, SerialIOException;
 
     private static native void native_setPort(long nativePtr, String port);
     private static native String native_getPort(long nativePtr);
+    private static native void native_setReplay(long nativePtr, String capture, double speed) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native boolean native_isReplay(long nativePtr);
 
     private static native void native_setBaudrate(long nativePtr, int baudrate) throws IllegalArgumentException, SerialException, SerialIOException;
     private static native int native_getBaudrate(long nativePtr);
@@ -1035,6 +1697,29 @@ public class Serial implements Closeable {
     private static native int native_getStopbits(long nativePtr);
     private static native void native_setFlowcontrol(long nativePtr, int flowcontrol) throws IllegalArgumentException, SerialException, SerialIOException;
     private static native int native_getFlowcontrol(long nativePtr);
+    private static native void native_setLatencyProfile(long nativePtr, int profile) throws SerialException, SerialIOException;
+    private static native int native_getLatencyProfile(long nativePtr);
+    private static native void native_setReadCoalescing(long nativePtr, int policy, int maxWaitUs);
+    private static native int native_getReadCoalescing(long nativePtr);
+    private static native int native_getReadCoalescingMaxWait(long nativePtr);
+    private static native void native_setWriteBatching(long nativePtr, int maxBytes, int deadlineUs) throws SerialException, SerialIOException;
+    private static native int native_getWriteBatchSize(long nativePtr);
+    private static native int native_getWriteBatchDeadline(long nativePtr);
+    private static native void native_flushWrites(long nativePtr) throws SerialException, SerialIOException;
+    private static native long native_submitWrite(long nativePtr, Serial serial, byte[] data, int offset, int size, int priority, WriteListener listener) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native void native_cancelWrites(long nativePtr);
+    private static native int native_getQueuedWrites(long nativePtr);
+    private static native long[] native_getStats(long nativePtr);
+    private static native void native_getLatency(long nativePtr, int op, long histogramPtr, boolean reset);
+    private static native void native_resetLatency(long nativePtr);
+    private static native void native_startCapture(long nativePtr, String path) throws SerialException, SerialIOException;
+    private static native void native_stopCapture(long nativePtr) throws SerialIOException;
+    private static native boolean native_isCapturing(long nativePtr);
+    private static native boolean native_setTracingEnabled(boolean enabled);
+    private static native boolean native_isTracingEnabled();
+
+    private static native void native_setContinuousReceive(long nativePtr, boolean enabled, int bufferSize) throws IllegalArgumentException, SerialIOException;
+    private static native boolean native_isContinuousReceive(long nativePtr);
 
     private static native void native_flush(long nativePtr);
     private static native void native_flushInput(long nativePtr);
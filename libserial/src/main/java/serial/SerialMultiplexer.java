@@ -0,0 +1,160 @@
+package serial;
+
+import java.io.Closeable;
+import java.util.HashMap;
+import java.util.Map;
+
+/**
+ * Waits on many serial ports at once.
+ *
+ * One thread can service any number of ports by calling {@link #select(int)}
+ * in a loop and reading the ports it returns with
+ * {@link Serial#readAvailable(byte[], int, int)}, instead of parking a
+ * blocked reader thread per port.
+ *
+ * A registered port must not be in continuous receive mode.  Closing a
+ * registered port, which {@link Serial#setPort(String)} does too, ends its
+ * registration; {@link #select(int)} returns it one last time.  Only one
+ * thread may call {@link #select(int)} at a time, and {@link #close()} must
+ * not race with it; the other methods may be called from any thread.
+ */
+public class SerialMultiplexer implements Closeable {
+
+    static {
+        System.loadLibrary("serial");
+    }
+
+    private static final Serial[] NO_PORTS = new Serial[0];
+
+    private long mNativeMultiplexer;
+    private final Map<Long, Serial> mPorts = new HashMap<Long, Serial>();
+
+    /**
+     * Creates an empty multiplexer.
+     *
+     * @throws SerialIOException if the native event set cannot be created.
+     */
+    public SerialMultiplexer() throws SerialIOException {
+        mNativeMultiplexer = native_create();
+    }
+
+    @Override
+    protected void finalize() throws Throwable {
+        close();
+        super.finalize();
+    }
+
+    private void checkValid() {
+        if (0 == mNativeMultiplexer)
+            throw new IllegalStateException("SerialMultiplexer is closed");
+    }
+
+    /**
+     * Registers an open port.
+     *
+     * @param port The port to wait on.
+     *
+     * @throws IllegalArgumentException if the port is already registered or
+     * is in continuous receive mode.
+     * @throws SerialException if the port is not open.
+     * @throws SerialIOException I/O error.
+     */
+    public synchronized void add(Serial port) throws SerialIOException {
+        checkValid();
+        long ptr = port.getNativePointer();
+        native_add(mNativeMultiplexer, ptr);
+        mPorts.put(ptr, port);
+    }
+
+    /**
+     * Unregisters a port.  Does nothing if it is not registered.
+     *
+     * @param port The port to forget.
+     */
+    public synchronized void remove(Serial port) {
+        checkValid();
+        long ptr = port.getNativePointer();
+        native_remove(mNativeMultiplexer, ptr);
+        mPorts.remove(ptr);
+    }
+
+    /**
+     * @return the number of registered ports.
+     */
+    public synchronized int size() {
+        checkValid();
+        return native_size(mNativeMultiplexer);
+    }
+
+    /**
+     * Waits for registered ports to become readable.
+     *
+     * Ports holding data left over from an earlier call, e.g. by readline,
+     * are returned without waiting.  A port that hung up or was closed is
+     * returned one last time and then no longer waited on, reading it
+     * returns no data or throws.  Call {@link #remove(Serial)} once done with it.
+     *
+     * @param timeoutMs How long to wait in milliseconds, -1 waits forever.
+     *
+     * @return The ready ports, empty on timeout or {@link #wakeup()}.
+     *
+     * @throws SerialIOException I/O error.
+     */
+    public Serial[] select(int timeoutMs) throws SerialIOException {
+        long nativeMultiplexer;
+        synchronized (this) {
+            checkValid();
+            nativeMultiplexer = mNativeMultiplexer;
+        }
+        long[] ready = native_select(nativeMultiplexer, timeoutMs);
+        if (ready == null || ready.length == 0)
+            return NO_PORTS;
+        synchronized (this) {
+            Serial[] ports = new Serial[ready.length];
+            int count = 0;
+            for (long ptr : ready) {
+                Serial port = mPorts.get(ptr);
+                if (port != null)
+                    ports[count++] = port;
+            }
+            if (count == ports.length)
+                return ports;
+            Serial[] result = new Serial[count];
+            System.arraycopy(ports, 0, result, 0, count);
+            return result;
+        }
+    }
+
+    /**
+     * Makes a blocked {@link #select(int)} return early.
+     */
+    public void wakeup() {
+        long nativeMultiplexer;
+        synchronized (this) {
+            if (0 == mNativeMultiplexer)
+                return;
+            nativeMultiplexer = mNativeMultiplexer;
+        }
+        native_wakeup(nativeMultiplexer);
+    }
+
+    /**
+     * Releases the native multiplexer.  Registered ports are left open.
+     */
+    @Override
+    public synchronized void close() {
+        if (mNativeMultiplexer != 0) {
+            native_destroy(mNativeMultiplexer);
+            mNativeMultiplexer = 0;
+            mPorts.clear();
+        }
+    }
+
+    private static native long native_create() throws SerialIOException;
+    private static native void native_destroy(long nativePtr);
+    private static native void native_add(long nativePtr, long serialPtr) throws IllegalArgumentException, SerialException, SerialIOException;
+    private static native void native_remove(long nativePtr, long serialPtr);
+    private static native int native_size(long nativePtr);
+    private static native long[] native_select(long nativePtr, int timeout) throws SerialIOException;
+    private static native void native_wakeup(long nativePtr);
+}
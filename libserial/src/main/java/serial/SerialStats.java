@@ -0,0 +1,121 @@
+package serial;
+
+/**
+ * Snapshot of a port's activity counters, see {@link Serial#getStats()}.
+ *
+ * The counters start at zero when the port is created and only grow, so
+ * rates come from the difference of two snapshots.
+ */
+public final class SerialStats {
+
+    // Indices into the native array, keep in sync with serial_jni.cc
+    private static final int BYTES_READ = 0;
+    private static final int BYTES_WRITTEN = 1;
+    private static final int READ_CALLS = 2;
+    private static final int WRITE_CALLS = 3;
+    private static final int ZERO_READS = 4;
+    private static final int PARTIAL_WRITES = 5;
+    private static final int WAIT_WAKEUPS = 6;
+    private static final int WAIT_TIMEOUTS = 7;
+    private static final int WAIT_NANOS = 8;
+    private static final int RECONFIGURATIONS = 9;
+    private static final int READ_LOCK_WAITS = 10;
+    private static final int READ_LOCK_WAIT_NANOS = 11;
+    private static final int WRITE_LOCK_WAITS = 12;
+    private static final int WRITE_LOCK_WAIT_NANOS = 13;
+
+    private final long[] mValues;
+
+    SerialStats(long[] values) {
+        mValues = values;
+    }
+
+    /** Bytes read from the port. */
+    public long getBytesRead() {
+        return mValues[BYTES_READ];
+    }
+
+    /** Bytes written to the port. */
+    public long getBytesWritten() {
+        return mValues[BYTES_WRITTEN];
+    }
+
+    /** read system calls, including those of the receive thread. */
+    public long getReadCalls() {
+        return mValues[READ_CALLS];
+    }
+
+    /** write system calls. */
+    public long getWriteCalls() {
+        return mValues[WRITE_CALLS];
+    }
+
+    /** Reads that returned no data. */
+    public long getZeroReads() {
+        return mValues[ZERO_READS];
+    }
+
+    /** Writes that took less than offered. */
+    public long getPartialWrites() {
+        return mValues[PARTIAL_WRITES];
+    }
+
+    /** Waits for data that ended with the port readable. */
+    public long getWaitWakeups() {
+        return mValues[WAIT_WAKEUPS];
+    }
+
+    /** Waits for data that timed out. */
+    public long getWaitTimeouts() {
+        return mValues[WAIT_TIMEOUTS];
+    }
+
+    /** Time spent waiting for data, in nanoseconds. */
+    public long getWaitNanos() {
+        return mValues[WAIT_NANOS];
+    }
+
+    /** Times the port settings were applied. */
+    public long getReconfigurations() {
+        return mValues[RECONFIGURATIONS];
+    }
+
+    /** Times a reader had to wait for another one. */
+    public long getReadLockWaits() {
+        return mValues[READ_LOCK_WAITS];
+    }
+
+    /** Time readers spent waiting for each other, in nanoseconds. */
+    public long getReadLockWaitNanos() {
+        return mValues[READ_LOCK_WAIT_NANOS];
+    }
+
+    /** Times a writer had to wait for another one. */
+    public long getWriteLockWaits() {
+        return mValues[WRITE_LOCK_WAITS];
+    }
+
+    /** Time writers spent waiting for each other, in nanoseconds. */
+    public long getWriteLockWaitNanos() {
+        return mValues[WRITE_LOCK_WAIT_NANOS];
+    }
+
+    @Override
+    public String toString() {
+        return "SerialStats{bytesRead=" + getBytesRead()
+                + ", bytesWritten=" + getBytesWritten()
+                + ", readCalls=" + getReadCalls()
+                + ", writeCalls=" + getWriteCalls()
+                + ", zeroReads=" + getZeroReads()
+                + ", partialWrites=" + getPartialWrites()
+                + ", waitWakeups=" + getWaitWakeups()
+                + ", waitTimeouts=" + getWaitTimeouts()
+                + ", waitNanos=" + getWaitNanos()
+                + ", reconfigurations=" + getReconfigurations()
+                + ", readLockWaits=" + getReadLockWaits()
+                + ", readLockWaitNanos=" + getReadLockWaitNanos()
+                + ", writeLockWaits=" + getWriteLockWaits()
+                + ", writeLockWaitNanos=" + getWriteLockWaitNanos()
+                + "}";
+    }
+}
@@ -0,0 +1,60 @@
+package serial;
+
+/**
+ * Outcome of {@link Serial#transact(byte[], int, int, Framer, int, boolean)}.
+ *
+ * Times are nanoseconds since transact was called.
+ */
+public final class TransactResult {
+
+    // Indices into the native array, keep in sync with framer_jni.cc
+    private static final int LOCKED_NANOS = 0;
+    private static final int REQUEST_NANOS = 1;
+    private static final int FIRST_BYTE_NANOS = 2;
+    private static final int COMPLETE_NANOS = 3;
+    private static final int BYTES_DISCARDED = 4;
+    static final int VALUE_COUNT = 5;
+
+    private final byte[] mResponse;
+    private final long[] mValues;
+
+    TransactResult(byte[] response, long[] values) {
+        mResponse = response;
+        mValues = values;
+    }
+
+    /** Whether a complete response arrived before the deadline. */
+    public boolean isComplete() {
+        return mResponse != null;
+    }
+
+    /** The decoded response, or null if the deadline passed first. */
+    public byte[] getResponse() {
+        return mResponse;
+    }
+
+    /** When both of the port's locks were held. */
+    public long getLockedNanos() {
+        return mValues[LOCKED_NANOS];
+    }
+
+    /** When the kernel had the whole request. */
+    public long getRequestNanos() {
+        return mValues[REQUEST_NANOS];
+    }
+
+    /** When the first response byte was read, 0 if none was. */
+    public long getFirstByteNanos() {
+        return mValues[FIRST_BYTE_NANOS];
+    }
+
+    /** When the response was complete, or when transact gave up. */
+    public long getCompleteNanos() {
+        return mValues[COMPLETE_NANOS];
+    }
+
+    /** Malformed input the matcher skipped. */
+    public long getBytesDiscarded() {
+        return mValues[BYTES_DISCARDED];
+    }
+}
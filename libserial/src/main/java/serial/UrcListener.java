@@ -0,0 +1,17 @@
+package serial;
+
+/**
+ * Receives unsolicited result codes routed by
+ * {@link AtEngine#setUrcHandler(String, UrcListener)}.
+ *
+ * Callbacks run on the same native thread as {@link AtResponseListener},
+ * in the order the lines arrived.
+ */
+public interface UrcListener {
+
+    /**
+     * @param engine The engine that read the line.
+     * @param line The line, without its line end.
+     */
+    void onUrc(AtEngine engine, String line);
+}
@@ -0,0 +1,22 @@
+package serial;
+
+/**
+ * Receives the outcome of writes queued with
+ * {@link Serial#submitWrite(byte[], int, int, WritePriority, WriteListener)}.
+ *
+ * Callbacks run on a single native thread shared by all ports, so they
+ * should return quickly.
+ */
+public interface WriteListener {
+
+    /**
+     * Called once for every submitted write.
+     *
+     * @param port The port the write was submitted to.
+     * @param id The id submitWrite returned.
+     * @param status How the write ended.
+     * @param written Bytes that were written, fewer than submitted unless
+     * status is {@link WriteStatus#Done}.
+     */
+    void onWriteComplete(Serial port, long id, WriteStatus status, int written);
+}
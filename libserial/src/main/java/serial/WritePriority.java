@@ -0,0 +1,21 @@
+package serial;
+
+/**
+ * Enumeration defines the order in which writes queued with
+ * {@link Serial#submitWrite(byte[], int, int, WritePriority, WriteListener)}
+ * are sent.  Earlier constants go first.
+ */
+public enum WritePriority {
+    /**
+     * Control frames, sent ahead of everything else that is queued.
+     */
+    Control,
+    /**
+     * Regular writes.
+     */
+    Normal,
+    /**
+     * Bulk transfers, sent when nothing more urgent is queued.
+     */
+    Bulk;
+}
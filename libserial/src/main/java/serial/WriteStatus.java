@@ -0,0 +1,27 @@
+package serial;
+
+/**
+ * Enumeration defines how a write queued with
+ * {@link Serial#submitWrite(byte[], int, int, WritePriority, WriteListener)}
+ * ended.
+ *
+ * @see WriteListener
+ */
+public enum WriteStatus {
+    /**
+     * Every byte was written.
+     */
+    Done,
+    /**
+     * The write timeout passed with bytes left over.
+     */
+    TimedOut,
+    /**
+     * Writing failed, or the port was closed while writing.
+     */
+    Failed,
+    /**
+     * The write was dropped from the queue before it was started.
+     */
+    Cancelled;
+}
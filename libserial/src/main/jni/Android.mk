@@ -3,6 +3,15 @@ LOCAL_PATH := $(call my-dir)
 $(call import-add-path,$(LOCAL_PATH)/libs)
 
 SERIAL_SRC_FILES := serial_jni.cc \
+    multiplexer_jni.cc \
+    receive_jni.cc \
+    write_jni.cc \
+    framer_jni.cc \
+    crc_jni.cc \
+    modbus_jni.cc \
+    histogram_jni.cc \
+    pattern_jni.cc \
+    at_jni.cc \
     jni_utility.cc \
     jni_main.cc
 
@@ -26,7 +35,7 @@ LOCAL_C_INCLUDES := $(SERIAL_C_INCLUDES)
 LOCAL_SRC_FILES := $(SERIAL_SRC_FILES)
 
 LOCAL_STATIC_LIBRARIES += nativehelper serialport
-LOCAL_LDLIBS := -llog -lz
+LOCAL_LDLIBS := -llog -lz -ldl
 
 include $(BUILD_SHARED_LIBRARY)
 
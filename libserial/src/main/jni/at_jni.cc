@@ -0,0 +1,330 @@
+#include <nativehelper/JNIHelp.h>
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+#include <serial/at_engine.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Backs serial.AtEngine.
+ *
+ * The engine's thread only moves responses and unsolicited lines onto a
+ * queue here; one daemon thread, attached to the VM once for its whole
+ * life, makes the upcalls for all engines, as write_jni.cc does for
+ * writes.  Releasing a handler's global references goes through the same
+ * queue, so it happens after every line already queued for it.
+ */
+
+static jmethodID gOnResponseMethod = 0;
+static jmethodID gOnUrcMethod = 0;
+static jclass gAtResponseClass = 0;
+static jmethodID gAtResponseConstructor = 0;
+// AtStatus constants, indexed by at_status_t
+static jobject gAtStatusValues[5];
+
+namespace {
+
+struct PendingCommand : public AtEngine::Callback {
+    jobject jengine;
+    jobject jlistener;
+
+    // Set on completion
+    uint64_t id;
+    AtResponse response;
+
+    virtual void onResponse(uint64_t id, const AtResponse &response);
+};
+
+struct JavaUrcHandler : public AtEngine::UrcHandler {
+    jobject jengine;
+    jobject jlistener;
+
+    virtual void onUrc(const string &line);
+};
+
+struct AtEvent {
+    PendingCommand *command;    // A response
+    JavaUrcHandler *handler;    // A line for handler, or its release
+    bool release;
+    string line;
+};
+
+// What a Java AtEngine points to
+struct NativeAtEngine {
+    AtEngine *engine;
+    map<string, JavaUrcHandler *> handlers;
+    pthread_mutex_t mutex;      // Guards handlers
+};
+
+}
+
+static deque<AtEvent> gEvents;
+static pthread_mutex_t gMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gCond = PTHREAD_COND_INITIALIZER;
+static bool gThreadStarted = false;
+
+static void pushEvent(const AtEvent &event)
+{
+    pthread_mutex_lock(&gMutex);
+    gEvents.push_back(event);
+    pthread_cond_signal(&gCond);
+    pthread_mutex_unlock(&gMutex);
+}
+
+void PendingCommand::onResponse(uint64_t id, const AtResponse &response)
+{
+    this->id = id;
+    this->response = response;
+    AtEvent event = { this, NULL, false, string() };
+    pushEvent(event);
+}
+
+void JavaUrcHandler::onUrc(const string &line)
+{
+    AtEvent event = { NULL, this, false, line };
+    pushEvent(event);
+}
+
+static jobject newAtResponse(JNIEnv *env, const AtResponse &response)
+{
+    ScopedLocalRef<jobjectArray> jlines(env, createStringArray(env, response.lines.size()));
+    if (!jlines.get())
+        return NULL;
+    for (size_t i = 0; i < response.lines.size(); ++i) {
+        ScopedLocalRef<jstring> jline(env, stdStringToJstring(env, response.lines[i]));
+        env->SetObjectArrayElement(jlines.get(), i, jline.get());
+    }
+    ScopedLocalRef<jstring> jfinal(env, stdStringToJstring(env, response.final_line));
+    return env->NewObject(gAtResponseClass, gAtResponseConstructor,
+            gAtStatusValues[response.status], jlines.get(), jfinal.get());
+}
+
+static void deliverEvent(JNIEnv *env, const AtEvent &event)
+{
+    if (event.command) {
+        PendingCommand *command = event.command;
+        ScopedLocalRef<jobject> jresponse(env, newAtResponse(env, command->response));
+        if (jresponse.get())
+            env->CallVoidMethod(command->jlistener, gOnResponseMethod, command->jengine,
+                    (jlong)command->id, jresponse.get());
+        checkException(env);
+        env->DeleteGlobalRef(command->jlistener);
+        env->DeleteGlobalRef(command->jengine);
+        delete command;
+    } else if (event.release) {
+        env->DeleteGlobalRef(event.handler->jlistener);
+        env->DeleteGlobalRef(event.handler->jengine);
+        delete event.handler;
+    } else {
+        ScopedLocalRef<jstring> jline(env, stdStringToJstring(env, event.line));
+        env->CallVoidMethod(event.handler->jlistener, gOnUrcMethod, event.handler->jengine,
+                jline.get());
+        checkException(env);
+    }
+}
+
+static void *dispatchThread(void *)
+{
+    JNIEnv *env = NULL;
+    JavaVMAttachArgs args;
+    args.version = JNI_VERSION_1_4;
+    args.name = "SerialAt";
+    args.group = NULL;
+    if (getJavaVM()->AttachCurrentThreadAsDaemon(&env, &args) != JNI_OK) {
+        LOGE("Could not attach the AT dispatch thread");
+        return NULL;
+    }
+    while (true) {
+        pthread_mutex_lock(&gMutex);
+        while (gEvents.empty())
+            pthread_cond_wait(&gCond, &gMutex);
+        AtEvent event = gEvents.front();
+        gEvents.pop_front();
+        pthread_mutex_unlock(&gMutex);
+
+        deliverEvent(env, event);
+    }
+    return NULL;
+}
+
+// Queues the release of handler behind the lines already queued for it
+static void releaseHandler(JavaUrcHandler *handler)
+{
+    AtEvent event = { NULL, handler, true, string() };
+    pushEvent(event);
+}
+
+static jlong native_create(JNIEnv *env, jobject, jlong serialPtr, jint maxInFlight)
+{
+    pthread_mutex_lock(&gMutex);
+    if (!gThreadStarted) {
+        pthread_t thread;
+        int result = pthread_create(&thread, NULL, dispatchThread, NULL);
+        if (result) {
+            pthread_mutex_unlock(&gMutex);
+            env->ThrowNew(gSerialIOExceptionClass, "Could not start the AT dispatch thread");
+            return 0;
+        }
+        pthread_detach(thread);
+        gThreadStarted = true;
+    }
+    pthread_mutex_unlock(&gMutex);
+    _BEGIN_TRY
+        NativeAtEngine *native = new NativeAtEngine();
+        try {
+            native->engine = new AtEngine((Serial *)serialPtr, (size_t)maxInFlight);
+        } catch (...) {
+            delete native;
+            throw;
+        }
+        pthread_mutex_init(&native->mutex, NULL);
+        return (jlong)native;
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+    return 0;
+}
+
+static void native_destroy(JNIEnv *, jobject, jlong ptr)
+{
+    NativeAtEngine *native = (NativeAtEngine *)ptr;
+    // Cancels what is left, which still reaches the listeners
+    delete native->engine;
+    for (map<string, JavaUrcHandler *>::iterator it = native->handlers.begin();
+            it != native->handlers.end(); ++it)
+        releaseHandler(it->second);
+    pthread_mutex_destroy(&native->mutex);
+    delete native;
+}
+
+static void native_setMaxInFlight(JNIEnv *env, jobject, jlong ptr, jint maxInFlight)
+{
+    _BEGIN_TRY
+        ((NativeAtEngine *)ptr)->engine->setMaxInFlight((size_t)maxInFlight);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _END_TRY
+}
+
+static jint native_getMaxInFlight(JNIEnv *, jobject, jlong ptr)
+{
+    return (jint)((NativeAtEngine *)ptr)->engine->getMaxInFlight();
+}
+
+static jlong native_submit(JNIEnv *env, jobject, jlong ptr, jobject jengine, jstring jcommand, jint timeoutMs, jstring jprefix, jobject jlistener)
+{
+    NativeAtEngine *native = (NativeAtEngine *)ptr;
+    PendingCommand *pending = NULL;
+    if (jlistener) {
+        pending = new PendingCommand();
+        pending->jengine = env->NewGlobalRef(jengine);
+        pending->jlistener = env->NewGlobalRef(jlistener);
+    }
+    return (jlong)native->engine->submit(jstringToStdString(env, jcommand), (uint32_t)timeoutMs,
+            jstringToStdString(env, jprefix), pending);
+}
+
+static jobject native_execute(JNIEnv *env, jobject, jlong ptr, jstring jcommand, jint timeoutMs, jstring jprefix)
+{
+    NativeAtEngine *native = (NativeAtEngine *)ptr;
+    AtResponse response = native->engine->execute(jstringToStdString(env, jcommand),
+            (uint32_t)timeoutMs, jstringToStdString(env, jprefix));
+    return newAtResponse(env, response);
+}
+
+static void native_setUrcHandler(JNIEnv *env, jobject, jlong ptr, jobject jengine, jstring jprefix, jobject jlistener)
+{
+    NativeAtEngine *native = (NativeAtEngine *)ptr;
+    string prefix = jstringToStdString(env, jprefix);
+    JavaUrcHandler *handler = new JavaUrcHandler();
+    handler->jengine = env->NewGlobalRef(jengine);
+    handler->jlistener = env->NewGlobalRef(jlistener);
+    pthread_mutex_lock(&native->mutex);
+    JavaUrcHandler *&slot = native->handlers[prefix];
+    if (slot) {
+        // Waits for a line being handed to the old handler, so its release
+        // is queued after that line
+        native->engine->removeUrcHandler(prefix);
+        releaseHandler(slot);
+    }
+    native->engine->setUrcHandler(prefix, handler);
+    slot = handler;
+    pthread_mutex_unlock(&native->mutex);
+}
+
+static void native_removeUrcHandler(JNIEnv *env, jobject, jlong ptr, jstring jprefix)
+{
+    NativeAtEngine *native = (NativeAtEngine *)ptr;
+    string prefix = jstringToStdString(env, jprefix);
+    pthread_mutex_lock(&native->mutex);
+    native->engine->removeUrcHandler(prefix);
+    map<string, JavaUrcHandler *>::iterator it = native->handlers.find(prefix);
+    if (it != native->handlers.end()) {
+        releaseHandler(it->second);
+        native->handlers.erase(it);
+    }
+    pthread_mutex_unlock(&native->mutex);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gAtEngineMethods[] = {
+    { "native_create", "(JI)J", (void*) native_create },
+    { "native_destroy", "(J)V", (void*) native_destroy },
+    { "native_setMaxInFlight", "(JI)V", (void*) native_setMaxInFlight },
+    { "native_getMaxInFlight", "(J)I", (void*) native_getMaxInFlight },
+    { "native_submit", "(JLserial/AtEngine;Ljava/lang/String;ILjava/lang/String;Lserial/AtResponseListener;)J", (void*) native_submit },
+    { "native_execute", "(JLjava/lang/String;ILjava/lang/String;)Lserial/AtResponse;", (void*) native_execute },
+    { "native_setUrcHandler", "(JLserial/AtEngine;Ljava/lang/String;Lserial/UrcListener;)V", (void*) native_setUrcHandler },
+    { "native_removeUrcHandler", "(JLjava/lang/String;)V", (void*) native_removeUrcHandler },
+};
+
+int registerAtEngine(JNIEnv* env)
+{
+    ScopedLocalRef<jclass> listenerClass(env, findClass("serial/AtResponseListener"));
+    if (!listenerClass.get())
+        return -1;
+    gOnResponseMethod = env->GetMethodID(listenerClass.get(), "onResponse", "(Lserial/AtEngine;JLserial/AtResponse;)V");
+    if (!gOnResponseMethod)
+        return -1;
+
+    ScopedLocalRef<jclass> urcClass(env, findClass("serial/UrcListener"));
+    if (!urcClass.get())
+        return -1;
+    gOnUrcMethod = env->GetMethodID(urcClass.get(), "onUrc", "(Lserial/AtEngine;Ljava/lang/String;)V");
+    if (!gOnUrcMethod)
+        return -1;
+
+    ScopedLocalRef<jclass> responseClass(env, findClass("serial/AtResponse"));
+    if (!responseClass.get())
+        return -1;
+    gAtResponseClass = (jclass)env->NewGlobalRef(responseClass.get());
+    gAtResponseConstructor = env->GetMethodID(responseClass.get(), "<init>", "(Lserial/AtStatus;[Ljava/lang/String;Ljava/lang/String;)V");
+    if (!gAtResponseConstructor)
+        return -1;
+
+    ScopedLocalRef<jclass> statusClass(env, findClass("serial/AtStatus"));
+    if (!statusClass.get())
+        return -1;
+    static const char *names[] = { "Ok", "Error", "TimedOut", "Failed", "Cancelled" };
+    for (size_t i = 0; i < NELEM(names); ++i) {
+        jfieldID field = env->GetStaticFieldID(statusClass.get(), names[i], "Lserial/AtStatus;");
+        if (!field)
+            return -1;
+        ScopedLocalRef<jobject> value(env, env->GetStaticObjectField(statusClass.get(), field));
+        gAtStatusValues[i] = env->NewGlobalRef(value.get());
+    }
+    return jniRegisterNativeMethods(env, "serial/AtEngine", gAtEngineMethods, NELEM(gAtEngineMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,106 @@
+#include <nativehelper/JNIHelp.h>
+
+#include <stdexcept>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/crc.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Backs serial.Crc.  Predefined models are native singletons that are never
+ * freed, custom ones are owned by their Java object.
+ */
+
+// Keep in sync with the predefined constants of serial.Crc
+static const Crc &predefinedCrc(jint id)
+{
+    switch (id) {
+    case 0: return Crc::crc8();
+    case 1: return Crc::crc8Maxim();
+    case 2: return Crc::crc16Modbus();
+    case 3: return Crc::crc16CcittFalse();
+    case 4: return Crc::crc16Kermit();
+    case 5: return Crc::crc16Xmodem();
+    case 6: return Crc::crc32();
+    default: return Crc::crc32c();
+    }
+}
+
+static jlong native_predefined(JNIEnv *, jobject, jint id)
+{
+    return (jlong)&predefinedCrc(id);
+}
+
+static jlong native_create(JNIEnv *env, jobject, jint width, jint poly, jint init, jboolean reflected, jint xorout)
+{
+    _BEGIN_TRY
+        return (jlong)new Crc((size_t)width, (uint32_t)poly, (uint32_t)init, reflected, (uint32_t)xorout);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _END_TRY
+    return 0;
+}
+
+static void native_destroy(JNIEnv *, jobject, jlong ptr)
+{
+    delete (Crc *)ptr;
+}
+
+static jint native_width(JNIEnv *, jobject, jlong ptr)
+{
+    return (jint)((Crc *)ptr)->width();
+}
+
+static jstring native_implementation(JNIEnv *env, jobject, jlong ptr)
+{
+    return env->NewStringUTF(((Crc *)ptr)->implementation());
+}
+
+static jlong native_compute(JNIEnv *env, jobject, jlong ptr, jbyteArray jdata, jint offset, jint size)
+{
+    Crc * crc = (Crc *)ptr;
+    if (offset < 0 || size < 0 || offset > env->GetArrayLength(jdata) - size) {
+        env->ThrowNew(gIllegalArgumentException, "offset or size out of range");
+        return -1;
+    }
+    // Computing never blocks, so the array can be pinned without a copy
+    uint8_t * data = (uint8_t *)env->GetPrimitiveArrayCritical(jdata, NULL);
+    if (!data)
+        return -1;
+    uint32_t value = crc->compute(data + offset, (size_t)size);
+    env->ReleasePrimitiveArrayCritical(jdata, data, JNI_ABORT);
+    return (jlong)value;
+}
+
+static jlong native_computeDirect(JNIEnv *env, jobject, jlong ptr, jobject jbuffer, jint offset, jint size)
+{
+    Crc * crc = (Crc *)ptr;
+    uint8_t * data = getDirectRegion(env, jbuffer, offset, size);
+    if (!data)
+        return -1;
+    return (jlong)crc->compute(data, (size_t)size);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gCrcMethods[] = {
+    { "native_predefined", "(I)J", (void*) native_predefined },
+    { "native_create", "(IIIZI)J", (void*) native_create },
+    { "native_destroy", "(J)V", (void*) native_destroy },
+    { "native_width", "(J)I", (void*) native_width },
+    { "native_implementation", "(J)Ljava/lang/String;", (void*) native_implementation },
+    { "native_compute", "(J[BII)J", (void*) native_compute },
+    { "native_computeDirect", "(JLjava/nio/ByteBuffer;II)J", (void*) native_computeDirect },
+};
+
+int registerCrc(JNIEnv* env)
+{
+    return jniRegisterNativeMethods(env, "serial/Crc", gCrcMethods, NELEM(gCrcMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,208 @@
+#include <nativehelper/JNIHelp.h>
+
+#include <vector>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+#include <serial/framer.h>
+#include <serial/crc.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Binds serial.Framer descriptions to the native frame extractors, so whole
+ * frames are split off natively and handed to Java in one call.
+ */
+
+// Keep in sync with the TYPE_ constants of serial.Framer
+enum {
+    FRAMER_NONE = 0,
+    FRAMER_FIXED_LENGTH = 1,
+    FRAMER_LENGTH_FIELD = 2,
+    FRAMER_DELIMITER = 3,
+    FRAMER_SLIP = 4,
+    FRAMER_COBS = 5,
+};
+
+static size_t toSize(jint value)
+{
+    if (value < 0)
+        throw invalid_argument("framer parameters must not be negative");
+    return (size_t)value;
+}
+
+static Framer *createFramer(jint type, const vector<jint> &params, const string &delimiter)
+{
+    static const size_t kParamCounts[] = { 0, 1, 6, 2, 1, 1 };
+    if (type < FRAMER_NONE || type > FRAMER_COBS || params.size() < kParamCounts[type])
+        throw invalid_argument("unknown framer");
+    switch (type) {
+    case FRAMER_FIXED_LENGTH:
+        return new FixedLengthFramer(toSize(params[0]));
+    case FRAMER_LENGTH_FIELD:
+        return new LengthFieldFramer(toSize(params[0]), toSize(params[1]),
+                params[2] ? byteorder_little_endian : byteorder_big_endian,
+                (long)params[3], toSize(params[4]), toSize(params[5]));
+    case FRAMER_DELIMITER:
+        return new DelimiterFramer(delimiter, params[0] != 0, toSize(params[1]));
+    case FRAMER_SLIP:
+        return new SlipFramer(toSize(params[0]));
+    case FRAMER_COBS:
+        return new CobsFramer(toSize(params[0]));
+    }
+    return NULL;
+}
+
+/*
+ * Builds the framer a serial.Framer describes, NULL for FRAMER_NONE.
+ */
+static Framer *buildFramer(JNIEnv *env, jint type, jintArray jparams, jbyteArray jdelimiter,
+                           jlong crcPtr, jboolean crcLittleEndian)
+{
+    vector<jint> params;
+    if (jparams) {
+        params.resize(env->GetArrayLength(jparams));
+        if (!params.empty())
+            env->GetIntArrayRegion(jparams, 0, params.size(), &params[0]);
+    }
+    string delimiter;
+    if (jdelimiter) {
+        delimiter.resize(env->GetArrayLength(jdelimiter));
+        if (!delimiter.empty())
+            env->GetByteArrayRegion(jdelimiter, 0, delimiter.size(), (jbyte *)&delimiter[0]);
+    }
+    Framer *framer = createFramer(type, params, delimiter);
+    if (framer && crcPtr)
+        framer = new CrcFramer(framer, *(Crc *)crcPtr,
+                crcLittleEndian ? byteorder_little_endian : byteorder_big_endian);
+    return framer;
+}
+
+static void native_setFramer(JNIEnv *env, jobject, jlong ptr, jint type, jintArray jparams, jbyteArray jdelimiter,
+                             jlong crcPtr, jboolean crcLittleEndian)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->setFramer(buildFramer(env, type, jparams, jdelimiter, crcPtr, crcLittleEndian));
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _END_TRY
+}
+
+static jbyteArray native_readFrame(JNIEnv *env, jobject, jlong ptr)
+{
+    LOGD("native_readFrame(0x%08llx)", ptr);
+    Serial * com = (Serial *)ptr;
+    vector<uint8_t> frame;
+    _BEGIN_TRY
+        if (!com->readFrame(frame))
+            return NULL;
+        jbyteArray jframe = env->NewByteArray(frame.size());
+        if (jframe && !frame.empty())
+            env->SetByteArrayRegion(jframe, 0, frame.size(), (const jbyte *)&frame[0]);
+        return jframe;
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+    return NULL;
+}
+
+static jint native_writeFrame(JNIEnv *env, jobject, jlong ptr, jbyteArray jpayload, jint offset, jint size)
+{
+    LOGD("native_writeFrame(0x%08llx,%p,%d,%d)", ptr, jpayload, offset, size);
+    Serial * com = (Serial *)ptr;
+    if (offset < 0 || size < 0 || offset > env->GetArrayLength(jpayload) - size) {
+        env->ThrowNew(gIllegalArgumentException, "offset or size out of range");
+        return -1;
+    }
+    jbyte* jarray = env->GetByteArrayElements(jpayload, NULL);
+    if (!jarray)
+        return -1;
+    jint bytesWritten = -1;
+    _BEGIN_TRY
+        bytesWritten = (jint)com->writeFrame((const uint8_t *)(jarray + offset), (size_t)size);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+    env->ReleaseByteArrayElements(jpayload, jarray, JNI_ABORT);
+    return bytesWritten;
+}
+
+/*
+ * Sends a request and reads the response the framer describes, with a
+ * FRAMER_NONE type standing for the port's own framer.  The timing array
+ * receives the fields of TransactTiming in declaration order.
+ */
+static jbyteArray native_transact(JNIEnv *env, jobject, jlong ptr, jbyteArray jrequest, jint offset, jint size,
+                                  jint type, jintArray jparams, jbyteArray jdelimiter, jlong crcPtr,
+                                  jboolean crcLittleEndian, jint deadlineMs, jboolean flushInput,
+                                  jlongArray jtiming)
+{
+    LOGD("native_transact(0x%08llx,%p,%d,%d)", ptr, jrequest, offset, size);
+    Serial * com = (Serial *)ptr;
+    if (offset < 0 || size < 0 || offset > env->GetArrayLength(jrequest) - size || deadlineMs < 0) {
+        env->ThrowNew(gIllegalArgumentException, "offset, size or deadline out of range");
+        return NULL;
+    }
+    Framer *matcher = NULL;
+    _BEGIN_TRY
+        matcher = buildFramer(env, type, jparams, jdelimiter, crcPtr, crcLittleEndian);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+        return NULL;
+    _END_TRY
+    jbyte* jarray = env->GetByteArrayElements(jrequest, NULL);
+    if (!jarray) {
+        delete matcher;
+        return NULL;
+    }
+    jbyteArray jresponse = NULL;
+    _BEGIN_TRY
+        vector<uint8_t> response;
+        TransactTiming timing;
+        bool complete = com->transact((const uint8_t *)(jarray + offset), (size_t)size, matcher,
+                response, (uint32_t)deadlineMs, flushInput, &timing);
+        jlong values[] = {
+            (jlong)timing.locked_ns,
+            (jlong)timing.request_ns,
+            (jlong)timing.first_byte_ns,
+            (jlong)timing.complete_ns,
+            (jlong)timing.bytes_discarded,
+        };
+        if (jtiming && env->GetArrayLength(jtiming) >= (jsize)NELEM(values))
+            env->SetLongArrayRegion(jtiming, 0, NELEM(values), values);
+        if (complete) {
+            jresponse = env->NewByteArray(response.size());
+            if (jresponse && !response.empty())
+                env->SetByteArrayRegion(jresponse, 0, response.size(), (const jbyte *)&response[0]);
+        }
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+    env->ReleaseByteArrayElements(jrequest, jarray, JNI_ABORT);
+    delete matcher;
+    return jresponse;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gFramerMethods[] = {
+    { "native_setFramer", "(JI[I[BJZ)V", (void*) native_setFramer },
+    { "native_readFrame", "(J)[B", (void*) native_readFrame },
+    { "native_writeFrame", "(J[BII)I", (void*) native_writeFrame },
+    { "native_transact", "(J[BIII[I[BJZIZ[J)[B", (void*) native_transact },
+};
+
+int registerFramer(JNIEnv* env)
+{
+    return jniRegisterNativeMethods(env, "serial/Serial", gFramerMethods, NELEM(gFramerMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,81 @@
+#include <nativehelper/JNIHelp.h>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/histogram.h>
+
+using namespace serial;
+
+/*
+ * Backs serial.LatencyHistogram, each Java object owns one native
+ * histogram that snapshots are copied into.
+ */
+
+static jlong native_create(JNIEnv *, jobject)
+{
+    return (jlong)new LatencyHistogram();
+}
+
+static void native_destroy(JNIEnv *, jobject, jlong ptr)
+{
+    delete (LatencyHistogram *)ptr;
+}
+
+static void native_add(JNIEnv *, jobject, jlong ptr, jlong otherPtr)
+{
+    ((LatencyHistogram *)ptr)->add(*(LatencyHistogram *)otherPtr);
+}
+
+static void native_reset(JNIEnv *, jobject, jlong ptr)
+{
+    ((LatencyHistogram *)ptr)->reset();
+}
+
+static jlong native_count(JNIEnv *, jobject, jlong ptr)
+{
+    return (jlong)((LatencyHistogram *)ptr)->count();
+}
+
+static jlong native_min(JNIEnv *, jobject, jlong ptr)
+{
+    return (jlong)((LatencyHistogram *)ptr)->min();
+}
+
+static jlong native_max(JNIEnv *, jobject, jlong ptr)
+{
+    return (jlong)((LatencyHistogram *)ptr)->max();
+}
+
+static jdouble native_mean(JNIEnv *, jobject, jlong ptr)
+{
+    return ((LatencyHistogram *)ptr)->mean();
+}
+
+static jlong native_percentile(JNIEnv *, jobject, jlong ptr, jdouble percent)
+{
+    return (jlong)((LatencyHistogram *)ptr)->percentile(percent);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gLatencyHistogramMethods[] = {
+    { "native_create", "()J", (void*) native_create },
+    { "native_destroy", "(J)V", (void*) native_destroy },
+    { "native_add", "(JJ)V", (void*) native_add },
+    { "native_reset", "(J)V", (void*) native_reset },
+    { "native_count", "(J)J", (void*) native_count },
+    { "native_min", "(J)J", (void*) native_min },
+    { "native_max", "(J)J", (void*) native_max },
+    { "native_mean", "(J)D", (void*) native_mean },
+    { "native_percentile", "(JD)J", (void*) native_percentile },
+};
+
+int registerLatencyHistogram(JNIEnv* env)
+{
+    return jniRegisterNativeMethods(env, "serial/LatencyHistogram", gLatencyHistogramMethods, NELEM(gLatencyHistogramMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,56 @@
+#ifndef SerialJNI_h
+#define SerialJNI_h
+
+#include <jni.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log.h"
+
+/*
+ * Exception translation shared by the JNI bindings.  A C++ exception caught
+ * with _CATCH_AND_THROW is rethrown in Java as the given class.
+ */
+#define _BEGIN_TRY                              try {
+#define _CATCH(cpp_ex)                          } catch (cpp_ex& _ex) {
+#define _CATCH_AND_THROW(env, cpp_ex, java_ex)  } catch (cpp_ex& _ex) { \
+    LOGE("%s", _ex.what());\
+    (env)->ThrowNew(java_ex, _ex.what());
+#define _END_TRY                                }
+
+// Global references, set up by registerSerial
+extern jclass gSerialExceptionClass;
+extern jclass gSerialIOExceptionClass;
+extern jclass gIllegalArgumentException;
+
+/*
+ * Returns the address of [offset, offset + size) inside a direct buffer, or
+ * NULL with an IllegalArgumentException pending.
+ */
+uint8_t * getDirectRegion(JNIEnv *env, jobject jbuffer, jint offset, jint size);
+
+/*
+ * Whether [offset, offset + size) lies inside a Java array, computed without
+ * overflow.  If not, an IllegalArgumentException is left pending.
+ */
+bool checkArrayRegion(JNIEnv *env, jbyteArray jarray, jint offset, jint size);
+
+// Native memory for a read or write through a Java array.  Only the bytes
+// actually moved cross the JNI boundary, with Get/SetByteArrayRegion, instead
+// of pinning or copying the whole array.  Small transfers stay on the stack.
+class ScratchBuffer {
+public:
+    explicit ScratchBuffer(size_t size)
+        : heap_(size > sizeof(stack_) ? new uint8_t[size] : NULL) {}
+    ~ScratchBuffer() { delete [] heap_; }
+    uint8_t * get() { return heap_ != NULL ? heap_ : stack_; }
+private:
+    // Disable copy constructors
+    ScratchBuffer(const ScratchBuffer&);
+    ScratchBuffer& operator=(const ScratchBuffer&);
+
+    uint8_t stack_[4096];
+    uint8_t * heap_;
+};
+
+#endif // SerialJNI_h
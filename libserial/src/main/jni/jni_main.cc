@@ -16,9 +16,27 @@ struct RegistrationMethod {
 };
 
 extern int registerSerial(JNIEnv* env);
+extern int registerSerialMultiplexer(JNIEnv* env);
+extern int registerReceive(JNIEnv* env);
+extern int registerWrite(JNIEnv* env);
+extern int registerFramer(JNIEnv* env);
+extern int registerCrc(JNIEnv* env);
+extern int registerModbusRtuMaster(JNIEnv* env);
+extern int registerLatencyHistogram(JNIEnv* env);
+extern int registerPatternSet(JNIEnv* env);
+extern int registerAtEngine(JNIEnv* env);
 
 static RegistrationMethod gRegMethods[] = {
     { "Serial", registerSerial },
+    { "SerialMultiplexer", registerSerialMultiplexer },
+    { "Receive", registerReceive },
+    { "Write", registerWrite },
+    { "Framer", registerFramer },
+    { "Crc", registerCrc },
+    { "ModbusRtuMaster", registerModbusRtuMaster },
+    { "LatencyHistogram", registerLatencyHistogram },
+    { "PatternSet", registerPatternSet },
+    { "AtEngine", registerAtEngine },
 };
 
 JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved)
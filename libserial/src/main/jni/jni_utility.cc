@@ -24,6 +24,7 @@
  */
 
 #include <jni_utility.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 static JavaVM* jvm = 0;
@@ -41,6 +42,10 @@ static jmethodID gLongValueOf = 0;
 static jclass gIntClass = 0;
 static jmethodID gIntValueOf = 0;
 
+// Threads attached by getJNIEnv, detached again when they exit
+static pthread_key_t gAttachedKey;
+static pthread_once_t gAttachedKeyOnce = PTHREAD_ONCE_INIT;
+
 void setupGlobalClassLoader()
 {
     JNIEnv* env = getJNIEnv();
@@ -105,8 +110,7 @@ jclass findClass(const char* name, int flags /*= FIND_CLASS_USE_CLASS_LOADER*/)
 
 // Provide the ability for an outside component to specify the JavaVM to use
 // If the jvm value is set, the getJavaVM function below will just return.
-// In getJNIEnv(), if AttachCurrentThread is called to a VM that is already
-// attached, the result is a no-op.
+// getJNIEnv() only attaches threads that are not attached yet.
 void setJavaVM(JavaVM* javaVM)
 {
     jvm = javaVM;
@@ -126,6 +130,11 @@ static void detachCurrentThread(void *data)
     getJavaVM()->DetachCurrentThread();
 }
 
+static void createAttachedKey()
+{
+    pthread_key_create(&gAttachedKey, detachCurrentThread);
+}
+
 JNIEnv* getJNIEnv()
 {
     union {
@@ -134,8 +143,16 @@ JNIEnv* getJNIEnv()
     } u;
     jint jniError = 0;
 
+    // Cheap for threads that are already attached, which is nearly all calls
+    jniError = getJavaVM()->GetEnv(&u.dummy, JNI_VERSION_1_4);
+    if (jniError == JNI_OK) {
+        return u.env;
+    }
     jniError = getJavaVM()->AttachCurrentThread(&u.env, 0);
     if (jniError == JNI_OK) {
+        // Native threads we attach are detached when they exit
+        pthread_once(&gAttachedKeyOnce, createAttachedKey);
+        pthread_setspecific(gAttachedKey, u.env);
         return u.env;
     }
     LOGE("AttachCurrentThread failed, returned %ld", static_cast<long>(jniError));
@@ -7,7 +7,19 @@ LOCAL_C_INCLUDES := \
     $(LOCAL_PATH)/include
 	
 LOCAL_SRC_FILES := serial.cc \
+    framer.cc \
+    pattern_set.cc \
+    crc.cc \
+    spsc_ring.cc \
+    histogram.cc \
+    trace.cc \
+    capture.cc \
+    modbus_rtu.cc \
+    at_engine.cc \
     serial_unix.cc \
+    backend_unix.cc \
+    poller_linux.cc \
+    multiplexer_linux.cc \
     list_ports_linux.cc
 
 LOCAL_EXPORT_CPPFLAGS := -I$(LOCAL_PATH)/include
@@ -0,0 +1,437 @@
+#if !defined(_WIN32)
+
+#include <time.h>
+
+#include <algorithm>
+
+#include "serial/at_engine.h"
+#include "serial/pattern_set.h"
+
+using std::deque;
+using std::invalid_argument;
+using std::map;
+using std::string;
+using std::vector;
+
+using serial::AtEngine;
+using serial::AtResponse;
+using serial::PatternSet;
+using serial::Serial;
+using serial::IOException;
+
+namespace {
+
+// Longest the thread waits for a line before it looks at the timeouts and
+// whether it should stop
+const uint32_t kPollMs = 100;
+
+struct FinalCode {
+  const char *prefix;
+  serial::at_status_t status;
+};
+
+// Final result codes of V.250 and 3GPP TS 27.007, matched as prefixes
+const FinalCode kFinalCodes[] = {
+  { "OK", serial::at_ok },
+  { "CONNECT", serial::at_ok },
+  { "ERROR", serial::at_error },
+  { "+CME ERROR:", serial::at_error },
+  { "+CMS ERROR:", serial::at_error },
+  { "NO CARRIER", serial::at_error },
+  { "NO ANSWER", serial::at_error },
+  { "NO DIALTONE", serial::at_error },
+  { "BUSY", serial::at_error },
+};
+
+int64_t
+now_ns ()
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t> (ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+bool
+starts_with (const string &line, const string &prefix)
+{
+  return line.compare (0, prefix.size (), prefix) == 0;
+}
+
+// Whether line is a final result code, and which status it stands for
+bool
+final_status (const string &line, serial::at_status_t &status)
+{
+  for (size_t i = 0; i < sizeof (kFinalCodes) / sizeof (kFinalCodes[0]); ++i) {
+    if (starts_with (line, kFinalCodes[i].prefix)) {
+      status = kFinalCodes[i].status;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Waits for the response of one command, for AtEngine::execute
+class SyncCallback : public AtEngine::Callback {
+public:
+  SyncCallback () : done_ (false)
+  {
+    pthread_mutex_init (&mutex_, NULL);
+    pthread_cond_init (&cond_, NULL);
+  }
+
+  ~SyncCallback ()
+  {
+    pthread_cond_destroy (&cond_);
+    pthread_mutex_destroy (&mutex_);
+  }
+
+  virtual void
+  onResponse (uint64_t, const AtResponse &response)
+  {
+    pthread_mutex_lock (&mutex_);
+    response_ = response;
+    done_ = true;
+    pthread_cond_signal (&cond_);
+    pthread_mutex_unlock (&mutex_);
+  }
+
+  AtResponse
+  wait ()
+  {
+    pthread_mutex_lock (&mutex_);
+    while (!done_) {
+      pthread_cond_wait (&cond_, &mutex_);
+    }
+    pthread_mutex_unlock (&mutex_);
+    return response_;
+  }
+
+private:
+  bool done_;
+  AtResponse response_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+};
+
+} // namespace
+
+AtEngine::AtEngine (Serial *port, size_t max_in_flight)
+  : port_ (port), line_end_ (NULL), max_in_flight_ (max_in_flight),
+    next_id_ (1), delivering_ (NULL), sending_ (false), stop_ (false)
+{
+  if (max_in_flight == 0) {
+    throw invalid_argument ("max_in_flight must be > 0");
+  }
+  line_end_ = new PatternSet (vector<string> (1, "\n"));
+  pthread_mutex_init (&mutex_, NULL);
+  pthread_cond_init (&idle_cond_, NULL);
+  int result = pthread_create (&thread_, NULL, &readThread, this);
+  if (result) {
+    pthread_cond_destroy (&idle_cond_);
+    pthread_mutex_destroy (&mutex_);
+    delete line_end_;
+    THROW (IOException, result);
+  }
+}
+
+AtEngine::~AtEngine ()
+{
+  pthread_mutex_lock (&mutex_);
+  stop_ = true;
+  pthread_mutex_unlock (&mutex_);
+  pthread_join (thread_, NULL);
+
+  vector<Command *> done (in_flight_.begin (), in_flight_.end ());
+  done.insert (done.end (), queue_.begin (), queue_.end ());
+  in_flight_.clear ();
+  queue_.clear ();
+  for (size_t i = 0; i < done.size (); ++i) {
+    done[i]->response.status = at_cancelled;
+  }
+  finish (done);
+
+  pthread_cond_destroy (&idle_cond_);
+  pthread_mutex_destroy (&mutex_);
+  delete line_end_;
+}
+
+void
+AtEngine::setMaxInFlight (size_t max_in_flight)
+{
+  if (max_in_flight == 0) {
+    throw invalid_argument ("max_in_flight must be > 0");
+  }
+  vector<Command *> done;
+  pthread_mutex_lock (&mutex_);
+  max_in_flight_ = max_in_flight;
+  pump (done);
+  pthread_mutex_unlock (&mutex_);
+  finish (done);
+}
+
+size_t
+AtEngine::getMaxInFlight () const
+{
+  pthread_mutex_lock (&mutex_);
+  size_t max_in_flight = max_in_flight_;
+  pthread_mutex_unlock (&mutex_);
+  return max_in_flight;
+}
+
+uint64_t
+AtEngine::submit (const string &command, uint32_t timeout_ms,
+                  const string &response_prefix, Callback *callback)
+{
+  Command *entry = new Command ();
+  entry->text = command;
+  entry->prefix = response_prefix;
+  entry->timeout_ms = timeout_ms;
+  entry->deadline_ns = 0;
+  entry->callback = callback;
+
+  vector<Command *> done;
+  pthread_mutex_lock (&mutex_);
+  uint64_t id = entry->id = next_id_++;
+  queue_.push_back (entry);
+  pump (done);
+  pthread_mutex_unlock (&mutex_);
+  finish (done);
+  return id;
+}
+
+AtResponse
+AtEngine::execute (const string &command, uint32_t timeout_ms,
+                   const string &response_prefix)
+{
+  SyncCallback callback;
+  submit (command, timeout_ms, response_prefix, &callback);
+  return callback.wait ();
+}
+
+void
+AtEngine::setUrcHandler (const string &prefix, UrcHandler *handler)
+{
+  pthread_mutex_lock (&mutex_);
+  handlers_[prefix] = handler;
+  pthread_mutex_unlock (&mutex_);
+}
+
+void
+AtEngine::removeUrcHandler (const string &prefix)
+{
+  pthread_mutex_lock (&mutex_);
+  map<string, UrcHandler *>::iterator it = handlers_.find (prefix);
+  if (it != handlers_.end ()) {
+    UrcHandler *handler = it->second;
+    handlers_.erase (it);
+    if (!pthread_equal (thread_, pthread_self ())) {
+      while (delivering_ != NULL && delivering_ == handler) {
+        pthread_cond_wait (&idle_cond_, &mutex_);
+      }
+    }
+  }
+  pthread_mutex_unlock (&mutex_);
+}
+
+void *
+AtEngine::readThread (void *arg)
+{
+  static_cast<AtEngine *> (arg)->readLoop ();
+  return NULL;
+}
+
+void
+AtEngine::readLoop ()
+{
+  vector<uint8_t> line;
+  while (true) {
+    vector<Command *> done;
+    pthread_mutex_lock (&mutex_);
+    if (stop_) {
+      pthread_mutex_unlock (&mutex_);
+      break;
+    }
+    expire (done);
+    pump (done);
+    // Wake up for the next timeout, if it comes before the next poll
+    uint32_t wait_ms = kPollMs;
+    if (!in_flight_.empty ()) {
+      int64_t left_ns = in_flight_.front ()->deadline_ns - now_ns ();
+      wait_ms = static_cast<uint32_t> (std::max<int64_t> (
+          0, std::min<int64_t> ((left_ns + 999999) / 1000000, kPollMs)));
+    }
+    pthread_mutex_unlock (&mutex_);
+    finish (done);
+
+    int index = -1;
+    try {
+      index = port_->readUntilAny (*line_end_, line, wait_ms);
+    } catch (std::exception &) {
+      // Closed or failed port: the commands in flight are lost, and the
+      // port may come back later
+      pthread_mutex_lock (&mutex_);
+      done.assign (in_flight_.begin (), in_flight_.end ());
+      in_flight_.clear ();
+      pthread_mutex_unlock (&mutex_);
+      for (size_t i = 0; i < done.size (); ++i) {
+        done[i]->response.status = at_failed;
+      }
+      finish (done);
+      timespec pause;
+      pause.tv_sec = 0;
+      pause.tv_nsec = kPollMs * 1000000L;
+      nanosleep (&pause, NULL);
+      continue;
+    }
+    if (index < 0) {
+      continue;
+    }
+    string text (line.begin (), line.end ());
+    if (!text.empty () && text[text.size () - 1] == '\r') {
+      text.resize (text.size () - 1);
+    }
+    if (!text.empty ()) {
+      handleLine (text);
+    }
+  }
+}
+
+void
+AtEngine::pump (vector<Command *> &done)
+{
+  // One thread writes at a time, so commands go out in order.  Whoever is
+  // writing also sends what was queued meanwhile.
+  if (sending_) {
+    return;
+  }
+  sending_ = true;
+  while (in_flight_.size () < max_in_flight_ && !queue_.empty ()) {
+    // Commands are in flight before they are written, so an answer that
+    // comes back quickly finds them.  Their text is copied, since the read
+    // thread may finish them once the lock is released.
+    vector<Command *> batch;
+    vector<string> wires;
+    while (in_flight_.size () < max_in_flight_ && !queue_.empty ()) {
+      Command *command = queue_.front ();
+      queue_.pop_front ();
+      command->deadline_ns = now_ns ()
+                             + static_cast<int64_t> (command->timeout_ms) * 1000000LL;
+      in_flight_.push_back (command);
+      batch.push_back (command);
+      wires.push_back (command->text + "\r");
+    }
+    pthread_mutex_unlock (&mutex_);
+    vector<bool> sent (batch.size (), false);
+    for (size_t i = 0; i < batch.size (); ++i) {
+      try {
+        sent[i] = port_->write (wires[i]) == wires[i].size ();
+      } catch (std::exception &) {
+      }
+    }
+    pthread_mutex_lock (&mutex_);
+    for (size_t i = 0; i < batch.size (); ++i) {
+      if (sent[i]) {
+        continue;
+      }
+      // Unless something else finished it meanwhile
+      deque<Command *>::iterator it
+          = std::find (in_flight_.begin (), in_flight_.end (), batch[i]);
+      if (it != in_flight_.end ()) {
+        in_flight_.erase (it);
+        batch[i]->response.status = at_failed;
+        done.push_back (batch[i]);
+      }
+    }
+  }
+  sending_ = false;
+}
+
+void
+AtEngine::expire (vector<Command *> &done)
+{
+  int64_t now = now_ns ();
+  while (!in_flight_.empty () && in_flight_.front ()->deadline_ns <= now) {
+    Command *command = in_flight_.front ();
+    in_flight_.pop_front ();
+    command->response.status = at_timeout;
+    done.push_back (command);
+  }
+}
+
+void
+AtEngine::handleLine (const string &line)
+{
+  vector<Command *> done;
+  UrcHandler *handler = NULL;
+  pthread_mutex_lock (&mutex_);
+  Command *head = in_flight_.empty () ? NULL : in_flight_.front ();
+  at_status_t status = at_ok;
+  if (isEcho (line)) {
+    // With ATE1
+  } else if (head != NULL && !head->prefix.empty ()
+             && starts_with (line, head->prefix)) {
+    head->response.lines.push_back (line);
+  } else if (head != NULL && final_status (line, status)) {
+    in_flight_.pop_front ();
+    head->response.status = status;
+    head->response.final_line = line;
+    done.push_back (head);
+    pump (done);
+  } else if ((handler = findHandler (line)) != NULL) {
+    delivering_ = handler;
+  } else if (head != NULL) {
+    head->response.lines.push_back (line);
+  }
+  pthread_mutex_unlock (&mutex_);
+  finish (done);
+
+  if (handler != NULL) {
+    handler->onUrc (line);
+    pthread_mutex_lock (&mutex_);
+    delivering_ = NULL;
+    pthread_cond_broadcast (&idle_cond_);
+    pthread_mutex_unlock (&mutex_);
+  }
+}
+
+bool
+AtEngine::isEcho (const string &line) const
+{
+  // With several commands in flight, a module that buffers them may echo
+  // a later one before it answers the oldest
+  for (size_t i = 0; i < in_flight_.size (); ++i) {
+    if (line == in_flight_[i]->text) {
+      return true;
+    }
+  }
+  return false;
+}
+
+AtEngine::UrcHandler *
+AtEngine::findHandler (const string &line) const
+{
+  // The map is sorted, so the longest prefix of line is the last match at
+  // or before line itself
+  map<string, UrcHandler *>::const_iterator it = handlers_.upper_bound (line);
+  while (it != handlers_.begin ()) {
+    --it;
+    if (starts_with (line, it->first)) {
+      return it->second;
+    }
+  }
+  return NULL;
+}
+
+void
+AtEngine::finish (vector<Command *> &done)
+{
+  for (size_t i = 0; i < done.size (); ++i) {
+    if (done[i]->callback != NULL) {
+      done[i]->callback->onResponse (done[i]->id, done[i]->response);
+    }
+    delete done[i];
+  }
+  done.clear ();
+}
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,289 @@
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "serial/impl/backend.h"
+#include "serial/impl/poller.h"
+#include "serial/capture.h"
+#include "serial/serial.h"
+
+using std::invalid_argument;
+using std::string;
+
+using serial::CaptureRecord;
+using serial::DeviceBackend;
+using serial::IOException;
+using serial::Poller;
+using serial::ReplayBackend;
+
+namespace {
+
+uint64_t
+monotonic_ns ()
+{
+  timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t> (now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+void
+sleep_ns (uint64_t ns)
+{
+  timespec pause;
+  pause.tv_sec = static_cast<time_t> (ns / 1000000000ULL);
+  pause.tv_nsec = static_cast<long> (ns % 1000000000ULL);
+  nanosleep (&pause, NULL);
+}
+
+} // namespace
+
+int
+DeviceBackend::open (const string &port)
+{
+  port_ = port;
+  return ::open (port_.c_str (), O_RDWR | O_NOCTTY | O_NONBLOCK);
+}
+
+int
+DeviceBackend::openReader ()
+{
+  return ::open (port_.c_str (), O_RDONLY | O_NOCTTY);
+}
+
+void
+DeviceBackend::close ()
+{
+}
+
+ReplayBackend::ReplayBackend (double speed)
+  : speed_ (speed), master_fd_ (-1), slave_fd_ (-1), poller_ (NULL),
+    running_ (false), stop_ (false)
+{
+  if (!(speed >= 0)) {
+    throw invalid_argument ("Replay speed must be >= 0.");
+  }
+}
+
+ReplayBackend::~ReplayBackend ()
+{
+  close ();
+}
+
+int
+ReplayBackend::open (const string &port)
+{
+  capture_ = port;
+  // Bad files fail the open, not the replay
+  reader_.open (capture_);
+
+  master_fd_ = posix_openpt (O_RDWR | O_NOCTTY);
+  char name[64];
+  if (master_fd_ == -1 || grantpt (master_fd_) == -1
+      || unlockpt (master_fd_) == -1
+      || ptsname_r (master_fd_, name, sizeof (name)) != 0) {
+    int error = errno;
+    close ();
+    errno = error;
+    return -1;
+  }
+  slave_path_ = name;
+  fcntl (master_fd_, F_SETFL, fcntl (master_fd_, F_GETFL) | O_NONBLOCK);
+  slave_fd_ = ::open (name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  int fd = slave_fd_ == -1 ? -1
+           : ::open (name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd == -1) {
+    int error = errno;
+    close ();
+    errno = error;
+    return -1;
+  }
+  // Raw before the first byte goes in, the port only reconfigures once
+  // it has the descriptor
+  struct termios options;
+  if (tcgetattr (fd, &options) == 0) {
+    cfmakeraw (&options);
+    tcsetattr (fd, TCSANOW, &options);
+  }
+
+  try {
+    poller_ = new Poller ();
+    poller_->add (master_fd_, poll_readable);
+  } catch (...) {
+    ::close (fd);
+    close ();
+    throw;
+  }
+  stop_ = false;
+  int result = pthread_create (&thread_, NULL, &feedThread, this);
+  if (result) {
+    ::close (fd);
+    close ();
+    THROW (IOException, result);
+  }
+  running_ = true;
+  return fd;
+}
+
+int
+ReplayBackend::openReader ()
+{
+  return ::open (slave_path_.c_str (), O_RDONLY | O_NOCTTY);
+}
+
+void
+ReplayBackend::close ()
+{
+  if (running_) {
+    __atomic_store_n (&stop_, true, __ATOMIC_RELEASE);
+    poller_->wakeup ();
+    pthread_join (thread_, NULL);
+    running_ = false;
+  }
+  delete poller_;
+  poller_ = NULL;
+  if (master_fd_ != -1) {
+    ::close (master_fd_);
+    master_fd_ = -1;
+  }
+  if (slave_fd_ != -1) {
+    ::close (slave_fd_);
+    slave_fd_ = -1;
+  }
+  reader_.close ();
+}
+
+void *
+ReplayBackend::feedThread (void *arg)
+{
+  static_cast<ReplayBackend *> (arg)->feedLoop ();
+  return NULL;
+}
+
+void
+ReplayBackend::feedLoop ()
+{
+  CaptureRecord record;
+  bool have = false;          // record is the chunk being sent
+  size_t sent = 0;
+  // A chunk is due base_ns plus its distance from base_ts, scaled
+  uint64_t base_ns = 0;
+  uint64_t base_ts = 0;
+  uint64_t last_ts = 0;
+  bool started = false;
+  uint64_t due_ns = 0;
+  while (!__atomic_load_n (&stop_, __ATOMIC_ACQUIRE)) {
+    if (!have) {
+      try {
+        if (!reader_.next (record)) {
+          waitConsumed ();
+          break;
+        }
+      } catch (IOException &) {
+        break;
+      }
+      if (record.type != capture_rx || record.data.empty ()) {
+        continue;
+      }
+      if (!started || record.timestamp_ns < last_ts) {
+        // The first chunk, or the first of a session recorded after a
+        // reboot, goes out at once
+        base_ns = monotonic_ns ();
+        base_ts = record.timestamp_ns;
+        started = true;
+      }
+      last_ts = record.timestamp_ns;
+      due_ns = base_ns;
+      if (speed_ > 0) {
+        due_ns += static_cast<uint64_t> (
+            static_cast<double> (record.timestamp_ns - base_ts) / speed_);
+      }
+      have = true;
+      sent = 0;
+    }
+
+    uint64_t now_ns = monotonic_ns ();
+    bool due = now_ns >= due_ns;
+    if (!due && due_ns - now_ns < 1000000) {
+      // The poller counts milliseconds, sleep off the rest
+      sleep_ns (due_ns - now_ns);
+      continue;
+    }
+    int timeout_ms = due ? -1 : static_cast<int> ((due_ns - now_ns) / 1000000);
+    try {
+      poller_->modify (master_fd_, due ? poll_readable | poll_writable
+                                       : poll_readable);
+      uint32_t events = poller_->waitFor (master_fd_, timeout_ms);
+      if ((events & poll_readable) != 0 && !drain ()) {
+        break;
+      }
+      if (due && (events & poll_writable) != 0) {
+        ssize_t written = ::write (master_fd_, &record.data[sent],
+                                   record.data.size () - sent);
+        if (written > 0) {
+          sent += static_cast<size_t> (written);
+          have = sent < record.data.size ();
+        }
+      }
+    } catch (IOException &) {
+      break;
+    }
+  }
+  if (!__atomic_load_n (&stop_, __ATOMIC_ACQUIRE)) {
+    // End of the capture: hang up on the port.  close () still joins.
+    poller_->remove (master_fd_);
+    ::close (master_fd_);
+    master_fd_ = -1;
+  }
+}
+
+bool
+ReplayBackend::drain ()
+{
+  uint8_t discard[4096];
+  while (true) {
+    ssize_t result = ::read (master_fd_, discard, sizeof (discard));
+    if (result > 0) {
+      continue;
+    }
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    return result < 0 && errno == EAGAIN;
+  }
+}
+
+void
+ReplayBackend::waitConsumed ()
+{
+  while (!__atomic_load_n (&stop_, __ATOMIC_ACQUIRE)) {
+    // Unlike FIONREAD, polling the slave first moves data still on its way
+    // from the master into the line discipline.  Whatever is left there
+    // when the master closes is flushed by the hangup.
+    pollfd slave;
+    slave.fd = slave_fd_;
+    slave.events = POLLIN;
+    slave.revents = 0;
+    if (::poll (&slave, 1, 0) != 1 || (slave.revents & POLLIN) == 0) {
+      return;
+    }
+    try {
+      poller_->modify (master_fd_, poll_readable);
+      if ((poller_->waitFor (master_fd_, 10) & poll_readable) != 0
+          && !drain ()) {
+        return;
+      }
+    } catch (IOException &) {
+      return;
+    }
+  }
+}
+
+#endif // !defined(_WIN32)
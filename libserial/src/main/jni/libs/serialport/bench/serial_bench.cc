@@ -0,0 +1,1092 @@
+/*!
+ * \file serial_bench.cc
+ *
+ * \section DESCRIPTION
+ *
+ * Throughput and latency benchmark for the serialport library.
+ *
+ * The library opens the slave end of an openpty() pair as if it were a real
+ * serial device while a peer thread drives the master end.  Every result is
+ * printed as one JSON object per line on stdout; progress and errors go to
+ * stderr.  Run with --help for the options.
+ *
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "serial/serial.h"
+#include "serial/spsc_ring.h"
+#include "syscall_counter.h"
+
+using std::string;
+using std::vector;
+
+using serial::Serial;
+using serial::SpscByteRing;
+using serial::Timeout;
+
+namespace {
+
+struct Options {
+  vector<string> benches;
+  vector<size_t> payloads;
+  size_t bytes;
+  size_t iterations;
+  size_t warmup;
+  size_t lines_per_call;
+  string eol;
+  Timeout timeout;
+  unsigned long baudrate;
+  bool continuous;
+  size_t ring_size;
+
+  Options ()
+    : bytes (4 << 20), iterations (2000), warmup (100), lines_per_call (64),
+      eol ("\n"), timeout (Timeout::simpleTimeout (1000)),
+      baudrate (4000000), continuous (false), ring_size (65536)
+  {}
+};
+
+void
+usage (const char *name)
+{
+  fprintf (stderr,
+    "usage: %s [options]\n"
+    "\n"
+    "  --bench=LIST       read,readline,readlines,write,rtt,handoff\n"
+    "                     (default: all)\n"
+    "  --payload=LIST     bytes per call; line length for readline(s)\n"
+    "                     (default: 1,16,64,256,1024,4096)\n"
+    "  --bytes=N          bytes moved per throughput run (default: 4194304)\n"
+    "  --iterations=N     round trips per latency run (default: 2000)\n"
+    "  --warmup=N         untimed round trips before each run (default: 100)\n"
+    "  --lines-per-call=N lines requested per readlines call (default: 64)\n"
+    "  --eol=STR          line terminator, \\r \\n \\t \\0 \\xHH escapes (default: \\n)\n"
+    "  --timeout=I,RC,RM,WC,WM\n"
+    "                     inter byte, read constant, read multiplier, write\n"
+    "                     constant and write multiplier in ms; I may be\n"
+    "                     'max' (default: max,1000,0,1000,0)\n"
+    "  --baudrate=N       baudrate, drives read coalescing (default: 4000000)\n"
+    "  --continuous[=N]   use continuous receive with an N byte ring\n"
+    "                     (default ring: 65536)\n"
+    "  --ring=N           ring size for handoff, and for --continuous if it\n"
+    "                     gives none (default: 65536)\n",
+    name);
+}
+
+vector<string>
+split (const string &s, char separator)
+{
+  vector<string> parts;
+  size_t start = 0;
+  while (true) {
+    size_t end = s.find (separator, start);
+    parts.push_back (s.substr (start, end - start));
+    if (end == string::npos)
+      break;
+    start = end + 1;
+  }
+  return parts;
+}
+
+bool
+parse_size (const string &s, size_t *value)
+{
+  char *end = NULL;
+  errno = 0;
+  unsigned long long v = strtoull (s.c_str (), &end, 0);
+  if (s.empty () || *end != '\0' || errno != 0)
+    return false;
+  *value = static_cast<size_t> (v);
+  return true;
+}
+
+bool
+parse_u32 (const string &s, uint32_t *value)
+{
+  if (s == "max") {
+    *value = Timeout::max ();
+    return true;
+  }
+  size_t v;
+  if (!parse_size (s, &v) || v > 0xffffffffULL)
+    return false;
+  *value = static_cast<uint32_t> (v);
+  return true;
+}
+
+bool
+parse_eol (const string &s, string *eol)
+{
+  eol->clear ();
+  for (size_t i = 0; i < s.length (); ++i) {
+    if (s[i] != '\\' || i + 1 == s.length ()) {
+      eol->push_back (s[i]);
+      continue;
+    }
+    char c = s[++i];
+    switch (c) {
+      case 'r': eol->push_back ('\r'); break;
+      case 'n': eol->push_back ('\n'); break;
+      case 't': eol->push_back ('\t'); break;
+      case '0': eol->push_back ('\0'); break;
+      case '\\': eol->push_back ('\\'); break;
+      case 'x': {
+        if (i + 2 >= s.length ())
+          return false;
+        string hex = s.substr (i + 1, 2);
+        char *end = NULL;
+        long v = strtol (hex.c_str (), &end, 16);
+        if (hex.length () != 2 || *end != '\0')
+          return false;
+        eol->push_back (static_cast<char> (v));
+        i += 2;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return !eol->empty ();
+}
+
+bool
+parse_options (int argc, char **argv, Options *opts)
+{
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    string key = arg;
+    string value;
+    bool has_value = false;
+    size_t eq = arg.find ('=');
+    if (eq != string::npos) {
+      key = arg.substr (0, eq);
+      value = arg.substr (eq + 1);
+      has_value = true;
+    }
+    if (key == "--help" || key == "-h") {
+      return false;
+    } else if (key == "--bench" && has_value) {
+      opts->benches = split (value, ',');
+    } else if (key == "--payload" && has_value) {
+      vector<string> parts = split (value, ',');
+      opts->payloads.clear ();
+      for (size_t j = 0; j < parts.size (); ++j) {
+        size_t v;
+        if (!parse_size (parts[j], &v) || v == 0) {
+          fprintf (stderr, "invalid payload size '%s'\n", parts[j].c_str ());
+          return false;
+        }
+        opts->payloads.push_back (v);
+      }
+    } else if (key == "--bytes" && has_value) {
+      if (!parse_size (value, &opts->bytes) || opts->bytes == 0)
+        return false;
+    } else if (key == "--iterations" && has_value) {
+      if (!parse_size (value, &opts->iterations) || opts->iterations == 0)
+        return false;
+    } else if (key == "--warmup" && has_value) {
+      if (!parse_size (value, &opts->warmup))
+        return false;
+    } else if (key == "--lines-per-call" && has_value) {
+      if (!parse_size (value, &opts->lines_per_call)
+          || opts->lines_per_call == 0)
+        return false;
+    } else if (key == "--eol" && has_value) {
+      if (!parse_eol (value, &opts->eol)) {
+        fprintf (stderr, "invalid eol '%s'\n", value.c_str ());
+        return false;
+      }
+    } else if (key == "--timeout" && has_value) {
+      vector<string> parts = split (value, ',');
+      uint32_t t[5];
+      if (parts.size () != 5)
+        return false;
+      for (size_t j = 0; j < 5; ++j) {
+        if (!parse_u32 (parts[j], &t[j]))
+          return false;
+      }
+      opts->timeout = Timeout (t[0], t[1], t[2], t[3], t[4]);
+    } else if (key == "--baudrate" && has_value) {
+      size_t v;
+      if (!parse_size (value, &v) || v == 0)
+        return false;
+      opts->baudrate = v;
+    } else if (key == "--ring" && has_value) {
+      if (!parse_size (value, &opts->ring_size) || opts->ring_size == 0)
+        return false;
+    } else if (key == "--continuous") {
+      opts->continuous = true;
+      if (has_value && (!parse_size (value, &opts->ring_size)
+                        || opts->ring_size == 0))
+        return false;
+    } else {
+      fprintf (stderr, "unknown option '%s'\n", arg.c_str ());
+      return false;
+    }
+  }
+  if (opts->benches.empty ()) {
+    const char *all[] = { "read", "readline", "readlines", "write", "rtt",
+                          "handoff" };
+    opts->benches.assign (all, all + 6);
+  }
+  if (opts->payloads.empty ()) {
+    const size_t sizes[] = { 1, 16, 64, 256, 1024, 4096 };
+    opts->payloads.assign (sizes, sizes + 6);
+  }
+  return true;
+}
+
+double
+now_seconds ()
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+string
+json_escape (const string &s)
+{
+  string out;
+  for (size_t i = 0; i < s.length (); ++i) {
+    unsigned char c = static_cast<unsigned char> (s[i]);
+    if (c == '"' || c == '\\') {
+      out.push_back ('\\');
+      out.push_back (c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      char buf[8];
+      snprintf (buf, sizeof (buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out.push_back (c);
+    }
+  }
+  return out;
+}
+
+/*! The pty pair and the thread that plays the device on the master end. */
+class Peer {
+public:
+  enum mode_t { feed, drain, echo };
+
+  Peer ()
+    : master_ (-1), slave_ (-1), mode_ (feed), total_ (0), stop_ (false),
+      error_ (0), running_ (false)
+  {
+    char name[256];
+    if (-1 == openpty (&master_, &slave_, name, NULL, NULL)) {
+      perror ("openpty");
+      exit (1);
+    }
+    name_ = name;
+  }
+
+  ~Peer ()
+  {
+    stop ();
+    ::close (slave_);
+    ::close (master_);
+  }
+
+  const string &
+  name () const
+  {
+    return name_;
+  }
+
+  /*! The slave end, for benchmarks that read it without a Serial. */
+  int
+  slave () const
+  {
+    return slave_;
+  }
+
+  /*! Writes pattern repeatedly until total bytes have been sent. */
+  void
+  startFeed (const vector<uint8_t> &pattern, size_t total)
+  {
+    pattern_ = pattern;
+    start (feed, total);
+  }
+
+  /*! Reads and discards total bytes. */
+  void
+  startDrain (size_t total)
+  {
+    start (drain, total);
+  }
+
+  /*! Writes back everything it reads until stopped. */
+  void
+  startEcho ()
+  {
+    start (echo, 0);
+  }
+
+  /*! Asks the thread to stop and joins it; false if it hit an error. */
+  bool
+  stop ()
+  {
+    if (running_)
+      __atomic_store_n (&stop_, true, __ATOMIC_RELEASE);
+    return join ();
+  }
+
+  /*! Waits for the thread to finish on its own; false if it hit an error. */
+  bool
+  join ()
+  {
+    if (!running_)
+      return true;
+    pthread_join (thread_, NULL);
+    running_ = false;
+    if (error_ != 0) {
+      fprintf (stderr, "peer: %s\n", strerror (error_));
+      return false;
+    }
+    return true;
+  }
+
+private:
+  void
+  start (mode_t mode, size_t total)
+  {
+    stop ();
+    mode_ = mode;
+    total_ = total;
+    stop_ = false;
+    error_ = 0;
+    if (0 != pthread_create (&thread_, NULL, &Peer::run, this)) {
+      perror ("pthread_create");
+      exit (1);
+    }
+    running_ = true;
+  }
+
+  // Waits for the master to become ready; false when asked to stop.
+  bool
+  waitFor (short events)
+  {
+    while (!__atomic_load_n (&stop_, __ATOMIC_ACQUIRE)) {
+      pollfd pfd;
+      pfd.fd = master_;
+      pfd.events = events;
+      pfd.revents = 0;
+      int r = poll (&pfd, 1, 50);
+      if (r > 0)
+        return true;
+      if (r < 0 && errno != EINTR) {
+        error_ = errno;
+        return false;
+      }
+    }
+    return false;
+  }
+
+  static void *
+  run (void *arg)
+  {
+    Peer *self = static_cast<Peer *> (arg);
+    switch (self->mode_) {
+      case feed: self->runFeed (); break;
+      case drain: self->runDrain (); break;
+      case echo: self->runEcho (); break;
+    }
+    return NULL;
+  }
+
+  void
+  runFeed ()
+  {
+    size_t sent = 0;
+    size_t offset = 0;
+    while (sent < total_) {
+      if (!waitFor (POLLOUT))
+        return;
+      size_t chunk = std::min (pattern_.size () - offset, total_ - sent);
+      ssize_t r = raw_write (master_, &pattern_[offset], chunk);
+      if (r < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        error_ = errno;
+        return;
+      }
+      sent += r;
+      offset = (offset + r) % pattern_.size ();
+    }
+  }
+
+  void
+  runDrain ()
+  {
+    uint8_t buf[65536];
+    size_t received = 0;
+    while (received < total_) {
+      if (!waitFor (POLLIN))
+        return;
+      ssize_t r = raw_read (master_, buf, sizeof (buf));
+      if (r < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        error_ = errno;
+        return;
+      }
+      received += r;
+    }
+  }
+
+  void
+  runEcho ()
+  {
+    uint8_t buf[65536];
+    while (waitFor (POLLIN)) {
+      ssize_t r = raw_read (master_, buf, sizeof (buf));
+      if (r < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        error_ = errno;
+        return;
+      }
+      ssize_t written = 0;
+      while (written < r) {
+        ssize_t w = raw_write (master_, buf + written, r - written);
+        if (w < 0) {
+          if (errno == EINTR || errno == EAGAIN)
+            continue;
+          error_ = errno;
+          return;
+        }
+        written += w;
+      }
+    }
+  }
+
+  int master_;
+  int slave_;
+  string name_;
+  mode_t mode_;
+  vector<uint8_t> pattern_;
+  size_t total_;
+  bool stop_;
+  int error_;
+  bool running_;
+  pthread_t thread_;
+};
+
+/*! Common fields of every result line. */
+string
+result_prefix (const Options &opts, const string &bench, size_t payload)
+{
+  const Timeout &t = opts.timeout;
+  char buf[512];
+  snprintf (buf, sizeof (buf),
+            "{\"bench\":\"%s\",\"payload\":%zu,\"baudrate\":%lu,"
+            "\"continuous\":%s,\"timeout\":[%u,%u,%u,%u,%u]",
+            bench.c_str (), payload, opts.baudrate,
+            opts.continuous ? "true" : "false",
+            t.inter_byte_timeout, t.read_timeout_constant,
+            t.read_timeout_multiplier, t.write_timeout_constant,
+            t.write_timeout_multiplier);
+  return buf;
+}
+
+string
+syscall_fields (const SyscallCounts &c, size_t bytes)
+{
+  char buf[512];
+  snprintf (buf, sizeof (buf),
+            ",\"syscalls\":{\"read\":%llu,\"write\":%llu,\"ioctl\":%llu,"
+            "\"epoll_wait\":%llu,\"nanosleep\":%llu,\"total\":%llu},"
+            "\"syscalls_per_byte\":%.6f",
+            (unsigned long long) c.read, (unsigned long long) c.write,
+            (unsigned long long) c.ioctl, (unsigned long long) c.epoll_wait,
+            (unsigned long long) c.nanosleep,
+            (unsigned long long) c.total (),
+            bytes ? (double) c.total () / bytes : 0.0);
+  return buf;
+}
+
+void
+print_throughput (const Options &opts, const string &bench, size_t payload,
+                  size_t bytes, size_t calls, size_t timeouts,
+                  double seconds, const SyscallCounts &counts)
+{
+  string line = result_prefix (opts, bench, payload);
+  if (bench == "readline" || bench == "readlines") {
+    line += ",\"eol\":\"" + json_escape (opts.eol) + "\"";
+  }
+  char buf[256];
+  snprintf (buf, sizeof (buf),
+            ",\"bytes\":%zu,\"calls\":%zu,\"timeouts\":%zu,\"seconds\":%.6f,"
+            "\"mb_per_s\":%.3f",
+            bytes, calls, timeouts, seconds,
+            seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+  line += buf;
+  line += syscall_fields (counts, bytes);
+  line += "}";
+  printf ("%s\n", line.c_str ());
+  fflush (stdout);
+}
+
+/*! payload bytes per line, the last eol.length () of them the eol. */
+vector<uint8_t>
+make_lines (size_t line_length, const string &eol)
+{
+  vector<uint8_t> line;
+  size_t body = line_length > eol.length () ? line_length - eol.length () : 0;
+  for (size_t i = 0; i < body; ++i) {
+    line.push_back (static_cast<uint8_t> ('a' + i % 26));
+  }
+  line.insert (line.end (), eol.begin (), eol.end ());
+  return line;
+}
+
+vector<uint8_t>
+make_pattern (size_t size)
+{
+  vector<uint8_t> pattern (std::max<size_t> (size, 4096));
+  for (size_t i = 0; i < pattern.size (); ++i) {
+    pattern[i] = static_cast<uint8_t> (i * 131 + 7);
+  }
+  return pattern;
+}
+
+void
+configure (Serial &port, const Options &opts)
+{
+  if (opts.continuous) {
+    port.setContinuousReceive (true, opts.ring_size);
+  }
+  port.flushInput ();
+}
+
+bool
+bench_read (Peer &peer, Serial &port, const Options &opts, size_t payload)
+{
+  vector<uint8_t> buf (payload);
+  size_t calls = 0, timeouts = 0, received = 0;
+  syscall_counts_reset ();
+  double start = now_seconds ();
+  peer.startFeed (make_pattern (payload), opts.bytes);
+  while (received < opts.bytes) {
+    size_t want = std::min (payload, opts.bytes - received);
+    size_t got = port.read (&buf[0], want);
+    ++calls;
+    if (got < want)
+      ++timeouts;
+    if (got == 0)
+      break;
+    received += got;
+  }
+  double seconds = now_seconds () - start;
+  SyscallCounts counts = syscall_counts ();
+  bool ok = peer.stop ();
+  print_throughput (opts, "read", payload, received, calls, timeouts,
+                    seconds, counts);
+  return ok && received == opts.bytes;
+}
+
+bool
+bench_readline (Peer &peer, Serial &port, const Options &opts,
+                size_t line_length, bool many)
+{
+  vector<uint8_t> line = make_lines (line_length, opts.eol);
+  size_t total = opts.bytes - opts.bytes % line.size ();
+  if (total == 0)
+    total = line.size ();
+  size_t calls = 0, timeouts = 0, received = 0;
+  syscall_counts_reset ();
+  double start = now_seconds ();
+  peer.startFeed (line, total);
+  while (received < total) {
+    size_t got = 0;
+    if (many) {
+      size_t want = std::min (line.size () * opts.lines_per_call,
+                              total - received);
+      vector<string> lines = port.readlines (want, opts.eol);
+      for (size_t i = 0; i < lines.size (); ++i) {
+        got += lines[i].length ();
+      }
+      if (got < want)
+        ++timeouts;
+    } else {
+      got = port.readline (std::max<size_t> (line.size (), 65536),
+                           opts.eol).length ();
+      if (got != line.size ())
+        ++timeouts;
+    }
+    ++calls;
+    if (got == 0)
+      break;
+    received += got;
+  }
+  double seconds = now_seconds () - start;
+  SyscallCounts counts = syscall_counts ();
+  bool ok = peer.stop ();
+  print_throughput (opts, many ? "readlines" : "readline", line.size (),
+                    received, calls, timeouts, seconds, counts);
+  return ok && received == total;
+}
+
+bool
+bench_write (Peer &peer, Serial &port, const Options &opts, size_t payload)
+{
+  vector<uint8_t> pattern = make_pattern (payload);
+  size_t calls = 0, timeouts = 0, sent = 0;
+  syscall_counts_reset ();
+  double start = now_seconds ();
+  peer.startDrain (opts.bytes);
+  while (sent < opts.bytes) {
+    size_t want = std::min (payload, opts.bytes - sent);
+    size_t put = port.write (&pattern[0], want);
+    ++calls;
+    if (put < want)
+      ++timeouts;
+    if (put == 0)
+      break;
+    sent += put;
+  }
+  SyscallCounts counts = syscall_counts ();
+  // Throughput counts until the peer has seen every byte
+  bool ok = sent == opts.bytes ? peer.join () : peer.stop ();
+  double seconds = now_seconds () - start;
+  print_throughput (opts, "write", payload, sent, calls, timeouts,
+                    seconds, counts);
+  return ok && sent == opts.bytes;
+}
+
+double
+percentile (const vector<double> &sorted, double p)
+{
+  if (sorted.empty ())
+    return 0;
+  size_t index = static_cast<size_t> (p / 100.0 * (sorted.size () - 1) + 0.5);
+  return sorted[std::min (index, sorted.size () - 1)];
+}
+
+bool
+bench_rtt (Peer &peer, Serial &port, const Options &opts, size_t payload)
+{
+  vector<uint8_t> out = make_pattern (payload);
+  vector<uint8_t> in (payload);
+  vector<double> samples;
+  samples.reserve (opts.iterations);
+  size_t failures = 0;
+  peer.startEcho ();
+  SyscallCounts counts;
+  for (size_t i = 0; i < opts.warmup + opts.iterations; ++i) {
+    if (i == opts.warmup)
+      syscall_counts_reset ();
+    double start = now_seconds ();
+    port.write (&out[0], payload);
+    size_t got = port.read (&in[0], payload);
+    double elapsed = now_seconds () - start;
+    if (got != payload || memcmp (&in[0], &out[0], payload) != 0) {
+      ++failures;
+      port.flushInput ();
+      continue;
+    }
+    if (i >= opts.warmup)
+      samples.push_back (elapsed * 1e6);
+  }
+  counts = syscall_counts ();
+  bool ok = peer.stop ();
+  std::sort (samples.begin (), samples.end ());
+  double sum = 0;
+  for (size_t i = 0; i < samples.size (); ++i) {
+    sum += samples[i];
+  }
+  string line = result_prefix (opts, "rtt", payload);
+  char buf[512];
+  snprintf (buf, sizeof (buf),
+            ",\"iterations\":%zu,\"failures\":%zu,\"mean_us\":%.3f,"
+            "\"min_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,"
+            "\"p999_us\":%.3f,\"max_us\":%.3f",
+            samples.size (), failures,
+            samples.empty () ? 0.0 : sum / samples.size (),
+            samples.empty () ? 0.0 : samples.front (),
+            percentile (samples, 50), percentile (samples, 90),
+            percentile (samples, 99), percentile (samples, 99.9),
+            samples.empty () ? 0.0 : samples.back ());
+  line += buf;
+  line += syscall_fields (counts, 2 * payload * samples.size ());
+  line += "}";
+  printf ("%s\n", line.c_str ());
+  fflush (stdout);
+  return ok && failures == 0;
+}
+
+/*!
+ * Byte ring behind one mutex with a condition variable per direction, the
+ * way the receive thread handed data over before SpscByteRing.  Baseline
+ * for the handoff benchmark.
+ */
+class MutexByteQueue {
+public:
+  explicit MutexByteQueue (size_t capacity)
+    : producer_waits (0), consumer_waits (0), storage_ (capacity),
+      head_ (0), count_ (0)
+  {
+    pthread_mutex_init (&mutex_, NULL);
+    pthread_cond_init (&data_cond_, NULL);
+    pthread_cond_init (&space_cond_, NULL);
+  }
+
+  ~MutexByteQueue ()
+  {
+    pthread_cond_destroy (&space_cond_);
+    pthread_cond_destroy (&data_cond_);
+    pthread_mutex_destroy (&mutex_);
+  }
+
+  static const char *
+  name ()
+  {
+    return "mutex";
+  }
+
+  /*! Blocks for free space, returns the contiguous free region. */
+  uint8_t *
+  writeSpan (size_t &length)
+  {
+    size_t capacity = storage_.size ();
+    pthread_mutex_lock (&mutex_);
+    while (count_ == capacity) {
+      ++producer_waits;
+      pthread_cond_wait (&space_cond_, &mutex_);
+    }
+    size_t tail = (head_ + count_) % capacity;
+    length = (tail >= head_ ? capacity : head_) - tail;
+    pthread_mutex_unlock (&mutex_);
+    return &storage_[tail];
+  }
+
+  void
+  commit (size_t length)
+  {
+    pthread_mutex_lock (&mutex_);
+    count_ += length;
+    pthread_cond_broadcast (&data_cond_);
+    pthread_mutex_unlock (&mutex_);
+  }
+
+  /*! Blocks for data, then moves up to size bytes into buf. */
+  size_t
+  take (uint8_t *buf, size_t size)
+  {
+    size_t capacity = storage_.size ();
+    size_t taken = 0;
+    pthread_mutex_lock (&mutex_);
+    while (count_ == 0) {
+      ++consumer_waits;
+      pthread_cond_wait (&data_cond_, &mutex_);
+    }
+    while (taken < size && count_ > 0) {
+      size_t chunk = std::min (size - taken,
+                               std::min (count_, capacity - head_));
+      memcpy (buf + taken, &storage_[head_], chunk);
+      head_ = (head_ + chunk) % capacity;
+      count_ -= chunk;
+      taken += chunk;
+    }
+    pthread_cond_broadcast (&space_cond_);
+    pthread_mutex_unlock (&mutex_);
+    return taken;
+  }
+
+  size_t producer_waits;
+  size_t consumer_waits;
+
+private:
+  vector<uint8_t> storage_;
+  size_t head_;
+  size_t count_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t data_cond_;
+  pthread_cond_t space_cond_;
+};
+
+/*!
+ * SpscByteRing with the same blocking interface, sleeping the way
+ * SerialImpl's receive thread and readers do: the mutex and condition
+ * variables are only touched by a side that found the ring full or empty,
+ * and by the other side when it sees someone asleep.
+ */
+class SpscByteQueue {
+public:
+  explicit SpscByteQueue (size_t capacity)
+    : producer_waits (0), consumer_waits (0), data_waiting_ (false),
+      space_waiting_ (false)
+  {
+    ring_.reset (capacity);
+    pthread_mutex_init (&mutex_, NULL);
+    pthread_cond_init (&data_cond_, NULL);
+    pthread_cond_init (&space_cond_, NULL);
+  }
+
+  ~SpscByteQueue ()
+  {
+    pthread_cond_destroy (&space_cond_);
+    pthread_cond_destroy (&data_cond_);
+    pthread_mutex_destroy (&mutex_);
+  }
+
+  static const char *
+  name ()
+  {
+    return "spsc";
+  }
+
+  uint8_t *
+  writeSpan (size_t &length)
+  {
+    uint8_t *span = ring_.writeSpan (length);
+    while (length == 0) {
+      pthread_mutex_lock (&mutex_);
+      __atomic_store_n (&space_waiting_, true, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+      while (ring_.size () >= ring_.capacity ()) {
+        ++producer_waits;
+        pthread_cond_wait (&space_cond_, &mutex_);
+      }
+      __atomic_store_n (&space_waiting_, false, __ATOMIC_RELAXED);
+      pthread_mutex_unlock (&mutex_);
+      span = ring_.writeSpan (length);
+    }
+    return span;
+  }
+
+  void
+  commit (size_t length)
+  {
+    ring_.commit (length);
+    wake (data_waiting_, data_cond_);
+  }
+
+  size_t
+  take (uint8_t *buf, size_t size)
+  {
+    size_t taken = ring_.take (buf, size);
+    while (taken == 0) {
+      pthread_mutex_lock (&mutex_);
+      __atomic_store_n (&data_waiting_, true, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+      while (ring_.size () == 0) {
+        ++consumer_waits;
+        pthread_cond_wait (&data_cond_, &mutex_);
+      }
+      __atomic_store_n (&data_waiting_, false, __ATOMIC_RELAXED);
+      pthread_mutex_unlock (&mutex_);
+      taken = ring_.take (buf, size);
+    }
+    wake (space_waiting_, space_cond_);
+    return taken;
+  }
+
+  size_t producer_waits;
+  size_t consumer_waits;
+
+private:
+  void
+  wake (bool &waiting, pthread_cond_t &cond)
+  {
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&waiting, __ATOMIC_RELAXED)) {
+      pthread_mutex_lock (&mutex_);
+      pthread_cond_broadcast (&cond);
+      pthread_mutex_unlock (&mutex_);
+    }
+  }
+
+  SpscByteRing ring_;
+  bool data_waiting_;
+  bool space_waiting_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t data_cond_;
+  pthread_cond_t space_cond_;
+};
+
+/*! The reading side of the handoff benchmark: drains the slave into a
+ *  queue with one read per free span. */
+template <typename Queue>
+struct HandoffProducer {
+  Queue *queue;
+  int fd;
+  size_t total;
+  int error;
+
+  static void *
+  run (void *arg)
+  {
+    HandoffProducer *self = static_cast<HandoffProducer *> (arg);
+    size_t received = 0;
+    while (received < self->total) {
+      size_t length = 0;
+      uint8_t *span = self->queue->writeSpan (length);
+      ssize_t r = ::read (self->fd, span,
+                          std::min (length, self->total - received));
+      if (r < 0) {
+        if (errno == EINTR)
+          continue;
+        self->error = errno;
+        return NULL;
+      }
+      self->queue->commit (static_cast<size_t> (r));
+      received += r;
+    }
+    return NULL;
+  }
+};
+
+/*! Moves opts.bytes from the pty through a reader thread and Queue to this
+ *  thread, payload bytes per take. */
+template <typename Queue>
+bool
+run_handoff (Peer &peer, const Options &opts, size_t payload)
+{
+  // Blocking raw reads of the slave, at least one byte each
+  termios tio;
+  tcgetattr (peer.slave (), &tio);
+  cfmakeraw (&tio);
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr (peer.slave (), TCSANOW, &tio);
+
+  Queue queue (opts.ring_size);
+  HandoffProducer<Queue> producer;
+  producer.queue = &queue;
+  producer.fd = peer.slave ();
+  producer.total = opts.bytes;
+  producer.error = 0;
+  vector<uint8_t> pattern = make_pattern (payload);
+  vector<uint8_t> buf (payload);
+  size_t calls = 0, received = 0, mismatches = 0;
+
+  syscall_counts_reset ();
+  double start = now_seconds ();
+  pthread_t thread;
+  if (0 != pthread_create (&thread, NULL, &HandoffProducer<Queue>::run,
+                           &producer)) {
+    perror ("pthread_create");
+    exit (1);
+  }
+  peer.startFeed (pattern, opts.bytes);
+  while (received < opts.bytes && producer.error == 0) {
+    size_t got = queue.take (&buf[0], std::min (payload,
+                                                opts.bytes - received));
+    for (size_t i = 0; i < got; ++i) {
+      if (buf[i] != pattern[(received + i) % pattern.size ()])
+        ++mismatches;
+    }
+    received += got;
+    ++calls;
+  }
+  double seconds = now_seconds () - start;
+  SyscallCounts counts = syscall_counts ();
+  pthread_join (thread, NULL);
+  bool ok = peer.stop ();
+
+  string line = result_prefix (opts, "handoff", payload);
+  char fields[512];
+  snprintf (fields, sizeof (fields),
+            ",\"queue\":\"%s\",\"ring\":%zu,\"bytes\":%zu,\"calls\":%zu,"
+            "\"seconds\":%.6f,\"mb_per_s\":%.3f,\"producer_waits\":%zu,"
+            "\"consumer_waits\":%zu,\"mismatches\":%zu",
+            Queue::name (), opts.ring_size, received, calls, seconds,
+            seconds > 0 ? received / seconds / 1e6 : 0.0,
+            queue.producer_waits, queue.consumer_waits, mismatches);
+  line += fields;
+  line += syscall_fields (counts, received);
+  line += "}";
+  printf ("%s\n", line.c_str ());
+  fflush (stdout);
+  return ok && producer.error == 0 && received == opts.bytes
+      && mismatches == 0;
+}
+
+bool
+bench_handoff (Peer &peer, const Options &opts, size_t payload)
+{
+  bool ok = run_handoff<MutexByteQueue> (peer, opts, payload);
+  Peer next;
+  return run_handoff<SpscByteQueue> (next, opts, payload) && ok;
+}
+
+} // namespace
+
+int
+main (int argc, char **argv)
+{
+  Options opts;
+  if (!parse_options (argc, argv, &opts)) {
+    usage (argv[0]);
+    return 2;
+  }
+
+  bool ok = true;
+  try {
+    for (size_t b = 0; b < opts.benches.size (); ++b) {
+      const string &bench = opts.benches[b];
+      if (bench != "read" && bench != "readline" && bench != "readlines"
+          && bench != "write" && bench != "rtt" && bench != "handoff") {
+        fprintf (stderr, "unknown benchmark '%s'\n", bench.c_str ());
+        return 2;
+      }
+      for (size_t p = 0; p < opts.payloads.size (); ++p) {
+        size_t payload = opts.payloads[p];
+        if ((bench == "readline" || bench == "readlines")
+            && payload <= opts.eol.length ()) {
+          // A line needs room for at least one byte besides the eol
+          continue;
+        }
+        fprintf (stderr, "%s payload=%zu\n", bench.c_str (), payload);
+        Peer peer;
+        if (bench == "handoff") {
+          // The queues read the pty themselves, no Serial involved
+          if (!bench_handoff (peer, opts, payload)) {
+            fprintf (stderr, "%s payload=%zu did not complete\n",
+                     bench.c_str (), payload);
+            ok = false;
+          }
+          continue;
+        }
+        Serial port (peer.name (), opts.baudrate, opts.timeout);
+        configure (port, opts);
+        bool passed;
+        if (bench == "read")
+          passed = bench_read (peer, port, opts, payload);
+        else if (bench == "readline")
+          passed = bench_readline (peer, port, opts, payload, false);
+        else if (bench == "readlines")
+          passed = bench_readline (peer, port, opts, payload, true);
+        else if (bench == "write")
+          passed = bench_write (peer, port, opts, payload);
+        else
+          passed = bench_rtt (peer, port, opts, payload);
+        if (!passed) {
+          fprintf (stderr, "%s payload=%zu did not complete\n",
+                   bench.c_str (), payload);
+          ok = false;
+        }
+      }
+    }
+  } catch (std::exception &e) {
+    fprintf (stderr, "error: %s\n", e.what ());
+    return 1;
+  }
+  return ok ? 0 : 1;
+}
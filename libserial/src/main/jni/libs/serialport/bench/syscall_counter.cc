@@ -0,0 +1,110 @@
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include "syscall_counter.h"
+
+extern "C" {
+ssize_t __real_read (int fd, void *buf, size_t count);
+ssize_t __real_write (int fd, const void *buf, size_t count);
+int __real_ioctl (int fd, unsigned long request, ...);
+int __real_epoll_wait (int epfd, struct epoll_event *events, int maxevents,
+                       int timeout);
+int __real_nanosleep (const struct timespec *req, struct timespec *rem);
+}
+
+// Bumped from the caller's thread and the receive thread alike
+static uint64_t g_read;
+static uint64_t g_write;
+static uint64_t g_ioctl;
+static uint64_t g_epoll_wait;
+static uint64_t g_nanosleep;
+
+static inline void
+count (uint64_t *counter)
+{
+  __atomic_fetch_add (counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t
+load (uint64_t *counter)
+{
+  return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+extern "C" ssize_t
+__wrap_read (int fd, void *buf, size_t count_)
+{
+  count (&g_read);
+  return __real_read (fd, buf, count_);
+}
+
+extern "C" ssize_t
+__wrap_write (int fd, const void *buf, size_t count_)
+{
+  count (&g_write);
+  return __real_write (fd, buf, count_);
+}
+
+extern "C" int
+__wrap_ioctl (int fd, unsigned long request, ...)
+{
+  // Every ioctl the library makes takes a single pointer argument
+  va_list args;
+  va_start (args, request);
+  void *arg = va_arg (args, void *);
+  va_end (args);
+  count (&g_ioctl);
+  return __real_ioctl (fd, request, arg);
+}
+
+extern "C" int
+__wrap_epoll_wait (int epfd, struct epoll_event *events, int maxevents,
+                   int timeout)
+{
+  count (&g_epoll_wait);
+  return __real_epoll_wait (epfd, events, maxevents, timeout);
+}
+
+extern "C" int
+__wrap_nanosleep (const struct timespec *req, struct timespec *rem)
+{
+  count (&g_nanosleep);
+  return __real_nanosleep (req, rem);
+}
+
+void
+syscall_counts_reset ()
+{
+  __atomic_store_n (&g_read, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&g_write, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&g_ioctl, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&g_epoll_wait, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&g_nanosleep, 0, __ATOMIC_RELAXED);
+}
+
+SyscallCounts
+syscall_counts ()
+{
+  SyscallCounts counts;
+  counts.read = load (&g_read);
+  counts.write = load (&g_write);
+  counts.ioctl = load (&g_ioctl);
+  counts.epoll_wait = load (&g_epoll_wait);
+  counts.nanosleep = load (&g_nanosleep);
+  return counts;
+}
+
+ssize_t
+raw_read (int fd, void *buf, size_t count_)
+{
+  return __real_read (fd, buf, count_);
+}
+
+ssize_t
+raw_write (int fd, const void *buf, size_t count_)
+{
+  return __real_write (fd, buf, count_);
+}
@@ -0,0 +1,51 @@
+/*!
+ * \file syscall_counter.h
+ *
+ * \section DESCRIPTION
+ *
+ * Counts the system calls made through the serialport library.  The
+ * benchmark is linked with -Wl,--wrap for each call listed here, so every
+ * call site in the static library goes through a counting wrapper.
+ *
+ * The peer side of the benchmark uses raw_read and raw_write so that only
+ * the library's own calls show up in the counts.
+ *
+ */
+
+#ifndef SERIAL_BENCH_SYSCALL_COUNTER_H
+#define SERIAL_BENCH_SYSCALL_COUNTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct SyscallCounts {
+  uint64_t read;
+  uint64_t write;
+  uint64_t ioctl;
+  uint64_t epoll_wait;
+  uint64_t nanosleep;
+
+  uint64_t
+  total () const
+  {
+    return read + write + ioctl + epoll_wait + nanosleep;
+  }
+};
+
+/*! Zeroes all counters. */
+void
+syscall_counts_reset ();
+
+/*! Returns the counts since the last reset. */
+SyscallCounts
+syscall_counts ();
+
+/*! Uncounted read, for the benchmark's side of the pty. */
+ssize_t
+raw_read (int fd, void *buf, size_t count);
+
+/*! Uncounted write, for the benchmark's side of the pty. */
+ssize_t
+raw_write (int fd, const void *buf, size_t count);
+
+#endif // SERIAL_BENCH_SYSCALL_COUNTER_H
@@ -0,0 +1,398 @@
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serial/capture.h"
+#include "serial/serial.h"
+
+using std::string;
+using std::vector;
+
+using serial::CaptureConfig;
+using serial::CaptureReader;
+using serial::CaptureRecorder;
+using serial::SerialException;
+using serial::IOException;
+using serial::kCaptureHeaderSize;
+
+namespace {
+
+const uint8_t kMagic[8] = { 'S', 'E', 'R', 'C', 'A', 'P', 0, 0 };
+const uint16_t kVersion = 1;
+
+// Buffered bytes that wake the writer before its period is up
+const size_t kBatchBytes = 64 * 1024;
+// Longest a record waits in memory
+const uint32_t kWritePeriodMs = 100;
+// Buffered bytes past which records are dropped
+const size_t kMaxBuffered = 4 * 1024 * 1024;
+
+uint64_t
+monotonic_ns ()
+{
+  timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t> (now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+void
+put_le (uint8_t *out, uint64_t value, size_t size)
+{
+  for (size_t i = 0; i < size; ++i) {
+    out[i] = static_cast<uint8_t> (value >> (8 * i));
+  }
+}
+
+uint64_t
+get_le (const uint8_t *in, size_t size)
+{
+  uint64_t value = 0;
+  for (size_t i = size; i > 0; --i) {
+    value = value << 8 | in[i - 1];
+  }
+  return value;
+}
+
+// Whether header starts a capture file this version can read
+bool
+valid_header (const uint8_t *header)
+{
+  return memcmp (header, kMagic, sizeof (kMagic)) == 0
+         && get_le (header + 8, 2) == kVersion
+         && get_le (header + 10, 2) >= kCaptureHeaderSize;
+}
+
+} // namespace
+
+CaptureReader::CaptureReader ()
+  : file_ (NULL), record_header_size_ (kCaptureHeaderSize)
+{
+}
+
+CaptureReader::~CaptureReader ()
+{
+  close ();
+}
+
+void
+CaptureReader::open (const string &path)
+{
+  close ();
+  file_ = fopen (path.c_str (), "rbe");
+  if (file_ == NULL) {
+    THROW (IOException, errno);
+  }
+  setvbuf (file_, NULL, _IOFBF, 64 * 1024);
+  uint8_t header[kCaptureHeaderSize];
+  if (fread (header, 1, sizeof (header), file_) != sizeof (header)
+      || !valid_header (header)) {
+    close ();
+    THROW (IOException, "Not a capture file of this version.");
+  }
+  record_header_size_ = static_cast<size_t> (get_le (header + 10, 2));
+}
+
+void
+CaptureReader::close ()
+{
+  if (file_ != NULL) {
+    fclose (file_);
+    file_ = NULL;
+  }
+}
+
+bool
+CaptureReader::next (CaptureRecord &record)
+{
+  if (file_ == NULL) {
+    return false;
+  }
+  uint8_t header[kCaptureHeaderSize];
+  size_t got = fread (header, 1, sizeof (header), file_);
+  // Later versions may have longer record headers
+  if (got == sizeof (header) && record_header_size_ > sizeof (header)
+      && fseek (file_, static_cast<long> (record_header_size_ - sizeof (header)),
+                SEEK_CUR) != 0) {
+    got = 0;
+  }
+  if (got == sizeof (header)) {
+    record.timestamp_ns = get_le (header, 8);
+    record.type = static_cast<capture_record_t> (header[12]);
+    record.data.resize (static_cast<size_t> (get_le (header + 8, 4)));
+    if (record.data.empty ()
+        || fread (&record.data[0], 1, record.data.size (), file_)
+           == record.data.size ()) {
+      return true;
+    }
+  }
+  if (ferror (file_)) {
+    THROW (IOException, errno != 0 ? errno : EIO);
+  }
+  // The end, or a record the recorder did not get to finish
+  return false;
+}
+
+CaptureRecorder::CaptureRecorder ()
+  : fd_ (-1), recording_ (false), stop_ (false), error_ (0), dropped_ (0),
+    gap_ (0)
+{
+  pthread_mutex_init (&mutex_, NULL);
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init (&cond_attr);
+  pthread_condattr_setclock (&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&cond_, &cond_attr);
+  pthread_condattr_destroy (&cond_attr);
+}
+
+CaptureRecorder::~CaptureRecorder ()
+{
+  try {
+    stop ();
+  } catch (...) {
+  }
+  pthread_cond_destroy (&cond_);
+  pthread_mutex_destroy (&mutex_);
+}
+
+void
+CaptureRecorder::start (const string &path)
+{
+  pthread_mutex_lock (&mutex_);
+  bool busy = fd_ != -1;
+  pthread_mutex_unlock (&mutex_);
+  if (busy) {
+    throw SerialException ("Capture already running.");
+  }
+
+  int fd = ::open (path.c_str (), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                   0644);
+  if (fd == -1) {
+    THROW (IOException, errno);
+  }
+  struct stat info;
+  if (fstat (fd, &info) == -1) {
+    int error = errno;
+    ::close (fd);
+    THROW (IOException, error);
+  }
+  if (info.st_size == 0) {
+    uint8_t header[kCaptureHeaderSize];
+    memset (header, 0, sizeof (header));
+    memcpy (header, kMagic, sizeof (kMagic));
+    put_le (header + 8, kVersion, 2);
+    put_le (header + 10, kCaptureHeaderSize, 2);
+    if (::write (fd, header, sizeof (header))
+        != static_cast<ssize_t> (sizeof (header))) {
+      int error = errno;
+      ::close (fd);
+      THROW (IOException, error);
+    }
+  } else {
+    // Only ever append to a capture of the same format
+    uint8_t header[kCaptureHeaderSize];
+    if (pread (fd, header, sizeof (header), 0)
+        != static_cast<ssize_t> (sizeof (header))
+        || !valid_header (header)
+        || get_le (header + 10, 2) != kCaptureHeaderSize) {
+      ::close (fd);
+      THROW (IOException, "Not a capture file of this version.");
+    }
+  }
+
+  pthread_mutex_lock (&mutex_);
+  if (fd_ != -1) {
+    // Lost a race with another start
+    pthread_mutex_unlock (&mutex_);
+    ::close (fd);
+    throw SerialException ("Capture already running.");
+  }
+  fd_ = fd;
+  stop_ = false;
+  error_ = 0;
+  dropped_ = 0;
+  gap_ = 0;
+  buffer_.clear ();
+  int result = pthread_create (&thread_, NULL, &writerThread, this);
+  if (result) {
+    fd_ = -1;
+    pthread_mutex_unlock (&mutex_);
+    ::close (fd);
+    THROW (IOException, result);
+  }
+  __atomic_store_n (&recording_, true, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&mutex_);
+}
+
+void
+CaptureRecorder::stop ()
+{
+  pthread_mutex_lock (&mutex_);
+  if (fd_ == -1) {
+    pthread_mutex_unlock (&mutex_);
+    return;
+  }
+  __atomic_store_n (&recording_, false, __ATOMIC_RELAXED);
+  stop_ = true;
+  pthread_cond_signal (&cond_);
+  pthread_mutex_unlock (&mutex_);
+  // The writer empties the buffer before it exits
+  pthread_join (thread_, NULL);
+
+  pthread_mutex_lock (&mutex_);
+  int error = error_;
+  int fd = fd_;
+  fd_ = -1;
+  buffer_.clear ();
+  pthread_mutex_unlock (&mutex_);
+  if (::close (fd) == -1 && error == 0) {
+    error = errno;
+  }
+  if (error != 0) {
+    THROW (IOException, error);
+  }
+}
+
+void
+CaptureRecorder::record (capture_record_t type, const uint8_t *data,
+                         size_t length)
+{
+  if (!isRecording ()) {
+    return;
+  }
+  uint64_t timestamp_ns = monotonic_ns ();
+  pthread_mutex_lock (&mutex_);
+  if (recording_) {
+    append (timestamp_ns, type, data, length);
+  }
+  pthread_mutex_unlock (&mutex_);
+}
+
+void
+CaptureRecorder::recordConfig (const CaptureConfig &config)
+{
+  uint8_t payload[kCaptureConfigSize];
+  put_le (payload, config.baudrate, 4);
+  payload[4] = config.bytesize;
+  payload[5] = config.parity;
+  payload[6] = config.stopbits;
+  payload[7] = config.flowcontrol;
+  record (capture_config, payload, sizeof (payload));
+}
+
+uint64_t
+CaptureRecorder::getDropped () const
+{
+  pthread_mutex_lock (&mutex_);
+  uint64_t dropped = dropped_;
+  pthread_mutex_unlock (&mutex_);
+  return dropped;
+}
+
+void
+CaptureRecorder::append (uint64_t timestamp_ns, capture_record_t type,
+                         const uint8_t *data, size_t length)
+{
+  size_t size = kCaptureHeaderSize + length;
+  if (gap_ > 0) {
+    size += kCaptureHeaderSize + 8;
+  }
+  if (buffer_.size () + size > kMaxBuffered) {
+    dropped_ += length;
+    gap_ += length;
+    return;
+  }
+  size_t old_size = buffer_.size ();
+  buffer_.resize (old_size + size);
+  uint8_t *out = &buffer_[old_size];
+  if (gap_ > 0) {
+    // Say how much is missing before the first record after it
+    memset (out, 0, kCaptureHeaderSize);
+    put_le (out, timestamp_ns, 8);
+    put_le (out + 8, 8, 4);
+    out[12] = capture_gap;
+    put_le (out + kCaptureHeaderSize, gap_, 8);
+    out += kCaptureHeaderSize + 8;
+    gap_ = 0;
+  }
+  memset (out, 0, kCaptureHeaderSize);
+  put_le (out, timestamp_ns, 8);
+  put_le (out + 8, length, 4);
+  out[12] = static_cast<uint8_t> (type);
+  if (length > 0) {
+    memcpy (out + kCaptureHeaderSize, data, length);
+  }
+  if (old_size < kBatchBytes && buffer_.size () >= kBatchBytes) {
+    pthread_cond_signal (&cond_);
+  }
+}
+
+void *
+CaptureRecorder::writerThread (void *arg)
+{
+  static_cast<CaptureRecorder *> (arg)->writerLoop ();
+  return NULL;
+}
+
+void
+CaptureRecorder::writerLoop ()
+{
+  // Swapped with buffer_, so records are added while the batch is written
+  vector<uint8_t> batch;
+  pthread_mutex_lock (&mutex_);
+  while (true) {
+    if (!stop_ && buffer_.size () < kBatchBytes) {
+      timespec deadline;
+      clock_gettime (CLOCK_MONOTONIC, &deadline);
+      deadline.tv_nsec += kWritePeriodMs * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait (&cond_, &mutex_, &deadline);
+    }
+    bool stop = stop_;
+    batch.swap (buffer_);
+    pthread_mutex_unlock (&mutex_);
+    bool written = batch.empty () || writeAll (batch);
+    batch.clear ();
+    pthread_mutex_lock (&mutex_);
+    if (!written) {
+      // Nothing after a failed write could be read back in order
+      __atomic_store_n (&recording_, false, __ATOMIC_RELAXED);
+      dropped_ += buffer_.size ();
+      buffer_.clear ();
+      break;
+    }
+    if (stop && buffer_.empty ()) {
+      break;
+    }
+  }
+  pthread_mutex_unlock (&mutex_);
+}
+
+bool
+CaptureRecorder::writeAll (const vector<uint8_t> &data)
+{
+  size_t written = 0;
+  while (written < data.size ()) {
+    ssize_t result = ::write (fd_, &data[written], data.size () - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      pthread_mutex_lock (&mutex_);
+      error_ = result < 0 ? errno : ENOSPC;
+      pthread_mutex_unlock (&mutex_);
+      return false;
+    }
+    written += static_cast<size_t> (result);
+  }
+  return true;
+}
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,570 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "serial/crc.h"
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRC32) \
+    || (defined(__clang__) && __clang_major__ >= 16) \
+    || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 10))
+# define SERIAL_CRC_ARM 1
+# include <arm_acle.h>
+# include <arm_neon.h>
+# include <sys/auxv.h>
+# ifndef HWCAP_PMULL
+#  define HWCAP_PMULL (1 << 4)
+# endif
+# ifndef HWCAP_CRC32
+#  define HWCAP_CRC32 (1 << 7)
+# endif
+# if defined(__clang__)
+#  define SERIAL_TARGET_CRC __attribute__ ((target ("crc")))
+#  define SERIAL_TARGET_PMULL __attribute__ ((target ("aes")))
+# else
+#  define SERIAL_TARGET_CRC __attribute__ ((target ("+crc")))
+#  define SERIAL_TARGET_PMULL __attribute__ ((target ("+crypto")))
+# endif
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define SERIAL_CRC_X86 1
+# include <immintrin.h>
+# define SERIAL_TARGET_SSE42 __attribute__ ((target ("sse4.2")))
+# define SERIAL_TARGET_CLMUL __attribute__ ((target ("pclmul,ssse3")))
+#endif
+
+using std::invalid_argument;
+using std::vector;
+
+using serial::Crc;
+using serial::CrcFramer;
+using serial::Framer;
+using serial::frame_status_t;
+
+namespace {
+
+enum {
+  engine_tables = 0,
+  // Carry-less multiply folding, PCLMULQDQ or PMULL
+  engine_clmul,
+  engine_pmull,
+  // Dedicated CRC instructions, for their polynomials only
+  engine_arm_crc32,
+  engine_arm_crc32c,
+  engine_sse42_crc32c
+};
+
+const uint32_t kCrc32Poly = 0x04C11DB7;
+const uint32_t kCrc32cPoly = 0x1EDC6F41;
+
+// Folding only pays off once a few blocks are in flight
+const size_t kFoldMin = 64;
+
+uint64_t
+reflect (uint64_t value, size_t bits)
+{
+  uint64_t result = 0;
+  for (size_t i = 0; i < bits; ++i) {
+    result = (result << 1) | (value & 1);
+    value >>= 1;
+  }
+  return result;
+}
+
+// x^n mod P for the unreflected width bit polynomial P
+uint32_t
+xpow_mod (size_t n, size_t width, uint32_t poly)
+{
+  uint64_t top = 1ULL << width;
+  uint64_t r = 1;
+  for (size_t i = 0; i < n; ++i) {
+    r <<= 1;
+    if (r & top) {
+      r ^= top | poly;
+    }
+  }
+  return static_cast<uint32_t> (r);
+}
+
+inline uint32_t
+load_le32 (const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t> (p[3]) << 24);
+}
+
+inline uint32_t
+load_be32 (const uint8_t *p)
+{
+  return (static_cast<uint32_t> (p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+#if defined(SERIAL_CRC_X86)
+
+SERIAL_TARGET_SSE42 uint32_t
+crc32c_sse42 (uint32_t crc, const uint8_t *data, size_t size)
+{
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t value;
+    memcpy (&value, data, 8);
+    crc64 = _mm_crc32_u64 (crc64, value);
+  }
+  crc = static_cast<uint32_t> (crc64);
+#endif
+  for (; size >= 4; data += 4, size -= 4) {
+    uint32_t value;
+    memcpy (&value, data, 4);
+    crc = _mm_crc32_u32 (crc, value);
+  }
+  for (; size > 0; ++data, --size) {
+    crc = _mm_crc32_u8 (crc, *data);
+  }
+  return crc;
+}
+
+SERIAL_TARGET_CLMUL inline __m128i
+fold_clmul (__m128i x, __m128i k)
+{
+  return _mm_xor_si128 (_mm_clmulepi64_si128 (x, k, 0x00),
+                        _mm_clmulepi64_si128 (x, k, 0x11));
+}
+
+SERIAL_TARGET_CLMUL inline __m128i
+load_clmul (const uint8_t *data, bool reflected, __m128i swap)
+{
+  __m128i x = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (data));
+  return reflected ? x : _mm_shuffle_epi8 (x, swap);
+}
+
+// Folds whole 16 byte blocks of data into one, stored to out.  size must
+// be at least kFoldMin, the number of bytes folded is returned.
+SERIAL_TARGET_CLMUL size_t
+fold_blocks_clmul (uint32_t crc, const uint8_t *data, size_t size,
+                   bool reflected, const uint64_t k128[2],
+                   const uint64_t k512[2], uint8_t out[16])
+{
+  const __m128i swap = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7,
+                                     8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i k4 = _mm_set_epi64x (k512[1], k512[0]);
+  const __m128i k1 = _mm_set_epi64x (k128[1], k128[0]);
+  const uint8_t *p = data;
+
+  // The register goes into the first bytes, as the tables would do it
+  __m128i first = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (p));
+  first = _mm_xor_si128 (first, _mm_cvtsi32_si128 (
+    static_cast<int> (reflected ? crc : __builtin_bswap32 (crc))));
+  __m128i x0 = reflected ? first : _mm_shuffle_epi8 (first, swap);
+  __m128i x1 = load_clmul (p + 16, reflected, swap);
+  __m128i x2 = load_clmul (p + 32, reflected, swap);
+  __m128i x3 = load_clmul (p + 48, reflected, swap);
+  p += 64;
+  size -= 64;
+  for (; size >= 64; p += 64, size -= 64) {
+    x0 = _mm_xor_si128 (fold_clmul (x0, k4), load_clmul (p, reflected, swap));
+    x1 = _mm_xor_si128 (fold_clmul (x1, k4), load_clmul (p + 16, reflected, swap));
+    x2 = _mm_xor_si128 (fold_clmul (x2, k4), load_clmul (p + 32, reflected, swap));
+    x3 = _mm_xor_si128 (fold_clmul (x3, k4), load_clmul (p + 48, reflected, swap));
+  }
+  __m128i x = _mm_xor_si128 (fold_clmul (x0, k1), x1);
+  x = _mm_xor_si128 (fold_clmul (x, k1), x2);
+  x = _mm_xor_si128 (fold_clmul (x, k1), x3);
+  for (; size >= 16; p += 16, size -= 16) {
+    x = _mm_xor_si128 (fold_clmul (x, k1), load_clmul (p, reflected, swap));
+  }
+  if (!reflected) {
+    x = _mm_shuffle_epi8 (x, swap);
+  }
+  _mm_storeu_si128 (reinterpret_cast<__m128i *> (out), x);
+  return p - data;
+}
+
+#endif // defined(SERIAL_CRC_X86)
+
+#if defined(SERIAL_CRC_ARM)
+
+SERIAL_TARGET_CRC uint32_t
+crc32_arm (uint32_t crc, const uint8_t *data, size_t size, bool castagnoli)
+{
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t value;
+    memcpy (&value, data, 8);
+    crc = castagnoli ? __crc32cd (crc, value) : __crc32d (crc, value);
+  }
+  for (; size > 0; ++data, --size) {
+    crc = castagnoli ? __crc32cb (crc, *data) : __crc32b (crc, *data);
+  }
+  return crc;
+}
+
+SERIAL_TARGET_PMULL inline uint64x2_t
+fold_pmull (uint64x2_t x, uint64x2_t k)
+{
+  poly128_t lo = vmull_p64 (static_cast<poly64_t> (vgetq_lane_u64 (x, 0)),
+                            static_cast<poly64_t> (vgetq_lane_u64 (k, 0)));
+  poly128_t hi = vmull_high_p64 (vreinterpretq_p64_u64 (x),
+                                 vreinterpretq_p64_u64 (k));
+  return veorq_u64 (vreinterpretq_u64_p128 (lo), vreinterpretq_u64_p128 (hi));
+}
+
+SERIAL_TARGET_PMULL inline uint64x2_t
+swap_pmull (uint64x2_t x)
+{
+  uint8x16_t bytes = vrev64q_u8 (vreinterpretq_u8_u64 (x));
+  return vreinterpretq_u64_u8 (vextq_u8 (bytes, bytes, 8));
+}
+
+SERIAL_TARGET_PMULL inline uint64x2_t
+load_pmull (const uint8_t *data, bool reflected)
+{
+  uint64x2_t x = vreinterpretq_u64_u8 (vld1q_u8 (data));
+  return reflected ? x : swap_pmull (x);
+}
+
+// Same as fold_blocks_clmul, with PMULL
+SERIAL_TARGET_PMULL size_t
+fold_blocks_pmull (uint32_t crc, const uint8_t *data, size_t size,
+                   bool reflected, const uint64_t k128[2],
+                   const uint64_t k512[2], uint8_t out[16])
+{
+  const uint64x2_t k4 = vld1q_u64 (k512);
+  const uint64x2_t k1 = vld1q_u64 (k128);
+  const uint8_t *p = data;
+
+  uint32x4_t init = vsetq_lane_u32 (reflected ? crc : __builtin_bswap32 (crc),
+                                    vdupq_n_u32 (0), 0);
+  uint64x2_t first = veorq_u64 (vreinterpretq_u64_u8 (vld1q_u8 (p)),
+                                vreinterpretq_u64_u32 (init));
+  uint64x2_t x0 = reflected ? first : swap_pmull (first);
+  uint64x2_t x1 = load_pmull (p + 16, reflected);
+  uint64x2_t x2 = load_pmull (p + 32, reflected);
+  uint64x2_t x3 = load_pmull (p + 48, reflected);
+  p += 64;
+  size -= 64;
+  for (; size >= 64; p += 64, size -= 64) {
+    x0 = veorq_u64 (fold_pmull (x0, k4), load_pmull (p, reflected));
+    x1 = veorq_u64 (fold_pmull (x1, k4), load_pmull (p + 16, reflected));
+    x2 = veorq_u64 (fold_pmull (x2, k4), load_pmull (p + 32, reflected));
+    x3 = veorq_u64 (fold_pmull (x3, k4), load_pmull (p + 48, reflected));
+  }
+  uint64x2_t x = veorq_u64 (fold_pmull (x0, k1), x1);
+  x = veorq_u64 (fold_pmull (x, k1), x2);
+  x = veorq_u64 (fold_pmull (x, k1), x3);
+  for (; size >= 16; p += 16, size -= 16) {
+    x = veorq_u64 (fold_pmull (x, k1), load_pmull (p, reflected));
+  }
+  if (!reflected) {
+    x = swap_pmull (x);
+  }
+  vst1q_u8 (out, vreinterpretq_u8_u64 (x));
+  return p - data;
+}
+
+#endif // defined(SERIAL_CRC_ARM)
+
+} // namespace
+
+Crc::Crc (size_t width, uint32_t poly, uint32_t init, bool reflected,
+          uint32_t xorout, bool accelerated)
+  : width_ (width), poly_ (poly), reflected_ (reflected), xorout_ (xorout),
+    engine_ (engine_tables)
+{
+  if (width < 1 || width > 32) {
+    throw invalid_argument ("CRC width must be 1 to 32 bits");
+  }
+  uint32_t mask = width == 32 ? 0xFFFFFFFFU : (1U << width) - 1;
+  poly_ &= mask;
+  init &= mask;
+  xorout_ &= mask;
+
+  // Reflected registers sit in the low bits, others are kept left aligned
+  // in 32 bits so both shift whole bytes out of the same end
+  if (reflected_) {
+    uint32_t rpoly = static_cast<uint32_t> (reflect (poly_, width));
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t r = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        r = (r & 1) ? (r >> 1) ^ rpoly : r >> 1;
+      }
+      table_[0][i] = r;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        uint32_t prev = table_[k - 1][i];
+        table_[k][i] = (prev >> 8) ^ table_[0][prev & 0xFF];
+      }
+    }
+    start_ = static_cast<uint32_t> (reflect (init, width));
+  } else {
+    uint32_t apoly = poly_ << (32 - width);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t r = i << 24;
+      for (int bit = 0; bit < 8; ++bit) {
+        r = (r & 0x80000000U) ? (r << 1) ^ apoly : r << 1;
+      }
+      table_[0][i] = r;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        uint32_t prev = table_[k - 1][i];
+        table_[k][i] = (prev << 8) ^ table_[0][prev >> 24];
+      }
+    }
+    start_ = init << (32 - width);
+  }
+
+  // Folding multipliers.  A 128 bit lane is split in two 64 bit halves that
+  // are moved D bits further down the message by multiplying them with
+  // x^D mod P, or x^(D + 64) for the half that comes first in the stream.
+  // Bit reflected lanes count powers downwards, so their constants are
+  // reversed and take one power less to make up for the product landing
+  // one bit lower.
+  size_t strides[2] = { 128, 512 };
+  uint64_t *folds[2] = { fold128_, fold512_ };
+  for (int s = 0; s < 2; ++s) {
+    size_t d = strides[s];
+    if (reflected_) {
+      folds[s][0] = reflect (xpow_mod (d + 64 - 1, width, poly_), 64);
+      folds[s][1] = reflect (xpow_mod (d - 1, width, poly_), 64);
+    } else {
+      folds[s][0] = xpow_mod (d, width, poly_);
+      folds[s][1] = xpow_mod (d + 64, width, poly_);
+    }
+  }
+
+  if (!accelerated) {
+    return;
+  }
+  bool crc32_family = width == 32 && reflected_;
+#if defined(SERIAL_CRC_ARM)
+  unsigned long hwcap = getauxval (AT_HWCAP);
+  if (crc32_family && poly_ == kCrc32Poly && (hwcap & HWCAP_CRC32)) {
+    engine_ = engine_arm_crc32;
+  } else if (crc32_family && poly_ == kCrc32cPoly && (hwcap & HWCAP_CRC32)) {
+    engine_ = engine_arm_crc32c;
+  } else if (hwcap & HWCAP_PMULL) {
+    engine_ = engine_pmull;
+  }
+#elif defined(SERIAL_CRC_X86)
+  __builtin_cpu_init ();
+  if (crc32_family && poly_ == kCrc32cPoly
+      && __builtin_cpu_supports ("sse4.2")) {
+    engine_ = engine_sse42_crc32c;
+  } else if (__builtin_cpu_supports ("pclmul")
+             && __builtin_cpu_supports ("ssse3")) {
+    engine_ = engine_clmul;
+  }
+#else
+  (void) crc32_family;
+#endif
+}
+
+const Crc &
+Crc::crc8 ()
+{
+  static const Crc crc (8, 0x07, 0x00, false, 0x00);
+  return crc;
+}
+
+const Crc &
+Crc::crc8Maxim ()
+{
+  static const Crc crc (8, 0x31, 0x00, true, 0x00);
+  return crc;
+}
+
+const Crc &
+Crc::crc16Modbus ()
+{
+  static const Crc crc (16, 0x8005, 0xFFFF, true, 0x0000);
+  return crc;
+}
+
+const Crc &
+Crc::crc16CcittFalse ()
+{
+  static const Crc crc (16, 0x1021, 0xFFFF, false, 0x0000);
+  return crc;
+}
+
+const Crc &
+Crc::crc16Kermit ()
+{
+  static const Crc crc (16, 0x1021, 0x0000, true, 0x0000);
+  return crc;
+}
+
+const Crc &
+Crc::crc16Xmodem ()
+{
+  static const Crc crc (16, 0x1021, 0x0000, false, 0x0000);
+  return crc;
+}
+
+const Crc &
+Crc::crc32 ()
+{
+  static const Crc crc (32, kCrc32Poly, 0xFFFFFFFF, true, 0xFFFFFFFF);
+  return crc;
+}
+
+const Crc &
+Crc::crc32c ()
+{
+  static const Crc crc (32, kCrc32cPoly, 0xFFFFFFFF, true, 0xFFFFFFFF);
+  return crc;
+}
+
+uint32_t
+Crc::update (uint32_t crc, const uint8_t *data, size_t size) const
+{
+  switch (engine_) {
+#if defined(SERIAL_CRC_ARM)
+  case engine_arm_crc32:
+    return crc32_arm (crc, data, size, false);
+  case engine_arm_crc32c:
+    return crc32_arm (crc, data, size, true);
+#endif
+#if defined(SERIAL_CRC_X86)
+  case engine_sse42_crc32c:
+    return crc32c_sse42 (crc, data, size);
+#endif
+  case engine_clmul:
+  case engine_pmull:
+    if (size >= kFoldMin) {
+      return updateFolding (crc, data, size);
+    }
+    break;
+  }
+  return updateTables (crc, data, size);
+}
+
+uint32_t
+Crc::updateTables (uint32_t crc, const uint8_t *data, size_t size) const
+{
+  const uint8_t *p = data;
+  if (reflected_) {
+    for (; size >= 8; p += 8, size -= 8) {
+      uint32_t lo = crc ^ load_le32 (p);
+      uint32_t hi = load_le32 (p + 4);
+      crc = table_[7][lo & 0xFF] ^ table_[6][(lo >> 8) & 0xFF]
+          ^ table_[5][(lo >> 16) & 0xFF] ^ table_[4][lo >> 24]
+          ^ table_[3][hi & 0xFF] ^ table_[2][(hi >> 8) & 0xFF]
+          ^ table_[1][(hi >> 16) & 0xFF] ^ table_[0][hi >> 24];
+    }
+    for (; size > 0; ++p, --size) {
+      crc = (crc >> 8) ^ table_[0][(crc ^ *p) & 0xFF];
+    }
+  } else {
+    for (; size >= 8; p += 8, size -= 8) {
+      uint32_t hi = crc ^ load_be32 (p);
+      uint32_t lo = load_be32 (p + 4);
+      crc = table_[7][hi >> 24] ^ table_[6][(hi >> 16) & 0xFF]
+          ^ table_[5][(hi >> 8) & 0xFF] ^ table_[4][hi & 0xFF]
+          ^ table_[3][lo >> 24] ^ table_[2][(lo >> 16) & 0xFF]
+          ^ table_[1][(lo >> 8) & 0xFF] ^ table_[0][lo & 0xFF];
+    }
+    for (; size > 0; ++p, --size) {
+      crc = (crc << 8) ^ table_[0][(crc >> 24) ^ *p];
+    }
+  }
+  return crc;
+}
+
+uint32_t
+Crc::updateFolding (uint32_t crc, const uint8_t *data, size_t size) const
+{
+  // The folded block carries the whole prefix, so its CRC from a zero
+  // register is the CRC of the prefix
+  uint8_t block[16];
+  size_t folded = 0;
+#if defined(SERIAL_CRC_X86)
+  folded = fold_blocks_clmul (crc, data, size, reflected_, fold128_,
+                              fold512_, block);
+#elif defined(SERIAL_CRC_ARM)
+  folded = fold_blocks_pmull (crc, data, size, reflected_, fold128_,
+                              fold512_, block);
+#else
+  return updateTables (crc, data, size);
+#endif
+  crc = updateTables (0, block, sizeof (block));
+  return updateTables (crc, data + folded, size - folded);
+}
+
+uint32_t
+Crc::finish (uint32_t crc) const
+{
+  if (!reflected_) {
+    crc >>= 32 - width_;
+  }
+  return crc ^ xorout_;
+}
+
+const char *
+Crc::implementation () const
+{
+  switch (engine_) {
+  case engine_clmul:
+    return "pclmulqdq";
+  case engine_pmull:
+    return "pmull";
+  case engine_arm_crc32:
+  case engine_arm_crc32c:
+    return "armv8-crc32";
+  case engine_sse42_crc32c:
+    return "sse4.2";
+  }
+  return "slicing-by-8";
+}
+
+CrcFramer::CrcFramer (Framer *framer, const Crc &crc,
+                      serial::byteorder_t byteorder)
+  : Framer (framer->maxFrameSize ()), framer_ (framer), crc_ (crc),
+    byteorder_ (byteorder)
+{
+}
+
+CrcFramer::~CrcFramer ()
+{
+  delete framer_;
+}
+
+frame_status_t
+CrcFramer::scan (const uint8_t *data, size_t size, size_t &consumed,
+                 vector<uint8_t> &frame) const
+{
+  frame_status_t status = framer_->scan (data, size, consumed, frame);
+  if (status != serial::frame_complete) {
+    return status;
+  }
+  size_t crc_bytes = crc_.bytes ();
+  if (frame.size () < crc_bytes) {
+    frame.clear ();
+    return serial::frame_invalid;
+  }
+  size_t body = frame.size () - crc_bytes;
+  uint32_t received = 0;
+  for (size_t i = 0; i < crc_bytes; ++i) {
+    size_t index = byteorder_ == serial::byteorder_big_endian
+                   ? i : crc_bytes - 1 - i;
+    received = (received << 8) | frame[body + index];
+  }
+  if (crc_.compute (frame.empty () ? NULL : &frame[0], body) != received) {
+    frame.clear ();
+    return serial::frame_invalid;
+  }
+  frame.resize (body);
+  return serial::frame_complete;
+}
+
+void
+CrcFramer::encode (const uint8_t *payload, size_t size,
+                   vector<uint8_t> &out) const
+{
+  vector<uint8_t> framed (payload, payload + size);
+  uint32_t crc = crc_.compute (payload, size);
+  size_t crc_bytes = crc_.bytes ();
+  for (size_t i = 0; i < crc_bytes; ++i) {
+    size_t shift = byteorder_ == serial::byteorder_big_endian
+                   ? crc_bytes - 1 - i : i;
+    framed.push_back (static_cast<uint8_t> (crc >> (8 * shift)));
+  }
+  framer_->encode (&framed[0], framed.size (), out);
+}
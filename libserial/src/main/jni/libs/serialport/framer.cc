@@ -0,0 +1,338 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "serial/framer.h"
+
+using std::invalid_argument;
+using std::string;
+using std::vector;
+
+using serial::Framer;
+using serial::FixedLengthFramer;
+using serial::LengthFieldFramer;
+using serial::DelimiterFramer;
+using serial::SlipFramer;
+using serial::CobsFramer;
+using serial::frame_status_t;
+using serial::frame_incomplete;
+using serial::frame_complete;
+using serial::frame_invalid;
+
+namespace {
+
+// SLIP special characters, RFC 1055
+const uint8_t kSlipEnd = 0xC0;
+const uint8_t kSlipEsc = 0xDB;
+const uint8_t kSlipEscEnd = 0xDC;
+const uint8_t kSlipEscEsc = 0xDD;
+
+// Returns the index of the first byte of data[0, size) that is not value
+size_t
+skip_all (const uint8_t *data, size_t size, uint8_t value)
+{
+  size_t i = 0;
+  while (i < size && data[i] == value) {
+    ++i;
+  }
+  return i;
+}
+
+// Returns the index of the first value in data[from, size), or size
+size_t
+find_byte (const uint8_t *data, size_t from, size_t size, uint8_t value)
+{
+  const void *hit = memchr (data + from, value, size - from);
+  return hit == NULL ? size
+                     : static_cast<const uint8_t *> (hit) - data;
+}
+
+} // namespace
+
+FixedLengthFramer::FixedLengthFramer (size_t length)
+  : Framer (length)
+{
+  if (length == 0) {
+    throw invalid_argument ("frame length must be > 0");
+  }
+}
+
+frame_status_t
+FixedLengthFramer::scan (const uint8_t *data, size_t size, size_t &consumed,
+                         vector<uint8_t> &frame) const
+{
+  consumed = 0;
+  frame.clear ();
+  if (size < max_frame_size_) {
+    return frame_incomplete;
+  }
+  frame.assign (data, data + max_frame_size_);
+  consumed = max_frame_size_;
+  return frame_complete;
+}
+
+void
+FixedLengthFramer::encode (const uint8_t *payload, size_t size,
+                           vector<uint8_t> &out) const
+{
+  if (size != max_frame_size_) {
+    throw invalid_argument ("payload size does not match the frame length");
+  }
+  out.insert (out.end (), payload, payload + size);
+}
+
+LengthFieldFramer::LengthFieldFramer (size_t offset, size_t field_size,
+                                      serial::byteorder_t byteorder,
+                                      long adjustment, size_t strip,
+                                      size_t max_frame_size)
+  : Framer (max_frame_size), offset_ (offset), field_size_ (field_size),
+    byteorder_ (byteorder), adjustment_ (adjustment), strip_ (strip)
+{
+  if (field_size < 1 || field_size > 4) {
+    throw invalid_argument ("length field must be 1 to 4 bytes");
+  }
+  if (offset + field_size > max_frame_size || strip > max_frame_size) {
+    throw invalid_argument ("header does not fit in max_frame_size");
+  }
+}
+
+frame_status_t
+LengthFieldFramer::scan (const uint8_t *data, size_t size, size_t &consumed,
+                         vector<uint8_t> &frame) const
+{
+  consumed = 0;
+  frame.clear ();
+  size_t header = offset_ + field_size_;
+  if (size < header) {
+    return frame_incomplete;
+  }
+  uint32_t value = 0;
+  const uint8_t *field = data + offset_;
+  for (size_t i = 0; i < field_size_; ++i) {
+    size_t index = byteorder_ == serial::byteorder_big_endian
+                   ? i : field_size_ - 1 - i;
+    value = (value << 8) | field[index];
+  }
+  long body = static_cast<long> (value) + adjustment_;
+  if (body < 0 || static_cast<unsigned long> (body) > max_frame_size_ - header
+      || header + static_cast<size_t> (body) < strip_) {
+    // Not a plausible header, resynchronize one byte further on
+    consumed = 1;
+    return frame_invalid;
+  }
+  size_t total = header + static_cast<size_t> (body);
+  if (size < total) {
+    return frame_incomplete;
+  }
+  frame.assign (data + strip_, data + total);
+  consumed = total;
+  return frame_complete;
+}
+
+void
+LengthFieldFramer::encode (const uint8_t *payload, size_t size,
+                           vector<uint8_t> &out) const
+{
+  long value = static_cast<long> (size) - adjustment_;
+  unsigned long limit = field_size_ == 4 ? 0xFFFFFFFFUL
+                                         : (1UL << (8 * field_size_)) - 1;
+  if (value < 0 || static_cast<unsigned long> (value) > limit
+      || offset_ + field_size_ + size > max_frame_size_) {
+    throw invalid_argument ("payload size cannot be encoded in the length field");
+  }
+  out.insert (out.end (), offset_, 0);
+  for (size_t i = 0; i < field_size_; ++i) {
+    size_t shift = byteorder_ == serial::byteorder_big_endian
+                   ? field_size_ - 1 - i : i;
+    out.push_back (static_cast<uint8_t> (value >> (8 * shift)));
+  }
+  out.insert (out.end (), payload, payload + size);
+}
+
+DelimiterFramer::DelimiterFramer (const string &delimiter,
+                                  bool include_delimiter,
+                                  size_t max_frame_size)
+  : Framer (max_frame_size), delimiter_ (delimiter),
+    include_delimiter_ (include_delimiter)
+{
+  if (delimiter.empty ()) {
+    throw invalid_argument ("delimiter must not be empty");
+  }
+  if (delimiter.length () > max_frame_size) {
+    throw invalid_argument ("delimiter does not fit in max_frame_size");
+  }
+}
+
+frame_status_t
+DelimiterFramer::scan (const uint8_t *data, size_t size, size_t &consumed,
+                       vector<uint8_t> &frame) const
+{
+  consumed = 0;
+  frame.clear ();
+  size_t delimiter_len = delimiter_.length ();
+  const uint8_t first = static_cast<uint8_t> (delimiter_[0]);
+  size_t from = 0;
+  while (size - from >= delimiter_len) {
+    size_t hit = find_byte (data, from, size - (delimiter_len - 1), first);
+    if (hit == size - (delimiter_len - 1)) {
+      break;
+    }
+    if (memcmp (data + hit + 1, delimiter_.data () + 1,
+                delimiter_len - 1) == 0) {
+      size_t end = hit + delimiter_len;
+      consumed = end;
+      if (end > max_frame_size_) {
+        return frame_invalid;
+      }
+      frame.assign (data, data + (include_delimiter_ ? end : hit));
+      return frame_complete;
+    }
+    from = hit + 1;
+  }
+  if (size >= max_frame_size_) {
+    // Too long already, keep only what may be the start of a delimiter
+    consumed = size - (delimiter_len - 1);
+    return frame_invalid;
+  }
+  return frame_incomplete;
+}
+
+void
+DelimiterFramer::encode (const uint8_t *payload, size_t size,
+                         vector<uint8_t> &out) const
+{
+  out.insert (out.end (), payload, payload + size);
+  out.insert (out.end (), delimiter_.begin (), delimiter_.end ());
+}
+
+SlipFramer::SlipFramer (size_t max_frame_size)
+  : Framer (max_frame_size)
+{
+}
+
+frame_status_t
+SlipFramer::scan (const uint8_t *data, size_t size, size_t &consumed,
+                  vector<uint8_t> &frame) const
+{
+  frame.clear ();
+  // Back to back ENDs are empty frames, senders use them to flush noise
+  size_t start = skip_all (data, size, kSlipEnd);
+  consumed = start;
+  size_t end = find_byte (data, start, size, kSlipEnd);
+  if (end == size) {
+    if (size - start >= max_frame_size_) {
+      consumed = size;
+      return frame_invalid;
+    }
+    return frame_incomplete;
+  }
+  consumed = end + 1;
+  if (end - start > max_frame_size_) {
+    return frame_invalid;
+  }
+  frame.reserve (end - start);
+  for (size_t i = start; i < end; ++i) {
+    uint8_t byte = data[i];
+    if (byte == kSlipEsc) {
+      if (++i == end) {
+        frame.clear ();
+        return frame_invalid;
+      }
+      if (data[i] == kSlipEscEnd) {
+        byte = kSlipEnd;
+      } else if (data[i] == kSlipEscEsc) {
+        byte = kSlipEsc;
+      } else {
+        frame.clear ();
+        return frame_invalid;
+      }
+    }
+    frame.push_back (byte);
+  }
+  return frame_complete;
+}
+
+void
+SlipFramer::encode (const uint8_t *payload, size_t size,
+                    vector<uint8_t> &out) const
+{
+  out.reserve (out.size () + size + 2);
+  out.push_back (kSlipEnd);
+  for (size_t i = 0; i < size; ++i) {
+    if (payload[i] == kSlipEnd) {
+      out.push_back (kSlipEsc);
+      out.push_back (kSlipEscEnd);
+    } else if (payload[i] == kSlipEsc) {
+      out.push_back (kSlipEsc);
+      out.push_back (kSlipEscEsc);
+    } else {
+      out.push_back (payload[i]);
+    }
+  }
+  out.push_back (kSlipEnd);
+}
+
+CobsFramer::CobsFramer (size_t max_frame_size)
+  : Framer (max_frame_size)
+{
+}
+
+frame_status_t
+CobsFramer::scan (const uint8_t *data, size_t size, size_t &consumed,
+                  vector<uint8_t> &frame) const
+{
+  frame.clear ();
+  size_t start = skip_all (data, size, 0);
+  consumed = start;
+  size_t end = find_byte (data, start, size, 0);
+  if (end == size) {
+    if (size - start >= max_frame_size_) {
+      consumed = size;
+      return frame_invalid;
+    }
+    return frame_incomplete;
+  }
+  consumed = end + 1;
+  if (end - start > max_frame_size_) {
+    return frame_invalid;
+  }
+  frame.reserve (end - start);
+  size_t i = start;
+  while (i < end) {
+    size_t code = data[i++];
+    if (code - 1 > end - i) {
+      // The block runs past the delimiter
+      frame.clear ();
+      return frame_invalid;
+    }
+    frame.insert (frame.end (), data + i, data + i + code - 1);
+    i += code - 1;
+    if (code < 0xFF && i < end) {
+      frame.push_back (0);
+    }
+  }
+  return frame_complete;
+}
+
+void
+CobsFramer::encode (const uint8_t *payload, size_t size,
+                    vector<uint8_t> &out) const
+{
+  out.reserve (out.size () + size + size / 254 + 2);
+  size_t code_pos = out.size ();
+  uint8_t code = 1;
+  out.push_back (0);
+  for (size_t i = 0; i < size; ++i) {
+    if (payload[i] != 0) {
+      out.push_back (payload[i]);
+      ++code;
+    }
+    if (payload[i] == 0 || code == 0xFF) {
+      out[code_pos] = code;
+      code_pos = out.size ();
+      code = 1;
+      out.push_back (0);
+    }
+  }
+  out[code_pos] = code;
+  out.push_back (0);
+}
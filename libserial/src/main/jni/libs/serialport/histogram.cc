@@ -0,0 +1,222 @@
+#include <time.h>
+
+#include <cmath>
+#include <cstring>
+
+#include "serial/histogram.h"
+
+using serial::LatencyHistogram;
+
+namespace {
+
+const uint64_t kEmptyMin = ~static_cast<uint64_t> (0);
+const uint64_t kSubBuckets = static_cast<uint64_t> (1) << LatencyHistogram::kSubBucketBits;
+
+inline uint64_t
+load (const uint64_t &value)
+{
+  return __atomic_load_n (&value, __ATOMIC_RELAXED);
+}
+
+inline void
+store (uint64_t &value, uint64_t new_value)
+{
+  __atomic_store_n (&value, new_value, __ATOMIC_RELAXED);
+}
+
+inline uint64_t
+take (uint64_t &value, uint64_t replacement)
+{
+  return __atomic_exchange_n (&value, replacement, __ATOMIC_RELAXED);
+}
+
+inline void
+raise_to (uint64_t &value, uint64_t candidate)
+{
+  uint64_t current = load (value);
+  while (candidate > current
+         && !__atomic_compare_exchange_n (&value, &current, candidate, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+inline void
+lower_to (uint64_t &value, uint64_t candidate)
+{
+  uint64_t current = load (value);
+  while (candidate < current
+         && !__atomic_compare_exchange_n (&value, &current, candidate, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+} // namespace
+
+const unsigned LatencyHistogram::kSubBucketBits;
+const unsigned LatencyHistogram::kMaxExponent;
+const size_t LatencyHistogram::kBucketCount;
+
+LatencyHistogram::LatencyHistogram ()
+  : count_ (0), sum_ (0), min_ (kEmptyMin), max_ (0)
+{
+  memset (buckets_, 0, sizeof (buckets_));
+}
+
+size_t
+LatencyHistogram::bucketIndex (uint64_t value)
+{
+  if (value < kSubBuckets) {
+    return static_cast<size_t> (value);
+  }
+  unsigned exponent = 63 - static_cast<unsigned> (__builtin_clzll (value));
+  if (exponent > kMaxExponent) {
+    return kBucketCount - 1;
+  }
+  // The top kSubBucketBits + 1 bits of the value, less the leading one,
+  // pick the bucket within the power of two
+  unsigned shift = exponent - kSubBucketBits;
+  return static_cast<size_t> (((shift + 1) << kSubBucketBits)
+                              + ((value >> shift) - kSubBuckets));
+}
+
+uint64_t
+LatencyHistogram::bucketLowest (size_t index)
+{
+  if (index < kSubBuckets) {
+    return index;
+  }
+  unsigned shift = static_cast<unsigned> ((index >> kSubBucketBits) - 1);
+  uint64_t sub = index & (kSubBuckets - 1);
+  return (kSubBuckets + sub) << shift;
+}
+
+void
+LatencyHistogram::record (uint64_t value)
+{
+  __atomic_fetch_add (&buckets_[bucketIndex (value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&count_, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&sum_, value, __ATOMIC_RELAXED);
+  lower_to (min_, value);
+  raise_to (max_, value);
+}
+
+void
+LatencyHistogram::add (const LatencyHistogram &other)
+{
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    uint64_t n = load (other.buckets_[i]);
+    if (n > 0) {
+      __atomic_fetch_add (&buckets_[i], n, __ATOMIC_RELAXED);
+    }
+  }
+  __atomic_fetch_add (&count_, load (other.count_), __ATOMIC_RELAXED);
+  __atomic_fetch_add (&sum_, load (other.sum_), __ATOMIC_RELAXED);
+  lower_to (min_, load (other.min_));
+  raise_to (max_, load (other.max_));
+}
+
+void
+LatencyHistogram::copyTo (LatencyHistogram &snapshot, bool reset)
+{
+  if (&snapshot == this) {
+    if (reset) {
+      this->reset ();
+    }
+    return;
+  }
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    store (snapshot.buckets_[i], reset ? take (buckets_[i], 0)
+                                       : load (buckets_[i]));
+  }
+  store (snapshot.count_, reset ? take (count_, 0) : load (count_));
+  store (snapshot.sum_, reset ? take (sum_, 0) : load (sum_));
+  store (snapshot.min_, reset ? take (min_, kEmptyMin) : load (min_));
+  store (snapshot.max_, reset ? take (max_, 0) : load (max_));
+}
+
+void
+LatencyHistogram::reset ()
+{
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    store (buckets_[i], 0);
+  }
+  store (count_, 0);
+  store (sum_, 0);
+  store (min_, kEmptyMin);
+  store (max_, 0);
+}
+
+uint64_t
+LatencyHistogram::count () const
+{
+  return load (count_);
+}
+
+uint64_t
+LatencyHistogram::min () const
+{
+  uint64_t value = load (min_);
+  return value == kEmptyMin ? 0 : value;
+}
+
+uint64_t
+LatencyHistogram::max () const
+{
+  return load (max_);
+}
+
+double
+LatencyHistogram::mean () const
+{
+  uint64_t n = load (count_);
+  return n == 0 ? 0.0 : static_cast<double> (load (sum_)) / n;
+}
+
+uint64_t
+LatencyHistogram::percentile (double percent) const
+{
+  // Work from the buckets alone, they are consistent with each other even
+  // if count_ has moved on
+  uint64_t total = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    total += load (buckets_[i]);
+  }
+  if (total == 0) {
+    return 0;
+  }
+  if (percent < 0.0) {
+    percent = 0.0;
+  } else if (percent > 100.0) {
+    percent = 100.0;
+  }
+  uint64_t target = static_cast<uint64_t> (std::ceil (percent / 100.0 * total));
+  if (target == 0) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  size_t index = 0;
+  for (; index < kBucketCount; ++index) {
+    seen += load (buckets_[index]);
+    if (seen >= target) {
+      break;
+    }
+  }
+  uint64_t highest = index + 1 < kBucketCount ? bucketLowest (index + 1) - 1
+                                              : load (max_);
+  uint64_t largest = load (max_);
+  return highest < largest ? highest : largest;
+}
+
+uint64_t
+LatencyHistogram::bucketCount (size_t index) const
+{
+  return index < kBucketCount ? load (buckets_[index]) : 0;
+}
+
+uint64_t
+LatencyHistogram::now ()
+{
+  timespec time;
+  clock_gettime (CLOCK_MONOTONIC, &time);
+  return static_cast<uint64_t> (time.tv_sec) * 1000000000ULL + time.tv_nsec;
+}
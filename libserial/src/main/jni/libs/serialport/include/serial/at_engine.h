@@ -0,0 +1,225 @@
+/*!
+ * \file serial/at_engine.h
+ *
+ * \section DESCRIPTION
+ *
+ * AT command engine for modems and GNSS modules.  Commands are queued and
+ * matched with their responses natively, and unsolicited result codes are
+ * routed to handlers by prefix, so nobody has to poll readlines.
+ *
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_AT_ENGINE_H
+#define SERIAL_AT_ENGINE_H
+
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "serial/serial.h"
+
+namespace serial {
+
+class PatternSet;
+
+/*!
+ * Enumeration defines how an AT command ended.
+ */
+typedef enum {
+  at_ok = 0,            //!< OK, or CONNECT
+  at_error,             //!< ERROR, +CME ERROR, +CMS ERROR or a call failure
+  at_timeout,           //!< No final result code within the timeout
+  at_failed,            //!< The command could not be sent
+  at_cancelled          //!< The engine stopped before the command finished
+} at_status_t;
+
+/*!
+ * What a module answered to a command.
+ */
+struct AtResponse {
+  at_status_t status;
+  //! Information lines before the final result code, without line ends
+  std::vector<std::string> lines;
+  //! The final result code, e.g. "OK" or "+CME ERROR: 10"; empty when the
+  //! module gave none
+  std::string final_line;
+
+  AtResponse () : status (at_ok) {}
+};
+
+/*!
+ * Drives an AT command interface over an open serial::Serial port.
+ *
+ * A native thread reads the port line by line.  Each line is given, in
+ * this order:
+ *   - to nobody if it is the echo of a command in flight,
+ *   - to that command if it starts with the command's response prefix,
+ *   - to that command as its final result code if it is one,
+ *   - to the handler with the longest matching prefix, e.g. "+CREG:" or
+ *     "RING"; a handler for "" catches every line no one else takes,
+ *   - to the oldest command in flight as an information line.
+ * So "+CREG: 1,2" answers AT+CREG? when that was sent with the "+CREG:"
+ * prefix and is an unsolicited code otherwise.
+ *
+ * Commands are sent in submission order.  Most modules finish one command
+ * before they read the next, which is the default; modules that buffer
+ * commands can be given several at once with setMaxInFlight.  Final
+ * result codes are matched to the commands in flight oldest first, so
+ * after a timeout a late answer may be taken for the next command's.
+ *
+ * The engine is the only reader of the port while it exists.  Writing
+ * other data to the port meanwhile is fine.
+ */
+class AtEngine {
+public:
+  /*! Receives the response to a submitted command. */
+  class Callback {
+  public:
+    virtual ~Callback () {}
+
+    /*! Called once per command on the engine's thread, or on the thread
+     *  destroying the engine for cancelled commands.  It must not destroy
+     *  the engine. */
+    virtual void
+    onResponse (uint64_t id, const AtResponse &response) = 0;
+  };
+
+  /*! Receives unsolicited result codes. */
+  class UrcHandler {
+  public:
+    virtual ~UrcHandler () {}
+
+    /*! Called on the engine's thread with one line, without its line end.
+     *  It must not destroy the engine. */
+    virtual void
+    onUrc (const std::string &line) = 0;
+  };
+
+  /*!
+   * Starts the engine's thread.
+   *
+   * \param port The port, which must be open and outlive the engine.
+   * \param max_in_flight Commands sent before the oldest has finished.
+   *
+   * \throw std::invalid_argument if max_in_flight is 0.
+   * \throw serial::IOException if the thread cannot be started.
+   */
+  explicit AtEngine (Serial *port, size_t max_in_flight = 1);
+
+  /*! Stops the engine's thread and cancels the commands not finished. */
+  ~AtEngine ();
+
+  /*! Sets how many commands may be in flight at once.
+   *
+   * \throw std::invalid_argument if max_in_flight is 0.
+   */
+  void
+  setMaxInFlight (size_t max_in_flight);
+
+  size_t
+  getMaxInFlight () const;
+
+  /*! Queues a command.
+   *
+   * \param command The command without its line end, e.g. "AT+CSQ".
+   * \param timeout_ms Time allowed for the final result code, counted
+   * from when the command is sent.
+   * \param response_prefix Prefix of the information lines the command
+   * answers with, e.g. "+CSQ:", so they are not taken for unsolicited
+   * codes; empty if it has none.
+   * \param callback Told the response, or NULL.  Must stay valid until
+   * then.
+   *
+   * \return The id of the command, passed to the callback.
+   */
+  uint64_t
+  submit (const std::string &command, uint32_t timeout_ms,
+          const std::string &response_prefix = "",
+          Callback *callback = NULL);
+
+  /*! Sends a command and waits for its response.  Must not be called from
+   *  a callback or handler.
+   *
+   * \see AtEngine::submit
+   */
+  AtResponse
+  execute (const std::string &command, uint32_t timeout_ms,
+           const std::string &response_prefix = "");
+
+  /*! Routes the unsolicited lines starting with prefix to handler, in
+   *  place of any handler the prefix had.  The handler must stay valid
+   *  until it is removed or the engine is destroyed. */
+  void
+  setUrcHandler (const std::string &prefix, UrcHandler *handler);
+
+  /*! Stops routing lines starting with prefix.  Waits for a call of the
+   *  handler that is running, unless called from it. */
+  void
+  removeUrcHandler (const std::string &prefix);
+
+private:
+  // Disable copy constructors
+  AtEngine (const AtEngine&);
+  AtEngine& operator= (const AtEngine&);
+
+  struct Command {
+    uint64_t id;
+    std::string text;
+    std::string prefix;
+    uint32_t timeout_ms;
+    int64_t deadline_ns;        // Once sent
+    Callback *callback;
+    AtResponse response;
+  };
+
+  static void *readThread (void *arg);
+
+  void readLoop ();
+
+  // Sends queued commands while there is room in flight.  Called with
+  // mutex_ held, which is released while writing, so callers must not keep
+  // commands across it; commands that could not be sent are moved to done.
+  void pump (std::vector<Command *> &done);
+
+  // Times out the commands in flight past their deadline, into done
+  void expire (std::vector<Command *> &done);
+
+  void handleLine (const std::string &line);
+
+  // Whether line echoes a command in flight.  Called with mutex_ held.
+  bool isEcho (const std::string &line) const;
+
+  // Longest prefix handler for line, or NULL.  Called with mutex_ held.
+  UrcHandler *findHandler (const std::string &line) const;
+
+  // Runs the callbacks of done and frees the commands
+  static void finish (std::vector<Command *> &done);
+
+  Serial *port_;
+  PatternSet *line_end_;
+  size_t max_in_flight_;
+  uint64_t next_id_;
+  std::deque<Command *> queue_;      // Not sent yet
+  std::deque<Command *> in_flight_;  // Sent, oldest first
+  std::map<std::string, UrcHandler *> handlers_;
+  // Handler being called by the engine's thread, see removeUrcHandler
+  UrcHandler *delivering_;
+  // A thread is in pump writing commands
+  bool sending_;
+
+  bool stop_;
+  pthread_t thread_;
+  mutable pthread_mutex_t mutex_;
+  pthread_cond_t idle_cond_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_AT_ENGINE_H
+
+#endif // !defined(_WIN32)
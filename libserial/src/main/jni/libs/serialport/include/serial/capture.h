@@ -0,0 +1,216 @@
+/*!
+ * \file serial/capture.h
+ *
+ * \section DESCRIPTION
+ *
+ * Binary capture of the traffic on a serial::Serial port, for looking at
+ * what a device in the field really sent and received.
+ *
+ * \section FORMAT
+ *
+ * A capture file starts with a 16 byte header:
+ *   - 8 bytes magic, "SERCAP" followed by two zero bytes,
+ *   - uint16 format version, currently 1,
+ *   - uint16 size of each record header, currently 16,
+ *   - 4 bytes reserved, zero.
+ *
+ * Records follow back to back, each a 16 byte header and its payload:
+ *   - uint64 CLOCK_MONOTONIC timestamp in nanoseconds,
+ *   - uint32 payload length,
+ *   - uint8 record type, a capture_record_t,
+ *   - 3 bytes reserved, zero.
+ *
+ * Numbers are little endian.  The payload of capture_rx and capture_tx is
+ * the bytes of one ::read or ::write, so the chunking of the traffic is
+ * kept.  capture_config carries a CaptureConfig, capture_gap the number of
+ * bytes dropped because the file could not keep up, as a uint64.  Files are
+ * only ever appended to, so one file may hold several sessions; timestamps
+ * restart when the device reboots.  A record cut short by a crash may end
+ * the file, readers stop before it.
+ *
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_CAPTURE_H
+#define SERIAL_CAPTURE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <serial/v8stdint.h>
+
+namespace serial {
+
+/*!
+ * Enumeration defines the kinds of capture records.
+ */
+typedef enum {
+  capture_rx = 1,               //!< Bytes read from the port
+  capture_tx = 2,               //!< Bytes written to the port
+  capture_config = 3,           //!< The port was opened or reconfigured
+  capture_gap = 4               //!< Records were dropped here
+} capture_record_t;
+
+/*!
+ * Payload of a capture_config record, 8 bytes on disk.
+ */
+struct CaptureConfig {
+  uint32_t baudrate;
+  uint8_t bytesize;             //!< A bytesize_t
+  uint8_t parity;               //!< A parity_t
+  uint8_t stopbits;             //!< A stopbits_t
+  uint8_t flowcontrol;          //!< A flowcontrol_t
+};
+
+//! Size of the file header and of each record header
+const size_t kCaptureHeaderSize = 16;
+//! Size of a capture_config payload
+const size_t kCaptureConfigSize = 8;
+
+/*!
+ * One record read back from a capture file.
+ */
+struct CaptureRecord {
+  uint64_t timestamp_ns;
+  capture_record_t type;
+  std::vector<uint8_t> data;
+};
+
+/*!
+ * Reads the records of a capture file in order, through a stdio buffer.
+ */
+class CaptureReader {
+public:
+  CaptureReader ();
+
+  ~CaptureReader ();
+
+  /*!
+   * Opens path and checks its header.
+   *
+   * \throw serial::IOException if the file cannot be read or is not a
+   * capture file of this version.
+   */
+  void
+  open (const std::string &path);
+
+  /*! Closes the file, if open. */
+  void
+  close ();
+
+  /*!
+   * Reads the next record.  Record types this version does not know are
+   * returned too, callers skip them.
+   *
+   * \return false at the end of the file, or of its last whole record.
+   *
+   * \throw serial::IOException if reading fails.
+   */
+  bool
+  next (CaptureRecord &record);
+
+private:
+  // Disable copy constructors
+  CaptureReader (const CaptureReader&);
+  CaptureReader& operator= (const CaptureReader&);
+
+  FILE *file_;
+  size_t record_header_size_;
+};
+
+/*!
+ * Appends capture records to a file.
+ *
+ * record only copies into a memory buffer; a thread of the recorder writes
+ * the buffer out in large batches, when enough has collected or every
+ * 100 ms.  Should the file fall more than a few megabytes behind, records
+ * are dropped and a capture_gap record says how much is missing, so the
+ * port is never held up by storage.
+ *
+ * All methods may be called from any thread.
+ */
+class CaptureRecorder {
+public:
+  CaptureRecorder ();
+
+  /*! Stops recording, ignoring errors. */
+  ~CaptureRecorder ();
+
+  /*!
+   * Starts recording to path, which is created if needed and appended to
+   * otherwise.
+   *
+   * \throw serial::SerialException if already recording.
+   * \throw serial::IOException if the file cannot be opened, is not a
+   * capture file, or the thread cannot be started.
+   */
+  void
+  start (const std::string &path);
+
+  /*!
+   * Writes out what is buffered and closes the file.  Does nothing if not
+   * recording.
+   *
+   * \throw serial::IOException if writing the file failed at some point;
+   * recording stopped then and everything after was dropped.
+   */
+  void
+  stop ();
+
+  /*! Whether records are being taken.  Costs a relaxed load. */
+  bool
+  isRecording () const
+  {
+    return __atomic_load_n (&recording_, __ATOMIC_RELAXED);
+  }
+
+  /*! Adds a record stamped with the current time, unless not recording. */
+  void
+  record (capture_record_t type, const uint8_t *data, size_t length);
+
+  /*! Adds a capture_config record. */
+  void
+  recordConfig (const CaptureConfig &config);
+
+  /*! Payload bytes dropped since start because the buffer was full, or
+   *  still buffered when a write to the file failed. */
+  uint64_t
+  getDropped () const;
+
+private:
+  // Disable copy constructors
+  CaptureRecorder (const CaptureRecorder&);
+  CaptureRecorder& operator= (const CaptureRecorder&);
+
+  // Appends one record to buffer_.  Called with mutex_ held.
+  void append (uint64_t timestamp_ns, capture_record_t type,
+               const uint8_t *data, size_t length);
+
+  static void *writerThread (void *arg);
+
+  void writerLoop ();
+
+  // Writes all of data to fd_, false with error_ set if that fails
+  bool writeAll (const std::vector<uint8_t> &data);
+
+  int fd_;
+  bool recording_;
+  bool stop_;
+  int error_;                   // errno of the first failed write
+  std::vector<uint8_t> buffer_; // Records not written yet
+  uint64_t dropped_;            // Bytes dropped since start
+  uint64_t gap_;                // Bytes dropped since the last gap record
+  pthread_t thread_;
+  mutable pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_CAPTURE_H
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,165 @@
+/*!
+ * \file serial/crc.h
+ *
+ * \section DESCRIPTION
+ *
+ * CRC computation for serial protocols.  Any CRC of up to 32 bits is
+ * computed with slicing-by-8 tables; on CPUs that have them the ARMv8 CRC32
+ * and x86 SSE4.2 instructions, or PMULL/PCLMULQDQ folding for long buffers,
+ * are picked at runtime.
+ *
+ */
+
+#ifndef SERIAL_CRC_H
+#define SERIAL_CRC_H
+
+#include <vector>
+
+#include <serial/v8stdint.h>
+#include <serial/framer.h>
+
+namespace serial {
+
+/*!
+ * A CRC algorithm, described by the usual Rocksoft model parameters with
+ * the input and output reflected alike.
+ *
+ * Objects are immutable once constructed and may be shared by threads.
+ */
+class Crc {
+public:
+  /*!
+   * \param width Width of the CRC in bits, 1 to 32.
+   * \param poly The generator polynomial, without the top bit.
+   * \param init Initial register value.
+   * \param reflected Whether input bytes and the result are bit reflected.
+   * \param xorout Value XORed into the final register.
+   * \param accelerated Whether CPU specific implementations may be used,
+   * false forces the portable tables.
+   *
+   * \throw std::invalid_argument if width is out of range.
+   */
+  Crc (size_t width, uint32_t poly, uint32_t init, bool reflected,
+       uint32_t xorout, bool accelerated = true);
+
+  /*! CRC-8/SMBUS, polynomial 0x07. */
+  static const Crc &
+  crc8 ();
+
+  /*! CRC-8/MAXIM-DOW (1-Wire), polynomial 0x31 reflected. */
+  static const Crc &
+  crc8Maxim ();
+
+  /*! CRC-16/MODBUS, sent least significant byte first. */
+  static const Crc &
+  crc16Modbus ();
+
+  /*! CRC-16/CCITT-FALSE (IBM-3740), polynomial 0x1021, init 0xFFFF. */
+  static const Crc &
+  crc16CcittFalse ();
+
+  /*! CRC-16/KERMIT, the reflected CCITT CRC. */
+  static const Crc &
+  crc16Kermit ();
+
+  /*! CRC-16/XMODEM, polynomial 0x1021, init 0. */
+  static const Crc &
+  crc16Xmodem ();
+
+  /*! CRC-32 as used by zlib and Ethernet. */
+  static const Crc &
+  crc32 ();
+
+  /*! CRC-32C (Castagnoli). */
+  static const Crc &
+  crc32c ();
+
+  /*! Returns the CRC of a buffer. */
+  uint32_t
+  compute (const uint8_t *data, size_t size) const
+  {
+    return finish (update (start (), data, size));
+  }
+
+  /*! Returns the register value to start an incremental computation. */
+  uint32_t
+  start () const { return start_; }
+
+  /*! Feeds data into a register value from start or update. */
+  uint32_t
+  update (uint32_t crc, const uint8_t *data, size_t size) const;
+
+  /*! Turns a register value into the CRC. */
+  uint32_t
+  finish (uint32_t crc) const;
+
+  /*! Width of the CRC in bits. */
+  size_t
+  width () const { return width_; }
+
+  /*! Number of bytes the CRC takes on the wire. */
+  size_t
+  bytes () const { return (width_ + 7) / 8; }
+
+  /*! Name of the implementation picked for this CPU, for diagnostics. */
+  const char *
+  implementation () const;
+
+private:
+  // Raw register updates, see crc.cc
+  uint32_t
+  updateTables (uint32_t crc, const uint8_t *data, size_t size) const;
+
+  uint32_t
+  updateFolding (uint32_t crc, const uint8_t *data, size_t size) const;
+
+  size_t width_;
+  uint32_t poly_;
+  bool reflected_;
+  uint32_t xorout_;
+  uint32_t start_;
+  int engine_;
+  uint32_t table_[8][256];
+  // Folding multipliers for 128 and 512 bit strides, see crc.cc
+  uint64_t fold128_[2];
+  uint64_t fold512_[2];
+};
+
+/*!
+ * Wraps a framer to append a CRC to written frames and check it on read
+ * ones.  Frames whose CRC does not match are dropped as invalid, the CRC
+ * is removed from frames that pass.
+ */
+class CrcFramer : public Framer {
+public:
+  /*!
+   * \param framer The framer that delimits frames, the CrcFramer takes
+   * ownership of it.
+   * \param crc The CRC, which is copied.
+   * \param byteorder Byte order of the CRC on the wire.
+   */
+  CrcFramer (Framer *framer, const Crc &crc, byteorder_t byteorder);
+
+  virtual ~CrcFramer ();
+
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const;
+
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const;
+
+private:
+  // Disable copy constructors
+  CrcFramer (const CrcFramer&);
+  CrcFramer& operator= (const CrcFramer&);
+
+  Framer *framer_;
+  Crc crc_;
+  byteorder_t byteorder_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_CRC_H
@@ -0,0 +1,224 @@
+/*!
+ * \file serial/framer.h
+ *
+ * \section DESCRIPTION
+ *
+ * Frame extractors for framed binary protocols.  A serial::Framer set on a
+ * serial::Serial lets serial::Serial::readFrame return exactly one complete
+ * frame per call, and serial::Serial::writeFrame send one.
+ *
+ */
+
+#ifndef SERIAL_FRAMER_H
+#define SERIAL_FRAMER_H
+
+#include <string>
+#include <vector>
+
+#include <serial/v8stdint.h>
+
+namespace serial {
+
+/*!
+ * Outcome of serial::Framer::scan.
+ */
+typedef enum {
+  /*! No complete frame yet, wait for more data. */
+  frame_incomplete = 0,
+  /*! A frame was decoded. */
+  frame_complete,
+  /*! The leading bytes cannot start a valid frame and must be dropped. */
+  frame_invalid
+} frame_status_t;
+
+/*!
+ * Enumeration defines the byte orders of a length field.
+ */
+typedef enum {
+  byteorder_big_endian = 0,
+  byteorder_little_endian
+} byteorder_t;
+
+/*!
+ * Splits a received byte stream into frames and encodes outgoing ones.
+ *
+ * Framers keep no state between calls, scan always looks at the stream
+ * from the first unconsumed byte, so a framer may be shared.
+ */
+class Framer {
+public:
+  /*!
+   * \param max_frame_size Largest frame on the wire, including any framing
+   * bytes.  Larger input is dropped as invalid so a corrupt stream cannot
+   * grow the buffer without bound.
+   */
+  explicit Framer (size_t max_frame_size) : max_frame_size_ (max_frame_size) {}
+
+  virtual ~Framer () {}
+
+  /*! Looks for a frame at the start of data.
+   *
+   * \param data The unconsumed bytes of the stream.
+   * \param size The number of bytes at data.
+   * \param consumed Set to the number of bytes to drop from the stream:
+   * the whole frame when complete, the garbage when invalid, which is
+   * at least one byte.  When
+   * incomplete it may count leading bytes that carry nothing, e.g. idle
+   * delimiters.
+   * \param frame Receives the decoded frame when complete, it is cleared
+   * first.
+   *
+   * \return The status, see serial::frame_status_t.
+   */
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const = 0;
+
+  /*! Appends the wire form of a frame to out.
+   *
+   * \throw std::invalid_argument if the payload cannot be framed, e.g. it
+   * is too long for the length field.
+   */
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const = 0;
+
+  size_t
+  maxFrameSize () const { return max_frame_size_; }
+
+protected:
+  size_t max_frame_size_;
+};
+
+/*!
+ * Frames of a fixed number of bytes.
+ */
+class FixedLengthFramer : public Framer {
+public:
+  /*!
+   * \throw std::invalid_argument if length is 0.
+   */
+  explicit FixedLengthFramer (size_t length);
+
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const;
+
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const;
+};
+
+/*!
+ * Frames that carry their length in a header field.
+ *
+ * The frame on the wire is offset bytes of header, the length field, then
+ * value + adjustment more bytes.  The first strip bytes of that are removed
+ * from the returned frame.
+ */
+class LengthFieldFramer : public Framer {
+public:
+  /*!
+   * \param offset Bytes before the length field.
+   * \param field_size Width of the length field: 1, 2, 3 or 4 bytes.
+   * \param byteorder Byte order of the length field.
+   * \param adjustment Added to the field value to get the number of bytes
+   * that follow the field, e.g. the size of a trailing CRC, or minus the
+   * header size if the field counts the whole frame.
+   * \param strip Bytes to remove from the start of returned frames.
+   * \param max_frame_size Largest frame on the wire.
+   *
+   * \throw std::invalid_argument for an unsupported field size or a strip
+   * larger than max_frame_size.
+   */
+  LengthFieldFramer (size_t offset, size_t field_size, byteorder_t byteorder,
+                     long adjustment = 0, size_t strip = 0,
+                     size_t max_frame_size = 65536);
+
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const;
+
+  /*! Writes offset zero bytes, the length field, then the payload, with
+   *  the field set to the payload size minus the adjustment. */
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const;
+
+private:
+  size_t offset_;
+  size_t field_size_;
+  byteorder_t byteorder_;
+  long adjustment_;
+  size_t strip_;
+};
+
+/*!
+ * Frames terminated by a delimiter.  A frame longer than max_frame_size is
+ * dropped in pieces, so its tail may come out as a frame of its own.
+ */
+class DelimiterFramer : public Framer {
+public:
+  /*!
+   * \param delimiter The bytes ending each frame.
+   * \param include_delimiter Whether returned frames keep the delimiter.
+   * \param max_frame_size Largest frame, including the delimiter.
+   *
+   * \throw std::invalid_argument if delimiter is empty.
+   */
+  DelimiterFramer (const std::string &delimiter,
+                   bool include_delimiter = false,
+                   size_t max_frame_size = 65536);
+
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const;
+
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const;
+
+private:
+  std::string delimiter_;
+  bool include_delimiter_;
+};
+
+/*!
+ * SLIP framing (RFC 1055).  Empty frames, e.g. from a leading END, are
+ * skipped.
+ */
+class SlipFramer : public Framer {
+public:
+  explicit SlipFramer (size_t max_frame_size = 65536);
+
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const;
+
+  /*! Writes END, the escaped payload, END. */
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const;
+};
+
+/*!
+ * Consistent Overhead Byte Stuffing, with a zero byte ending each frame.
+ * Empty frames are skipped.
+ */
+class CobsFramer : public Framer {
+public:
+  explicit CobsFramer (size_t max_frame_size = 65536);
+
+  virtual frame_status_t
+  scan (const uint8_t *data, size_t size, size_t &consumed,
+        std::vector<uint8_t> &frame) const;
+
+  /*! Writes the encoded payload and the terminating zero. */
+  virtual void
+  encode (const uint8_t *payload, size_t size,
+          std::vector<uint8_t> &out) const;
+};
+
+} // namespace serial
+
+#endif // SERIAL_FRAMER_H
@@ -0,0 +1,119 @@
+/*!
+ * \file serial/histogram.h
+ *
+ * \section DESCRIPTION
+ *
+ * Log-linear latency histogram in the style of HdrHistogram, used to keep
+ * the latency distribution of serial::Serial calls.
+ *
+ */
+
+#ifndef SERIAL_HISTOGRAM_H
+#define SERIAL_HISTOGRAM_H
+
+#include <serial/v8stdint.h>
+#include <stddef.h>
+
+namespace serial {
+
+/*!
+ * Counts values, nanoseconds by convention, in buckets that are linear
+ * within each power of two: 32 buckets per doubling, so every value is
+ * kept to within 1/32 (about 3%) of itself.  Values below 32 are exact,
+ * values of 2^40 (about 18 minutes in nanoseconds) and above share the
+ * last bucket.
+ *
+ * record may be called from any number of threads at once, it is a few
+ * relaxed atomic adds and never locks.  Snapshots taken while values are
+ * being recorded may miss the values in flight.
+ */
+class LatencyHistogram {
+public:
+  /*! Linear buckets per power of two, as a power of two. */
+  static const unsigned kSubBucketBits = 5;
+  /*! Values of 2^(kMaxExponent + 1) and above share the last bucket. */
+  static const unsigned kMaxExponent = 39;
+  /*! Number of buckets. */
+  static const size_t kBucketCount =
+      (kMaxExponent - kSubBucketBits + 2) << kSubBucketBits;
+
+  LatencyHistogram ();
+
+  /*! Counts one value. */
+  void
+  record (uint64_t value);
+
+  /*! Adds all values of another histogram to this one, e.g. to merge the
+   *  histograms of several ports. */
+  void
+  add (const LatencyHistogram &other);
+
+  /*! Copies this histogram into snapshot, replacing its contents.
+   *
+   * \param snapshot Receives the values.
+   * \param reset Whether to empty this histogram as it is copied, so
+   * consecutive snapshots cover back to back time windows without losing
+   * values recorded meanwhile.
+   */
+  void
+  copyTo (LatencyHistogram &snapshot, bool reset = false);
+
+  /*! Forgets all values. */
+  void
+  reset ();
+
+  /*! Number of values. */
+  uint64_t
+  count () const;
+
+  /*! Smallest value, 0 if empty. */
+  uint64_t
+  min () const;
+
+  /*! Largest value, 0 if empty. */
+  uint64_t
+  max () const;
+
+  /*! Mean of the values, 0 if empty. */
+  double
+  mean () const;
+
+  /*! Value below or at which percent of the values lie, e.g. 99.9.
+   *
+   * Returns the highest value of the bucket the percentile falls in, and
+   * never more than max.  0 if empty.
+   */
+  uint64_t
+  percentile (double percent) const;
+
+  /*! Number of values in a bucket. */
+  uint64_t
+  bucketCount (size_t index) const;
+
+  /*! Lowest value that lands in a bucket. */
+  static uint64_t
+  bucketLowest (size_t index);
+
+  /*! Bucket a value lands in. */
+  static size_t
+  bucketIndex (uint64_t value);
+
+  /*! CLOCK_MONOTONIC in nanoseconds, the clock Serial records with. */
+  static uint64_t
+  now ();
+
+private:
+  // Disable copy constructors, use copyTo
+  LatencyHistogram (const LatencyHistogram&);
+  LatencyHistogram& operator= (const LatencyHistogram&);
+
+  uint64_t buckets_[kBucketCount];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_HISTOGRAM_H
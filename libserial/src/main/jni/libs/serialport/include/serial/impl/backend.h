@@ -0,0 +1,135 @@
+/*!
+ * \file serial/impl/backend.h
+ *
+ * \section DESCRIPTION
+ *
+ * Data sources behind the unix SerialImpl.  A backend only opens the
+ * descriptor the port then reads, writes, polls and configures, so
+ * everything above it works the same for a device and for a replay.
+ *
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_IMPL_BACKEND_H
+#define SERIAL_IMPL_BACKEND_H
+
+#include <pthread.h>
+
+#include <string>
+
+#include "serial/capture.h"
+#include "serial/v8stdint.h"
+
+namespace serial {
+
+class Poller;
+
+/*!
+ * Opens the descriptors of a port.
+ */
+class SerialBackend {
+public:
+  virtual ~SerialBackend () {}
+
+  /*! Opens port read/write, non-blocking and without becoming the
+   *  controlling terminal.  Returns the descriptor, or -1 with errno set
+   *  like ::open; may throw serial::IOException. */
+  virtual int
+  open (const std::string &port) = 0;
+
+  /*! Opens a second, blocking, read-only descriptor of the port last
+   *  opened.  Returns -1 with errno set on failure. */
+  virtual int
+  openReader () = 0;
+
+  /*! Called once the port has closed its descriptors. */
+  virtual void
+  close () = 0;
+};
+
+/*!
+ * A serial device node, e.g. /dev/ttyS1.
+ */
+class DeviceBackend : public SerialBackend {
+public:
+  virtual int
+  open (const std::string &port);
+
+  virtual int
+  openReader ();
+
+  virtual void
+  close ();
+
+private:
+  std::string port_;
+};
+
+/*!
+ * Plays back the received data of a capture file, see serial/capture.h.
+ *
+ * The port is handed the slave side of a pseudo terminal.  A thread of the
+ * backend writes the capture_rx records into the master side, each when
+ * it is due, and reads and drops whatever the port writes.  Once the last
+ * record has been read by the port the master is closed, so the port sees
+ * a hangup like an unplugged adapter.  Every open starts over at the
+ * first record.
+ */
+class ReplayBackend : public SerialBackend {
+public:
+  /*!
+   * \param speed 1 to keep the recorded gaps between chunks, 2 to halve
+   * them and so on, 0 to send every chunk as soon as the port can take it.
+   *
+   * \throw std::invalid_argument if speed is negative.
+   */
+  explicit ReplayBackend (double speed);
+
+  virtual ~ReplayBackend ();
+
+  /*! Opens the capture file at port. */
+  virtual int
+  open (const std::string &port);
+
+  virtual int
+  openReader ();
+
+  virtual void
+  close ();
+
+  double
+  getSpeed () const { return speed_; }
+
+private:
+  // Disable copy constructors
+  ReplayBackend (const ReplayBackend&);
+  ReplayBackend& operator= (const ReplayBackend&);
+
+  static void *feedThread (void *arg);
+
+  void feedLoop ();
+
+  // Reads and drops what the port wrote, false once the slave is gone
+  bool drain ();
+
+  // Waits until the port has read everything sent, or stop_ is set
+  void waitConsumed ();
+
+  double speed_;
+  std::string capture_;
+  CaptureReader reader_;
+  std::string slave_path_;
+  int master_fd_;
+  int slave_fd_;              // Our own descriptor of the slave, to watch it
+  Poller *poller_;
+  bool running_;
+  bool stop_;
+  pthread_t thread_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_IMPL_BACKEND_H
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,114 @@
+/*!
+ * \file serial/impl/poller.h
+ *
+ * \section DESCRIPTION
+ *
+ * A persistent epoll based wait engine.  Unlike select it is set up once,
+ * has no FD_SETSIZE limit and can be interrupted from another thread.
+ *
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_IMPL_POLLER_H
+#define SERIAL_IMPL_POLLER_H
+
+#include <map>
+
+#include <pthread.h>
+
+#include "serial/v8stdint.h"
+
+namespace serial {
+
+/*!
+ * Readiness bits reported by Poller.
+ */
+typedef enum {
+  poll_readable = 0x01,
+  poll_writable = 0x02,
+  poll_hangup = 0x04,
+  poll_error = 0x08
+} poll_event_t;
+
+/*!
+ * A single readiness notification returned by Poller::wait.
+ */
+struct PollEvent {
+  /*! File descriptor the event belongs to. */
+  int fd;
+  /*! Combination of poll_event_t bits. */
+  uint32_t events;
+  /*! Cookie given when the descriptor was added. */
+  void *data;
+};
+
+/*!
+ * Waits on a set of file descriptors with a single epoll instance.
+ *
+ * Every poller owns an eventfd so that wait can be cancelled with wakeup
+ * from any thread.  Descriptors may be added and removed while another
+ * thread is waiting, events for removed descriptors are dropped.
+ */
+class Poller {
+public:
+  Poller ();
+
+  virtual ~Poller ();
+
+  /*! Starts watching fd for the given poll_event_t bits.  Hangup and error
+   *  conditions are always reported.  In edge triggered mode a descriptor is
+   *  only reported again after new data arrives, so the caller has to drain
+   *  it until EAGAIN. */
+  void
+  add (int fd, uint32_t events, bool edge_triggered = false, void *data = NULL);
+
+  /*! Changes the events, trigger mode or cookie of a watched descriptor. */
+  void
+  modify (int fd, uint32_t events, bool edge_triggered = false,
+          void *data = NULL);
+
+  /*! Stops watching fd, unknown descriptors are ignored. */
+  void
+  remove (int fd);
+
+  /*! Waits up to timeout_ms milliseconds, or forever if negative.
+   *
+   * \return The number of events stored in events, 0 on timeout, on EINTR
+   * or when woken up.  If woken is given it is set to true when the wait
+   * ended because of wakeup.
+   */
+  int
+  wait (int timeout_ms, PollEvent *events, int max_events,
+        bool *woken = NULL);
+
+  /*! Waits for a single descriptor, returning its poll_event_t bits or 0 on
+   *  timeout or wakeup. */
+  uint32_t
+  waitFor (int fd, int timeout_ms, bool *woken = NULL);
+
+  /*! Interrupts a thread blocked in wait, or the next wait if none is. */
+  void
+  wakeup ();
+
+private:
+  // Disable copy constructors
+  Poller (const Poller&);
+  Poller& operator= (const Poller&);
+
+  void
+  control (int op, int fd, uint32_t events, bool edge_triggered, void *data);
+
+  int epoll_fd_;
+  int wakeup_fd_;
+
+  // Cookies of the watched descriptors, guarded by data_mutex_
+  std::map<int, void *> data_;
+  pthread_mutex_t data_mutex_;
+};
+
+}
+
+#endif // SERIAL_IMPL_POLLER_H
+
+#endif // !defined(_WIN32)
@@ -31,7 +31,8 @@
  * \section DESCRIPTION
  *
  * This provides a unix based pimpl for the Serial class. This implementation is
- * based off termios.h and uses select for multiplexing the IO ports.
+ * based off termios.h and uses a persistent epoll set (see Poller) for
+ * multiplexing the IO ports.
  *
  */
 
@@ -41,9 +42,16 @@
 #define SERIAL_IMPL_UNIX_H
 
 #include "serial/serial.h"
+#include "serial/capture.h"
+#include "serial/impl/backend.h"
+#include "serial/impl/poller.h"
+#include "serial/spsc_ring.h"
 
 #include <pthread.h>
 
+#include <deque>
+#include <vector>
+
 namespace serial {
 
 using std::size_t;
@@ -89,12 +97,54 @@ public:
   bool
   waitReadable (uint32_t timeout);
 
+  /*! Waits until no data has arrived for idle_ns nanoseconds.  Returns
+   *  true if the line stayed quiet, false as soon as data is readable. */
+  bool
+  waitIdle (uint64_t idle_ns);
+
+  /*! Nanoseconds to transmit or receive one character. */
+  uint32_t
+  getByteTimeNs () const;
+
   void
   waitByteTimes (size_t count);
 
   size_t
   read (uint8_t *buf, size_t size = 1);
 
+  /*! Waits like a single byte read, then returns up to size bytes that are
+   *  already available. */
+  size_t
+  readSome (uint8_t *buf, size_t size);
+
+  /*! Pushes bytes back so they are returned first by the next read. */
+  void
+  unread (const uint8_t *data, size_t length);
+
+  /*! Returns up to size bytes that can be had without waiting. */
+  size_t
+  readAvailable (uint8_t *buf, size_t size);
+
+  /*! True if data is held in user space, where polling the descriptor
+   *  cannot see it. */
+  bool
+  hasBuffered ();
+
+  int
+  getFd () const;
+
+  /*! Counts the times the port was closed.  A descriptor taken from getFd
+   *  is gone once this changes, even if the port was opened again. */
+  uint32_t
+  getCloseCount () const;
+
+  /*! Wakes poller every time the port closes, until unwatchClose. */
+  void
+  watchClose (Poller *poller);
+
+  void
+  unwatchClose (Poller *poller);
+
   size_t
   write (const uint8_t *data, size_t length);
 
@@ -140,6 +190,12 @@ public:
   string
   getPort () const;
 
+  void
+  setReplay (const string &capture, double speed);
+
+  bool
+  isReplay () const;
+
   void
   setTimeout (Timeout &timeout);
 
@@ -176,6 +232,65 @@ public:
   flowcontrol_t
   getFlowcontrol () const;
 
+  void
+  setLatencyProfile (latency_profile_t profile);
+
+  latency_profile_t
+  getLatencyProfile () const;
+
+  void
+  setReadCoalescing (coalesce_policy_t policy, uint32_t max_wait_us);
+
+  coalesce_policy_t
+  getReadCoalescing () const;
+
+  uint32_t
+  getReadCoalescingMaxWait () const;
+
+  void
+  getStats (PortStats &stats) const;
+
+  void
+  startCapture (const string &path);
+
+  void
+  stopCapture ();
+
+  bool
+  isCapturing () const;
+
+  void
+  setWriteBatching (size_t max_bytes, uint32_t deadline_us);
+
+  size_t
+  getWriteBatchSize () const;
+
+  uint32_t
+  getWriteBatchDeadline () const;
+
+  void
+  flushWrites ();
+
+  // The unbatched write, straight to the port within the write timeout
+  size_t
+  writeNow (const uint8_t *data, size_t length);
+
+  uint64_t
+  submitWrite (const uint8_t *data, size_t length, write_priority_t priority,
+               WriteListener *listener);
+
+  void
+  cancelWrites ();
+
+  size_t
+  getQueuedWrites () const;
+
+  void
+  setContinuousReceive (bool enabled, size_t buffer_size);
+
+  bool
+  isContinuousReceive () const;
+
   void
   readLock ();
 
@@ -191,9 +306,94 @@ public:
 protected:
   void reconfigurePort ();
 
+  // Applies the driver side of latency_profile_, after reconfigurePort
+  void applyLatencyProfile ();
+
+  // VTIME for the current inter-byte timeout, 0 if the kernel cannot time it
+  uint8_t kernelInterByteTime () const;
+
+  // Bytes to ask of a kernel timed read on rx_block_fd_, so that it ends
+  // within remaining_ms however slowly they arrive; below 2 use fd_.
+  size_t kernelReadSize (size_t missing, int64_t remaining_ms) const;
+
+  // Records the current configuration, if capturing
+  void captureConfig ();
+
+  // Records the bytes a ::read or ::write returned, if capturing
+  void
+  capture (capture_record_t type, const uint8_t *data, ssize_t result)
+  {
+    if (result > 0 && capture_.isRecording ()) {
+      capture_.record (type, data, static_cast<size_t> (result));
+    }
+  }
+
+  void startReceiver ();
+
+  void stopReceiver ();
+
+  void receiveLoop ();
+
+  static void *receiveThread (void *arg);
+
+  size_t readAtLeast (uint8_t *buf, size_t size, size_t min_size);
+
+  // Waits for up to missing more bytes before a read, per coalesce_policy_
+  void coalesceRead (size_t missing, int64_t timeout_remaining_ms);
+
+  size_t readReceived (uint8_t *buf, size_t size, size_t min_size);
+
+  size_t takeReceived (uint8_t *buf, size_t size);
+
+  // Waits for data in the ring until deadline, false once the receiver has
+  // stopped, with error set to why
+  bool waitReceived (const timespec &deadline, int &error);
+
+  // Wake the consumer after a commit and the receiver after a consume, if
+  // either went to sleep on the ring
+  void notifyReceived ();
+
+  void notifyRingSpace ();
+
+  size_t takePending (uint8_t *buf, size_t size);
+
+  // Throws for a receive thread error code, does nothing for 0
+  static void throwReceiveError (int error);
+
+  // Sends the write batch, keeping what the timeout left over.  Callers
+  // hold the write lock.
+  void flushBatch ();
+
+  // Throws, once, the error a deadline flush ran into
+  void throwBatchError ();
+
+  void startFlusher ();
+
+  void stopFlusher ();
+
+  // Has the flush thread look at the batch at at_ns, CLOCK_MONOTONIC
+  void armFlusher (uint64_t at_ns);
+
+  void flushLoop ();
+
+  static void *flushThread (void *arg);
+
+  void startWriter ();
+
+  // Stops the writer thread once its current write is done, and cancels
+  // the rest.  Must not be called with the write lock held.
+  void stopWriter ();
+
+  void writerLoop ();
+
+  static void *writerThread (void *arg);
+
 private:
   string port_;               // Path to the file descriptor
   int fd_;                    // The current file descriptor
+  // Opens fd_: a DeviceBackend, or a ReplayBackend after setReplay
+  SerialBackend *backend_;
+  bool replay_;
 
   bool is_open_;
   bool xonxoff_;
@@ -207,11 +407,144 @@ private:
   bytesize_t bytesize_;       // Size of the bytes
   stopbits_t stopbits_;       // Stop Bits
   flowcontrol_t flowcontrol_; // Flow Control
+  latency_profile_t latency_profile_; // Receive latency profile
+
+  // Blocking descriptor of the same port, read with kernel VMIN/VTIME
+  // timing when latency_profile_ is latency_low, otherwise -1
+  int rx_block_fd_;
+  bool kernel_timed_reads_;   // VTIME is set for the inter-byte timeout
+
+  // Read coalescing, see setReadCoalescing
+  coalesce_policy_t coalesce_policy_;
+  uint32_t coalesce_max_wait_us_;
+  // Observed nanoseconds per received byte, for coalesce_adaptive
+  uint64_t rx_ns_per_byte_;
+
+  // Activity counters, see getStats.  Readers and the receive thread
+  // update the first set, writers the second; they are kept on separate
+  // cache lines so the two sides do not contend for them.
+  struct RxStats {
+    uint64_t bytes;
+    uint64_t calls;
+    uint64_t zero_reads;
+    uint64_t wakeups;
+    uint64_t timeouts;
+    uint64_t wait_ns;
+    uint64_t lock_waits;
+    uint64_t lock_wait_ns;
+  };
+  struct TxStats {
+    uint64_t bytes;
+    uint64_t calls;
+    uint64_t partial_writes;
+    uint64_t lock_waits;
+    uint64_t lock_wait_ns;
+    uint64_t reconfigurations;
+  };
+  // Padded rather than aligned, see SpscByteRing
+  char stats_pad_before_[64];
+  RxStats rx_stats_;
+  char stats_pad_between_[64];
+  TxStats tx_stats_;
+  char stats_pad_after_[64];
+
+  // Wait engines for the read and write side.  They are separate so that a
+  // reader and a writer can block at the same time, each under its lock.
+  Poller *rx_poller_;
+  Poller *tx_poller_;
+
+  // Bumped before each close of fd_, and the pollers woken after it, see
+  // watchClose
+  uint32_t close_count_;
+  std::vector<Poller *> close_watchers_;
+  pthread_mutex_t close_mutex_;
 
   // Mutex used to lock the read functions
   pthread_mutex_t read_mutex;
   // Mutex used to lock the write functions
   pthread_mutex_t write_mutex;
+
+  // Continuous receive mode, see setContinuousReceive
+  bool rx_enabled_;           // Receive thread requested by the user
+  bool rx_running_;           // Receive thread currently started
+  bool rx_stop_;              // Asks the receive thread to exit
+  int rx_error_;              // errno that stopped the receiver, -1 on EOF
+  size_t rx_capacity_;        // Requested ring capacity in bytes
+  // Data drained from the port.  The receive thread is its producer and
+  // whoever holds the read lock its consumer, neither locks to use it.
+  SpscByteRing rx_ring_;
+  pthread_t rx_thread_;
+  // Mutex guarding the receiver state, and the ring only while a side
+  // sleeps on it
+  pthread_mutex_t rx_mutex_;
+  // Signalled when data is added to the ring or the receiver stops
+  pthread_cond_t rx_data_cond_;
+  // Signalled when the consumer frees space in the ring
+  pthread_cond_t rx_space_cond_;
+  int rx_data_waiters_;       // Threads sleeping on rx_data_cond_
+  bool rx_space_waiting_;     // Receive thread sleeping on rx_space_cond_
+
+  // Write batching, see setWriteBatching.  The batch and its settings are
+  // guarded by the write lock.
+  size_t tx_batch_limit_;       // Queue size that triggers a batch, 0 if off
+  uint32_t tx_batch_deadline_us_; // Longest wait in the queue, 0 for none
+  std::vector<uint8_t> tx_batch_;
+  uint64_t tx_batch_due_ns_;    // When the queued bytes are due
+  int tx_batch_error_;          // errno of a failed deadline flush, -1 EOF
+  // The flush thread sends batches whose deadline passed.  It sleeps on
+  // its own mutex and only ever tries the write lock, so whoever holds the
+  // write lock can stop it.  Finding the lock taken, it raises
+  // tx_flush_on_unlock_ and writeUnlock wakes it.
+  bool tx_flusher_running_;
+  bool tx_flusher_stop_;
+  bool tx_flush_on_unlock_;
+  uint64_t tx_flush_at_ns_;     // Next look at the batch, 0 for none
+  pthread_t tx_flusher_;
+  pthread_mutex_t tx_flush_mutex_;
+  pthread_cond_t tx_flush_cond_;
+
+  // Writes queued by submitWrite, one FIFO per priority, guarded by
+  // tx_queue_mutex_.  The writer thread sends them one at a time under
+  // the write lock.  It is only stopped by the destructor: close may run
+  // with the write lock held, so it just cancels what is queued.
+  struct TxSubmission {
+    uint64_t id;
+    std::vector<uint8_t> data;
+    WriteListener *listener;
+  };
+  std::deque<TxSubmission *> tx_queue_[write_priority_count];
+  size_t tx_queued_;            // Submissions in all of tx_queue_
+  uint64_t tx_next_id_;
+  bool tx_writer_running_;
+  bool tx_writer_stop_;
+  pthread_t tx_writer_;
+  mutable pthread_mutex_t tx_queue_mutex_;
+  pthread_cond_t tx_queue_cond_;
+
+  // Traffic recorder, see startCapture.  It locks for itself, readers, the
+  // receive thread and writers all feed it.
+  CaptureRecorder capture_;
+
+  // Bytes read ahead by readline and pushed back with unread.  Only touched
+  // with the read lock held.
+  std::vector<uint8_t> pending_;
+  size_t pending_pos_;
+  // Bytes left in pending_, for available, waitReadable and hasBuffered,
+  // which run without the read lock.  Stored with the read lock held.
+  size_t pending_count_;
+
+  size_t
+  pendingCount () const
+  {
+    return __atomic_load_n (&pending_count_, __ATOMIC_ACQUIRE);
+  }
+
+  void
+  updatePendingCount ()
+  {
+    __atomic_store_n (&pending_count_, pending_.size () - pending_pos_,
+                      __ATOMIC_RELEASE);
+  }
 };
 
 }
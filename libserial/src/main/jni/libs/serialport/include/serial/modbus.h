@@ -0,0 +1,217 @@
+/*!
+ * \file serial/modbus.h
+ *
+ * \section DESCRIPTION
+ *
+ * Modbus RTU master.  Frame ends are found from the inter-character
+ * silence derived from the port's character time, so a request/response
+ * round trip takes as long as the wire needs and no longer.
+ *
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_MODBUS_H
+#define SERIAL_MODBUS_H
+
+#include <string>
+#include <vector>
+
+#include "serial/serial.h"
+
+namespace serial {
+
+/*!
+ * Thrown when a slave answers with a Modbus exception response.
+ */
+class ModbusException : public std::exception
+{
+  // Disable copy constructors
+  ModbusException& operator=(const ModbusException&);
+  std::string e_what_;
+  uint8_t function_;
+  uint8_t code_;
+public:
+  ModbusException (uint8_t function, uint8_t code)
+    : function_(function), code_(code) {
+      std::stringstream ss;
+      ss << "ModbusException: function 0x" << std::hex
+         << static_cast<int> (function) << " failed with exception code "
+         << std::dec << static_cast<int> (code) << ".";
+      e_what_ = ss.str();
+  }
+  ModbusException (const ModbusException& other)
+    : e_what_(other.e_what_), function_(other.function_), code_(other.code_) {}
+  virtual ~ModbusException() throw() {}
+
+  /*! The function code of the request. */
+  uint8_t getFunction () const { return function_; }
+
+  /*! The exception code, e.g. 2 for an illegal data address. */
+  uint8_t getCode () const { return code_; }
+
+  virtual const char* what () const throw () {
+    return e_what_.c_str();
+  }
+};
+
+/*!
+ * Polls Modbus RTU slaves over an open serial::Serial port.
+ *
+ * Every request holds the port's read and write locks for the whole
+ * exchange, so a port may be shared with other users and one master may be
+ * used from several threads.  Before sending, the master makes sure the
+ * line has been quiet for 3.5 character times; a response ends once its
+ * length is known from its header, or else after 3.5 character times of
+ * silence.  Above 19200 baud the fixed 750 us and 1750 us of the
+ * specification are used for t1.5 and t3.5.
+ *
+ * Responses that fail the CRC or do not answer the request, e.g. late
+ * replies to an earlier request that timed out, are dropped; the request
+ * is sent again after the response timeout, up to the configured number
+ * of retries.
+ */
+class ModbusRtuMaster {
+public:
+  /*!
+   * \param port The port, which must outlive the master.
+   */
+  explicit ModbusRtuMaster (Serial *port);
+
+  /*! How long to wait for the start of a response, in milliseconds.
+   *  Defaults to 1000. */
+  void
+  setResponseTimeout (uint32_t timeout_ms);
+
+  uint32_t
+  getResponseTimeout () const;
+
+  /*! How many times a request is sent again when no valid response
+   *  arrives.  Defaults to 2. */
+  void
+  setRetries (uint32_t retries);
+
+  uint32_t
+  getRetries () const;
+
+  /*! How long to wait after a broadcast, in milliseconds, so the slaves
+   *  can process it.  Defaults to 100. */
+  void
+  setTurnaroundDelay (uint32_t delay_ms);
+
+  /*! Sets a lower bound for the end of frame silence, in microseconds.
+   *
+   * USB adapters deliver received data in bursts a few milliseconds apart,
+   * which looks like silence at t3.5.  Raise this to the adapter's latency
+   * when responses of unknown length get cut short.  Defaults to 0.
+   */
+  void
+  setMinimumSilence (uint32_t silence_us);
+
+  /*! Makes a gap of more than t1.5 inside a frame invalidate it, as the
+   *  specification requires.  Off by default, since few adapters deliver
+   *  bytes with that precision. */
+  void
+  setStrictTiming (bool strict);
+
+  /*! Sends a request PDU and returns the response PDU.
+   *
+   * \param slave The slave address, 0 broadcasts and returns nothing.
+   * \param pdu The function code followed by its data.
+   * \param size The number of bytes at pdu, at most 253.
+   * \param response Receives the function code and data of the response,
+   * it is cleared first.
+   *
+   * \throw serial::ModbusException if the slave returns an exception.
+   * \throw serial::IOException if no valid response arrives.
+   * \throw serial::PortNotOpenedException
+   * \throw std::invalid_argument
+   */
+  void
+  transact (uint8_t slave, const uint8_t *pdu, size_t size,
+            std::vector<uint8_t> &response);
+
+  /*! Reads count coils (function 0x01), one bool per coil in values. */
+  void
+  readCoils (uint8_t slave, uint16_t address, uint16_t count,
+             bool *values);
+
+  /*! Reads count discrete inputs (function 0x02). */
+  void
+  readDiscreteInputs (uint8_t slave, uint16_t address, uint16_t count,
+                      bool *values);
+
+  /*! Reads count holding registers (function 0x03). */
+  void
+  readHoldingRegisters (uint8_t slave, uint16_t address, uint16_t count,
+                        uint16_t *values);
+
+  /*! Reads count input registers (function 0x04). */
+  void
+  readInputRegisters (uint8_t slave, uint16_t address, uint16_t count,
+                      uint16_t *values);
+
+  /*! Writes a single coil (function 0x05). */
+  void
+  writeSingleCoil (uint8_t slave, uint16_t address, bool value);
+
+  /*! Writes a single holding register (function 0x06). */
+  void
+  writeSingleRegister (uint8_t slave, uint16_t address, uint16_t value);
+
+  /*! Writes count coils (function 0x0F). */
+  void
+  writeMultipleCoils (uint8_t slave, uint16_t address, uint16_t count,
+                      const bool *values);
+
+  /*! Writes count holding registers (function 0x10). */
+  void
+  writeMultipleRegisters (uint8_t slave, uint16_t address, uint16_t count,
+                          const uint16_t *values);
+
+private:
+  // Disable copy constructors
+  ModbusRtuMaster (const ModbusRtuMaster&);
+  ModbusRtuMaster& operator= (const ModbusRtuMaster&);
+
+  void
+  readBits (uint8_t function, uint8_t slave, uint16_t address,
+            uint16_t count, bool *values);
+
+  void
+  readRegisters (uint8_t function, uint8_t slave, uint16_t address,
+                 uint16_t count, uint16_t *values);
+
+  // Sends the framed request once and waits for a matching response, the
+  // port's locks must be held.  Returns false if none arrived in time.
+  bool
+  exchange (uint8_t slave, const uint8_t *pdu, size_t size,
+            std::vector<uint8_t> &response);
+
+  // Reads one frame into rx_, false on timeout
+  bool
+  receiveFrame (int64_t deadline_ns, uint64_t t15_ns, uint64_t t35_ns);
+
+  // Waits until the line has been quiet for t3.5, dropping stale input
+  void
+  waitForSilence (uint64_t t35_ns);
+
+  Serial *port_;
+  uint32_t response_timeout_ms_;
+  uint32_t retries_;
+  uint32_t turnaround_delay_ms_;
+  uint32_t minimum_silence_us_;
+  bool strict_timing_;
+
+  // Reused frame buffers, guarded by the port's locks
+  std::vector<uint8_t> tx_;
+  std::vector<uint8_t> rx_;
+  // When data was last seen on the line, CLOCK_MONOTONIC nanoseconds
+  int64_t last_activity_ns_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_MODBUS_H
+
+#endif // !defined(_WIN32)
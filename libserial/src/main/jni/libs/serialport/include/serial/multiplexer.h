@@ -0,0 +1,203 @@
+/*!
+ * \file serial/multiplexer.h
+ *
+ * \section DESCRIPTION
+ *
+ * Waits on many serial ports with a single epoll set, so one thread can
+ * service all of them instead of parking a blocked reader per port.
+ *
+ */
+
+#if !defined(_WIN32)
+
+#ifndef SERIAL_MULTIPLEXER_H
+#define SERIAL_MULTIPLEXER_H
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "serial/serial.h"
+
+namespace serial {
+
+class Poller;
+
+/*!
+ * Dispatches readiness of many serial::Serial ports from one thread.
+ *
+ * Ports are either dispatched to a Listener, by calling dispatch or by
+ * running the multiplexer's own thread with start, or polled select style
+ * with select.  Only one thread may call dispatch or select at a time.
+ *
+ * A registered port must not use continuous receive mode since its
+ * receive thread already owns the descriptor.  Closing a registered port,
+ * which setPort and setReplay do too, ends its registration: dispatch
+ * reports it to onError and select returns it one last time.  Add it
+ * again once it is open.
+ */
+class SerialMultiplexer {
+public:
+  /*!
+   * Receives the events of one registered port.  Callbacks run on the
+   * dispatching thread and may call add and remove, including removing the
+   * port being dispatched.
+   */
+  class Listener {
+  public:
+    virtual ~Listener () {}
+
+    /*! Called when port has data.  The default reads everything available
+     *  with serial::Serial::readAvailable and passes it to onData; override
+     *  it to read from the port yourself. */
+    virtual void
+    onReadable (Serial &port);
+
+    /*! Called by the default onReadable with the data it read. */
+    virtual void
+    onData (Serial &port, const uint8_t *data, size_t size);
+
+    /*! Called once when the port hangs up, reading from it fails or it is
+     *  closed.  The port has already been removed from the multiplexer. */
+    virtual void
+    onError (Serial &port, const std::string &message);
+  };
+
+  /*!
+   * \throw serial::IOException if the epoll set cannot be created.
+   */
+  SerialMultiplexer ();
+
+  /*! Stops the dispatch thread if running.  Ports are not closed. */
+  virtual ~SerialMultiplexer ();
+
+  /*! Registers an open port.
+   *
+   * \param port The port, which must outlive its registration.
+   * \param listener Receives the port's events from dispatch, may be NULL
+   * if the port is only used with select.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw std::invalid_argument if the port is already registered or is in
+   * continuous receive mode.
+   * \throw serial::IOException
+   */
+  void
+  add (Serial *port, Listener *listener);
+
+  /*! Unregisters a port.  Does nothing if it is not registered.
+   *
+   * When called from another thread while the port's listener is running,
+   * this waits for the callback to return, so the listener may be
+   * destroyed afterwards.
+   */
+  void
+  remove (Serial *port);
+
+  /*! Returns the number of registered ports. */
+  size_t
+  size ();
+
+  /*! Waits for ports to become readable.
+   *
+   * Ports holding data the descriptor cannot show, e.g. bytes left over by
+   * readline, are reported without waiting.  A port that hung up or was
+   * closed is reported one last time and removed, reading it then returns
+   * no data or throws.
+   *
+   * \param timeout_ms How long to wait, -1 waits forever.
+   * \param ready Receives the ready ports, it is cleared first.
+   *
+   * \return The number of ready ports, 0 on timeout or wakeup.
+   *
+   * \throw serial::IOException
+   */
+  size_t
+  select (int timeout_ms, std::vector<Serial *> &ready);
+
+  /*! Waits once for ports to become readable and calls their listeners.
+   *
+   * \param timeout_ms How long to wait, -1 waits forever.
+   *
+   * \return The number of ports dispatched, 0 on timeout or wakeup.
+   *
+   * \throw serial::IOException
+   */
+  size_t
+  dispatch (int timeout_ms);
+
+  /*! Runs dispatch in a thread owned by the multiplexer until stop.
+   *
+   * \throw serial::SerialException if already running.
+   */
+  void
+  start ();
+
+  /*! Stops and joins the thread started by start. */
+  void
+  stop ();
+
+  bool
+  isRunning ();
+
+  /*! Makes a pending select or dispatch return early. */
+  void
+  wakeup ();
+
+private:
+  // Disable copy constructors
+  SerialMultiplexer (const SerialMultiplexer&);
+  SerialMultiplexer& operator= (const SerialMultiplexer&);
+
+  struct Entry {
+    Serial *port;
+    Listener *listener;
+    int fd;
+    uint32_t close_count;       // The port's close count when added
+    bool removed;
+  };
+
+  // Whether entry's port was closed since it was added, its descriptor and
+  // so its registration in poller_ are gone then.
+  bool
+  isClosed (Entry *entry) const;
+
+  // Whether entry is still registered, mutex_ must be held.  Compares
+  // pointers only, entry may already be freed.
+  bool
+  isRegistered (Entry *entry) const;
+
+  size_t
+  wait (int timeout_ms, std::vector<Entry *> &ready,
+        std::vector<uint32_t> &events);
+
+  void
+  dispatchEntry (Entry *entry, uint32_t events);
+
+  void
+  fail (Entry *entry, const std::string &message);
+
+  static void *
+  run (void *self);
+
+  Poller *poller_;
+
+  std::map<Serial *, Entry *> entries_;
+  // Entry being dispatched and the thread doing it
+  Entry *current_;
+  pthread_t current_thread_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t idle_cond_;
+
+  pthread_t thread_;
+  bool running_;
+  bool stop_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_MULTIPLEXER_H
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,104 @@
+/*!
+ * \file serial/pattern_set.h
+ *
+ * \section DESCRIPTION
+ *
+ * A set of byte patterns compiled into an Aho-Corasick automaton, for
+ * serial::Serial::readUntilAny to wait for whichever of several responses
+ * comes first.
+ *
+ */
+
+#ifndef SERIAL_PATTERN_SET_H
+#define SERIAL_PATTERN_SET_H
+
+#include <string>
+#include <vector>
+
+#include <serial/v8stdint.h>
+
+namespace serial {
+
+/*!
+ * Patterns searched for in one pass over a byte stream.
+ *
+ * The patterns are compiled once, in the constructor, into a deterministic
+ * automaton with a full transition table.  Bytes that occur in no pattern
+ * share one column, so the table has a row per pattern prefix and a column
+ * per distinct pattern byte plus one.  Scanning costs two table lookups per
+ * byte whatever the number of patterns, and a scan can stop and resume
+ * anywhere, so the stream may arrive in chunks of any size.
+ *
+ * Objects are immutable once constructed and may be shared by threads.
+ */
+class PatternSet {
+public:
+  /*!
+   * \param patterns The patterns, at most 65534 bytes in total.  Duplicates
+   * keep the lower index.
+   *
+   * \throw std::invalid_argument if there are no patterns, one is empty, or
+   * they are too long.
+   */
+  explicit PatternSet (const std::vector<std::string> &patterns);
+
+  /*! Number of patterns. */
+  size_t
+  size () const { return patterns_.size (); }
+
+  /*! The pattern at index. */
+  const std::string &
+  pattern (size_t index) const { return patterns_[index]; }
+
+  /*!
+   * Where a scan of a stream stands, carried from one chunk to the next.
+   * A new stream starts with a default constructed one.
+   */
+  struct ScanState {
+    ScanState () : node (0), fed (0), match (-1), match_start (0),
+                   match_end (0) {}
+    uint32_t node;              //!< Automaton state
+    size_t fed;                 //!< Bytes fed since the stream started
+    int match;                  //!< Best match so far, -1 for none
+    size_t match_start;         //!< Stream offset of its first byte
+    size_t match_end;           //!< Stream offset just past its last byte
+  };
+
+  /*! Feeds bytes to the automaton until a match is settled.
+   *
+   * Of the matches in the stream the one starting first wins, and of
+   * those the longest, so with "ERROR" and "+CME ERROR:" in the set the
+   * input "+CME ERROR: 10" matches "+CME ERROR:".  A match is settled once
+   * the bytes after it show that no such longer or earlier one can still
+   * complete.  Until then it is kept in state.match, and a caller that
+   * gets no more input may take it as it is.
+   *
+   * \param data The next bytes of the stream.
+   * \param size The number of bytes at data.
+   * \param state The scan state, updated so the next call continues where
+   * this one stopped.  On a settled match, state.match_start and
+   * state.match_end locate it in the stream; bytes the scan looked at past
+   * match_end are counted in state.fed.
+   *
+   * \return The index of the settled match, or -1 if data ran out first.
+   */
+  int
+  scan (const uint8_t *data, size_t size, ScanState &state) const;
+
+private:
+  std::vector<std::string> patterns_;
+  // Column of every byte value in next_, 0 for bytes in no pattern
+  uint16_t byte_class_[256];
+  size_t class_count_;
+  // next_[state * class_count_ + class] is the state after that byte
+  std::vector<uint16_t> next_;
+  // Longest pattern ending in each state plus one, 0 for none
+  std::vector<uint16_t> match_;
+  // Length of the longest input suffix in each state that a pattern can
+  // still grow from, 0 for none
+  std::vector<uint16_t> grow_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_PATTERN_SET_H
@@ -89,6 +89,93 @@ typedef enum {
   flowcontrol_hardware
 } flowcontrol_t;
 
+/*!
+ * Enumeration defines the receive latency profiles for the serial port,
+ * see Serial::setLatencyProfile.
+ */
+typedef enum {
+  latency_default = 0,
+  latency_low,
+  latency_throughput
+} latency_profile_t;
+
+/*!
+ * Enumeration defines how multi-byte reads wait for the rest of their
+ * data, see Serial::setReadCoalescing.
+ */
+typedef enum {
+  coalesce_fixed = 0,
+  coalesce_none,
+  coalesce_adaptive
+} coalesce_policy_t;
+
+/*!
+ * Enumeration defines the calls whose latency is kept, see
+ * Serial::getLatency.
+ */
+typedef enum {
+  latency_op_read = 0,
+  latency_op_write,
+  latency_op_readline,
+  latency_op_flush,
+  latency_op_count
+} latency_op_t;
+
+/*!
+ * Enumeration defines the order in which writes queued with
+ * Serial::submitWrite are sent, lower values go first.
+ */
+typedef enum {
+  write_priority_control = 0,
+  write_priority_normal,
+  write_priority_bulk,
+  write_priority_count
+} write_priority_t;
+
+/*!
+ * Enumeration defines how a write queued with Serial::submitWrite ended.
+ */
+typedef enum {
+  write_done = 0,       //!< Every byte was written
+  write_timed_out,      //!< The write timeout passed with bytes left over
+  write_failed,         //!< Writing threw, the port failed or was closed
+  write_cancelled       //!< Dropped from the queue before it was started
+} write_status_t;
+
+/*!
+ * Snapshot of a port's activity counters, see Serial::getStats.  The
+ * counters start at zero when the Serial is created and only grow, so
+ * rates come from the difference of two snapshots.
+ */
+struct PortStats {
+  uint64_t bytes_read;          //!< Bytes read from the port
+  uint64_t bytes_written;       //!< Bytes written to the port
+  uint64_t read_calls;          //!< ::read system calls
+  uint64_t write_calls;         //!< ::write system calls
+  uint64_t zero_reads;          //!< Reads that returned no data
+  uint64_t partial_writes;      //!< Writes that took less than offered
+  uint64_t wait_wakeups;        //!< Waits for data that ended readable
+  uint64_t wait_timeouts;       //!< Waits for data that timed out
+  uint64_t wait_ns;             //!< Time blocked in waitReadable
+  uint64_t reconfigurations;    //!< Times the termios settings were applied
+  uint64_t read_lock_waits;     //!< Contended acquisitions of the read lock
+  uint64_t read_lock_wait_ns;   //!< Time spent waiting for the read lock
+  uint64_t write_lock_waits;    //!< Contended acquisitions of the write lock
+  uint64_t write_lock_wait_ns;  //!< Time spent waiting for the write lock
+};
+
+/*!
+ * Timing of one Serial::transact exchange.  Times are nanoseconds since
+ * transact was called, on the CLOCK_MONOTONIC clock.
+ */
+struct TransactTiming {
+  uint64_t locked_ns;           //!< Both of the port's locks were held
+  uint64_t request_ns;          //!< The kernel had the whole request
+  uint64_t first_byte_ns;       //!< First response byte was read, 0 if none
+  uint64_t complete_ns;         //!< The response was complete, or gave up
+  size_t bytes_discarded;       //!< Malformed input the matcher skipped
+};
+
 /*!
  * Structure for setting the timeout of the serial port, times are
  * in milliseconds.
@@ -141,6 +228,93 @@ struct Timeout {
   {}
 };
 
+/*!
+ * A view of caller owned bytes, in the spirit of std::span.
+ *
+ * The Serial overloads taking a span read into or write from the caller's
+ * memory directly, so a buffer that is reused across calls makes the steady
+ * state free of allocations.  A span never owns or resizes its memory.
+ */
+template <typename T>
+class BasicByteSpan {
+public:
+  BasicByteSpan () : data_ (NULL), size_ (0) {}
+
+  BasicByteSpan (T *data, size_t size) : data_ (data), size_ (size) {}
+
+  template <size_t N>
+  BasicByteSpan (T (&array)[N]) : data_ (array), size_ (N) {}
+
+  /*! Spans the current size of the vector, not its capacity. */
+  template <typename Alloc>
+  BasicByteSpan (std::vector<uint8_t, Alloc> &v)
+    : data_ (v.empty () ? NULL : &v[0]), size_ (v.size ()) {}
+
+  template <typename Alloc>
+  BasicByteSpan (const std::vector<uint8_t, Alloc> &v)
+    : data_ (v.empty () ? NULL : &v[0]), size_ (v.size ()) {}
+
+  /*! Allows a mutable span where a const one is expected. */
+  template <typename U>
+  BasicByteSpan (const BasicByteSpan<U> &other)
+    : data_ (other.data ()), size_ (other.size ()) {}
+
+  T *
+  data () const { return data_; }
+
+  size_t
+  size () const { return size_; }
+
+  bool
+  empty () const { return size_ == 0; }
+
+  /*! The part starting at offset, at most count bytes long. */
+  BasicByteSpan
+  subspan (size_t offset, size_t count = static_cast<size_t> (-1)) const
+  {
+    if (offset > size_) {
+      offset = size_;
+    }
+    if (count > size_ - offset) {
+      count = size_ - offset;
+    }
+    return BasicByteSpan (data_ + offset, count);
+  }
+
+private:
+  T *data_;
+  size_t size_;
+};
+
+typedef BasicByteSpan<uint8_t> ByteSpan;
+typedef BasicByteSpan<const uint8_t> ConstByteSpan;
+
+class Framer;
+class LatencyHistogram;
+class PatternSet;
+
+/*!
+ * Receives the outcome of writes queued with Serial::submitWrite.
+ */
+class WriteListener {
+public:
+  virtual ~WriteListener () {}
+
+  /*! Called once for every submission.
+   *
+   * Runs on the port's writer thread, or on the thread that cancelled the
+   * write, with none of the port's locks held.  It should return quickly,
+   * the next queued write waits for it.
+   *
+   * \param id The id submitWrite returned.
+   * \param status How the write ended.
+   * \param written Bytes that were written, fewer than submitted unless
+   * status is write_done.
+   */
+  virtual void
+  onWriteComplete (uint64_t id, write_status_t status, size_t written) = 0;
+};
+
 /*!
  * Class that provides a portable serial port interface.
  */
@@ -278,6 +452,39 @@ public:
   size_t
   read (std::vector<uint8_t> &buffer, size_t size = 1);
 
+  /*! Read into caller owned memory, up to the size of the span.
+   *
+   * Behaves like read(uint8_t *, size_t), see there for when it returns.
+   *
+   * \param buffer The memory to fill, which is not resized.
+   *
+   * \return A size_t representing the number of bytes read as a result of the
+   *         call to read.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException
+   */
+  size_t
+  read (ByteSpan buffer);
+
+  /*! Read whatever data can be had without waiting.
+   *
+   * Unlike read, this never waits for data to arrive and ignores the
+   * timeouts.  It is meant for callers that already know the port is
+   * readable, such as a serial::SerialMultiplexer listener.
+   *
+   * \param buffer An uint8_t array of at least the requested size.
+   * \param size A size_t defining the most bytes to be read.
+   *
+   * \return The number of bytes read, possibly 0.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException
+   * \throw serial::IOException
+   */
+  size_t
+  readAvailable (uint8_t *buffer, size_t size);
+
   /*! Read a given amount of bytes from the serial port into a give buffer.
    *
    * \param buffer A reference to a std::string.
@@ -309,6 +516,9 @@ public:
    *
    * Reads from the serial port until a single line has been read.
    *
+   * Data is pulled in as large chunks as are available; bytes received
+   * after the end of the line are kept and returned by the next read.
+   *
    * \param buffer A std::string reference used to store the data.
    * \param size A maximum length of a line, defaults to 65536 (2^16)
    * \param eol A string to match against for the EOL.
@@ -336,6 +546,23 @@ public:
   std::string
   readline (size_t size = 65536, std::string eol = "\n");
 
+  /*! Reads in a line into caller owned memory.
+   *
+   * Like readline(std::string &, size_t, std::string), with the size of the
+   * span as the maximum length of the line.
+   *
+   * \param buffer The memory to fill, which is not resized.
+   * \param eol A string to match against for the EOL.
+   *
+   * \return A size_t representing the number of bytes read, including the
+   * EOL if one was found.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException
+   */
+  size_t
+  readline (ByteSpan buffer, const std::string &eol = "\n");
+
   /*! Reads in multiple lines until the serial port times out.
    *
    * This requires a timeout > 0 before it can be run. It will read until a
@@ -353,6 +580,98 @@ public:
   std::vector<std::string>
   readlines (size_t size = 65536, std::string eol = "\n");
 
+  /*! Sets the frame extractor used by readFrame and writeFrame.
+   *
+   * \param framer The framer, the Serial object takes ownership of it and
+   * deletes the previous one.  NULL removes the framer.
+   */
+  void
+  setFramer (Framer *framer);
+
+  /*! Returns the framer set with setFramer, or NULL. */
+  Framer *
+  getFramer () const;
+
+  /*! Reads exactly one complete frame.
+   *
+   * Data is read in bulk and split by the framer, bytes past the end of the
+   * frame are kept for the next read.  Malformed input is skipped.  Like
+   * readline, this gives up when reading the next chunk times out; the
+   * bytes of a partial frame are kept so a later call can complete it.
+   *
+   * \param frame Receives the decoded frame, it is cleared first.
+   *
+   * \return true if a frame was read, false on timeout.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException if no framer is set.
+   */
+  bool
+  readFrame (std::vector<uint8_t> &frame);
+
+  /*! Writes a request and reads its response in one call.
+   *
+   * Both locks are held for the whole exchange, so no other reader or
+   * writer can get between the request and its response.  Bytes queued by
+   * write batching go out before the request, which itself is written
+   * directly.  The response is read in bulk and split by matcher like
+   * readFrame does: a DelimiterFramer waits for a terminator, a
+   * FixedLengthFramer or LengthFieldFramer for a length.  Bytes past the
+   * end of the response are kept for the next read.
+   *
+   * \param request The bytes to send.
+   * \param size Number of bytes in request.
+   * \param matcher Decides when the response is complete, NULL for the
+   * framer set with setFramer.
+   * \param response Receives the response as the matcher decodes it, it
+   * is cleared first.
+   * \param deadline_ms Time from the call until the response must be
+   * complete, in milliseconds.  It replaces the read timeout, the write
+   * timeout still applies to the request.
+   * \param flush_input Whether to drop any input received before the
+   * request, e.g. a late response to an earlier one.
+   * \param timing Receives when each step happened, or NULL.
+   *
+   * \return true if a complete response was read, false if the deadline
+   * passed first.  A partial response is kept for a later read.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException if matcher is NULL and no framer is set.
+   * \throw serial::IOException if the request could not be sent in time.
+   */
+  bool
+  transact (const uint8_t *request, size_t size, const Framer *matcher,
+            std::vector<uint8_t> &response, uint32_t deadline_ms,
+            bool flush_input = false, TransactTiming *timing = NULL);
+
+  /*! Reads until one of several patterns arrives.
+   *
+   * Data is read in bulk and fed through the patterns' automaton as it
+   * comes, so the time spent matching is linear in the input whatever the
+   * number of patterns.  The match starting first wins, and of those the
+   * longest, as described at PatternSet::scan.  A match that a longer one
+   * may still extend is only reported when the next bytes rule that out
+   * or the deadline passes.  Bytes after the match are kept for the next
+   * read.
+   *
+   * \param patterns The patterns to wait for.
+   * \param before Receives the bytes that came before the match, it is
+   * cleared first.  On timeout it holds everything that was read.
+   * \param deadline_ms Time from the call until a pattern must have
+   * arrived, in milliseconds.  It replaces the read timeout.  With 0, only
+   * data that has already arrived is searched.
+   *
+   * \return The index of the pattern that matched, or -1 if the deadline
+   * passed first.  Then the bytes read are also kept for the next read.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::IOException
+   * \throw serial::SerialException
+   */
+  int
+  readUntilAny (const PatternSet &patterns, std::vector<uint8_t> &before,
+                uint32_t deadline_ms);
+
   /*! Write a string to the serial port.
    *
    * \param data A const reference containing the data to be written
@@ -386,6 +705,20 @@ public:
   size_t
   write (const std::vector<uint8_t> &data);
 
+  /*! Write the bytes of a span to the serial port.
+   *
+   * \param data The caller owned bytes to be written.
+   *
+   * \return A size_t representing the number of bytes actually written to
+   * the serial port.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException
+   * \throw serial::IOException
+   */
+  size_t
+  write (ConstByteSpan data);
+
   /*! Write a string to the serial port.
    *
    * \param data A const reference containing the data to be written
@@ -401,6 +734,21 @@ public:
   size_t
   write (const std::string &data);
 
+  /*! Encodes a payload with the framer and writes the frame.
+   *
+   * \param payload The frame contents.
+   * \param size The number of bytes at payload.
+   *
+   * \return The number of bytes written to the port, including framing.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::SerialException if no framer is set.
+   * \throw serial::IOException
+   * \throw std::invalid_argument if the framer cannot encode the payload.
+   */
+  size_t
+  writeFrame (const uint8_t *payload, size_t size);
+
   /*! Sets the serial port identifier.
    *
    * \param port A const std::string reference containing the address of the
@@ -421,6 +769,35 @@ public:
   std::string
   getPort () const;
 
+  /*! Makes the port play back a capture file instead of opening a device.
+   *
+   * The port then reads the received data of the capture (see
+   * serial/capture.h and Serial::startCapture) through a pseudo terminal,
+   * chunk by chunk as it was recorded, and everything written to it is
+   * dropped.  All reads, waits, framers, continuous receive and so on work
+   * as with a device, so parsers can be tested and benchmarked without
+   * hardware and with the same input every time.  Once the port has read
+   * the last chunk it sees a hangup, as if the adapter was unplugged.
+   * Each open starts the capture over.  setPort goes back to a device.
+   *
+   * Like setPort, this closes the port if it is open and reopens it with
+   * the capture.
+   *
+   * \param capture Path of the capture file; getPort returns it.
+   * \param speed 1 to keep the recorded gaps between chunks, 2 to halve
+   * them and so on, 0 to send every chunk as soon as the port can take it.
+   *
+   * \throw std::invalid_argument if speed is negative.
+   * \throw serial::IOException if the port is reopened and the file is not
+   * a capture.
+   */
+  void
+  setReplay (const std::string &capture, double speed = 1.0);
+
+  /*! Returns true if the port plays back a capture, see setReplay. */
+  bool
+  isReplay () const;
+
   /*! Sets the timeout for reads and writes using the Timeout struct.
    *
    * There are two timeout conditions described here:
@@ -584,6 +961,250 @@ public:
   flowcontrol_t
   getFlowcontrol () const;
 
+  /*! Trades receive latency against system calls and interrupt load.
+   *
+   * latency_low sets the driver's ASYNC_LOW_LATENCY flag, so received data
+   * is pushed to the tty layer at once (USB adapters such as the FTDI ones
+   * drop their latency timer to 1 ms).  Multi-byte reads with an
+   * inter-byte timeout of 100 ms or more are then timed by the kernel
+   * through VMIN/VTIME: one system call returns as soon as the requested
+   * bytes are in, or once the line has been idle for the inter-byte
+   * timeout, rounded to tenths of a second.  Reads without an inter-byte
+   * timeout no longer sleep for the missing bytes before reading.
+   *
+   * latency_throughput clears ASYNC_LOW_LATENCY and keeps waiting for
+   * multi-byte reads to fill up, so fewer, larger reads are made.
+   *
+   * latency_default, the default, leaves the driver flag as it is and
+   * behaves like latency_throughput otherwise.
+   *
+   * Drivers without TIOCGSERIAL, e.g. ptys, only get the read behaviour.
+   *
+   * \param profile The profile.
+   *
+   * \throw serial::IOException
+   */
+  void
+  setLatencyProfile (latency_profile_t profile);
+
+  /*! Gets the receive latency profile.
+   *
+   * \see Serial::setLatencyProfile
+   */
+  latency_profile_t
+  getLatencyProfile () const;
+
+  /*! Sets how a read without an inter-byte timeout waits for its data.
+   *
+   * Once the first bytes of such a read are in, waiting for the rest
+   * before reading saves system calls, at the price of latency when the
+   * device goes quiet before the read is satisfied.
+   *
+   * coalesce_fixed, the default, sleeps for as many character times as
+   * bytes are missing.  coalesce_none reads whatever has arrived at once.
+   * coalesce_adaptive sleeps in steps of at most 32 characters, timed by
+   * the arrival rate observed on the port, and stops waiting as soon as a
+   * step brings no new data.
+   *
+   * Has no effect with the latency_low profile, which never waits.
+   *
+   * \param policy The policy.
+   * \param max_wait_us Upper bound for one wait in microseconds, 0 for
+   * none.  Waits never go past the read timeout.
+   */
+  void
+  setReadCoalescing (coalesce_policy_t policy, uint32_t max_wait_us = 0);
+
+  /*! Gets the read coalescing policy.
+   *
+   * \see Serial::setReadCoalescing
+   */
+  coalesce_policy_t
+  getReadCoalescing () const;
+
+  /*! Gets the bound for one coalescing wait in microseconds, 0 for none.
+   *
+   * \see Serial::setReadCoalescing
+   */
+  uint32_t
+  getReadCoalescingMaxWait () const;
+
+  /*! Queues small writes and sends them to the port in batches.
+   *
+   * While batching is on, write appends its bytes to a queue and returns
+   * at once, counting them as written.  The queue goes out in one ::write
+   * once it holds max_bytes, once deadline_us has passed since its first
+   * byte was queued, or when flushWrites or flush is called.  A write that
+   * does not fit sends the queue first, and one of max_bytes or more then
+   * goes out directly.  Writes stay in order either way.
+   *
+   * The write timeout applies to every batch.  Bytes a batch could not
+   * send in time stay queued; a write finding the queue still too full
+   * after that returns 0.  When a deadline flush fails, the queued bytes
+   * are dropped and the next write or flushWrites throws the error.
+   *
+   * \param max_bytes Queue size that triggers a batch, 0 to turn batching
+   * off (the default).  Bytes still queued are sent first.
+   * \param deadline_us Longest time a byte waits in the queue in
+   * microseconds, 0 to wait for max_bytes or flushWrites only.
+   *
+   * \throw serial::IOException, serial::SerialException if sending the
+   * queued bytes fails.
+   */
+  void
+  setWriteBatching (size_t max_bytes, uint32_t deadline_us = 1000);
+
+  /*! Gets the queue size that triggers a batch, 0 when batching is off.
+   *
+   * \see Serial::setWriteBatching
+   */
+  size_t
+  getWriteBatchSize () const;
+
+  /*! Gets the longest time a byte waits in the write queue, in
+   *  microseconds.
+   *
+   * \see Serial::setWriteBatching
+   */
+  uint32_t
+  getWriteBatchDeadline () const;
+
+  /*! Sends the bytes queued by write batching now, within the write
+   *  timeout.  Does nothing when batching is off.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw serial::IOException, serial::SerialException if sending fails,
+   * or a deadline flush failed since the last write.
+   */
+  void
+  flushWrites ();
+
+  /*! Queues a write and returns without waiting for the port.
+   *
+   * The bytes are copied and sent by a native writer thread the port
+   * starts on first use.  It always takes the oldest write of the most
+   * urgent priority next, so control frames overtake queued bulk data;
+   * a write it has started is finished first, writes are never split.
+   * Each write is a regular write under the write lock: it has the write
+   * timeout, goes through write batching and stays whole with respect to
+   * other writers.
+   *
+   * Closing the port cancels the writes that have not started yet.
+   *
+   * \param data The bytes to write.
+   * \param size Number of bytes in data.
+   * \param priority Where the write goes in the queue.
+   * \param listener Told when the write is finished, or NULL.  Must stay
+   * valid until then.
+   *
+   * \return The id of the write, passed to the listener, never 0.
+   *
+   * \throw serial::PortNotOpenedException
+   * \throw std::invalid_argument
+   * \throw serial::IOException if the writer thread cannot be started.
+   */
+  uint64_t
+  submitWrite (const uint8_t *data, size_t size,
+               write_priority_t priority = write_priority_normal,
+               WriteListener *listener = NULL);
+
+  /*! Cancels every queued write that has not started yet.  Their
+   *  listeners are called with write_cancelled before this returns. */
+  void
+  cancelWrites ();
+
+  /*! Returns the number of queued writes that have not started yet. */
+  size_t
+  getQueuedWrites () const;
+
+  /*! Returns the port's activity counters.
+   *
+   * The counters are kept with relaxed atomic adds and are always on.
+   * A snapshot does not take the port's locks, so its fields may be from
+   * slightly different instants.
+   */
+  PortStats
+  getStats () const;
+
+  /*! Copies the latency distribution of a kind of call.
+   *
+   * Every read, write, readline and flush records how long it took,
+   * waiting for the port's lock included, in nanoseconds.  Snapshots of
+   * several ports can be merged with LatencyHistogram::add.
+   *
+   * \param op The kind of call.
+   * \param snapshot Receives the distribution.
+   * \param reset Whether to start a new time window, see
+   * LatencyHistogram::copyTo.
+   *
+   * \throw std::invalid_argument
+   */
+  void
+  getLatency (latency_op_t op, LatencyHistogram &snapshot, bool reset = false);
+
+  /*! Forgets the recorded latencies of all calls. */
+  void
+  resetLatency ();
+
+  /*! Starts recording the port's traffic to a capture file.
+   *
+   * Every chunk the port reads or writes is recorded with a monotonic
+   * timestamp, as is the configuration now and whenever it changes.  Bytes
+   * read ahead and pushed back by readline are recorded once, when they
+   * come off the port.  Records are copied to memory and written to the
+   * file in batches by a thread of the recorder; see serial/capture.h for
+   * the format.  Recording survives closing and reopening the port.
+   *
+   * \param path The capture file, created if needed, appended to if it
+   * already is one.
+   *
+   * \throw serial::SerialException if already recording.
+   * \throw serial::IOException if the file cannot be used.
+   */
+  void
+  startCapture (const std::string &path);
+
+  /*! Writes out the records still in memory and stops recording.  Does
+   *  nothing if not recording.
+   *
+   * \throw serial::IOException if writing the file failed since
+   * startCapture; recording stopped at that point.
+   */
+  void
+  stopCapture ();
+
+  /*! Returns true while traffic is being recorded. */
+  bool
+  isCapturing () const;
+
+  /*! Enables or disables continuous receive mode.
+   *
+   * In continuous receive mode a dedicated native thread drains the port
+   * into a ring buffer as soon as data arrives, independent of how often
+   * read is called.  read, readline, readlines, available and waitReadable
+   * are then served from that ring, with the same timeout semantics.
+   *
+   * If the ring fills up the thread stops draining the port until the
+   * application catches up, at which point the driver's own buffer (and
+   * flow control, if enabled) takes over.
+   *
+   * The mode survives close and open, the thread only runs while the port
+   * is open.  Data still in the ring when the mode is disabled is returned
+   * by subsequent reads.
+   *
+   * \param enabled true to start the receive thread, false to stop it.
+   * \param buffer_size Capacity of the ring buffer in bytes.
+   *
+   * \throw std::invalid_argument
+   * \throw serial::IOException
+   */
+  void
+  setContinuousReceive (bool enabled, size_t buffer_size = 65536);
+
+  /*! Returns true if continuous receive mode is enabled. */
+  bool
+  isContinuousReceive () const;
+
   /*! Flush the input and output buffers */
   void
   flush ();
@@ -658,12 +1279,34 @@ private:
   class ScopedReadLock;
   class ScopedWriteLock;
 
+  // Needs the descriptor and buffered state of registered ports
+  friend class SerialMultiplexer;
+  // Holds both locks and watches line silence for a whole exchange
+  friend class ModbusRtuMaster;
+
   // Read common function
   size_t
   read_ (uint8_t *buffer, size_t size);
+  // Readline common function, the read lock must be held
+  size_t
+  readline_ (uint8_t *buffer, size_t size, const std::string &eol);
   // Write common function
   size_t
   write_ (const uint8_t *data, size_t length);
+  // Appends one chunk that arrives before deadline_ns to buffer, or that
+  // has already arrived once it passed, else returns 0.  The read lock
+  // must be held, buffer is pushed back on error.
+  size_t
+  readBefore_ (std::vector<uint8_t> &buffer, uint64_t deadline_ns);
+
+  // Set with setFramer, replaced only with both locks held
+  Framer *framer_;
+  // Latency of each latency_op_t, see getLatency
+  LatencyHistogram *latency_;
+  // Bytes being split into frames, guarded by the read lock
+  std::vector<uint8_t> frame_rx_;
+  // Frame being encoded, guarded by the write lock
+  std::vector<uint8_t> frame_tx_;
 
 };
 
@@ -763,7 +1406,13 @@ struct PortInfo {
  * Returns a vector of available serial ports, each represented
  * by a serial::PortInfo data structure:
  *
- * \return vector of serial::PortInfo.
+ * On Linux the first call enumerates the ports and keeps them in memory,
+ * later calls are answered from there.  Device nodes that appear or go
+ * away are picked up by watching /dev with inotify, a moment after udev or
+ * ueventd creates or removes them.  Where /dev cannot be watched every
+ * call enumerates again.
+ *
+ * \return vector of serial::PortInfo, sorted by port.
  */
 std::vector<PortInfo>
 list_ports();
@@ -0,0 +1,121 @@
+/*!
+ * \file serial/spsc_ring.h
+ *
+ * \section DESCRIPTION
+ *
+ * Lock-free single producer, single consumer byte ring used to hand data
+ * read from a port over to the threads consuming it.
+ *
+ */
+
+#ifndef SERIAL_SPSC_RING_H
+#define SERIAL_SPSC_RING_H
+
+#include <serial/v8stdint.h>
+#include <stddef.h>
+
+namespace serial {
+
+/*!
+ * Fixed capacity byte ring shared by exactly one producer thread and one
+ * consumer thread without locks.
+ *
+ * Both sides work on contiguous spans so data can be moved with a single
+ * ::read or memcpy: the producer asks for free space with writeSpan, fills
+ * it and publishes it with commit; the consumer looks at the oldest data
+ * with peek and releases it with consume.  Publishing is a release store of
+ * the position, so whatever the producer wrote into a span is visible to
+ * the consumer once it sees the commit, and likewise for consumed space.
+ *
+ * The producer and consumer positions live on separate cache lines, each
+ * next to a cached copy of the other side's position, so the two threads
+ * only touch each other's line when the cached copy says the ring looks
+ * full or empty.
+ *
+ * reset and the destructor must not run concurrently with anything else.
+ * size may be called from any thread, its result is a snapshot.
+ */
+class SpscByteRing {
+public:
+  SpscByteRing ();
+
+  ~SpscByteRing ();
+
+  /*! Drops any data and resizes the ring to hold capacity bytes. */
+  void
+  reset (size_t capacity);
+
+  /*! Number of bytes the ring holds when full. */
+  size_t
+  capacity () const
+  {
+    return capacity_;
+  }
+
+  /*! Number of bytes waiting to be consumed. */
+  size_t
+  size () const;
+
+  /*! Producer: returns the largest contiguous free region following the
+   *  data, and its length in length; NULL and 0 when the ring is full. */
+  uint8_t *
+  writeSpan (size_t &length);
+
+  /*! Producer: publishes length bytes of the last write span. */
+  void
+  commit (size_t length);
+
+  /*! Producer: copies as much of data as fits, returns the bytes copied. */
+  size_t
+  put (const uint8_t *data, size_t length);
+
+  /*! Consumer: returns the oldest contiguous run of data and its length in
+   *  length; NULL and 0 when the ring is empty.  The data stays in the ring
+   *  until consumed. */
+  const uint8_t *
+  peek (size_t &length);
+
+  /*! Consumer: releases the first length bytes, at most what peek and size
+   *  reported. */
+  void
+  consume (size_t length);
+
+  /*! Consumer: moves up to size bytes from the front of the ring into buf. */
+  size_t
+  take (uint8_t *buf, size_t size);
+
+  /*! Consumer: drops all data published so far. */
+  void
+  discard ();
+
+private:
+  // Disable copy constructors
+  SpscByteRing (const SpscByteRing&);
+  SpscByteRing& operator= (const SpscByteRing&);
+
+  // Positions run freely and wrap at SIZE_MAX; the storage is a power of
+  // two so position & mask_ stays right across the wrap.  capacity_ may be
+  // smaller than the storage, it is what limits the fill level.
+  uint8_t *storage_;
+  size_t mask_;
+  size_t capacity_;
+
+  // A full cache line of padding between the groups keeps them apart
+  // wherever the ring is placed; alignment attributes would not survive
+  // operator new in C++11.
+  char pad_shared_[64];
+
+  // Written by the producer only
+  size_t write_pos_;
+  size_t cached_read_pos_;
+  char pad_producer_[64];
+
+  // Written by the consumer only
+  size_t read_pos_;
+  size_t cached_write_pos_;
+  char pad_consumer_[64];
+};
+
+} // namespace serial
+
+#endif // SERIAL_SPSC_RING_H
@@ -0,0 +1,88 @@
+/*!
+ * \file serial/trace.h
+ *
+ * \section DESCRIPTION
+ *
+ * Optional systrace/Perfetto markers for serial::Serial.  On Android they go
+ * through the NDK ATrace functions, elsewhere they are written to the ftrace
+ * trace_marker file.
+ *
+ */
+
+#ifndef SERIAL_TRACE_H
+#define SERIAL_TRACE_H
+
+#include <serial/v8stdint.h>
+
+namespace serial {
+
+/*!
+ * Process wide switch for trace markers.  Off by default; while off every
+ * marker costs one relaxed load and a branch.
+ */
+class Trace {
+public:
+  /*! Turns trace markers on or off.
+   *
+   * \return Whether markers are now being emitted, false when turning them
+   * on found no backend (no ATrace and no writable trace_marker).
+   */
+  static bool
+  setEnabled (bool enabled);
+
+  /*! Whether markers are being emitted. */
+  static bool
+  isEnabled ()
+  {
+    return __atomic_load_n (&enabled_, __ATOMIC_RELAXED);
+  }
+
+  /*! Opens a section on the calling thread, name is copied. */
+  static void
+  beginSection (const char *name);
+
+  /*! Closes the innermost section opened by the calling thread. */
+  static void
+  endSection ();
+
+  /*! Sets a counter track to value. */
+  static void
+  setCounter (const char *name, int64_t value);
+
+private:
+  static bool enabled_;
+};
+
+/*!
+ * Section covering the lifetime of the object.  Whether it is emitted is
+ * decided once, in the constructor, so sections stay balanced when tracing
+ * is switched meanwhile.
+ */
+class ScopedTrace {
+public:
+  explicit ScopedTrace (const char *name)
+    : active_ (Trace::isEnabled ())
+  {
+    if (active_) {
+      Trace::beginSection (name);
+    }
+  }
+
+  ~ScopedTrace ()
+  {
+    if (active_) {
+      Trace::endSection ();
+    }
+  }
+
+private:
+  // Disable copy constructors
+  ScopedTrace (const ScopedTrace&);
+  ScopedTrace& operator= (const ScopedTrace&);
+
+  bool active_;
+};
+
+} // namespace serial
+
+#endif // SERIAL_TRACE_H
@@ -17,7 +17,13 @@
 #include <cstdarg>
 #include <cstdlib>
 
+#include <map>
+
+#include <errno.h>
+#include <fnmatch.h>
 #include <glob.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -43,6 +49,58 @@ static vector<string> get_sysfs_info(const string& device_path);
 static string read_line(const string& file);
 static string usb_sysfs_hw_string(const string& sysfs_path);
 static string format(const char* format, ...);
+static bool is_port_name(const string& name);
+static PortInfo get_port_info(const string& device);
+
+// Device nodes under /dev that are listed as ports
+static const char* const port_patterns[] = {
+    "ttyACM*",
+    "ttyS*",
+    "ttyUSB*",
+    "tty.*",
+    "cu.*"
+};
+static const size_t port_pattern_count =
+    sizeof(port_patterns) / sizeof(port_patterns[0]);
+
+namespace {
+
+// Keeps the ports under /dev in memory.  The first list() enumerates them,
+// after that a thread applies the nodes inotify reports created or removed,
+// so later calls only copy the cache.  Without inotify every list()
+// enumerates again.
+class PortRegistry
+{
+public:
+    static PortRegistry& instance();
+
+    vector<PortInfo> list();
+
+private:
+    PortRegistry();
+
+    static void init();
+
+    // Enumerates /dev again.  Called with mutex_ held.
+    void scan();
+
+    static void* watch_thread(void* arg);
+
+    void watch_loop();
+
+    void apply(const inotify_event& event);
+
+    static pthread_once_t once_;
+    static PortRegistry* instance_;
+
+    pthread_mutex_t mutex_;
+    std::map<string, PortInfo> ports_;  // By device path
+    int inotify_fd_;
+    bool watching_;
+    bool stale_;                        // Events were lost, scan again
+};
+
+} // namespace
 
 vector<string>
 glob(const vector<string>& patterns)
@@ -294,42 +352,223 @@ usb_sysfs_hw_string(const string& sysfs_path)
     return format("USB VID:PID=%s:%s %s", vid.c_str(), pid.c_str(), serial_number.c_str() );
 }
 
+bool
+is_port_name(const string& name)
+{
+    for(size_t i = 0; i < port_pattern_count; i++)
+    {
+        if( fnmatch( port_patterns[i], name.c_str(), 0 ) == 0 )
+            return true;
+    }
+
+    return false;
+}
+
+PortInfo
+get_port_info(const string& device)
+{
+    vector<string> sysfs_info = get_sysfs_info( device );
+
+    PortInfo device_entry;
+    device_entry.port = device;
+    device_entry.description = sysfs_info[0];
+    device_entry.hardware_id = sysfs_info[1];
+
+    return device_entry;
+}
+
+pthread_once_t PortRegistry::once_ = PTHREAD_ONCE_INIT;
+PortRegistry* PortRegistry::instance_ = NULL;
+
+PortRegistry&
+PortRegistry::instance()
+{
+    pthread_once(&once_, &PortRegistry::init);
+    return *instance_;
+}
+
+void
+PortRegistry::init()
+{
+    // Never deleted, the watch thread runs until the process exits
+    instance_ = new PortRegistry();
+}
+
+PortRegistry::PortRegistry()
+    : inotify_fd_(-1), watching_(false), stale_(true)
+{
+    pthread_mutex_init(&mutex_, NULL);
+
+    // Watch before the first scan, so nodes that come and go during it
+    // are applied afterwards
+    inotify_fd_ = inotify_init1( IN_CLOEXEC );
+
+    if( inotify_fd_ == -1 )
+        return;
+
+    if( inotify_add_watch( inotify_fd_, "/dev", IN_CREATE | IN_DELETE
+                           | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB ) == -1 )
+    {
+        close( inotify_fd_ );
+        inotify_fd_ = -1;
+        return;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    watching_ = pthread_create(&thread, &attr, &PortRegistry::watch_thread,
+                               this) == 0;
+    pthread_attr_destroy(&attr);
+
+    if( !watching_ )
+    {
+        close( inotify_fd_ );
+        inotify_fd_ = -1;
+    }
+}
+
 vector<PortInfo>
-serial::list_ports()
+PortRegistry::list()
 {
+    pthread_mutex_lock(&mutex_);
+
+    if( stale_ || !watching_ )
+    {
+        scan();
+        stale_ = false;
+    }
+
     vector<PortInfo> results;
+    results.reserve( ports_.size() );
+
+    std::map<string, PortInfo>::const_iterator iter = ports_.begin();
+
+    while( iter != ports_.end() )
+        results.push_back( (iter++)->second );
+
+    pthread_mutex_unlock(&mutex_);
+
+    return results;
+}
 
+void
+PortRegistry::scan()
+{
     vector<string> search_globs;
-    search_globs.push_back("/dev/ttyACM*");
-    search_globs.push_back("/dev/ttyS*");
-    search_globs.push_back("/dev/ttyUSB*");
-    search_globs.push_back("/dev/tty.*");
-    search_globs.push_back("/dev/cu.*");
+
+    for(size_t i = 0; i < port_pattern_count; i++)
+        search_globs.push_back( string("/dev/") + port_patterns[i] );
 
     vector<string> devices_found = glob( search_globs );
 
+    ports_.clear();
+
     vector<string>::iterator iter = devices_found.begin();
 
     while( iter != devices_found.end() )
     {
         string device = *iter++;
 
-        vector<string> sysfs_info = get_sysfs_info( device );
+        ports_[device] = get_port_info( device );
+    }
+}
+
+void*
+PortRegistry::watch_thread(void* arg)
+{
+    static_cast<PortRegistry*>(arg)->watch_loop();
+    return NULL;
+}
+
+void
+PortRegistry::watch_loop()
+{
+    // Aligned for the inotify_event structures read into it
+    union {
+        inotify_event event;
+        char bytes[4096];
+    } buffer;
+
+    while( true )
+    {
+        ssize_t length = read( inotify_fd_, buffer.bytes, sizeof(buffer) );
+
+        if( length == -1 && errno == EINTR )
+            continue;
+
+        if( length <= 0 )
+            break;
+
+        ssize_t offset = 0;
 
-        string friendly_name = sysfs_info[0];
+        while( offset < length )
+        {
+            const inotify_event* event =
+                reinterpret_cast<const inotify_event*>( buffer.bytes + offset );
 
-        string hardware_id = sysfs_info[1];
+            if( event->mask & IN_IGNORED )
+            {
+                // /dev went away, fall back to enumerating on every call
+                length = 0;
+                break;
+            }
 
-        PortInfo device_entry;
-        device_entry.port = device;
-        device_entry.description = friendly_name;
-        device_entry.hardware_id = hardware_id;
+            apply( *event );
 
-        results.push_back( device_entry );
+            offset += sizeof(inotify_event) + event->len;
+        }
 
+        if( length == 0 )
+            break;
     }
 
-    return results;
+    pthread_mutex_lock(&mutex_);
+    watching_ = false;
+    pthread_mutex_unlock(&mutex_);
+
+    close( inotify_fd_ );
+    inotify_fd_ = -1;
+}
+
+void
+PortRegistry::apply(const inotify_event& event)
+{
+    if( event.mask & IN_Q_OVERFLOW )
+    {
+        pthread_mutex_lock(&mutex_);
+        stale_ = true;
+        pthread_mutex_unlock(&mutex_);
+        return;
+    }
+
+    if( event.len == 0 || !is_port_name( event.name ) )
+        return;
+
+    string device = string("/dev/") + event.name;
+
+    if( event.mask & (IN_DELETE | IN_MOVED_FROM) )
+    {
+        pthread_mutex_lock(&mutex_);
+        ports_.erase( device );
+        pthread_mutex_unlock(&mutex_);
+        return;
+    }
+
+    // Created, moved in, or its owner or mode changed by ueventd once the
+    // driver is bound: read sysfs again, outside the lock
+    PortInfo device_entry = get_port_info( device );
+
+    pthread_mutex_lock(&mutex_);
+    ports_[device] = device_entry;
+    pthread_mutex_unlock(&mutex_);
+}
+
+vector<PortInfo>
+serial::list_ports()
+{
+    return PortRegistry::instance().list();
 }
 
 #endif // defined(__linux__)
@@ -0,0 +1,472 @@
+#if !defined(_WIN32)
+
+#include <time.h>
+
+#include <algorithm>
+
+#include "serial/modbus.h"
+#include "serial/crc.h"
+#include "serial/impl/unix.h"
+
+using std::invalid_argument;
+using std::max;
+using std::vector;
+
+using serial::Crc;
+using serial::ModbusRtuMaster;
+using serial::ModbusException;
+using serial::Serial;
+using serial::SerialException;
+using serial::IOException;
+
+namespace {
+
+// Largest RTU frame: address, 253 bytes of PDU and the CRC
+const size_t kMaxAdu = 256;
+const size_t kMaxPdu = 253;
+
+// Above 19200 baud the specification fixes the silent intervals
+const uint32_t kFixedTimingBaud = 19200;
+const uint64_t kFixedT15Ns = 750000;
+const uint64_t kFixedT35Ns = 1750000;
+
+int64_t
+now_ns ()
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t> (ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+void
+put_u16 (vector<uint8_t> &out, uint16_t value)
+{
+  out.push_back (static_cast<uint8_t> (value >> 8));
+  out.push_back (static_cast<uint8_t> (value));
+}
+
+uint16_t
+get_u16 (const uint8_t *p)
+{
+  return static_cast<uint16_t> ((p[0] << 8) | p[1]);
+}
+
+// Length of the response frame starting at buf, once the header says, or 0
+size_t
+response_length (const uint8_t *buf, size_t size)
+{
+  if (size < 2) {
+    return 0;
+  }
+  uint8_t function = buf[1];
+  if (function & 0x80) {
+    return 5;
+  }
+  switch (function) {
+  case 0x01:
+  case 0x02:
+  case 0x03:
+  case 0x04:
+  case 0x17:
+    return size < 3 ? 0 : 5 + buf[2];
+  case 0x05:
+  case 0x06:
+  case 0x0F:
+  case 0x10:
+    return 8;
+  }
+  return 0;
+}
+
+// Whether a response PDU answers the request PDU
+bool
+answers (const uint8_t *request, size_t request_size,
+         const vector<uint8_t> &response)
+{
+  uint8_t function = request[0];
+  switch (function) {
+  case 0x01:
+  case 0x02:
+  case 0x03:
+  case 0x04: {
+    if (request_size < 5 || response.size () < 2) {
+      return false;
+    }
+    uint16_t count = get_u16 (request + 3);
+    size_t bytes = function <= 0x02 ? (count + 7) / 8 : count * 2u;
+    return response[1] == bytes && response.size () == bytes + 2;
+  }
+  case 0x05:
+  case 0x06:
+  case 0x0F:
+  case 0x10:
+    // Echoes the address and the value or quantity
+    return request_size >= 5 && response.size () == 5
+           && std::equal (request + 1, request + 5, response.begin () + 1);
+  }
+  return true;
+}
+
+} // namespace
+
+ModbusRtuMaster::ModbusRtuMaster (Serial *port)
+  : port_ (port), response_timeout_ms_ (1000), retries_ (2),
+    turnaround_delay_ms_ (100), minimum_silence_us_ (0),
+    strict_timing_ (false), last_activity_ns_ (0)
+{
+  tx_.reserve (kMaxAdu);
+  rx_.reserve (kMaxAdu);
+}
+
+void
+ModbusRtuMaster::setResponseTimeout (uint32_t timeout_ms)
+{
+  response_timeout_ms_ = timeout_ms;
+}
+
+uint32_t
+ModbusRtuMaster::getResponseTimeout () const
+{
+  return response_timeout_ms_;
+}
+
+void
+ModbusRtuMaster::setRetries (uint32_t retries)
+{
+  retries_ = retries;
+}
+
+uint32_t
+ModbusRtuMaster::getRetries () const
+{
+  return retries_;
+}
+
+void
+ModbusRtuMaster::setTurnaroundDelay (uint32_t delay_ms)
+{
+  turnaround_delay_ms_ = delay_ms;
+}
+
+void
+ModbusRtuMaster::setMinimumSilence (uint32_t silence_us)
+{
+  minimum_silence_us_ = silence_us;
+}
+
+void
+ModbusRtuMaster::setStrictTiming (bool strict)
+{
+  strict_timing_ = strict;
+}
+
+void
+ModbusRtuMaster::transact (uint8_t slave, const uint8_t *pdu, size_t size,
+                           vector<uint8_t> &response)
+{
+  if (size == 0 || size > kMaxPdu) {
+    throw invalid_argument ("Modbus PDU must be 1 to 253 bytes");
+  }
+  if (!port_->isOpen ()) {
+    throw serial::PortNotOpenedException ("ModbusRtuMaster::transact");
+  }
+  Serial::SerialImpl *impl = port_->pimpl_;
+  // Nobody else may talk on the line between a request and its response
+  impl->readLock ();
+  impl->writeLock ();
+  bool answered = false;
+  try {
+    for (uint32_t attempt = 0; attempt <= retries_ && !answered; ++attempt) {
+      answered = exchange (slave, pdu, size, response);
+    }
+  } catch (...) {
+    impl->writeUnlock ();
+    impl->readUnlock ();
+    throw;
+  }
+  impl->writeUnlock ();
+  impl->readUnlock ();
+  if (!answered) {
+    THROW (IOException, "no valid Modbus response before the timeout");
+  }
+}
+
+bool
+ModbusRtuMaster::exchange (uint8_t slave, const uint8_t *pdu, size_t size,
+                           vector<uint8_t> &response)
+{
+  Serial::SerialImpl *impl = port_->pimpl_;
+  uint64_t byte_ns = impl->getByteTimeNs ();
+  uint64_t t15_ns, t35_ns;
+  if (port_->getBaudrate () > kFixedTimingBaud) {
+    t15_ns = kFixedT15Ns;
+    t35_ns = kFixedT35Ns;
+  } else {
+    t15_ns = byte_ns * 3 / 2;
+    t35_ns = byte_ns * 7 / 2;
+  }
+  t35_ns = max<uint64_t> (t35_ns, minimum_silence_us_ * 1000ULL);
+
+  const Crc &crc = Crc::crc16Modbus ();
+  tx_.clear ();
+  tx_.push_back (slave);
+  tx_.insert (tx_.end (), pdu, pdu + size);
+  uint16_t check = static_cast<uint16_t> (crc.compute (&tx_[0], tx_.size ()));
+  tx_.push_back (static_cast<uint8_t> (check));
+  tx_.push_back (static_cast<uint8_t> (check >> 8));
+
+  // The frame has to go out whole and on time, whatever write batching
+  // has queued goes first
+  impl->flushWrites ();
+  waitForSilence (t35_ns);
+  if (impl->writeNow (&tx_[0], tx_.size ()) != tx_.size ()) {
+    THROW (IOException, "timed out sending the Modbus request");
+  }
+  // write returns once the kernel has the bytes, the line needs longer
+  last_activity_ns_ = now_ns () + static_cast<int64_t> (byte_ns * tx_.size ());
+  response.clear ();
+  if (slave == 0) {
+    // Broadcasts are not answered
+    timespec delay;
+    delay.tv_sec = turnaround_delay_ms_ / 1000;
+    delay.tv_nsec = static_cast<long> (turnaround_delay_ms_ % 1000) * 1000000L;
+    nanosleep (&delay, NULL);
+    return true;
+  }
+
+  int64_t deadline_ns = last_activity_ns_
+                        + static_cast<int64_t> (response_timeout_ms_) * 1000000LL;
+  while (receiveFrame (deadline_ns, t15_ns, t35_ns)) {
+    size_t length = rx_.size ();
+    if (length < 4 || rx_[0] != slave || (rx_[1] & 0x7F) != pdu[0]) {
+      continue;
+    }
+    uint16_t received = static_cast<uint16_t> (rx_[length - 2]
+                                               | (rx_[length - 1] << 8));
+    if (crc.compute (&rx_[0], length - 2) != received) {
+      continue;
+    }
+    if (rx_[1] & 0x80) {
+      if (length != 5) {
+        continue;
+      }
+      throw ModbusException (pdu[0], rx_[2]);
+    }
+    response.assign (rx_.begin () + 1, rx_.end () - 2);
+    if (answers (pdu, size, response)) {
+      return true;
+    }
+  }
+  response.clear ();
+  return false;
+}
+
+bool
+ModbusRtuMaster::receiveFrame (int64_t deadline_ns, uint64_t t15_ns,
+                               uint64_t t35_ns)
+{
+  Serial::SerialImpl *impl = port_->pimpl_;
+  rx_.clear ();
+  // Wait for the first character
+  while (true) {
+    int64_t remaining_ns = deadline_ns - now_ns ();
+    if (remaining_ns <= 0) {
+      return false;
+    }
+    uint32_t wait_ms = static_cast<uint32_t> ((remaining_ns + 999999) / 1000000);
+    if (impl->waitReadable (wait_ms)) {
+      break;
+    }
+  }
+
+  rx_.resize (kMaxAdu);
+  size_t received = 0;
+  bool broken = false;
+  while (true) {
+    size_t bytes_read = impl->readAvailable (&rx_[received],
+                                             kMaxAdu - received);
+    if (bytes_read == 0) {
+      // Reported readable but nothing came, the same as in read
+      throw SerialException ("device reports readiness to read but "
+                             "returned no data (device disconnected?)");
+    }
+    received += bytes_read;
+    last_activity_ns_ = now_ns ();
+    size_t expected = response_length (&rx_[0], received);
+    if ((expected != 0 && received >= expected) || received == kMaxAdu) {
+      // Anything past the expected length is line noise
+      if (expected != 0 && received > expected) {
+        received = expected;
+      }
+      break;
+    }
+    // A frame ends with 3.5 characters of silence, and a gap of more than
+    // 1.5 inside one is a fault
+    if (impl->waitIdle (t15_ns)) {
+      if (impl->waitIdle (t35_ns > t15_ns ? t35_ns - t15_ns : 0)) {
+        break;
+      }
+      broken = broken || strict_timing_;
+    }
+  }
+  rx_.resize (broken ? 0 : received);
+  return true;
+}
+
+void
+ModbusRtuMaster::waitForSilence (uint64_t t35_ns)
+{
+  Serial::SerialImpl *impl = port_->pimpl_;
+  uint8_t discard[64];
+  int64_t give_up_ns = now_ns ()
+                       + static_cast<int64_t> (response_timeout_ms_) * 1000000LL;
+  while (true) {
+    // Drop whatever arrived since the last exchange, e.g. late responses
+    while (impl->readAvailable (discard, sizeof (discard)) > 0) {
+      last_activity_ns_ = now_ns ();
+    }
+    int64_t now = now_ns ();
+    int64_t quiet_ns = now - last_activity_ns_;
+    if (quiet_ns >= static_cast<int64_t> (t35_ns)) {
+      return;
+    }
+    if (now > give_up_ns) {
+      THROW (IOException, "the Modbus line never went quiet");
+    }
+    if (impl->waitIdle (t35_ns - quiet_ns)) {
+      return;
+    }
+  }
+}
+
+void
+ModbusRtuMaster::readBits (uint8_t function, uint8_t slave, uint16_t address,
+                           uint16_t count, bool *values)
+{
+  if (count < 1 || count > 2000) {
+    throw invalid_argument ("Modbus bit count must be 1 to 2000");
+  }
+  vector<uint8_t> request;
+  request.push_back (function);
+  put_u16 (request, address);
+  put_u16 (request, count);
+  vector<uint8_t> response;
+  transact (slave, &request[0], request.size (), response);
+  for (uint16_t i = 0; i < count; ++i) {
+    values[i] = (response[2 + i / 8] >> (i % 8)) & 1;
+  }
+}
+
+void
+ModbusRtuMaster::readRegisters (uint8_t function, uint8_t slave,
+                                uint16_t address, uint16_t count,
+                                uint16_t *values)
+{
+  if (count < 1 || count > 125) {
+    throw invalid_argument ("Modbus register count must be 1 to 125");
+  }
+  vector<uint8_t> request;
+  request.push_back (function);
+  put_u16 (request, address);
+  put_u16 (request, count);
+  vector<uint8_t> response;
+  transact (slave, &request[0], request.size (), response);
+  for (uint16_t i = 0; i < count; ++i) {
+    values[i] = get_u16 (&response[2 + 2 * i]);
+  }
+}
+
+void
+ModbusRtuMaster::readCoils (uint8_t slave, uint16_t address, uint16_t count,
+                            bool *values)
+{
+  readBits (0x01, slave, address, count, values);
+}
+
+void
+ModbusRtuMaster::readDiscreteInputs (uint8_t slave, uint16_t address,
+                                     uint16_t count, bool *values)
+{
+  readBits (0x02, slave, address, count, values);
+}
+
+void
+ModbusRtuMaster::readHoldingRegisters (uint8_t slave, uint16_t address,
+                                       uint16_t count, uint16_t *values)
+{
+  readRegisters (0x03, slave, address, count, values);
+}
+
+void
+ModbusRtuMaster::readInputRegisters (uint8_t slave, uint16_t address,
+                                     uint16_t count, uint16_t *values)
+{
+  readRegisters (0x04, slave, address, count, values);
+}
+
+void
+ModbusRtuMaster::writeSingleCoil (uint8_t slave, uint16_t address, bool value)
+{
+  vector<uint8_t> request;
+  request.push_back (0x05);
+  put_u16 (request, address);
+  put_u16 (request, value ? 0xFF00 : 0x0000);
+  vector<uint8_t> response;
+  transact (slave, &request[0], request.size (), response);
+}
+
+void
+ModbusRtuMaster::writeSingleRegister (uint8_t slave, uint16_t address,
+                                      uint16_t value)
+{
+  vector<uint8_t> request;
+  request.push_back (0x06);
+  put_u16 (request, address);
+  put_u16 (request, value);
+  vector<uint8_t> response;
+  transact (slave, &request[0], request.size (), response);
+}
+
+void
+ModbusRtuMaster::writeMultipleCoils (uint8_t slave, uint16_t address,
+                                     uint16_t count, const bool *values)
+{
+  if (count < 1 || count > 1968) {
+    throw invalid_argument ("Modbus coil count must be 1 to 1968");
+  }
+  vector<uint8_t> request;
+  request.push_back (0x0F);
+  put_u16 (request, address);
+  put_u16 (request, count);
+  request.push_back (static_cast<uint8_t> ((count + 7) / 8));
+  request.resize (request.size () + (count + 7) / 8, 0);
+  for (uint16_t i = 0; i < count; ++i) {
+    if (values[i]) {
+      request[6 + i / 8] |= static_cast<uint8_t> (1 << (i % 8));
+    }
+  }
+  vector<uint8_t> response;
+  transact (slave, &request[0], request.size (), response);
+}
+
+void
+ModbusRtuMaster::writeMultipleRegisters (uint8_t slave, uint16_t address,
+                                         uint16_t count,
+                                         const uint16_t *values)
+{
+  if (count < 1 || count > 123) {
+    throw invalid_argument ("Modbus register count must be 1 to 123");
+  }
+  vector<uint8_t> request;
+  request.push_back (0x10);
+  put_u16 (request, address);
+  put_u16 (request, count);
+  request.push_back (static_cast<uint8_t> (count * 2));
+  for (uint16_t i = 0; i < count; ++i) {
+    put_u16 (request, values[i]);
+  }
+  vector<uint8_t> response;
+  transact (slave, &request[0], request.size (), response);
+}
+
+#endif // !defined(_WIN32)
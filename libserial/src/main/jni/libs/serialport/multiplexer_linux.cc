@@ -0,0 +1,370 @@
+#if defined(__linux__)
+
+#include <errno.h>
+
+#include "serial/multiplexer.h"
+#include "serial/impl/unix.h"
+
+using std::invalid_argument;
+using std::map;
+using std::string;
+using std::vector;
+
+using serial::Serial;
+using serial::SerialMultiplexer;
+using serial::SerialException;
+using serial::PortNotOpenedException;
+using serial::Poller;
+using serial::PollEvent;
+
+namespace {
+
+class ScopedLock {
+public:
+  ScopedLock (pthread_mutex_t *mutex) : mutex_ (mutex) {
+    pthread_mutex_lock (mutex_);
+  }
+  ~ScopedLock () {
+    pthread_mutex_unlock (mutex_);
+  }
+private:
+  // Disable copy constructors
+  ScopedLock (const ScopedLock&);
+  const ScopedLock& operator= (ScopedLock);
+
+  pthread_mutex_t *mutex_;
+};
+
+// Most bytes handed to onData at once by the default onReadable
+const size_t kReadChunk = 4096;
+
+// Most events taken from the epoll set per wait
+const int kMaxEvents = 16;
+
+} // namespace
+
+void
+SerialMultiplexer::Listener::onReadable (Serial &port)
+{
+  uint8_t buffer[kReadChunk];
+  size_t bytes_read;
+  do {
+    bytes_read = port.readAvailable (buffer, sizeof (buffer));
+    if (bytes_read > 0) {
+      onData (port, buffer, bytes_read);
+    }
+  } while (bytes_read == sizeof (buffer));
+}
+
+void
+SerialMultiplexer::Listener::onData (Serial &, const uint8_t *, size_t)
+{
+}
+
+void
+SerialMultiplexer::Listener::onError (Serial &, const string &)
+{
+}
+
+SerialMultiplexer::SerialMultiplexer ()
+  : poller_ (new Poller ()), current_ (NULL), running_ (false), stop_ (false)
+{
+  pthread_mutex_init (&mutex_, NULL);
+  pthread_cond_init (&idle_cond_, NULL);
+}
+
+SerialMultiplexer::~SerialMultiplexer ()
+{
+  stop ();
+  for (map<Serial *, Entry *>::iterator it = entries_.begin ();
+       it != entries_.end (); ++it) {
+    it->first->pimpl_->unwatchClose (poller_);
+    delete it->second;
+  }
+  delete poller_;
+  pthread_cond_destroy (&idle_cond_);
+  pthread_mutex_destroy (&mutex_);
+}
+
+void
+SerialMultiplexer::add (Serial *port, Listener *listener)
+{
+  // Taken first, a close from here on is noticed by wait
+  uint32_t close_count = port->pimpl_->getCloseCount ();
+  if (!port->isOpen ()) {
+    throw PortNotOpenedException ("SerialMultiplexer::add");
+  }
+  if (port->isContinuousReceive ()) {
+    throw invalid_argument ("port is in continuous receive mode");
+  }
+  ScopedLock lock (&mutex_);
+  if (entries_.find (port) != entries_.end ()) {
+    throw invalid_argument ("port is already registered");
+  }
+  Entry *entry = new Entry ();
+  entry->port = port;
+  entry->listener = listener;
+  entry->fd = port->pimpl_->getFd ();
+  entry->close_count = close_count;
+  entry->removed = false;
+  try {
+    poller_->add (entry->fd, poll_readable, false, entry);
+  } catch (...) {
+    delete entry;
+    throw;
+  }
+  entries_[port] = entry;
+  port->pimpl_->watchClose (poller_);
+}
+
+void
+SerialMultiplexer::remove (Serial *port)
+{
+  ScopedLock lock (&mutex_);
+  map<Serial *, Entry *>::iterator it = entries_.find (port);
+  if (it == entries_.end ()) {
+    return;
+  }
+  Entry *entry = it->second;
+  entries_.erase (it);
+  port->pimpl_->unwatchClose (poller_);
+  // A closed descriptor left the epoll set by itself, and its number may
+  // belong to another port by now
+  if (!isClosed (entry)) {
+    poller_->remove (entry->fd);
+  }
+  if (current_ != entry) {
+    delete entry;
+    return;
+  }
+  // Being dispatched, the dispatching thread frees it when the callback
+  // returns.  Other threads wait for that so the listener can go away.
+  entry->removed = true;
+  if (!pthread_equal (current_thread_, pthread_self ())) {
+    while (current_ == entry) {
+      pthread_cond_wait (&idle_cond_, &mutex_);
+    }
+  }
+}
+
+bool
+SerialMultiplexer::isClosed (Entry *entry) const
+{
+  return entry->port->pimpl_->getCloseCount () != entry->close_count;
+}
+
+size_t
+SerialMultiplexer::size ()
+{
+  ScopedLock lock (&mutex_);
+  return entries_.size ();
+}
+
+bool
+SerialMultiplexer::isRegistered (Entry *entry) const
+{
+  for (map<Serial *, Entry *>::const_iterator it = entries_.begin ();
+       it != entries_.end (); ++it) {
+    if (it->second == entry) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t
+SerialMultiplexer::wait (int timeout_ms, vector<Entry *> &ready,
+                         vector<uint32_t> &events)
+{
+  ready.clear ();
+  events.clear ();
+  {
+    // Data already pulled into user space never shows up in the epoll set,
+    // and a closed port never shows up again.  Closing wakes the wait.
+    ScopedLock lock (&mutex_);
+    for (map<Serial *, Entry *>::iterator it = entries_.begin ();
+         it != entries_.end (); ++it) {
+      if (isClosed (it->second)) {
+        ready.push_back (it->second);
+        events.push_back (poll_hangup);
+      } else if (it->first->pimpl_->hasBuffered ()) {
+        ready.push_back (it->second);
+        events.push_back (poll_readable);
+      }
+    }
+  }
+  if (!ready.empty ()) {
+    timeout_ms = 0;
+  }
+
+  PollEvent polled[kMaxEvents];
+  int count = poller_->wait (timeout_ms, polled, kMaxEvents);
+
+  ScopedLock lock (&mutex_);
+  for (int i = 0; i < count; ++i) {
+    Entry *entry = static_cast<Entry *> (polled[i].data);
+    size_t j = 0;
+    while (j < ready.size () && ready[j] != entry) {
+      ++j;
+    }
+    if (j < ready.size ()) {
+      events[j] |= polled[i].events;
+    } else {
+      ready.push_back (entry);
+      events.push_back (polled[i].events);
+    }
+  }
+  // Drop entries removed since the wait returned
+  size_t kept = 0;
+  for (size_t i = 0; i < ready.size (); ++i) {
+    if (isRegistered (ready[i])) {
+      ready[kept] = ready[i];
+      events[kept] = events[i];
+      ++kept;
+    }
+  }
+  ready.resize (kept);
+  events.resize (kept);
+  return kept;
+}
+
+size_t
+SerialMultiplexer::select (int timeout_ms, vector<Serial *> &ready)
+{
+  vector<Entry *> entries;
+  vector<uint32_t> events;
+  wait (timeout_ms, entries, events);
+  ready.clear ();
+  for (size_t i = 0; i < entries.size (); ++i) {
+    Serial *port = entries[i]->port;
+    ready.push_back (port);
+    if (events[i] & (poll_hangup | poll_error)) {
+      // Reported one last time so the owner finds out when reading
+      remove (port);
+    }
+  }
+  return ready.size ();
+}
+
+size_t
+SerialMultiplexer::dispatch (int timeout_ms)
+{
+  vector<Entry *> entries;
+  vector<uint32_t> events;
+  wait (timeout_ms, entries, events);
+
+  size_t dispatched = 0;
+  for (size_t i = 0; i < entries.size (); ++i) {
+    Entry *entry = entries[i];
+    {
+      ScopedLock lock (&mutex_);
+      // An earlier callback may have removed it
+      if (!isRegistered (entry)) {
+        continue;
+      }
+      current_ = entry;
+      current_thread_ = pthread_self ();
+    }
+    dispatchEntry (entry, events[i]);
+    ++dispatched;
+    bool removed;
+    {
+      ScopedLock lock (&mutex_);
+      current_ = NULL;
+      removed = entry->removed;
+      pthread_cond_broadcast (&idle_cond_);
+    }
+    if (removed) {
+      delete entry;
+    }
+  }
+  return dispatched;
+}
+
+void
+SerialMultiplexer::dispatchEntry (Entry *entry, uint32_t events)
+{
+  try {
+    if ((events & poll_readable) && entry->listener) {
+      entry->listener->onReadable (*entry->port);
+    }
+  } catch (std::exception &e) {
+    fail (entry, e.what ());
+    return;
+  }
+  if (events & (poll_hangup | poll_error)) {
+    fail (entry, isClosed (entry) ? "port was closed"
+          : "device reports a hang up or error (device disconnected?)");
+  }
+}
+
+void
+SerialMultiplexer::fail (Entry *entry, const string &message)
+{
+  bool registered;
+  {
+    ScopedLock lock (&mutex_);
+    registered = !entry->removed;
+  }
+  if (!registered) {
+    return;
+  }
+  remove (entry->port);
+  if (entry->listener) {
+    entry->listener->onError (*entry->port, message);
+  }
+}
+
+void *
+SerialMultiplexer::run (void *self)
+{
+  SerialMultiplexer *mux = static_cast<SerialMultiplexer *> (self);
+  try {
+    while (!__atomic_load_n (&mux->stop_, __ATOMIC_ACQUIRE)) {
+      mux->dispatch (-1);
+    }
+  } catch (std::exception &) {
+    // The epoll set itself failed, nothing left to wait on
+  }
+  return NULL;
+}
+
+void
+SerialMultiplexer::start ()
+{
+  if (running_) {
+    throw SerialException ("SerialMultiplexer is already running");
+  }
+  stop_ = false;
+  int result = pthread_create (&thread_, NULL, &SerialMultiplexer::run, this);
+  if (result) {
+    THROW (IOException, result);
+  }
+  running_ = true;
+}
+
+void
+SerialMultiplexer::stop ()
+{
+  if (!running_) {
+    return;
+  }
+  __atomic_store_n (&stop_, true, __ATOMIC_RELEASE);
+  poller_->wakeup ();
+  pthread_join (thread_, NULL);
+  running_ = false;
+}
+
+bool
+SerialMultiplexer::isRunning ()
+{
+  return running_;
+}
+
+void
+SerialMultiplexer::wakeup ()
+{
+  poller_->wakeup ();
+}
+
+#endif // defined(__linux__)
@@ -0,0 +1,140 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "serial/pattern_set.h"
+
+using std::invalid_argument;
+using std::string;
+using std::vector;
+
+using serial::PatternSet;
+
+namespace {
+
+// Marks a transition the trie does not have yet, while building
+const uint16_t kNoState = 0xFFFF;
+
+// State numbers and match indices have to fit next_ and match_
+const size_t kMaxTotalLength = 0xFFFE;
+
+} // namespace
+
+PatternSet::PatternSet (const vector<string> &patterns)
+  : patterns_ (patterns), class_count_ (1)
+{
+  if (patterns_.empty ()) {
+    throw invalid_argument ("a pattern set needs at least one pattern");
+  }
+  size_t total = 0;
+  bool used[256];
+  memset (used, 0, sizeof (used));
+  for (size_t i = 0; i < patterns_.size (); ++i) {
+    if (patterns_[i].empty ()) {
+      throw invalid_argument ("patterns must not be empty");
+    }
+    total += patterns_[i].size ();
+    for (size_t j = 0; j < patterns_[i].size (); ++j) {
+      used[static_cast<uint8_t> (patterns_[i][j])] = true;
+    }
+  }
+  if (total > kMaxTotalLength) {
+    throw invalid_argument ("patterns are too long");
+  }
+
+  // Column 0 is shared by all bytes no pattern contains
+  for (size_t b = 0; b < 256; ++b) {
+    byte_class_[b] = used[b] ? static_cast<uint16_t> (class_count_++) : 0;
+  }
+
+  // The trie, with kNoState for missing edges
+  next_.assign (class_count_, kNoState);
+  match_.assign (1, 0);
+  for (size_t i = 0; i < patterns_.size (); ++i) {
+    size_t state = 0;
+    const string &pattern = patterns_[i];
+    for (size_t j = 0; j < pattern.size (); ++j) {
+      size_t edge = state * class_count_
+                    + byte_class_[static_cast<uint8_t> (pattern[j])];
+      if (next_[edge] == kNoState) {
+        next_[edge] = static_cast<uint16_t> (match_.size ());
+        next_.resize (next_.size () + class_count_, kNoState);
+        match_.push_back (0);
+      }
+      state = next_[edge];
+    }
+    if (match_[state] == 0) {
+      match_[state] = static_cast<uint16_t> (i + 1);
+    }
+  }
+
+  // Breadth first, so the failure state of every state is complete before
+  // it is used: missing edges take the failure state's edge, a state with
+  // no pattern of its own reports the longest one ending there, and a leaf
+  // can only grow into a pattern from its failure state.
+  vector<uint16_t> fail (match_.size (), 0);
+  vector<uint16_t> depth (match_.size (), 0);
+  vector<bool> inner (match_.size (), false);
+  for (size_t i = 0; i < next_.size (); ++i) {
+    if (next_[i] != kNoState) {
+      inner[i / class_count_] = true;
+      depth[next_[i]] = static_cast<uint16_t> (depth[i / class_count_] + 1);
+    }
+  }
+  grow_.assign (match_.size (), 0);
+  vector<uint16_t> queue;
+  queue.reserve (match_.size ());
+  for (size_t c = 0; c < class_count_; ++c) {
+    uint16_t child = next_[c];
+    if (child == kNoState) {
+      next_[c] = 0;
+    } else {
+      queue.push_back (child);
+    }
+  }
+  for (size_t head = 0; head < queue.size (); ++head) {
+    uint16_t state = queue[head];
+    if (match_[state] == 0) {
+      match_[state] = match_[fail[state]];
+    }
+    grow_[state] = inner[state] ? depth[state] : grow_[fail[state]];
+    for (size_t c = 0; c < class_count_; ++c) {
+      uint16_t &edge = next_[state * class_count_ + c];
+      uint16_t fallback = next_[fail[state] * class_count_ + c];
+      if (edge == kNoState) {
+        edge = fallback;
+      } else {
+        fail[edge] = fallback;
+        queue.push_back (edge);
+      }
+    }
+  }
+}
+
+int
+PatternSet::scan (const uint8_t *data, size_t size, ScanState &state) const
+{
+  size_t current = state.node;
+  for (size_t i = 0; i < size; ++i) {
+    current = next_[current * class_count_ + byte_class_[data[i]]];
+    size_t fed = state.fed + i + 1;
+    if (match_[current] != 0) {
+      // The longest pattern ending here also starts first
+      int index = match_[current] - 1;
+      size_t start = fed - patterns_[index].size ();
+      if (state.match < 0 || start <= state.match_start) {
+        state.match = index;
+        state.match_start = start;
+        state.match_end = fed;
+      }
+    }
+    // Settled unless a pattern starting no later may still be completed
+    if (state.match >= 0 && fed - grow_[current] > state.match_start) {
+      state.node = static_cast<uint32_t> (current);
+      state.fed = fed;
+      return state.match;
+    }
+  }
+  state.node = static_cast<uint32_t> (current);
+  state.fed += size;
+  return -1;
+}
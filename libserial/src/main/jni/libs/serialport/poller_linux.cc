@@ -0,0 +1,181 @@
+#if defined(__linux__)
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "serial/serial.h"
+#include "serial/impl/poller.h"
+
+using serial::Poller;
+using serial::PollEvent;
+using serial::IOException;
+
+// Largest batch of events fetched by a single epoll_wait
+static const int kMaxBatch = 16;
+
+static uint32_t
+to_epoll (uint32_t events, bool edge_triggered)
+{
+  uint32_t result = 0;
+  if (events & serial::poll_readable)
+    result |= EPOLLIN;
+  if (events & serial::poll_writable)
+    result |= EPOLLOUT;
+  if (edge_triggered)
+    result |= EPOLLET;
+  return result;
+}
+
+static uint32_t
+from_epoll (uint32_t events)
+{
+  uint32_t result = 0;
+  if (events & (EPOLLIN | EPOLLPRI))
+    result |= serial::poll_readable;
+  if (events & EPOLLOUT)
+    result |= serial::poll_writable;
+  if (events & (EPOLLHUP | EPOLLRDHUP))
+    result |= serial::poll_hangup;
+  if (events & EPOLLERR)
+    result |= serial::poll_error;
+  return result;
+}
+
+Poller::Poller ()
+  : epoll_fd_ (-1), wakeup_fd_ (-1)
+{
+  epoll_fd_ = epoll_create1 (EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    THROW (IOException, errno);
+  }
+  wakeup_fd_ = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeup_fd_ == -1) {
+    int error = errno;
+    ::close (epoll_fd_);
+    THROW (IOException, error);
+  }
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_fd_;
+  if (-1 == epoll_ctl (epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event)) {
+    int error = errno;
+    ::close (wakeup_fd_);
+    ::close (epoll_fd_);
+    THROW (IOException, error);
+  }
+  pthread_mutex_init (&data_mutex_, NULL);
+}
+
+Poller::~Poller ()
+{
+  ::close (wakeup_fd_);
+  ::close (epoll_fd_);
+  pthread_mutex_destroy (&data_mutex_);
+}
+
+void
+Poller::control (int op, int fd, uint32_t events, bool edge_triggered,
+                 void *data)
+{
+  epoll_event event;
+  event.events = to_epoll (events, edge_triggered);
+  event.data.fd = fd;
+  if (-1 == epoll_ctl (epoll_fd_, op, fd, &event)) {
+    THROW (IOException, errno);
+  }
+  pthread_mutex_lock (&data_mutex_);
+  data_[fd] = data;
+  pthread_mutex_unlock (&data_mutex_);
+}
+
+void
+Poller::add (int fd, uint32_t events, bool edge_triggered, void *data)
+{
+  control (EPOLL_CTL_ADD, fd, events, edge_triggered, data);
+}
+
+void
+Poller::modify (int fd, uint32_t events, bool edge_triggered, void *data)
+{
+  control (EPOLL_CTL_MOD, fd, events, edge_triggered, data);
+}
+
+void
+Poller::remove (int fd)
+{
+  pthread_mutex_lock (&data_mutex_);
+  bool known = data_.erase (fd) > 0;
+  pthread_mutex_unlock (&data_mutex_);
+  if (known) {
+    // The descriptor may already be closed, which removed it from the set.
+    epoll_ctl (epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+  }
+}
+
+int
+Poller::wait (int timeout_ms, PollEvent *events, int max_events, bool *woken)
+{
+  epoll_event ready[kMaxBatch];
+  if (max_events > kMaxBatch)
+    max_events = kMaxBatch;
+  if (woken)
+    *woken = false;
+
+  int r = epoll_wait (epoll_fd_, ready, max_events, timeout_ms);
+  if (r < 0) {
+    // Interrupted, let the caller re-evaluate its timeout
+    if (errno == EINTR) {
+      return 0;
+    }
+    THROW (IOException, errno);
+  }
+
+  int count = 0;
+  pthread_mutex_lock (&data_mutex_);
+  for (int i = 0; i < r; ++i) {
+    int fd = ready[i].data.fd;
+    if (fd == wakeup_fd_) {
+      uint64_t value;
+      while (-1 == ::read (wakeup_fd_, &value, sizeof (value))
+             && errno == EINTR) {}
+      if (woken)
+        *woken = true;
+      continue;
+    }
+    std::map<int, void *>::iterator it = data_.find (fd);
+    if (it == data_.end ()) {
+      // Removed while we were waiting
+      continue;
+    }
+    events[count].fd = fd;
+    events[count].events = from_epoll (ready[i].events);
+    events[count].data = it->second;
+    ++count;
+  }
+  pthread_mutex_unlock (&data_mutex_);
+  return count;
+}
+
+uint32_t
+Poller::waitFor (int fd, int timeout_ms, bool *woken)
+{
+  PollEvent events[kMaxBatch];
+  int count = wait (timeout_ms, events, kMaxBatch, woken);
+  uint32_t result = 0;
+  for (int i = 0; i < count; ++i) {
+    if (events[i].fd == fd)
+      result |= events[i].events;
+  }
+  return result;
+}
+
+void
+Poller::wakeup ()
+{
+  uint64_t value = 1;
+  while (-1 == ::write (wakeup_fd_, &value, sizeof (value)) && errno == EINTR) {}
+}
+
+#endif // defined(__linux__)
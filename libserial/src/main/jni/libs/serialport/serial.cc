@@ -1,5 +1,6 @@
 /* Copyright 2012 William Woodall and John Harrison */
 #include <algorithm>
+#include <cstring>
 
 #if !defined(_WIN32) && !defined(__OpenBSD__) && !defined(__FreeBSD__)
 # include <alloca.h>
@@ -10,6 +11,10 @@
 #endif
 
 #include "serial/serial.h"
+#include "serial/framer.h"
+#include "serial/histogram.h"
+#include "serial/pattern_set.h"
+#include "serial/trace.h"
 
 #ifdef _WIN32
 #include "serial/impl/win.h"
@@ -31,6 +36,34 @@ using serial::bytesize_t;
 using serial::parity_t;
 using serial::stopbits_t;
 using serial::flowcontrol_t;
+using serial::latency_profile_t;
+using serial::coalesce_policy_t;
+using serial::PortStats;
+using serial::LatencyHistogram;
+using serial::latency_op_t;
+using serial::Framer;
+using serial::frame_status_t;
+using serial::ScopedTrace;
+using serial::PatternSet;
+using serial::TransactTiming;
+
+// Records the time from construction to destruction into a histogram.
+// Declared ahead of the scoped locks, it covers the wait for them too.
+class ScopedLatency {
+public:
+  explicit ScopedLatency (LatencyHistogram &histogram)
+    : histogram_ (histogram), start_ (LatencyHistogram::now ()) {}
+  ~ScopedLatency () {
+    histogram_.record (LatencyHistogram::now () - start_);
+  }
+private:
+  // Disable copy constructors
+  ScopedLatency (const ScopedLatency&);
+  const ScopedLatency& operator= (ScopedLatency);
+
+  LatencyHistogram &histogram_;
+  uint64_t start_;
+};
 
 class Serial::ScopedReadLock {
 public:
@@ -67,14 +100,23 @@ Serial::Serial (const string &port, uint32_t baudrate, serial::Timeout timeout,
                 bytesize_t bytesize, parity_t parity, stopbits_t stopbits,
                 flowcontrol_t flowcontrol)
  : pimpl_(new SerialImpl (port, baudrate, bytesize, parity,
-                                           stopbits, flowcontrol))
-{
+                                           stopbits, flowcontrol)),
+   framer_(NULL), latency_(NULL)
+{
+  try {
+    latency_ = new LatencyHistogram[serial::latency_op_count];
+  } catch (...) {
+    delete pimpl_;
+    throw;
+  }
   pimpl_->setTimeout(timeout);
 }
 
 Serial::~Serial ()
 {
   delete pimpl_;
+  delete framer_;
+  delete [] latency_;
 }
 
 void
@@ -123,32 +165,71 @@ Serial::read_ (uint8_t *buffer, size_t size)
 size_t
 Serial::read (uint8_t *buffer, size_t size)
 {
+  ScopedLatency timer(latency_[serial::latency_op_read]);
   ScopedReadLock lock(this->pimpl_);
   return this->pimpl_->read (buffer, size);
 }
 
+size_t
+Serial::readAvailable (uint8_t *buffer, size_t size)
+{
+  ScopedReadLock lock(this->pimpl_);
+  return this->pimpl_->readAvailable (buffer, size);
+}
+
 size_t
 Serial::read (std::vector<uint8_t> &buffer, size_t size)
 {
+  ScopedLatency timer(latency_[serial::latency_op_read]);
   ScopedReadLock lock(this->pimpl_);
-  uint8_t *buffer_ = new uint8_t[size];
-  size_t bytes_read = this->pimpl_->read (buffer_, size);
-  buffer.insert (buffer.end (), buffer_, buffer_+bytes_read);
-  delete[] buffer_;
+  if (size == 0) {
+    return this->pimpl_->read (NULL, 0);
+  }
+  // Read straight into the tail of the container, a buffer reused across
+  // calls keeps its capacity and does not allocate again
+  size_t old_size = buffer.size ();
+  buffer.resize (old_size + size);
+  size_t bytes_read = 0;
+  try {
+    bytes_read = this->pimpl_->read (&buffer[old_size], size);
+  } catch (...) {
+    buffer.resize (old_size);
+    throw;
+  }
+  buffer.resize (old_size + bytes_read);
   return bytes_read;
 }
 
 size_t
 Serial::read (std::string &buffer, size_t size)
 {
+  ScopedLatency timer(latency_[serial::latency_op_read]);
   ScopedReadLock lock(this->pimpl_);
-  uint8_t *buffer_ = new uint8_t[size];
-  size_t bytes_read = this->pimpl_->read (buffer_, size);
-  buffer.append (reinterpret_cast<const char*>(buffer_), bytes_read);
-  delete[] buffer_;
+  if (size == 0) {
+    return this->pimpl_->read (NULL, 0);
+  }
+  size_t old_size = buffer.size ();
+  buffer.resize (old_size + size);
+  size_t bytes_read = 0;
+  try {
+    bytes_read = this->pimpl_->read
+      (reinterpret_cast<uint8_t*> (&buffer[old_size]), size);
+  } catch (...) {
+    buffer.resize (old_size);
+    throw;
+  }
+  buffer.resize (old_size + bytes_read);
   return bytes_read;
 }
 
+size_t
+Serial::read (ByteSpan buffer)
+{
+  ScopedLatency timer(latency_[serial::latency_op_read]);
+  ScopedReadLock lock(this->pimpl_);
+  return this->pimpl_->read (buffer.data (), buffer.size ());
+}
+
 string
 Serial::read (size_t size)
 {
@@ -157,30 +238,79 @@ Serial::read (size_t size)
   return buffer;
 }
 
+// Returns the start of the first eol in [begin, end), or NULL.  The first
+// byte is located with memchr, which the C library vectorizes, so long runs
+// of payload are skipped many bytes at a time.
+static const uint8_t *
+find_eol (const uint8_t *begin, const uint8_t *end, const string &eol)
+{
+  size_t eol_len = eol.length ();
+  const uint8_t first = static_cast<uint8_t> (eol[0]);
+  while (static_cast<size_t> (end - begin) >= eol_len) {
+    const uint8_t *hit = static_cast<const uint8_t *>
+      (memchr (begin, first, (end - begin) - (eol_len - 1)));
+    if (hit == NULL) {
+      return NULL;
+    }
+    if (memcmp (hit + 1, eol.data () + 1, eol_len - 1) == 0) {
+      return hit;
+    }
+    begin = hit + 1;
+  }
+  return NULL;
+}
+
 size_t
 Serial::readline (string &buffer, size_t size, string eol)
 {
+  ScopedLatency timer(latency_[serial::latency_op_readline]);
   ScopedReadLock lock(this->pimpl_);
-  size_t eol_len = eol.length ();
   uint8_t *buffer_ = static_cast<uint8_t*>
                               (alloca (size * sizeof (uint8_t)));
+  size_t read_so_far = this->readline_ (buffer_, size, eol);
+  buffer.append(reinterpret_cast<const char*> (buffer_), read_so_far);
+  return read_so_far;
+}
+
+size_t
+Serial::readline (ByteSpan buffer, const string &eol)
+{
+  ScopedLatency timer(latency_[serial::latency_op_readline]);
+  ScopedReadLock lock(this->pimpl_);
+  return this->readline_ (buffer.data (), buffer.size (), eol);
+}
+
+size_t
+Serial::readline_ (uint8_t *buffer_, size_t size, const string &eol)
+{
+  size_t eol_len = eol.length ();
   size_t read_so_far = 0;
-  while (true)
+  while (read_so_far < size)
   {
-    size_t bytes_read = this->read_ (buffer_ + read_so_far, 1);
-    read_so_far += bytes_read;
+    // Grab everything that is already there, not just one byte.  Anything
+    // past the end of the line is pushed back for the next read.
+    size_t wanted = eol_len == 0 ? 1 : size - read_so_far;
+    size_t bytes_read = this->pimpl_->readSome (buffer_ + read_so_far, wanted);
     if (bytes_read == 0) {
       break; // Timeout occured on reading 1 byte
     }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
-      break; // EOL found
+    if (eol_len == 0) {
+      read_so_far += bytes_read;
+      break;
     }
-    if (read_so_far == size) {
-      break; // Reached the maximum read length
+    // An eol may straddle the previous chunk and this one
+    size_t scan_from = read_so_far >= eol_len - 1 ? read_so_far - (eol_len - 1) : 0;
+    read_so_far += bytes_read;
+    const uint8_t *found = find_eol (buffer_ + scan_from,
+                                     buffer_ + read_so_far, eol);
+    if (found != NULL) {
+      // EOL found
+      size_t line_end = (found - buffer_) + eol_len;
+      this->pimpl_->unread (buffer_ + line_end, read_so_far - line_end);
+      read_so_far = line_end;
+      break;
     }
   }
-  buffer.append(reinterpret_cast<const char*> (buffer_), read_so_far);
   return read_so_far;
 }
 
@@ -203,39 +333,292 @@ Serial::readlines (size_t size, string eol)
   size_t read_so_far = 0;
   size_t start_of_line = 0;
   while (read_so_far < size) {
-    size_t bytes_read = this->read_ (buffer_+read_so_far, 1);
-    read_so_far += bytes_read;
+    size_t wanted = eol_len == 0 ? 1 : size - read_so_far;
+    size_t bytes_read = this->pimpl_->readSome (buffer_ + read_so_far, wanted);
     if (bytes_read == 0) {
-      if (start_of_line != read_so_far) {
-        lines.push_back (
-          string (reinterpret_cast<const char*> (buffer_ + start_of_line),
-            read_so_far - start_of_line));
-      }
       break; // Timeout occured on reading 1 byte
     }
-    if (string (reinterpret_cast<const char*>
-         (buffer_ + read_so_far - eol_len), eol_len) == eol) {
+    if (eol_len == 0) {
+      // Every byte is a line of its own
+      read_so_far += bytes_read;
+      lines.push_back (
+        string (reinterpret_cast<const char*> (buffer_ + start_of_line),
+          read_so_far - start_of_line));
+      start_of_line = read_so_far;
+      continue;
+    }
+    size_t scan_from = std::max (start_of_line,
+      read_so_far >= eol_len - 1 ? read_so_far - (eol_len - 1) : 0);
+    read_so_far += bytes_read;
+    const uint8_t *found;
+    while ((found = find_eol (buffer_ + scan_from, buffer_ + read_so_far,
+                              eol)) != NULL) {
       // EOL found
+      size_t line_end = (found - buffer_) + eol_len;
       lines.push_back(
         string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-          read_so_far - start_of_line));
-      start_of_line = read_so_far;
+          line_end - start_of_line));
+      start_of_line = scan_from = line_end;
+    }
+  }
+  // Timed out or reached the maximum read length
+  if (start_of_line != read_so_far) {
+    lines.push_back(
+      string(reinterpret_cast<const char*> (buffer_ + start_of_line),
+        read_so_far - start_of_line));
+  }
+  return lines;
+}
+
+// Most bytes taken from the port per read while looking for a frame
+static const size_t kFrameChunk = 4096;
+
+// Looks for a frame at the start of data, skipping malformed input.  Sets
+// start to the bytes used up, the frame included when it is complete.
+static frame_status_t
+scan_frame (const Framer &framer, const vector<uint8_t> &data, size_t &start,
+            vector<uint8_t> &frame)
+{
+  start = 0;
+  frame_status_t status = serial::frame_incomplete;
+  while (start < data.size ()) {
+    size_t consumed = 0;
+    status = framer.scan (&data[start], data.size () - start, consumed, frame);
+    if (status == serial::frame_invalid && consumed == 0) {
+      consumed = 1;
+    }
+    start += consumed;
+    if (status != serial::frame_invalid) {
+      break;
+    }
+  }
+  return status;
+}
+
+void
+Serial::setFramer (Framer *framer)
+{
+  ScopedReadLock rlock(this->pimpl_);
+  ScopedWriteLock wlock(this->pimpl_);
+  if (framer != framer_) {
+    delete framer_;
+    framer_ = framer;
+  }
+}
+
+Framer *
+Serial::getFramer () const
+{
+  return framer_;
+}
+
+bool
+Serial::readFrame (vector<uint8_t> &frame)
+{
+  ScopedReadLock lock(this->pimpl_);
+  if (framer_ == NULL) {
+    throw SerialException ("Serial::readFrame without a framer");
+  }
+  frame.clear ();
+  frame_rx_.clear ();
+  while (true) {
+    // Split what has been read so far, dropping garbage
+    size_t start = 0;
+    frame_status_t status = scan_frame (*framer_, frame_rx_, start, frame);
+    if (status == serial::frame_complete) {
+      // The rest belongs to the next frame, or to whoever reads next
+      this->pimpl_->unread (&frame_rx_[0] + start, frame_rx_.size () - start);
+      frame_rx_.clear ();
+      return true;
     }
-    if (read_so_far == size) {
-      if (start_of_line != read_so_far) {
-        lines.push_back(
-          string(reinterpret_cast<const char*> (buffer_ + start_of_line),
-            read_so_far - start_of_line));
+    frame_rx_.erase (frame_rx_.begin (), frame_rx_.begin () + start);
+
+    size_t old_size = frame_rx_.size ();
+    frame_rx_.resize (old_size + kFrameChunk);
+    size_t bytes_read = 0;
+    try {
+      bytes_read = this->pimpl_->readSome (&frame_rx_[old_size], kFrameChunk);
+    } catch (...) {
+      frame_rx_.resize (old_size);
+      if (old_size > 0) {
+        this->pimpl_->unread (&frame_rx_[0], old_size);
       }
-      break; // Reached the maximum read length
+      throw;
+    }
+    frame_rx_.resize (old_size + bytes_read);
+    if (bytes_read == 0) {
+      // Timed out, keep the partial frame for the next call
+      if (old_size > 0) {
+        this->pimpl_->unread (&frame_rx_[0], old_size);
+      }
+      frame_rx_.clear ();
+      frame.clear ();
+      return false;
     }
   }
-  return lines;
+}
+
+bool
+Serial::transact (const uint8_t *request, size_t size, const Framer *matcher,
+                  vector<uint8_t> &response, uint32_t deadline_ms,
+                  bool flush_input, TransactTiming *timing)
+{
+  ScopedTrace trace ("serial transact");
+  uint64_t start_ns = LatencyHistogram::now ();
+  uint64_t deadline_ns = start_ns + deadline_ms * 1000000ULL;
+  TransactTiming steps;
+  memset (&steps, 0, sizeof (steps));
+
+  ScopedReadLock rlock(this->pimpl_);
+  ScopedWriteLock wlock(this->pimpl_);
+  steps.locked_ns = LatencyHistogram::now () - start_ns;
+  if (!pimpl_->isOpen ()) {
+    throw serial::PortNotOpenedException ("Serial::transact");
+  }
+  if (matcher == NULL) {
+    matcher = framer_;
+  }
+  if (matcher == NULL) {
+    throw SerialException ("Serial::transact without a matcher");
+  }
+
+  if (flush_input) {
+    pimpl_->flushInput ();
+  }
+  pimpl_->flushWrites ();
+  if (pimpl_->writeNow (request, size) != size) {
+    THROW (IOException, "timed out sending the request");
+  }
+  steps.request_ns = LatencyHistogram::now () - start_ns;
+
+  response.clear ();
+  frame_rx_.clear ();
+  bool complete = false;
+  bool late = false;
+  while (true) {
+    size_t start = 0;
+    frame_status_t status = scan_frame (*matcher, frame_rx_, start, response);
+    if (status == serial::frame_complete) {
+      this->pimpl_->unread (&frame_rx_[0] + start, frame_rx_.size () - start);
+      complete = true;
+      break;
+    }
+    // Whatever the matcher used up without completing a frame was skipped
+    steps.bytes_discarded += start;
+    frame_rx_.erase (frame_rx_.begin (), frame_rx_.begin () + start);
+
+    if (late || readBefore_ (frame_rx_, deadline_ns) == 0) {
+      break;
+    }
+    late = LatencyHistogram::now () >= deadline_ns;
+    if (steps.first_byte_ns == 0) {
+      steps.first_byte_ns = LatencyHistogram::now () - start_ns;
+    }
+  }
+  if (!complete) {
+    // Keep the partial response for whoever reads next
+    if (!frame_rx_.empty ()) {
+      this->pimpl_->unread (&frame_rx_[0], frame_rx_.size ());
+    }
+    response.clear ();
+  }
+  frame_rx_.clear ();
+  steps.complete_ns = LatencyHistogram::now () - start_ns;
+  if (timing != NULL) {
+    *timing = steps;
+  }
+  return complete;
+}
+
+int
+Serial::readUntilAny (const PatternSet &patterns, vector<uint8_t> &before,
+                      uint32_t deadline_ms)
+{
+  ScopedTrace trace ("serial readUntilAny");
+  uint64_t deadline_ns = LatencyHistogram::now () + deadline_ms * 1000000ULL;
+  ScopedReadLock lock(this->pimpl_);
+  if (!pimpl_->isOpen ()) {
+    throw serial::PortNotOpenedException ("Serial::readUntilAny");
+  }
+  before.clear ();
+  // The automaton carries over from one chunk to the next, so every byte
+  // is looked at exactly once
+  PatternSet::ScanState state;
+  int index = -1;
+  bool late = false;
+  do {
+    index = patterns.scan (before.empty () ? NULL : &before[0] + state.fed,
+                           before.size () - state.fed, state);
+    if (index >= 0 || late) {
+      break;
+    }
+    // Past the deadline only what has already arrived is read, once
+    late = LatencyHistogram::now () >= deadline_ns;
+  } while (readBefore_ (before, deadline_ns) > 0);
+  if (index < 0) {
+    // No more input, so a shorter match is as good as it gets
+    index = state.match;
+  }
+  if (index < 0) {
+    // Nothing matched, keep the bytes for the next read
+    if (!before.empty ()) {
+      this->pimpl_->unread (&before[0], before.size ());
+    }
+    return -1;
+  }
+  // The rest is for whoever reads next
+  this->pimpl_->unread (&before[0] + state.match_end,
+                        before.size () - state.match_end);
+  before.resize (state.match_start);
+  return index;
+}
+
+size_t
+Serial::readBefore_ (vector<uint8_t> &buffer, uint64_t deadline_ns)
+{
+  while (true) {
+    // Past the deadline, data that has already arrived is still taken
+    uint64_t now_ns = LatencyHistogram::now ();
+    uint32_t wait_ms = 0;
+    if (now_ns < deadline_ns) {
+      wait_ms = static_cast<uint32_t> (std::min<uint64_t> (
+          (deadline_ns - now_ns + 999999) / 1000000, UINT32_MAX));
+    }
+    if (pimpl_->waitReadable (wait_ms)) {
+      break;
+    }
+    if (wait_ms == 0) {
+      return 0;
+    }
+  }
+  size_t old_size = buffer.size ();
+  buffer.resize (old_size + kFrameChunk);
+  size_t bytes_read = 0;
+  try {
+    bytes_read = this->pimpl_->readAvailable (&buffer[old_size], kFrameChunk);
+  } catch (...) {
+    buffer.resize (old_size);
+    if (old_size > 0) {
+      this->pimpl_->unread (&buffer[0], old_size);
+    }
+    throw;
+  }
+  buffer.resize (old_size + bytes_read);
+  if (bytes_read == 0) {
+    // Reported readable but nothing came, the same as in read
+    if (old_size > 0) {
+      this->pimpl_->unread (&buffer[0], old_size);
+    }
+    throw SerialException ("device reports readiness to read but "
+                           "returned no data (device disconnected?)");
+  }
+  return bytes_read;
 }
 
 size_t
 Serial::write (const string &data)
 {
+  ScopedLatency timer(latency_[serial::latency_op_write]);
   ScopedWriteLock lock(this->pimpl_);
   return this->write_ (reinterpret_cast<const uint8_t*>(data.c_str()),
                        data.length());
@@ -244,17 +627,40 @@ Serial::write (const string &data)
 size_t
 Serial::write (const std::vector<uint8_t> &data)
 {
+  ScopedLatency timer(latency_[serial::latency_op_write]);
   ScopedWriteLock lock(this->pimpl_);
-  return this->write_ (&data[0], data.size());
+  return this->write_ (data.empty () ? NULL : &data[0], data.size());
+}
+
+size_t
+Serial::write (ConstByteSpan data)
+{
+  ScopedLatency timer(latency_[serial::latency_op_write]);
+  ScopedWriteLock lock(this->pimpl_);
+  return this->write_ (data.data (), data.size ());
 }
 
 size_t
 Serial::write (const uint8_t *data, size_t size)
 {
+  ScopedLatency timer(latency_[serial::latency_op_write]);
   ScopedWriteLock lock(this->pimpl_);
   return this->write_(data, size);
 }
 
+size_t
+Serial::writeFrame (const uint8_t *payload, size_t size)
+{
+  ScopedWriteLock lock(this->pimpl_);
+  if (framer_ == NULL) {
+    throw SerialException ("Serial::writeFrame without a framer");
+  }
+  frame_tx_.clear ();
+  framer_->encode (payload, size, frame_tx_);
+  return this->write_ (frame_tx_.empty () ? NULL : &frame_tx_[0],
+                       frame_tx_.size ());
+}
+
 size_t
 Serial::write_ (const uint8_t *data, size_t length)
 {
@@ -278,6 +684,26 @@ Serial::getPort () const
   return pimpl_->getPort ();
 }
 
+void
+Serial::setReplay (const string &capture, double speed)
+{
+  if (!(speed >= 0)) {
+    throw invalid_argument ("Replay speed must be >= 0.");
+  }
+  ScopedReadLock rlock(this->pimpl_);
+  ScopedWriteLock wlock(this->pimpl_);
+  bool was_open = pimpl_->isOpen ();
+  if (was_open) close();
+  pimpl_->setReplay (capture, speed);
+  if (was_open) open ();
+}
+
+bool
+Serial::isReplay () const
+{
+  return pimpl_->isReplay ();
+}
+
 void
 Serial::setTimeout (serial::Timeout &timeout)
 {
@@ -349,8 +775,145 @@ Serial::getFlowcontrol () const
   return pimpl_->getFlowcontrol ();
 }
 
+void
+Serial::setLatencyProfile (latency_profile_t profile)
+{
+  // The blocking read descriptor may be replaced
+  ScopedReadLock lock(this->pimpl_);
+  pimpl_->setLatencyProfile (profile);
+}
+
+latency_profile_t
+Serial::getLatencyProfile () const
+{
+  return pimpl_->getLatencyProfile ();
+}
+
+void
+Serial::setReadCoalescing (coalesce_policy_t policy, uint32_t max_wait_us)
+{
+  ScopedReadLock lock(this->pimpl_);
+  pimpl_->setReadCoalescing (policy, max_wait_us);
+}
+
+coalesce_policy_t
+Serial::getReadCoalescing () const
+{
+  return pimpl_->getReadCoalescing ();
+}
+
+uint32_t
+Serial::getReadCoalescingMaxWait () const
+{
+  return pimpl_->getReadCoalescingMaxWait ();
+}
+
+void
+Serial::setWriteBatching (size_t max_bytes, uint32_t deadline_us)
+{
+  ScopedWriteLock lock(this->pimpl_);
+  pimpl_->setWriteBatching (max_bytes, deadline_us);
+}
+
+size_t
+Serial::getWriteBatchSize () const
+{
+  return pimpl_->getWriteBatchSize ();
+}
+
+uint32_t
+Serial::getWriteBatchDeadline () const
+{
+  return pimpl_->getWriteBatchDeadline ();
+}
+
+void
+Serial::flushWrites ()
+{
+  ScopedWriteLock lock(this->pimpl_);
+  pimpl_->flushWrites ();
+}
+
+uint64_t
+Serial::submitWrite (const uint8_t *data, size_t size,
+                     serial::write_priority_t priority,
+                     serial::WriteListener *listener)
+{
+  // The queue has its own lock, the writer thread takes the write lock
+  return pimpl_->submitWrite (data, size, priority, listener);
+}
+
+void
+Serial::cancelWrites ()
+{
+  pimpl_->cancelWrites ();
+}
+
+size_t
+Serial::getQueuedWrites () const
+{
+  return pimpl_->getQueuedWrites ();
+}
+
+serial::PortStats
+Serial::getStats () const
+{
+  PortStats stats;
+  pimpl_->getStats (stats);
+  return stats;
+}
+
+void
+Serial::getLatency (latency_op_t op, LatencyHistogram &snapshot, bool reset)
+{
+  if (op < 0 || op >= serial::latency_op_count) {
+    throw invalid_argument ("unknown latency_op_t");
+  }
+  latency_[op].copyTo (snapshot, reset);
+}
+
+void
+Serial::resetLatency ()
+{
+  for (int op = 0; op < serial::latency_op_count; ++op) {
+    latency_[op].reset ();
+  }
+}
+
+void
+Serial::startCapture (const string &path)
+{
+  pimpl_->startCapture (path);
+}
+
+void
+Serial::stopCapture ()
+{
+  pimpl_->stopCapture ();
+}
+
+bool
+Serial::isCapturing () const
+{
+  return pimpl_->isCapturing ();
+}
+
+void
+Serial::setContinuousReceive (bool enabled, size_t buffer_size)
+{
+  ScopedReadLock lock(this->pimpl_);
+  pimpl_->setContinuousReceive (enabled, buffer_size);
+}
+
+bool
+Serial::isContinuousReceive () const
+{
+  return pimpl_->isContinuousReceive ();
+}
+
 void Serial::flush ()
 {
+  ScopedLatency timer(latency_[serial::latency_op_flush]);
   ScopedReadLock rlock(this->pimpl_);
   ScopedWriteLock wlock(this->pimpl_);
   pimpl_->flush ();
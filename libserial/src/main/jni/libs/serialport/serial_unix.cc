@@ -7,10 +7,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <sstream>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/select.h>
 #include <sys/signal.h>
 #include <errno.h>
 #include <paths.h>
@@ -23,7 +26,6 @@
 # include <linux/serial.h>
 #endif
 
-#include <sys/select.h>
 #include <sys/time.h>
 #include <time.h>
 #ifdef __MACH__
@@ -33,6 +35,7 @@
 #endif
 
 #include "serial/impl/unix.h"
+#include "serial/trace.h"
 
 #ifndef TIOCINQ
 #ifdef FIONREAD
@@ -56,10 +59,14 @@ using std::string;
 using std::stringstream;
 using std::invalid_argument;
 using serial::MillisecondTimer;
+using serial::Poller;
 using serial::Serial;
 using serial::SerialException;
 using serial::PortNotOpenedException;
 using serial::IOException;
+using serial::ScopedTrace;
+using serial::Trace;
+using serial::WriteListener;
 
 
 MillisecondTimer::MillisecondTimer (const uint32_t millis)
@@ -111,25 +118,121 @@ timespec_from_ms (const uint32_t millis)
   return time;
 }
 
+// Absolute CLOCK_MONOTONIC time nanos from now, for pthread_cond_timedwait.
+static timespec
+monotonic_deadline_ns (const uint64_t nanos)
+{
+  timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  time.tv_sec += static_cast<time_t> (nanos / 1000000000ULL);
+  time.tv_nsec += static_cast<long> (nanos % 1000000000ULL);
+  if (time.tv_nsec >= 1000000000L) {
+    time.tv_sec += 1;
+    time.tv_nsec -= 1000000000L;
+  }
+  return time;
+}
+
+static timespec
+monotonic_deadline (const uint32_t millis)
+{
+  return monotonic_deadline_ns (static_cast<uint64_t> (millis) * 1000000ULL);
+}
+
+static uint64_t
+monotonic_ns ()
+{
+  timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t> (now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+// Counters are only ever added to, readers take relaxed snapshots
+static inline void
+count (uint64_t &counter, uint64_t amount = 1)
+{
+  __atomic_fetch_add (&counter, amount, __ATOMIC_RELAXED);
+}
+
+// Accounts one ::read, whatever it returned
+static inline void
+count_read (uint64_t &calls, uint64_t &bytes, uint64_t &zero_reads,
+            ssize_t result)
+{
+  count (calls);
+  if (result > 0) {
+    count (bytes, static_cast<uint64_t> (result));
+  } else {
+    count (zero_reads);
+  }
+}
+
 Serial::SerialImpl::SerialImpl (const string &port, unsigned long baudrate,
                                 bytesize_t bytesize,
                                 parity_t parity, stopbits_t stopbits,
                                 flowcontrol_t flowcontrol)
-  : port_ (port), fd_ (-1), is_open_ (false), xonxoff_ (false), rtscts_ (false),
+  : port_ (port), fd_ (-1), backend_ (NULL), replay_ (false),
+    is_open_ (false), xonxoff_ (false), rtscts_ (false),
     baudrate_ (baudrate), parity_ (parity),
-    bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol)
+    bytesize_ (bytesize), stopbits_ (stopbits), flowcontrol_ (flowcontrol),
+    latency_profile_ (latency_default), rx_block_fd_ (-1),
+    kernel_timed_reads_ (false), coalesce_policy_ (coalesce_fixed),
+    coalesce_max_wait_us_ (0), rx_ns_per_byte_ (0),
+    rx_poller_ (new Poller ()), tx_poller_ (NULL), close_count_ (0),
+    rx_enabled_ (false), rx_running_ (false), rx_stop_ (false), rx_error_ (0),
+    rx_capacity_ (0), rx_data_waiters_ (0), rx_space_waiting_ (false),
+    tx_batch_limit_ (0), tx_batch_deadline_us_ (0), tx_batch_due_ns_ (0),
+    tx_batch_error_ (0), tx_flusher_running_ (false), tx_flusher_stop_ (false),
+    tx_flush_on_unlock_ (false), tx_flush_at_ns_ (0), tx_queued_ (0), tx_next_id_ (1),
+    tx_writer_running_ (false), tx_writer_stop_ (false), pending_pos_ (0),
+    pending_count_ (0)
 {
+  try {
+    tx_poller_ = new Poller ();
+  } catch (...) {
+    delete rx_poller_;
+    throw;
+  }
+  backend_ = new DeviceBackend ();
+  memset (&rx_stats_, 0, sizeof (rx_stats_));
+  memset (&tx_stats_, 0, sizeof (tx_stats_));
   pthread_mutex_init(&this->read_mutex, NULL);
   pthread_mutex_init(&this->write_mutex, NULL);
+  pthread_mutex_init(&this->rx_mutex_, NULL);
+  pthread_mutex_init(&this->tx_flush_mutex_, NULL);
+  pthread_mutex_init(&this->tx_queue_mutex_, NULL);
+  pthread_mutex_init(&this->close_mutex_, NULL);
+  // Receive waits use deadlines on the monotonic clock, like MillisecondTimer
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&this->rx_data_cond_, &cond_attr);
+  pthread_cond_init(&this->rx_space_cond_, &cond_attr);
+  pthread_cond_init(&this->tx_flush_cond_, &cond_attr);
+  pthread_cond_init(&this->tx_queue_cond_, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
   if (port_.empty () == false)
     open ();
 }
 
 Serial::SerialImpl::~SerialImpl ()
 {
+  // Let a write in progress finish before its descriptor goes away
+  stopWriter ();
   close();
   pthread_mutex_destroy(&this->read_mutex);
   pthread_mutex_destroy(&this->write_mutex);
+  pthread_cond_destroy(&this->rx_data_cond_);
+  pthread_cond_destroy(&this->rx_space_cond_);
+  pthread_mutex_destroy(&this->rx_mutex_);
+  pthread_cond_destroy(&this->tx_flush_cond_);
+  pthread_mutex_destroy(&this->tx_flush_mutex_);
+  pthread_cond_destroy(&this->tx_queue_cond_);
+  pthread_mutex_destroy(&this->tx_queue_mutex_);
+  pthread_mutex_destroy(&this->close_mutex_);
+  delete rx_poller_;
+  delete tx_poller_;
+  delete backend_;
 }
 
 void
@@ -141,8 +244,9 @@ Serial::SerialImpl::open ()
   if (is_open_ == true) {
     throw SerialException ("Serial port already open.");
   }
+  ScopedTrace trace ("serial open");
 
-  fd_ = ::open (port_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  fd_ = backend_->open (port_);
 
   if (fd_ == -1) {
     switch (errno) {
@@ -158,13 +262,35 @@ Serial::SerialImpl::open ()
     }
   }
 
-  reconfigurePort();
+  try {
+    reconfigurePort();
+    rx_poller_->add (fd_, poll_readable);
+    tx_poller_->add (fd_, poll_writable);
+  } catch (...) {
+    rx_poller_->remove (fd_);
+    if (rx_block_fd_ != -1) {
+      ::close (rx_block_fd_);
+      rx_block_fd_ = -1;
+    }
+    ::close (fd_);
+    fd_ = -1;
+    backend_->close ();
+    throw;
+  }
   is_open_ = true;
+
+  if (rx_enabled_) {
+    startReceiver ();
+  }
+  if (tx_batch_limit_ > 0 && tx_batch_deadline_us_ > 0) {
+    startFlusher ();
+  }
 }
 
 void
 Serial::SerialImpl::reconfigurePort ()
 {
+  ScopedTrace trace ("serial reconfigure");
   if (fd_ == -1) {
     // Can only operate on a valid file descriptor
     THROW (IOException, "Invalid file descriptor, is the serial port open?");
@@ -442,9 +568,22 @@ Serial::SerialImpl::reconfigurePort ()
   // to read before each call, so we should never needlessly poll
   options.c_cc[VMIN] = 0;
   options.c_cc[VTIME] = 0;
+  // In the low latency profile blocking reads on rx_block_fd_ return once
+  // the requested bytes (up to VMIN) are in or the line has been idle for
+  // VTIME.  fd_ is non-blocking, so its reads and polls are not affected;
+  // VMIN without VTIME would change what poll reports, hence both or none.
+  uint8_t vtime = kernelInterByteTime ();
+  if (vtime > 0) {
+    options.c_cc[VMIN] = 255;
+    options.c_cc[VTIME] = vtime;
+  }
 
   // activate settings
   ::tcsetattr (fd_, TCSANOW, &options);
+  count (tx_stats_.reconfigurations);
+
+  applyLatencyProfile ();
+  kernel_timed_reads_ = vtime > 0;
 
   // Update byte_time_ based on the new settings.
   uint32_t bit_time_ns = 1e9 / baudrate_;
@@ -455,13 +594,103 @@ Serial::SerialImpl::reconfigurePort ()
   if (stopbits_ == stopbits_one_point_five) {
     byte_time_ns_ += ((1.5 - stopbits_one_point_five) * bit_time_ns);
   }
+  // Start the adaptive estimate over at line rate
+  rx_ns_per_byte_ = byte_time_ns_;
+  captureConfig ();
+}
+
+void
+Serial::SerialImpl::applyLatencyProfile ()
+{
+#if defined(__linux__) && defined (TIOCSSERIAL) && defined (ASYNC_LOW_LATENCY)
+  if (latency_profile_ != latency_default) {
+    // Only a hint to the driver, ports without it (ptys, some USB
+    // adapters) work the same, just with the driver's own latency.
+    struct serial_struct ser;
+    if (-1 != ioctl (fd_, TIOCGSERIAL, &ser)) {
+      int flags = ser.flags;
+      if (latency_profile_ == latency_low) {
+        ser.flags |= ASYNC_LOW_LATENCY;
+      } else {
+        ser.flags &= ~ASYNC_LOW_LATENCY;
+      }
+      if (flags != ser.flags) {
+        ioctl (fd_, TIOCSSERIAL, &ser);
+      }
+    }
+  }
+#endif
+  if (latency_profile_ == latency_low && rx_block_fd_ == -1) {
+    // A second open file description, so that it can block without
+    // making writes on fd_ block as well.  It shares the termios settings.
+    rx_block_fd_ = backend_->openReader ();
+    if (rx_block_fd_ == -1) {
+      THROW (IOException, errno);
+    }
+  } else if (latency_profile_ != latency_low && rx_block_fd_ != -1) {
+    ::close (rx_block_fd_);
+    rx_block_fd_ = -1;
+  }
+}
+
+uint8_t
+Serial::SerialImpl::kernelInterByteTime () const
+{
+  // VTIME counts tenths of a second, shorter inter-byte timeouts are left
+  // to the poller
+  if (latency_profile_ != latency_low
+      || timeout_.inter_byte_timeout == Timeout::max ()
+      || timeout_.inter_byte_timeout < 100) {
+    return 0;
+  }
+  return static_cast<uint8_t> (std::min<uint32_t> (
+      (timeout_.inter_byte_timeout + 50) / 100, 255));
+}
+
+size_t
+Serial::SerialImpl::kernelReadSize (size_t missing, int64_t remaining_ms) const
+{
+  if (!kernel_timed_reads_ || missing < 2 || remaining_ms <= 0) {
+    return 0;
+  }
+  // VTIME restarts with every byte, a line trickling bytes just inside it
+  // keeps the read going for up to one VTIME per byte asked for.  The first
+  // byte is already in when this is used.
+  int64_t vtime_ms = static_cast<int64_t> (kernelInterByteTime ()) * 100;
+  if (vtime_ms == 0) {
+    return 0;
+  }
+  int64_t fits = remaining_ms / vtime_ms;
+  // VMIN caps a read at 255
+  return static_cast<size_t> (std::min<int64_t> (
+      std::min<int64_t> (static_cast<int64_t> (missing), 255), fits));
 }
 
 void
 Serial::SerialImpl::close ()
 {
   if (is_open_ == true) {
+    __atomic_add_fetch (&close_count_, 1, __ATOMIC_RELEASE);
+    // Submitted writes that have not started would only fail now
+    cancelWrites ();
+    // The receiver and the flush thread use fd_, they have to be gone
+    // before fd_ is.  Whatever is still queued gets one last try.
+    stopFlusher ();
+    if (!tx_batch_.empty ()) {
+      try {
+        writeNow (&tx_batch_[0], tx_batch_.size ());
+      } catch (...) {
+      }
+      tx_batch_.clear ();
+    }
+    stopReceiver ();
+    if (rx_block_fd_ != -1) {
+      ::close (rx_block_fd_);
+      rx_block_fd_ = -1;
+    }
     if (fd_ != -1) {
+      rx_poller_->remove (fd_);
+      tx_poller_->remove (fd_);
       int ret;
       ret = ::close (fd_);
       if (ret == 0) {
@@ -470,7 +699,13 @@ Serial::SerialImpl::close ()
         THROW (IOException, errno);
       }
     }
+    backend_->close ();
     is_open_ = false;
+    pthread_mutex_lock (&close_mutex_);
+    for (size_t i = 0; i < close_watchers_.size (); ++i) {
+      close_watchers_[i]->wakeup ();
+    }
+    pthread_mutex_unlock (&close_mutex_);
   }
 }
 
@@ -486,75 +721,252 @@ Serial::SerialImpl::available ()
   if (!is_open_) {
     return 0;
   }
+  size_t buffered = rx_ring_.size () + pendingCount ();
+  if (rx_running_) {
+    return buffered;
+  }
   int count = 0;
   if (-1 == ioctl (fd_, TIOCINQ, &count)) {
       THROW (IOException, errno);
   } else {
-      return static_cast<size_t> (count);
+      return buffered + static_cast<size_t> (count);
   }
 }
 
 bool
 Serial::SerialImpl::waitReadable (uint32_t timeout)
 {
-  // Setup a select call to block for serial data or a timeout
-  fd_set readfds;
-  FD_ZERO (&readfds);
-  FD_SET (fd_, &readfds);
-  timespec timeout_ts (timespec_from_ms (timeout));
-  int r = pselect (fd_ + 1, &readfds, NULL, NULL, &timeout_ts, NULL);
-
-  if (r < 0) {
-    // Select was interrupted
-    if (errno == EINTR) {
-      return false;
+  if (pendingCount () > 0) {
+    return true;
+  }
+  ScopedTrace trace ("serial waitReadable");
+  uint64_t start_ns = monotonic_ns ();
+  bool readable;
+  if (rx_running_ || rx_ring_.size () > 0) {
+    // Served by the receive thread, wait for it to fill the ring instead.
+    if (rx_ring_.size () == 0) {
+      int error = 0;
+      waitReceived (monotonic_deadline (timeout), error);
     }
-    // Otherwise there was some error
-    THROW (IOException, errno);
+    readable = rx_ring_.size () > 0;
+  } else {
+    // Block for serial data or a timeout.  Interruptions (EINTR) count as
+    // a timeout.  Hangups and errors are reported as readable so that the
+    // following read gets to see and report them.
+    int wait_ms = static_cast<int> (std::min<uint32_t> (timeout, INT32_MAX));
+    readable = rx_poller_->waitFor (fd_, wait_ms) != 0;
   }
-  // Timeout occurred
-  if (r == 0) {
+  count (rx_stats_.wait_ns, monotonic_ns () - start_ns);
+  count (readable ? rx_stats_.wakeups : rx_stats_.timeouts);
+  return readable;
+}
+
+bool
+Serial::SerialImpl::waitIdle (uint64_t idle_ns)
+{
+  if (pendingCount () > 0) {
     return false;
   }
-  // This shouldn't happen, if r > 0 our fd has to be in the list!
-  if (!FD_ISSET (fd_, &readfds)) {
-    THROW (IOException, "select reports ready to read, but our fd isn't"
-           " in the list, this shouldn't happen!");
+  if (rx_running_ || rx_ring_.size () > 0) {
+    if (rx_ring_.size () > 0) {
+      return false;
+    }
+    int error = 0;
+    waitReceived (monotonic_deadline_ns (idle_ns), error);
+    return rx_ring_.size () == 0 && error == 0;
   }
-  // Data available to read.
-  return true;
+  // epoll only counts milliseconds, character times at high baud rates are
+  // much shorter, so this one waits with ppoll
+  pollfd readable;
+  readable.fd = fd_;
+  readable.events = POLLIN;
+  readable.revents = 0;
+  timespec timeout;
+  timeout.tv_sec = static_cast<time_t> (idle_ns / 1000000000ULL);
+  timeout.tv_nsec = static_cast<long> (idle_ns % 1000000000ULL);
+  int r = ppoll (&readable, 1, &timeout, NULL);
+  if (r < 0 && errno != EINTR) {
+    THROW (IOException, errno);
+  }
+  // An interruption ends the wait early, which only shortens the gap
+  return r == 0;
+}
+
+uint32_t
+Serial::SerialImpl::getByteTimeNs () const
+{
+  return byte_time_ns_;
 }
 
 void
 Serial::SerialImpl::waitByteTimes (size_t count)
 {
-  timespec wait_time = { 0, static_cast<long>(byte_time_ns_ * count)};
-  pselect (0, NULL, NULL, NULL, &wait_time, NULL);
+  uint64_t wait_ns = static_cast<uint64_t> (byte_time_ns_) * count;
+  timespec wait_time;
+  wait_time.tv_sec = static_cast<time_t> (wait_ns / 1000000000ULL);
+  wait_time.tv_nsec = static_cast<long> (wait_ns % 1000000000ULL);
+  nanosleep (&wait_time, NULL);
 }
 
 size_t
 Serial::SerialImpl::read (uint8_t *buf, size_t size)
+{
+  return readAtLeast (buf, size, size);
+}
+
+size_t
+Serial::SerialImpl::readSome (uint8_t *buf, size_t size)
+{
+  // Same wait as a single byte read, but take whatever else is there too.
+  return readAtLeast (buf, size, std::min<size_t> (size, 1));
+}
+
+void
+Serial::SerialImpl::unread (const uint8_t *data, size_t length)
+{
+  if (length == 0) {
+    return;
+  }
+  // Put the bytes back in front of whatever is still pending
+  pending_.erase (pending_.begin (), pending_.begin () + pending_pos_);
+  pending_.insert (pending_.begin (), data, data + length);
+  pending_pos_ = 0;
+  updatePendingCount ();
+}
+
+size_t
+Serial::SerialImpl::readAvailable (uint8_t *buf, size_t size)
+{
+  if (!is_open_) {
+    throw PortNotOpenedException ("Serial::readAvailable");
+  }
+  size_t bytes_read = takePending (buf, size);
+  if (rx_running_) {
+    // Look at the error first, everything received before it was published
+    // is in the ring by then
+    int error = __atomic_load_n (&rx_error_, __ATOMIC_ACQUIRE);
+    size_t taken = takeReceived (buf + bytes_read, size - bytes_read);
+    bytes_read += taken;
+    if (bytes_read == 0) {
+      throwReceiveError (error);
+    }
+    return bytes_read;
+  }
+  bytes_read += takeReceived (buf + bytes_read, size - bytes_read);
+  if (bytes_read == size) {
+    return bytes_read;
+  }
+  // The descriptor is non-blocking, this returns at once
+  ssize_t bytes_read_now = ::read (fd_, buf + bytes_read, size - bytes_read);
+  count_read (rx_stats_.calls, rx_stats_.bytes, rx_stats_.zero_reads,
+              bytes_read_now);
+  capture (capture_rx, buf + bytes_read, bytes_read_now);
+  if (bytes_read_now > 0) {
+    bytes_read += bytes_read_now;
+  } else if (bytes_read_now < 0 && errno != EAGAIN && errno != EINTR
+             && bytes_read == 0) {
+    THROW (IOException, errno);
+  }
+  return bytes_read;
+}
+
+bool
+Serial::SerialImpl::hasBuffered ()
+{
+  return pendingCount () > 0 || rx_ring_.size () > 0;
+}
+
+int
+Serial::SerialImpl::getFd () const
+{
+  return fd_;
+}
+
+uint32_t
+Serial::SerialImpl::getCloseCount () const
+{
+  return __atomic_load_n (&close_count_, __ATOMIC_ACQUIRE);
+}
+
+void
+Serial::SerialImpl::watchClose (Poller *poller)
+{
+  pthread_mutex_lock (&close_mutex_);
+  close_watchers_.push_back (poller);
+  pthread_mutex_unlock (&close_mutex_);
+}
+
+void
+Serial::SerialImpl::unwatchClose (Poller *poller)
+{
+  pthread_mutex_lock (&close_mutex_);
+  std::vector<Poller *>::iterator it =
+    std::find (close_watchers_.begin (), close_watchers_.end (), poller);
+  if (it != close_watchers_.end ()) {
+    close_watchers_.erase (it);
+  }
+  pthread_mutex_unlock (&close_mutex_);
+}
+
+size_t
+Serial::SerialImpl::takePending (uint8_t *buf, size_t size)
+{
+  size_t count = std::min (size, pending_.size () - pending_pos_);
+  if (count > 0) {
+    memcpy (buf, &pending_[pending_pos_], count);
+    pending_pos_ += count;
+  }
+  if (pending_pos_ == pending_.size ()) {
+    // Keep the capacity around, it is reused by the next unread
+    pending_.clear ();
+    pending_pos_ = 0;
+  }
+  if (count > 0) {
+    updatePendingCount ();
+  }
+  return count;
+}
+
+size_t
+Serial::SerialImpl::readAtLeast (uint8_t *buf, size_t size, size_t min_size)
 {
   // If the port is not open, throw
   if (!is_open_) {
     throw PortNotOpenedException ("Serial::read");
   }
-  size_t bytes_read = 0;
+  ScopedTrace trace ("serial read");
+  // Bytes pushed back by readline come first
+  size_t bytes_read = takePending (buf, size);
+  if (bytes_read >= min_size) {
+    return bytes_read;
+  }
+  if (rx_running_) {
+    return bytes_read + readReceived (buf + bytes_read, size - bytes_read,
+                                      min_size - bytes_read);
+  }
+  // Data left over by a receive thread that has since been stopped
+  bytes_read += takeReceived (buf + bytes_read, size - bytes_read);
+  if (bytes_read >= min_size) {
+    return bytes_read;
+  }
 
   // Calculate total timeout in milliseconds t_c + (t_m * N)
   long total_timeout_ms = timeout_.read_timeout_constant;
-  total_timeout_ms += timeout_.read_timeout_multiplier * static_cast<long> (size);
+  total_timeout_ms += timeout_.read_timeout_multiplier * static_cast<long> (min_size);
   MillisecondTimer total_timeout(total_timeout_ms);
 
   // Pre-fill buffer with available bytes
   {
-    ssize_t bytes_read_now = ::read (fd_, buf, size);
+    ssize_t bytes_read_now = ::read (fd_, buf + bytes_read, size - bytes_read);
+    count_read (rx_stats_.calls, rx_stats_.bytes, rx_stats_.zero_reads,
+                bytes_read_now);
+    capture (capture_rx, buf + bytes_read, bytes_read_now);
     if (bytes_read_now > 0) {
-      bytes_read = bytes_read_now;
+      bytes_read += bytes_read_now;
     }
   }
 
-  while (bytes_read < size) {
+  while (bytes_read < min_size) {
     int64_t timeout_remaining_ms = total_timeout.remaining();
     if (timeout_remaining_ms <= 0) {
       // Timed out
@@ -566,19 +978,34 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
                                 timeout_.inter_byte_timeout);
     // Wait for the device to be readable, and then attempt to read.
     if (waitReadable(timeout)) {
-      // If it's a fixed-length multi-byte read, insert a wait here so that
-      // we can attempt to grab the whole thing in a single IO call. Skip
-      // this wait if a non-max inter_byte_timeout is specified.
-      if (size > 1 && timeout_.inter_byte_timeout == Timeout::max()) {
-        size_t bytes_available = available();
-        if (bytes_available + bytes_read < size) {
-          waitByteTimes(size - (bytes_available + bytes_read));
+      ssize_t bytes_read_now;
+      size_t kernel_bytes = kernelReadSize (min_size - bytes_read,
+                                            total_timeout.remaining ());
+      if (kernel_bytes > 1) {
+        // The kernel returns as soon as kernel_bytes are in or the line has
+        // been idle for the inter-byte timeout.  Nothing interrupts the
+        // read, kernelReadSize keeps it within the total timeout.
+        bytes_read_now = ::read (rx_block_fd_, buf + bytes_read,
+                                 kernel_bytes);
+        if (bytes_read_now < 0 && errno == EINTR) {
+          continue;
         }
+      } else {
+        // If it's a fixed-length multi-byte read, insert a wait here so
+        // that we can attempt to grab the whole thing in a single IO call.
+        // Skip this wait if a non-max inter_byte_timeout is specified, or
+        // latency matters more than the number of reads.
+        if (min_size > 1 && timeout_.inter_byte_timeout == Timeout::max()
+            && latency_profile_ != latency_low) {
+          coalesceRead (min_size - bytes_read, total_timeout.remaining ());
+        }
+        // This should be non-blocking returning only what is available now
+        //  Then returning so that select can block again.
+        bytes_read_now = ::read (fd_, buf + bytes_read, size - bytes_read);
       }
-      // This should be non-blocking returning only what is available now
-      //  Then returning so that select can block again.
-      ssize_t bytes_read_now =
-        ::read (fd_, buf + bytes_read, size - bytes_read);
+      count_read (rx_stats_.calls, rx_stats_.bytes, rx_stats_.zero_reads,
+                  bytes_read_now);
+      capture (capture_rx, buf + bytes_read, bytes_read_now);
       // read should always return some data as select reported it was
       // ready to read when we get to this point.
       if (bytes_read_now < 1) {
@@ -590,12 +1017,12 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
       }
       // Update bytes_read
       bytes_read += static_cast<size_t> (bytes_read_now);
-      // If bytes_read == size then we have read everything we need
-      if (bytes_read == size) {
+      // If bytes_read >= min_size then we have read everything we need
+      if (bytes_read >= min_size && bytes_read <= size) {
         break;
       }
-      // If bytes_read < size then we have more to read
-      if (bytes_read < size) {
+      // If bytes_read < min_size then we have more to read
+      if (bytes_read < min_size) {
         continue;
       }
       // If bytes_read > size then we have over read, which shouldn't happen
@@ -606,16 +1033,111 @@ Serial::SerialImpl::read (uint8_t *buf, size_t size)
       }
     }
   }
+  if (Trace::isEnabled ()) {
+    Trace::setCounter ("serial rx bytes", static_cast<int64_t> (
+        __atomic_load_n (&rx_stats_.bytes, __ATOMIC_RELAXED)));
+  }
   return bytes_read;
 }
 
+void
+Serial::SerialImpl::coalesceRead (size_t missing, int64_t timeout_remaining_ms)
+{
+  if (coalesce_policy_ == coalesce_none || timeout_remaining_ms <= 0) {
+    return;
+  }
+  uint64_t max_wait_ns = static_cast<uint64_t> (timeout_remaining_ms) * 1000000ULL;
+  if (coalesce_max_wait_us_ > 0) {
+    max_wait_ns = std::min<uint64_t> (max_wait_ns,
+                                      coalesce_max_wait_us_ * 1000ULL);
+  }
+  size_t bytes_available = available ();
+  if (coalesce_policy_ == coalesce_fixed) {
+    if (bytes_available < missing) {
+      uint64_t wait_ns = std::min<uint64_t> (
+          static_cast<uint64_t> (byte_time_ns_) * (missing - bytes_available),
+          max_wait_ns);
+      timespec wait_time;
+      wait_time.tv_sec = static_cast<time_t> (wait_ns / 1000000000ULL);
+      wait_time.tv_nsec = static_cast<long> (wait_ns % 1000000000ULL);
+      nanosleep (&wait_time, NULL);
+    }
+    return;
+  }
+  // Adaptive: short steps, each checking that data is still coming in, so
+  // a device that went quiet costs at most one step.  The step length
+  // follows the rate the device actually sends at, which for bursty
+  // devices and USB adapters is well below the line rate.
+  const size_t kStepBytes = 32;
+  uint64_t waited_ns = 0;
+  while (bytes_available < missing && waited_ns < max_wait_ns) {
+    uint64_t per_byte_ns = std::max<uint64_t> (rx_ns_per_byte_, byte_time_ns_);
+    uint64_t step_ns = per_byte_ns * std::min (missing - bytes_available,
+                                               kStepBytes);
+    step_ns = std::min (step_ns, max_wait_ns - waited_ns);
+    timespec wait_time;
+    wait_time.tv_sec = static_cast<time_t> (step_ns / 1000000000ULL);
+    wait_time.tv_nsec = static_cast<long> (step_ns % 1000000000ULL);
+    nanosleep (&wait_time, NULL);
+    waited_ns += step_ns;
+    size_t now_available = available ();
+    if (now_available <= bytes_available) {
+      // Quiet for a whole step, read what is there
+      break;
+    }
+    // Moving average over about eight steps
+    uint64_t sample_ns = step_ns / (now_available - bytes_available);
+    rx_ns_per_byte_ = (rx_ns_per_byte_ * 7 + sample_ns) / 8;
+    bytes_available = now_available;
+  }
+}
+
 size_t
 Serial::SerialImpl::write (const uint8_t *data, size_t length)
 {
   if (is_open_ == false) {
     throw PortNotOpenedException ("Serial::write");
   }
-  fd_set writefds;
+  if (tx_batch_limit_ == 0) {
+    // Batching may have been turned off with bytes still queued
+    if (!tx_batch_.empty ()) {
+      flushBatch ();
+      if (!tx_batch_.empty ()) {
+        return 0;
+      }
+    }
+    return writeNow (data, length);
+  }
+  throwBatchError ();
+  if (tx_batch_.size () + length > tx_batch_limit_) {
+    // No room, the queue goes first to keep the order
+    flushBatch ();
+    if (!tx_batch_.empty ()) {
+      // The write timeout ran out on the queued bytes
+      return 0;
+    }
+    if (length >= tx_batch_limit_) {
+      return writeNow (data, length);
+    }
+  }
+  bool was_empty = tx_batch_.empty ();
+  tx_batch_.insert (tx_batch_.end (), data, data + length);
+  if (tx_batch_.size () >= tx_batch_limit_) {
+    flushBatch ();
+  } else if (was_empty && tx_batch_deadline_us_ > 0) {
+    tx_batch_due_ns_ = monotonic_ns () + tx_batch_deadline_us_ * 1000ULL;
+    armFlusher (tx_batch_due_ns_);
+  }
+  return length;
+}
+
+size_t
+Serial::SerialImpl::writeNow (const uint8_t *data, size_t length)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::write");
+  }
+  ScopedTrace trace ("serial write");
   size_t bytes_written = 0;
 
   // Calculate total timeout in milliseconds t_c + (t_m * N)
@@ -629,65 +1151,42 @@ Serial::SerialImpl::write (const uint8_t *data, size_t length)
       // Timed out
       break;
     }
-    timespec timeout(timespec_from_ms(timeout_remaining_ms));
-
-    FD_ZERO (&writefds);
-    FD_SET (fd_, &writefds);
-
-    // Do the select
-    int r = pselect (fd_ + 1, NULL, &writefds, NULL, &timeout, NULL);
-
-    // Figure out what happened by looking at select's response 'r'
-    /** Error **/
-    if (r < 0) {
-      // Select was interrupted, try again
-      if (errno == EINTR) {
-        continue;
+    // The port is non-blocking, so try the write first and only wait for
+    // the port to drain when the driver buffer is full.
+    ssize_t bytes_written_now =
+      ::write (fd_, data + bytes_written, length - bytes_written);
+    count (tx_stats_.calls);
+    capture (capture_tx, data + bytes_written, bytes_written_now);
+    if (bytes_written_now > 0) {
+      count (tx_stats_.bytes, static_cast<uint64_t> (bytes_written_now));
+      if (static_cast<size_t> (bytes_written_now) < length - bytes_written) {
+        count (tx_stats_.partial_writes);
       }
-      // Otherwise there was some error
-      THROW (IOException, errno);
+      bytes_written += static_cast<size_t> (bytes_written_now);
+      continue;
     }
-    /** Timeout **/
-    if (r == 0) {
-      break;
+    if (bytes_written_now < 0 && errno == EINTR) {
+      continue;
     }
-    /** Port ready to write **/
-    if (r > 0) {
-      // Make sure our file descriptor is in the ready to write list
-      if (FD_ISSET (fd_, &writefds)) {
-        // This will write some
-        ssize_t bytes_written_now =
-          ::write (fd_, data + bytes_written, length - bytes_written);
-        // write should always return some data as select reported it was
-        // ready to write when we get to this point.
-        if (bytes_written_now < 1) {
-          // Disconnected devices, at least on Linux, show the
-          // behavior that they are always ready to write immediately
-          // but writing returns nothing.
-          throw SerialException ("device reports readiness to write but "
-                                 "returned no data (device disconnected?)");
-        }
-        // Update bytes_written
-        bytes_written += static_cast<size_t> (bytes_written_now);
-        // If bytes_written == size then we have written everything we need to
-        if (bytes_written == length) {
-          break;
-        }
-        // If bytes_written < size then we have more to write
-        if (bytes_written < length) {
-          continue;
-        }
-        // If bytes_written > size then we have over written, which shouldn't happen
-        if (bytes_written > length) {
-          throw SerialException ("write over wrote, too many bytes where "
-                                 "written, this shouldn't happen, might be "
-                                 "a logical error!");
-        }
+    if (bytes_written_now < 0 && errno == EAGAIN) {
+      int wait_ms = static_cast<int> (std::min<int64_t> (timeout_remaining_ms,
+                                                         INT32_MAX));
+      uint32_t events = tx_poller_->waitFor (fd_, wait_ms);
+      if ((events & (poll_hangup | poll_error)) == 0
+          || (events & poll_writable) != 0) {
+        // Writable, timed out or interrupted: the loop sorts it out
+        continue;
       }
-      // This shouldn't happen, if r > 0 our fd has to be in the list!
-      THROW (IOException, "select reports ready to write, but our fd isn't"
-                          " in the list, this shouldn't happen!");
     }
+    // Disconnected devices, at least on Linux, show the
+    // behavior that they are always ready to write immediately
+    // but writing returns nothing.
+    throw SerialException ("device reports readiness to write but "
+                           "returned no data (device disconnected?)");
+  }
+  if (Trace::isEnabled ()) {
+    Trace::setCounter ("serial tx bytes", static_cast<int64_t> (
+        __atomic_load_n (&tx_stats_.bytes, __ATOMIC_RELAXED)));
   }
   return bytes_written;
 }
@@ -695,6 +1194,12 @@ Serial::SerialImpl::write (const uint8_t *data, size_t length)
 void
 Serial::SerialImpl::setPort (const string &port)
 {
+  if (replay_) {
+    SerialBackend *backend = new DeviceBackend ();
+    delete backend_;
+    backend_ = backend;
+    replay_ = false;
+  }
   port_ = port;
 }
 
@@ -704,10 +1209,35 @@ Serial::SerialImpl::getPort () const
   return port_;
 }
 
+void
+Serial::SerialImpl::setReplay (const string &capture, double speed)
+{
+  if (is_open_ == true) {
+    throw SerialException ("Serial port already open.");
+  }
+  SerialBackend *backend = new ReplayBackend (speed);
+  delete backend_;
+  backend_ = backend;
+  replay_ = true;
+  port_ = capture;
+}
+
+bool
+Serial::SerialImpl::isReplay () const
+{
+  return replay_;
+}
+
 void
 Serial::SerialImpl::setTimeout (serial::Timeout &timeout)
 {
   timeout_ = timeout;
+  if (is_open_ && kernelInterByteTime () != 0) {
+    reconfigurePort ();
+  } else if (kernel_timed_reads_) {
+    // Back to polled reads, VTIME no longer matters
+    kernel_timed_reads_ = false;
+  }
 }
 
 serial::Timeout
@@ -786,12 +1316,437 @@ Serial::SerialImpl::getFlowcontrol () const
   return flowcontrol_;
 }
 
+void
+Serial::SerialImpl::setLatencyProfile (serial::latency_profile_t profile)
+{
+  latency_profile_ = profile;
+  if (is_open_)
+    reconfigurePort ();
+}
+
+serial::latency_profile_t
+Serial::SerialImpl::getLatencyProfile () const
+{
+  return latency_profile_;
+}
+
+void
+Serial::SerialImpl::setReadCoalescing (serial::coalesce_policy_t policy,
+                                       uint32_t max_wait_us)
+{
+  coalesce_policy_ = policy;
+  coalesce_max_wait_us_ = max_wait_us;
+}
+
+serial::coalesce_policy_t
+Serial::SerialImpl::getReadCoalescing () const
+{
+  return coalesce_policy_;
+}
+
+uint32_t
+Serial::SerialImpl::getReadCoalescingMaxWait () const
+{
+  return coalesce_max_wait_us_;
+}
+
+void
+Serial::SerialImpl::getStats (serial::PortStats &stats) const
+{
+  stats.bytes_read = __atomic_load_n (&rx_stats_.bytes, __ATOMIC_RELAXED);
+  stats.bytes_written = __atomic_load_n (&tx_stats_.bytes, __ATOMIC_RELAXED);
+  stats.read_calls = __atomic_load_n (&rx_stats_.calls, __ATOMIC_RELAXED);
+  stats.write_calls = __atomic_load_n (&tx_stats_.calls, __ATOMIC_RELAXED);
+  stats.zero_reads = __atomic_load_n (&rx_stats_.zero_reads, __ATOMIC_RELAXED);
+  stats.partial_writes = __atomic_load_n (&tx_stats_.partial_writes,
+                                          __ATOMIC_RELAXED);
+  stats.wait_wakeups = __atomic_load_n (&rx_stats_.wakeups, __ATOMIC_RELAXED);
+  stats.wait_timeouts = __atomic_load_n (&rx_stats_.timeouts, __ATOMIC_RELAXED);
+  stats.wait_ns = __atomic_load_n (&rx_stats_.wait_ns, __ATOMIC_RELAXED);
+  stats.reconfigurations = __atomic_load_n (&tx_stats_.reconfigurations,
+                                            __ATOMIC_RELAXED);
+  stats.read_lock_waits = __atomic_load_n (&rx_stats_.lock_waits,
+                                           __ATOMIC_RELAXED);
+  stats.read_lock_wait_ns = __atomic_load_n (&rx_stats_.lock_wait_ns,
+                                             __ATOMIC_RELAXED);
+  stats.write_lock_waits = __atomic_load_n (&tx_stats_.lock_waits,
+                                            __ATOMIC_RELAXED);
+  stats.write_lock_wait_ns = __atomic_load_n (&tx_stats_.lock_wait_ns,
+                                              __ATOMIC_RELAXED);
+}
+
+void
+Serial::SerialImpl::startCapture (const string &path)
+{
+  capture_.start (path);
+  // A capture starts with the settings its bytes were sent with
+  captureConfig ();
+}
+
+void
+Serial::SerialImpl::stopCapture ()
+{
+  capture_.stop ();
+}
+
+bool
+Serial::SerialImpl::isCapturing () const
+{
+  return capture_.isRecording ();
+}
+
+void
+Serial::SerialImpl::captureConfig ()
+{
+  if (!capture_.isRecording ()) {
+    return;
+  }
+  CaptureConfig config;
+  config.baudrate = static_cast<uint32_t> (baudrate_);
+  config.bytesize = static_cast<uint8_t> (bytesize_);
+  config.parity = static_cast<uint8_t> (parity_);
+  config.stopbits = static_cast<uint8_t> (stopbits_);
+  config.flowcontrol = static_cast<uint8_t> (flowcontrol_);
+  capture_.recordConfig (config);
+}
+
+void
+Serial::SerialImpl::setWriteBatching (size_t max_bytes, uint32_t deadline_us)
+{
+  if (is_open_) {
+    // Leaves everything as it was if the queue cannot be sent
+    throwBatchError ();
+    flushBatch ();
+  }
+  stopFlusher ();
+  tx_batch_limit_ = max_bytes;
+  tx_batch_deadline_us_ = deadline_us;
+  if (is_open_ && tx_batch_limit_ > 0 && tx_batch_deadline_us_ > 0) {
+    startFlusher ();
+    if (!tx_batch_.empty ()) {
+      tx_batch_due_ns_ = monotonic_ns () + tx_batch_deadline_us_ * 1000ULL;
+      armFlusher (tx_batch_due_ns_);
+    }
+  }
+}
+
+size_t
+Serial::SerialImpl::getWriteBatchSize () const
+{
+  return tx_batch_limit_;
+}
+
+uint32_t
+Serial::SerialImpl::getWriteBatchDeadline () const
+{
+  return tx_batch_deadline_us_;
+}
+
+void
+Serial::SerialImpl::flushWrites ()
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::flushWrites");
+  }
+  throwBatchError ();
+  flushBatch ();
+}
+
+void
+Serial::SerialImpl::flushBatch ()
+{
+  if (tx_batch_.empty ()) {
+    return;
+  }
+  size_t written = writeNow (&tx_batch_[0], tx_batch_.size ());
+  tx_batch_.erase (tx_batch_.begin (), tx_batch_.begin () + written);
+  if (!tx_batch_.empty () && tx_batch_deadline_us_ > 0) {
+    // Timed out, the rest gets another deadline
+    tx_batch_due_ns_ = monotonic_ns () + tx_batch_deadline_us_ * 1000ULL;
+    armFlusher (tx_batch_due_ns_);
+  }
+}
+
+void
+Serial::SerialImpl::throwBatchError ()
+{
+  int error = tx_batch_error_;
+  if (error == 0) {
+    return;
+  }
+  tx_batch_error_ = 0;
+  if (error > 0) {
+    THROW (IOException, error);
+  }
+  throw SerialException ("device reports readiness to write but "
+                         "returned no data (device disconnected?)");
+}
+
+void
+Serial::SerialImpl::startFlusher ()
+{
+  if (tx_flusher_running_) {
+    return;
+  }
+  tx_flusher_stop_ = false;
+  int result = pthread_create (&tx_flusher_, NULL, &flushThread, this);
+  if (result) {
+    THROW (IOException, result);
+  }
+  tx_flusher_running_ = true;
+}
+
+void
+Serial::SerialImpl::stopFlusher ()
+{
+  if (!tx_flusher_running_) {
+    return;
+  }
+  pthread_mutex_lock (&tx_flush_mutex_);
+  tx_flusher_stop_ = true;
+  pthread_cond_signal (&tx_flush_cond_);
+  pthread_mutex_unlock (&tx_flush_mutex_);
+  pthread_join (tx_flusher_, NULL);
+  tx_flusher_running_ = false;
+  tx_flush_at_ns_ = 0;
+  __atomic_store_n (&tx_flush_on_unlock_, false, __ATOMIC_RELAXED);
+}
+
+void
+Serial::SerialImpl::armFlusher (uint64_t at_ns)
+{
+  if (!tx_flusher_running_) {
+    return;
+  }
+  pthread_mutex_lock (&tx_flush_mutex_);
+  if (tx_flush_at_ns_ == 0 || at_ns < tx_flush_at_ns_) {
+    tx_flush_at_ns_ = at_ns;
+    pthread_cond_signal (&tx_flush_cond_);
+  }
+  pthread_mutex_unlock (&tx_flush_mutex_);
+}
+
+void *
+Serial::SerialImpl::flushThread (void *arg)
+{
+  static_cast<SerialImpl *> (arg)->flushLoop ();
+  return NULL;
+}
+
+void
+Serial::SerialImpl::flushLoop ()
+{
+  pthread_mutex_lock (&tx_flush_mutex_);
+  while (!tx_flusher_stop_) {
+    if (tx_flush_at_ns_ == 0) {
+      pthread_cond_wait (&tx_flush_cond_, &tx_flush_mutex_);
+      continue;
+    }
+    if (monotonic_ns () < tx_flush_at_ns_) {
+      timespec at;
+      at.tv_sec = static_cast<time_t> (tx_flush_at_ns_ / 1000000000ULL);
+      at.tv_nsec = static_cast<long> (tx_flush_at_ns_ % 1000000000ULL);
+      pthread_cond_timedwait (&tx_flush_cond_, &tx_flush_mutex_, &at);
+      continue;
+    }
+    tx_flush_at_ns_ = 0;
+    pthread_mutex_unlock (&tx_flush_mutex_);
+
+    // Never block on the write lock: its holder may be stopping this thread.
+    // A busy lock means a writer, which wakes us when it lets go.  Trying
+    // once more after raising the flag covers a writer that let go before
+    // it could see it.
+    uint64_t retry_at = 0;
+    bool locked = pthread_mutex_trylock (&write_mutex) == 0;
+    if (!locked) {
+      __atomic_store_n (&tx_flush_on_unlock_, true, __ATOMIC_SEQ_CST);
+      locked = pthread_mutex_trylock (&write_mutex) == 0;
+      if (locked) {
+        __atomic_store_n (&tx_flush_on_unlock_, false, __ATOMIC_RELAXED);
+      }
+    }
+    if (locked) {
+      if (!tx_batch_.empty ()) {
+        if (monotonic_ns () < tx_batch_due_ns_) {
+          retry_at = tx_batch_due_ns_;
+        } else {
+          try {
+            flushBatch ();
+          } catch (IOException &e) {
+            tx_batch_error_ = e.getErrorNumber () != 0 ? e.getErrorNumber ()
+                                                       : EIO;
+            tx_batch_.clear ();
+          } catch (std::exception &) {
+            tx_batch_error_ = -1;
+            tx_batch_.clear ();
+          }
+        }
+      }
+      pthread_mutex_unlock (&write_mutex);
+    }
+
+    pthread_mutex_lock (&tx_flush_mutex_);
+    if (retry_at != 0 && (tx_flush_at_ns_ == 0 || retry_at < tx_flush_at_ns_)) {
+      tx_flush_at_ns_ = retry_at;
+    }
+  }
+  pthread_mutex_unlock (&tx_flush_mutex_);
+}
+
+uint64_t
+Serial::SerialImpl::submitWrite (const uint8_t *data, size_t length,
+                                 write_priority_t priority,
+                                 WriteListener *listener)
+{
+  if (is_open_ == false) {
+    throw PortNotOpenedException ("Serial::submitWrite");
+  }
+  if (priority < 0 || priority >= write_priority_count) {
+    throw invalid_argument ("unknown write_priority_t");
+  }
+  TxSubmission *submission = new TxSubmission ();
+  submission->data.assign (data, data + length);
+  submission->listener = listener;
+
+  pthread_mutex_lock (&tx_queue_mutex_);
+  try {
+    startWriter ();
+  } catch (...) {
+    pthread_mutex_unlock (&tx_queue_mutex_);
+    delete submission;
+    throw;
+  }
+  submission->id = tx_next_id_++;
+  tx_queue_[priority].push_back (submission);
+  tx_queued_++;
+  pthread_cond_signal (&tx_queue_cond_);
+  pthread_mutex_unlock (&tx_queue_mutex_);
+  return submission->id;
+}
+
+void
+Serial::SerialImpl::cancelWrites ()
+{
+  std::vector<TxSubmission *> cancelled;
+  pthread_mutex_lock (&tx_queue_mutex_);
+  for (int i = 0; i < write_priority_count; ++i) {
+    cancelled.insert (cancelled.end (), tx_queue_[i].begin (),
+                      tx_queue_[i].end ());
+    tx_queue_[i].clear ();
+  }
+  tx_queued_ = 0;
+  pthread_mutex_unlock (&tx_queue_mutex_);
+
+  for (size_t i = 0; i < cancelled.size (); ++i) {
+    if (cancelled[i]->listener != NULL) {
+      cancelled[i]->listener->onWriteComplete (cancelled[i]->id,
+                                               serial::write_cancelled, 0);
+    }
+    delete cancelled[i];
+  }
+}
+
+size_t
+Serial::SerialImpl::getQueuedWrites () const
+{
+  pthread_mutex_lock (&tx_queue_mutex_);
+  size_t queued = tx_queued_;
+  pthread_mutex_unlock (&tx_queue_mutex_);
+  return queued;
+}
+
+void
+Serial::SerialImpl::startWriter ()
+{
+  // Called with tx_queue_mutex_ held
+  if (tx_writer_running_) {
+    return;
+  }
+  tx_writer_stop_ = false;
+  int result = pthread_create (&tx_writer_, NULL, &writerThread, this);
+  if (result) {
+    THROW (IOException, result);
+  }
+  tx_writer_running_ = true;
+}
+
+void
+Serial::SerialImpl::stopWriter ()
+{
+  pthread_mutex_lock (&tx_queue_mutex_);
+  bool running = tx_writer_running_;
+  tx_writer_stop_ = true;
+  pthread_cond_signal (&tx_queue_cond_);
+  pthread_mutex_unlock (&tx_queue_mutex_);
+  if (running) {
+    pthread_join (tx_writer_, NULL);
+    tx_writer_running_ = false;
+  }
+  cancelWrites ();
+}
+
+void *
+Serial::SerialImpl::writerThread (void *arg)
+{
+  static_cast<SerialImpl *> (arg)->writerLoop ();
+  return NULL;
+}
+
+void
+Serial::SerialImpl::writerLoop ()
+{
+  pthread_mutex_lock (&tx_queue_mutex_);
+  while (!tx_writer_stop_) {
+    TxSubmission *submission = NULL;
+    for (int i = 0; i < write_priority_count && submission == NULL; ++i) {
+      if (!tx_queue_[i].empty ()) {
+        submission = tx_queue_[i].front ();
+        tx_queue_[i].pop_front ();
+        tx_queued_--;
+      }
+    }
+    if (submission == NULL) {
+      pthread_cond_wait (&tx_queue_cond_, &tx_queue_mutex_);
+      continue;
+    }
+    pthread_mutex_unlock (&tx_queue_mutex_);
+
+    ScopedTrace trace ("serial submitted write");
+    write_status_t status = serial::write_failed;
+    size_t written = 0;
+    try {
+      writeLock ();
+      try {
+        if (!submission->data.empty ()) {
+          written = write (&submission->data[0], submission->data.size ());
+        }
+      } catch (...) {
+        writeUnlock ();
+        throw;
+      }
+      writeUnlock ();
+      status = written == submission->data.size () ? serial::write_done
+                                                   : serial::write_timed_out;
+    } catch (std::exception &) {
+    }
+    if (submission->listener != NULL) {
+      submission->listener->onWriteComplete (submission->id, status, written);
+    }
+    delete submission;
+
+    pthread_mutex_lock (&tx_queue_mutex_);
+  }
+  pthread_mutex_unlock (&tx_queue_mutex_);
+}
+
 void
 Serial::SerialImpl::flush ()
 {
   if (is_open_ == false) {
     throw PortNotOpenedException ("Serial::flush");
   }
+  ScopedTrace trace ("serial flush");
+  flushBatch ();
   tcdrain (fd_);
 }
 
@@ -802,6 +1757,11 @@ Serial::SerialImpl::flushInput ()
     throw PortNotOpenedException ("Serial::flushInput");
   }
   tcflush (fd_, TCIFLUSH);
+  pending_.clear ();
+  pending_pos_ = 0;
+  updatePendingCount ();
+  rx_ring_.discard ();
+  notifyRingSpace ();
 }
 
 void
@@ -810,6 +1770,7 @@ Serial::SerialImpl::flushOutput ()
   if (is_open_ == false) {
     throw PortNotOpenedException ("Serial::flushOutput");
   }
+  tx_batch_.clear ();
   tcflush (fd_, TCOFLUSH);
 }
 
@@ -1025,13 +1986,278 @@ Serial::SerialImpl::getCD ()
   }
 }
 
+void
+Serial::SerialImpl::setContinuousReceive (bool enabled, size_t buffer_size)
+{
+  if (enabled && buffer_size == 0) {
+    throw invalid_argument ("Receive buffer size must be greater than zero.");
+  }
+  stopReceiver ();
+  rx_enabled_ = enabled;
+  if (enabled) {
+    rx_capacity_ = buffer_size;
+    if (is_open_) {
+      startReceiver ();
+    }
+  }
+}
+
+bool
+Serial::SerialImpl::isContinuousReceive () const
+{
+  return rx_enabled_;
+}
+
+void
+Serial::SerialImpl::startReceiver ()
+{
+  if (rx_running_) {
+    return;
+  }
+  if (rx_ring_.capacity () != rx_capacity_) {
+    // Carry over whatever an earlier receiver left behind.
+    std::vector<uint8_t> leftover (rx_ring_.size ());
+    if (!leftover.empty ()) {
+      rx_ring_.take (&leftover[0], leftover.size ());
+    }
+    rx_ring_.reset (rx_capacity_);
+    if (!leftover.empty ()) {
+      rx_ring_.put (&leftover[0], leftover.size ());
+    }
+  }
+  // The receiver drains the port until EAGAIN, so it can go edge triggered
+  rx_poller_->modify (fd_, poll_readable, true);
+  rx_stop_ = false;
+  rx_error_ = 0;
+  int result = pthread_create (&rx_thread_, NULL, &receiveThread, this);
+  if (result) {
+    rx_poller_->modify (fd_, poll_readable);
+    THROW (IOException, result);
+  }
+  rx_running_ = true;
+}
+
+void
+Serial::SerialImpl::stopReceiver ()
+{
+  if (!rx_running_) {
+    return;
+  }
+  pthread_mutex_lock (&rx_mutex_);
+  __atomic_store_n (&rx_stop_, true, __ATOMIC_RELEASE);
+  pthread_cond_broadcast (&rx_space_cond_);
+  pthread_mutex_unlock (&rx_mutex_);
+  rx_poller_->wakeup ();
+  pthread_join (rx_thread_, NULL);
+  // Back to level triggered for plain reads, and swallow the wakeup in case
+  // the receiver had already exited and never consumed it.
+  rx_poller_->modify (fd_, poll_readable);
+  rx_poller_->waitFor (fd_, 0);
+
+  pthread_mutex_lock (&rx_mutex_);
+  rx_running_ = false;
+  pthread_cond_broadcast (&rx_data_cond_);
+  pthread_mutex_unlock (&rx_mutex_);
+}
+
+void *
+Serial::SerialImpl::receiveThread (void *arg)
+{
+  static_cast<SerialImpl *> (arg)->receiveLoop ();
+  return NULL;
+}
+
+void
+Serial::SerialImpl::receiveLoop ()
+{
+  // Edge triggered: only wait once a read came back short (or EAGAIN),
+  // anything arriving after that raises a new edge.
+  bool drained = true;
+  bool hangup = false;
+  while (!__atomic_load_n (&rx_stop_, __ATOMIC_ACQUIRE)) {
+    size_t span_length = 0;
+    uint8_t *span = rx_ring_.writeSpan (span_length);
+    if (span_length == 0) {
+      // Ring is full, let the consumer catch up.  The tty keeps buffering
+      // (and throttling, if flow control is on) in the meantime.
+      pthread_mutex_lock (&rx_mutex_);
+      __atomic_store_n (&rx_space_waiting_, true, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+      while (rx_ring_.size () >= rx_ring_.capacity () && !rx_stop_) {
+        pthread_cond_wait (&rx_space_cond_, &rx_mutex_);
+      }
+      __atomic_store_n (&rx_space_waiting_, false, __ATOMIC_RELAXED);
+      pthread_mutex_unlock (&rx_mutex_);
+      continue;
+    }
+
+    int error = 0;
+    ssize_t bytes_read = 0;
+    if (drained) {
+      try {
+        uint32_t events = rx_poller_->waitFor (fd_, -1);
+        drained = events == 0;
+        hangup = (events & (poll_hangup | poll_error)) != 0;
+      } catch (IOException &e) {
+        error = e.getErrorNumber () != 0 ? e.getErrorNumber () : EIO;
+      }
+    }
+    if (!drained && error == 0) {
+      // The span belongs to the free part of the ring, the consumer never
+      // touches it until it is committed.
+      bytes_read = ::read (fd_, span, span_length);
+      count_read (rx_stats_.calls, rx_stats_.bytes, rx_stats_.zero_reads,
+                  bytes_read);
+      capture (capture_rx, span, bytes_read);
+      if (bytes_read == 0) {
+        // With VMIN = VTIME = 0 an empty read returns 0 rather than EAGAIN,
+        // and an edge may be left over from data already drained.  Only a
+        // hangup means the device went away.
+        if (hangup) {
+          error = -1;
+        }
+        drained = true;
+      } else if (bytes_read < 0) {
+        if (errno == EAGAIN) {
+          drained = true;
+        } else if (errno != EINTR) {
+          error = errno;
+        }
+        bytes_read = 0;
+      } else if (static_cast<size_t> (bytes_read) < span_length) {
+        drained = true;
+      }
+    }
+
+    if (bytes_read > 0) {
+      rx_ring_.commit (static_cast<size_t> (bytes_read));
+      notifyReceived ();
+    }
+    if (error != 0) {
+      pthread_mutex_lock (&rx_mutex_);
+      __atomic_store_n (&rx_error_, error, __ATOMIC_RELEASE);
+      pthread_cond_broadcast (&rx_data_cond_);
+      pthread_mutex_unlock (&rx_mutex_);
+      break;
+    }
+  }
+}
+
+void
+Serial::SerialImpl::notifyReceived ()
+{
+  // Pairs with the fence in waitReceived: either the consumer sees the
+  // commit before it sleeps, or this sees it waiting
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&rx_data_waiters_, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock (&rx_mutex_);
+    pthread_cond_broadcast (&rx_data_cond_);
+    pthread_mutex_unlock (&rx_mutex_);
+  }
+}
+
+void
+Serial::SerialImpl::notifyRingSpace ()
+{
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&rx_space_waiting_, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock (&rx_mutex_);
+    pthread_cond_broadcast (&rx_space_cond_);
+    pthread_mutex_unlock (&rx_mutex_);
+  }
+}
+
+bool
+Serial::SerialImpl::waitReceived (const timespec &deadline, int &error)
+{
+  pthread_mutex_lock (&rx_mutex_);
+  __atomic_add_fetch (&rx_data_waiters_, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  while (rx_ring_.size () == 0 && rx_running_ && rx_error_ == 0) {
+    if (pthread_cond_timedwait (&rx_data_cond_, &rx_mutex_, &deadline)
+        == ETIMEDOUT) {
+      break;
+    }
+  }
+  __atomic_sub_fetch (&rx_data_waiters_, 1, __ATOMIC_RELAXED);
+  error = rx_error_;
+  bool running = rx_running_ && error == 0;
+  pthread_mutex_unlock (&rx_mutex_);
+  return running;
+}
+
+size_t
+Serial::SerialImpl::takeReceived (uint8_t *buf, size_t size)
+{
+  size_t taken = rx_ring_.take (buf, size);
+  if (taken > 0) {
+    notifyRingSpace ();
+  }
+  return taken;
+}
+
+size_t
+Serial::SerialImpl::readReceived (uint8_t *buf, size_t size, size_t min_size)
+{
+  // Same timeout rules as read(), but the data comes out of the ring
+  long total_timeout_ms = timeout_.read_timeout_constant;
+  total_timeout_ms += timeout_.read_timeout_multiplier * static_cast<long> (min_size);
+  MillisecondTimer total_timeout(total_timeout_ms);
+
+  size_t bytes_read = 0;
+  int error = 0;
+  bool running = true;
+  while (true) {
+    bytes_read += takeReceived (buf + bytes_read, size - bytes_read);
+    if (bytes_read >= min_size) {
+      break;
+    }
+    // Checked after one more take, so nothing received before the
+    // receiver stopped is left behind
+    if (!running) {
+      break;
+    }
+    int64_t timeout_remaining_ms = total_timeout.remaining();
+    if (timeout_remaining_ms <= 0) {
+      break;
+    }
+    uint32_t timeout = std::min(static_cast<uint32_t> (timeout_remaining_ms),
+                                timeout_.inter_byte_timeout);
+    running = waitReceived (monotonic_deadline (timeout), error);
+  }
+
+  // Report a dead receiver only once everything it got has been consumed
+  if (bytes_read == 0) {
+    throwReceiveError (error);
+  }
+  return bytes_read;
+}
+
+void
+Serial::SerialImpl::throwReceiveError (int error)
+{
+  if (error == -1) {
+    throw SerialException ("device reports readiness to read but "
+                           "returned no data (device disconnected?)");
+  }
+  if (error > 0) {
+    THROW (IOException, error);
+  }
+}
+
 void
 Serial::SerialImpl::readLock ()
 {
+  if (pthread_mutex_trylock(&this->read_mutex) == 0) {
+    return;
+  }
+  uint64_t start_ns = monotonic_ns ();
   int result = pthread_mutex_lock(&this->read_mutex);
   if (result) {
     THROW (IOException, result);
   }
+  count (rx_stats_.lock_waits);
+  count (rx_stats_.lock_wait_ns, monotonic_ns () - start_ns);
 }
 
 void
@@ -1046,10 +2272,16 @@ Serial::SerialImpl::readUnlock ()
 void
 Serial::SerialImpl::writeLock ()
 {
+  if (pthread_mutex_trylock(&this->write_mutex) == 0) {
+    return;
+  }
+  uint64_t start_ns = monotonic_ns ();
   int result = pthread_mutex_lock(&this->write_mutex);
   if (result) {
     THROW (IOException, result);
   }
+  count (tx_stats_.lock_waits);
+  count (tx_stats_.lock_wait_ns, monotonic_ns () - start_ns);
 }
 
 void
@@ -1059,6 +2291,14 @@ Serial::SerialImpl::writeUnlock ()
   if (result) {
     THROW (IOException, result);
   }
+  if (__atomic_load_n (&tx_flush_on_unlock_, __ATOMIC_SEQ_CST)
+      && __atomic_exchange_n (&tx_flush_on_unlock_, false, __ATOMIC_SEQ_CST)) {
+    // The flush thread found the lock taken, let it look again now
+    pthread_mutex_lock (&tx_flush_mutex_);
+    tx_flush_at_ns_ = monotonic_ns ();
+    pthread_cond_signal (&tx_flush_cond_);
+    pthread_mutex_unlock (&tx_flush_mutex_);
+  }
 }
 
 #endif // !defined(_WIN32)
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+
+#include "serial/spsc_ring.h"
+
+using serial::SpscByteRing;
+
+namespace {
+
+inline size_t
+load_acquire (const size_t &position)
+{
+  return __atomic_load_n (&position, __ATOMIC_ACQUIRE);
+}
+
+inline void
+store_release (size_t &position, size_t value)
+{
+  __atomic_store_n (&position, value, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+SpscByteRing::SpscByteRing ()
+  : storage_ (NULL), mask_ (0), capacity_ (0),
+    write_pos_ (0), cached_read_pos_ (0),
+    read_pos_ (0), cached_write_pos_ (0)
+{
+}
+
+SpscByteRing::~SpscByteRing ()
+{
+  delete [] storage_;
+}
+
+void
+SpscByteRing::reset (size_t capacity)
+{
+  size_t storage_size = 1;
+  while (storage_size < capacity) {
+    storage_size <<= 1;
+  }
+  if (capacity == 0 || storage_size != mask_ + 1 || storage_ == NULL) {
+    delete [] storage_;
+    storage_ = capacity == 0 ? NULL : new uint8_t[storage_size];
+  }
+  mask_ = storage_size - 1;
+  capacity_ = capacity;
+  write_pos_ = cached_read_pos_ = 0;
+  read_pos_ = cached_write_pos_ = 0;
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+}
+
+size_t
+SpscByteRing::size () const
+{
+  // Read position first: the write position can only be ahead of it
+  size_t read_pos = load_acquire (read_pos_);
+  size_t write_pos = load_acquire (write_pos_);
+  return std::min (write_pos - read_pos, capacity_);
+}
+
+uint8_t *
+SpscByteRing::writeSpan (size_t &length)
+{
+  size_t offset = write_pos_ & mask_;
+  size_t contiguous = mask_ + 1 - offset;
+  size_t space = capacity_ - (write_pos_ - cached_read_pos_);
+  if (space < contiguous) {
+    // Only go to the consumer's cache line when the stale copy is limiting
+    cached_read_pos_ = load_acquire (read_pos_);
+    space = capacity_ - (write_pos_ - cached_read_pos_);
+  }
+  length = std::min (space, contiguous);
+  return length == 0 ? NULL : storage_ + offset;
+}
+
+void
+SpscByteRing::commit (size_t length)
+{
+  store_release (write_pos_, write_pos_ + length);
+}
+
+size_t
+SpscByteRing::put (const uint8_t *data, size_t length)
+{
+  size_t copied = 0;
+  while (copied < length) {
+    size_t span_length = 0;
+    uint8_t *span = writeSpan (span_length);
+    if (span_length == 0) {
+      break;
+    }
+    size_t chunk = std::min (span_length, length - copied);
+    memcpy (span, data + copied, chunk);
+    commit (chunk);
+    copied += chunk;
+  }
+  return copied;
+}
+
+const uint8_t *
+SpscByteRing::peek (size_t &length)
+{
+  size_t offset = read_pos_ & mask_;
+  size_t contiguous = mask_ + 1 - offset;
+  size_t available = cached_write_pos_ - read_pos_;
+  if (available < contiguous) {
+    cached_write_pos_ = load_acquire (write_pos_);
+    available = cached_write_pos_ - read_pos_;
+  }
+  length = std::min (available, contiguous);
+  return length == 0 ? NULL : storage_ + offset;
+}
+
+void
+SpscByteRing::consume (size_t length)
+{
+  store_release (read_pos_, read_pos_ + length);
+}
+
+size_t
+SpscByteRing::take (uint8_t *buf, size_t size)
+{
+  size_t taken = 0;
+  while (taken < size) {
+    size_t span_length = 0;
+    const uint8_t *span = peek (span_length);
+    if (span_length == 0) {
+      break;
+    }
+    size_t chunk = std::min (span_length, size - taken);
+    memcpy (buf + taken, span, chunk);
+    consume (chunk);
+    taken += chunk;
+  }
+  return taken;
+}
+
+void
+SpscByteRing::discard ()
+{
+  cached_write_pos_ = load_acquire (write_pos_);
+  store_release (read_pos_, cached_write_pos_);
+}
@@ -0,0 +1,126 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#if defined(__ANDROID__)
+#include <dlfcn.h>
+#endif
+
+#include "serial/trace.h"
+
+using serial::Trace;
+
+namespace {
+
+#if defined(__ANDROID__)
+// Looked up at run time: ATrace_setCounter only exists from API 29
+typedef void (*begin_section_fn) (const char *);
+typedef void (*end_section_fn) ();
+typedef void (*set_counter_fn) (const char *, int64_t);
+
+begin_section_fn atrace_begin = NULL;
+end_section_fn atrace_end = NULL;
+set_counter_fn atrace_counter = NULL;
+#else
+int marker_fd = -1;
+int marker_pid = 0;
+
+void
+write_marker (const char *format, const char *name, long long value)
+{
+  char line[256];
+  int length = snprintf (line, sizeof (line), format, marker_pid, name, value);
+  if (length <= 0) {
+    return;
+  }
+  if (length >= static_cast<int> (sizeof (line))) {
+    length = sizeof (line) - 1;
+  }
+  // One write per marker, the kernel keeps it in one piece
+  ssize_t ignored = ::write (marker_fd, line, static_cast<size_t> (length));
+  (void) ignored;
+}
+#endif
+
+pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+bool backend_available = false;
+
+void
+init_backend ()
+{
+#if defined(__ANDROID__)
+  void *library = dlopen ("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+  if (library == NULL) {
+    return;
+  }
+  atrace_begin = reinterpret_cast<begin_section_fn> (
+      dlsym (library, "ATrace_beginSection"));
+  atrace_end = reinterpret_cast<end_section_fn> (
+      dlsym (library, "ATrace_endSection"));
+  atrace_counter = reinterpret_cast<set_counter_fn> (
+      dlsym (library, "ATrace_setCounter"));
+  backend_available = atrace_begin != NULL && atrace_end != NULL;
+#else
+  marker_fd = ::open ("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+  if (marker_fd == -1) {
+    marker_fd = ::open ("/sys/kernel/debug/tracing/trace_marker",
+                        O_WRONLY | O_CLOEXEC);
+  }
+  marker_pid = static_cast<int> (getpid ());
+  backend_available = marker_fd != -1;
+#endif
+}
+
+} // namespace
+
+bool Trace::enabled_ = false;
+
+bool
+Trace::setEnabled (bool enabled)
+{
+  if (enabled) {
+    pthread_once (&backend_once, init_backend);
+    enabled = backend_available;
+  }
+  __atomic_store_n (&enabled_, enabled, __ATOMIC_RELAXED);
+  return enabled;
+}
+
+void
+Trace::beginSection (const char *name)
+{
+#if defined(__ANDROID__)
+  if (atrace_begin != NULL) {
+    atrace_begin (name);
+  }
+#else
+  write_marker ("B|%d|%s", name, 0);
+#endif
+}
+
+void
+Trace::endSection ()
+{
+#if defined(__ANDROID__)
+  if (atrace_end != NULL) {
+    atrace_end ();
+  }
+#else
+  write_marker ("E|%d", "", 0);
+#endif
+}
+
+void
+Trace::setCounter (const char *name, int64_t value)
+{
+  if (!isEnabled ()) {
+    return;
+  }
+#if defined(__ANDROID__)
+  if (atrace_counter != NULL) {
+    atrace_counter (name, value);
+  }
+#else
+  write_marker ("C|%d|%s|%lld", name, static_cast<long long> (value));
+#endif
+}
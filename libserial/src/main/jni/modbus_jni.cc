@@ -0,0 +1,236 @@
+#include <nativehelper/JNIHelp.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+#include <serial/modbus.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Backs serial.ModbusRtuMaster.  The whole exchange, retries included, runs
+ * natively; Java only sees the decoded values.
+ */
+
+static jclass gModbusExceptionClass = 0;
+static jmethodID gModbusExceptionConstructor = 0;
+
+static void throwModbusException(JNIEnv *env, const ModbusException &ex)
+{
+    LOGE("%s", ex.what());
+    jstring jmessage = env->NewStringUTF(ex.what());
+    if (!jmessage)
+        return;
+    jobject jex = env->NewObject(gModbusExceptionClass, gModbusExceptionConstructor,
+            jmessage, (jint)ex.getFunction(), (jint)ex.getCode());
+    if (jex)
+        env->Throw((jthrowable)jex);
+}
+
+// The exceptions every exchange can end with
+#define _CATCH_MODBUS(env) \
+    _CATCH(ModbusException) \
+        throwModbusException(env, _ex); \
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException) \
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass) \
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass) \
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+
+static jlong native_create(JNIEnv *, jobject, jlong serialPtr)
+{
+    return (jlong)new ModbusRtuMaster((Serial *)serialPtr);
+}
+
+static void native_destroy(JNIEnv *, jobject, jlong ptr)
+{
+    delete (ModbusRtuMaster *)ptr;
+}
+
+static void native_setResponseTimeout(JNIEnv *, jobject, jlong ptr, jint timeoutMs)
+{
+    ((ModbusRtuMaster *)ptr)->setResponseTimeout((uint32_t)timeoutMs);
+}
+
+static void native_setRetries(JNIEnv *, jobject, jlong ptr, jint retries)
+{
+    ((ModbusRtuMaster *)ptr)->setRetries((uint32_t)retries);
+}
+
+static void native_setTurnaroundDelay(JNIEnv *, jobject, jlong ptr, jint delayMs)
+{
+    ((ModbusRtuMaster *)ptr)->setTurnaroundDelay((uint32_t)delayMs);
+}
+
+static void native_setMinimumSilence(JNIEnv *, jobject, jlong ptr, jint silenceUs)
+{
+    ((ModbusRtuMaster *)ptr)->setMinimumSilence((uint32_t)silenceUs);
+}
+
+static void native_setStrictTiming(JNIEnv *, jobject, jlong ptr, jboolean strict)
+{
+    ((ModbusRtuMaster *)ptr)->setStrictTiming(strict);
+}
+
+static jbyteArray native_transact(JNIEnv *env, jobject, jlong ptr, jint slave, jbyteArray jpdu)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    vector<uint8_t> pdu(env->GetArrayLength(jpdu));
+    if (!pdu.empty())
+        env->GetByteArrayRegion(jpdu, 0, pdu.size(), (jbyte *)&pdu[0]);
+    vector<uint8_t> response;
+    _BEGIN_TRY
+        master->transact((uint8_t)slave, pdu.empty() ? NULL : &pdu[0], pdu.size(), response);
+        jbyteArray jresponse = env->NewByteArray(response.size());
+        if (jresponse && !response.empty())
+            env->SetByteArrayRegion(jresponse, 0, response.size(), (const jbyte *)&response[0]);
+        return jresponse;
+    _CATCH_MODBUS(env)
+    _END_TRY
+    return NULL;
+}
+
+static void native_readBits(JNIEnv *env, jobject, jlong ptr, jint function, jint slave, jint address,
+                            jbooleanArray jvalues, jint count)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    if (count < 0 || count > env->GetArrayLength(jvalues)) {
+        env->ThrowNew(gIllegalArgumentException, "count out of range");
+        return;
+    }
+    vector<jboolean> values(count);
+    _BEGIN_TRY
+        bool bits[2000];
+        if (count > 2000)
+            throw invalid_argument("Modbus bit count must be 1 to 2000");
+        if (function == 0x01)
+            master->readCoils((uint8_t)slave, (uint16_t)address, (uint16_t)count, bits);
+        else
+            master->readDiscreteInputs((uint8_t)slave, (uint16_t)address, (uint16_t)count, bits);
+        for (jint i = 0; i < count; ++i)
+            values[i] = bits[i] ? JNI_TRUE : JNI_FALSE;
+        env->SetBooleanArrayRegion(jvalues, 0, count, &values[0]);
+    _CATCH_MODBUS(env)
+    _END_TRY
+}
+
+static void native_readRegisters(JNIEnv *env, jobject, jlong ptr, jint function, jint slave, jint address,
+                                 jintArray jvalues, jint count)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    if (count < 0 || count > env->GetArrayLength(jvalues)) {
+        env->ThrowNew(gIllegalArgumentException, "count out of range");
+        return;
+    }
+    vector<jint> values(count);
+    _BEGIN_TRY
+        uint16_t registers[125];
+        if (count > 125)
+            throw invalid_argument("Modbus register count must be 1 to 125");
+        if (function == 0x03)
+            master->readHoldingRegisters((uint8_t)slave, (uint16_t)address, (uint16_t)count, registers);
+        else
+            master->readInputRegisters((uint8_t)slave, (uint16_t)address, (uint16_t)count, registers);
+        for (jint i = 0; i < count; ++i)
+            values[i] = registers[i];
+        env->SetIntArrayRegion(jvalues, 0, count, &values[0]);
+    _CATCH_MODBUS(env)
+    _END_TRY
+}
+
+static void native_writeSingleCoil(JNIEnv *env, jobject, jlong ptr, jint slave, jint address, jboolean value)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    _BEGIN_TRY
+        master->writeSingleCoil((uint8_t)slave, (uint16_t)address, value);
+    _CATCH_MODBUS(env)
+    _END_TRY
+}
+
+static void native_writeSingleRegister(JNIEnv *env, jobject, jlong ptr, jint slave, jint address, jint value)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    _BEGIN_TRY
+        master->writeSingleRegister((uint8_t)slave, (uint16_t)address, (uint16_t)value);
+    _CATCH_MODBUS(env)
+    _END_TRY
+}
+
+static void native_writeMultipleCoils(JNIEnv *env, jobject, jlong ptr, jint slave, jint address,
+                                      jbooleanArray jvalues, jint count)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    if (count < 0 || count > env->GetArrayLength(jvalues)) {
+        env->ThrowNew(gIllegalArgumentException, "count out of range");
+        return;
+    }
+    vector<jboolean> values(count);
+    if (count > 0)
+        env->GetBooleanArrayRegion(jvalues, 0, count, &values[0]);
+    _BEGIN_TRY
+        bool coils[1968];
+        if (count > 1968)
+            throw invalid_argument("Modbus coil count must be 1 to 1968");
+        for (jint i = 0; i < count; ++i)
+            coils[i] = values[i] != JNI_FALSE;
+        master->writeMultipleCoils((uint8_t)slave, (uint16_t)address, (uint16_t)count, coils);
+    _CATCH_MODBUS(env)
+    _END_TRY
+}
+
+static void native_writeMultipleRegisters(JNIEnv *env, jobject, jlong ptr, jint slave, jint address,
+                                          jintArray jvalues, jint count)
+{
+    ModbusRtuMaster * master = (ModbusRtuMaster *)ptr;
+    if (count < 0 || count > env->GetArrayLength(jvalues)) {
+        env->ThrowNew(gIllegalArgumentException, "count out of range");
+        return;
+    }
+    vector<jint> values(count);
+    if (count > 0)
+        env->GetIntArrayRegion(jvalues, 0, count, &values[0]);
+    vector<uint16_t> registers(values.begin(), values.end());
+    _BEGIN_TRY
+        master->writeMultipleRegisters((uint8_t)slave, (uint16_t)address, (uint16_t)count,
+                registers.empty() ? NULL : &registers[0]);
+    _CATCH_MODBUS(env)
+    _END_TRY
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gModbusRtuMasterMethods[] = {
+    { "native_create", "(J)J", (void*) native_create },
+    { "native_destroy", "(J)V", (void*) native_destroy },
+    { "native_setResponseTimeout", "(JI)V", (void*) native_setResponseTimeout },
+    { "native_setRetries", "(JI)V", (void*) native_setRetries },
+    { "native_setTurnaroundDelay", "(JI)V", (void*) native_setTurnaroundDelay },
+    { "native_setMinimumSilence", "(JI)V", (void*) native_setMinimumSilence },
+    { "native_setStrictTiming", "(JZ)V", (void*) native_setStrictTiming },
+    { "native_transact", "(JI[B)[B", (void*) native_transact },
+    { "native_readBits", "(JIII[ZI)V", (void*) native_readBits },
+    { "native_readRegisters", "(JIII[II)V", (void*) native_readRegisters },
+    { "native_writeSingleCoil", "(JIIZ)V", (void*) native_writeSingleCoil },
+    { "native_writeSingleRegister", "(JIII)V", (void*) native_writeSingleRegister },
+    { "native_writeMultipleCoils", "(JII[ZI)V", (void*) native_writeMultipleCoils },
+    { "native_writeMultipleRegisters", "(JII[II)V", (void*) native_writeMultipleRegisters },
+};
+
+int registerModbusRtuMaster(JNIEnv* env)
+{
+    gModbusExceptionClass = findClass("serial/ModbusException", FIND_CLASS_RETURN_GLOBAL_REF);
+    if (!gModbusExceptionClass)
+        return -1;
+    gModbusExceptionConstructor = env->GetMethodID(gModbusExceptionClass, "<init>", "(Ljava/lang/String;II)V");
+    if (!gModbusExceptionConstructor)
+        return -1;
+    return jniRegisterNativeMethods(env, "serial/ModbusRtuMaster", gModbusRtuMasterMethods, NELEM(gModbusRtuMasterMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,96 @@
+#include <nativehelper/JNIHelp.h>
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+#include <serial/multiplexer.h>
+
+using namespace std;
+using namespace serial;
+
+static jlong native_create(JNIEnv *env, jobject)
+{
+    SerialMultiplexer * mux = NULL;
+    _BEGIN_TRY
+        mux = new SerialMultiplexer();
+        LOGD("Native multiplexer object %p.", mux);
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+    return (jlong)mux;
+}
+
+static void native_destroy(JNIEnv *env, jobject, jlong ptr)
+{
+    SerialMultiplexer * mux = (SerialMultiplexer *)ptr;
+    if (mux)
+        delete mux;
+}
+
+static void native_add(JNIEnv *env, jobject, jlong ptr, jlong serialPtr)
+{
+    SerialMultiplexer * mux = (SerialMultiplexer *)ptr;
+    _BEGIN_TRY
+        mux->add((Serial *)serialPtr, NULL);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+}
+
+static void native_remove(JNIEnv *env, jobject, jlong ptr, jlong serialPtr)
+{
+    SerialMultiplexer * mux = (SerialMultiplexer *)ptr;
+    mux->remove((Serial *)serialPtr);
+}
+
+static jint native_size(JNIEnv *env, jobject, jlong ptr)
+{
+    SerialMultiplexer * mux = (SerialMultiplexer *)ptr;
+    return (jint)mux->size();
+}
+
+static jlongArray native_select(JNIEnv *env, jobject, jlong ptr, jint timeout)
+{
+    SerialMultiplexer * mux = (SerialMultiplexer *)ptr;
+    _BEGIN_TRY
+        vector<Serial *> ready;
+        mux->select(timeout, ready);
+        jlongArray jready = env->NewLongArray(ready.size());
+        if (jready && !ready.empty()) {
+            vector<jlong> ptrs;
+            for (vector<Serial *>::iterator it = ready.begin(); it != ready.end(); ++it)
+                ptrs.push_back((jlong)*it);
+            env->SetLongArrayRegion(jready, 0, ptrs.size(), &ptrs[0]);
+        }
+        return jready;
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+    return NULL;
+}
+
+static void native_wakeup(JNIEnv *env, jobject, jlong ptr)
+{
+    SerialMultiplexer * mux = (SerialMultiplexer *)ptr;
+    mux->wakeup();
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gSerialMultiplexerMethods[] = {
+    { "native_create", "()J", (void*) native_create },
+    { "native_destroy", "(J)V", (void*) native_destroy },
+    { "native_add", "(JJ)V", (void*) native_add },
+    { "native_remove", "(JJ)V", (void*) native_remove },
+    { "native_size", "(J)I", (void*) native_size },
+    { "native_select", "(JI)[J", (void*) native_select },
+    { "native_wakeup", "(J)V", (void*) native_wakeup },
+};
+
+int registerSerialMultiplexer(JNIEnv* env)
+{
+    return jniRegisterNativeMethods(env, "serial/SerialMultiplexer", gSerialMultiplexerMethods, NELEM(gSerialMultiplexerMethods));
+}
+#ifdef __cplusplus
+}
+#endif
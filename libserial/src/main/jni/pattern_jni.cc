@@ -0,0 +1,88 @@
+#include <nativehelper/JNIHelp.h>
+
+#include <string>
+#include <vector>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+#include <serial/pattern_set.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Backs serial.PatternSet, each Java object owns one compiled native
+ * pattern set, and Serial.readUntilAny.
+ */
+
+static jlong native_create(JNIEnv *env, jobject, jobjectArray jpatterns)
+{
+    vector<string> patterns(env->GetArrayLength(jpatterns));
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        ScopedLocalRef<jbyteArray> jpattern(env, (jbyteArray)env->GetObjectArrayElement(jpatterns, i));
+        if (!jpattern.get()) {
+            env->ThrowNew(gIllegalArgumentException, "patterns must not be null");
+            return 0;
+        }
+        patterns[i].resize(env->GetArrayLength(jpattern.get()));
+        if (!patterns[i].empty())
+            env->GetByteArrayRegion(jpattern.get(), 0, patterns[i].size(), (jbyte *)&patterns[i][0]);
+    }
+    _BEGIN_TRY
+        return (jlong)new PatternSet(patterns);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _END_TRY
+    return 0;
+}
+
+static void native_destroy(JNIEnv *, jobject, jlong ptr)
+{
+    delete (PatternSet *)ptr;
+}
+
+static jbyteArray native_readUntilAny(JNIEnv *env, jobject, jlong ptr, jlong patternsPtr, jint deadlineMs, jintArray jindex)
+{
+    LOGD("native_readUntilAny(0x%08llx,%d)", ptr, deadlineMs);
+    Serial * com = (Serial *)ptr;
+    if (deadlineMs < 0) {
+        env->ThrowNew(gIllegalArgumentException, "deadlineMs must be >= 0");
+        return NULL;
+    }
+    vector<uint8_t> before;
+    _BEGIN_TRY
+        jint index = com->readUntilAny(*(PatternSet *)patternsPtr, before, (uint32_t)deadlineMs);
+        env->SetIntArrayRegion(jindex, 0, 1, &index);
+        jbyteArray jbefore = env->NewByteArray(before.size());
+        if (jbefore && !before.empty())
+            env->SetByteArrayRegion(jbefore, 0, before.size(), (const jbyte *)&before[0]);
+        return jbefore;
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+    return NULL;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gPatternSetMethods[] = {
+    { "native_create", "([[B)J", (void*) native_create },
+    { "native_destroy", "(J)V", (void*) native_destroy },
+};
+
+static JNINativeMethod gPatternSerialMethods[] = {
+    { "native_readUntilAny", "(JJI[I)[B", (void*) native_readUntilAny },
+};
+
+int registerPatternSet(JNIEnv* env)
+{
+    if (jniRegisterNativeMethods(env, "serial/PatternSet", gPatternSetMethods, NELEM(gPatternSetMethods)) < 0)
+        return -1;
+    return jniRegisterNativeMethods(env, "serial/Serial", gPatternSerialMethods, NELEM(gPatternSerialMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,310 @@
+#include <nativehelper/JNIHelp.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <map>
+#include <vector>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+#include <serial/multiplexer.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Pushes received data to serial.ReceiveListener objects.
+ *
+ * All ports with a listener share one SerialMultiplexer and one daemon
+ * thread, attached to the VM once for its whole life.  Data read from a
+ * port is collected until batchSize bytes are buffered or the oldest byte
+ * has waited maxLatencyMs, then handed to Java in a single upcall.
+ */
+
+static jmethodID gOnReceiveMethod = 0;
+static jmethodID gOnReceiveErrorMethod = 0;
+
+static int64_t nowNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+namespace {
+
+struct ReceiveTarget : public SerialMultiplexer::Listener {
+    Serial *port;
+    jobject jserial;
+    jobject jlistener;
+    size_t batchSize;
+    int64_t maxLatencyNs;
+
+    // Only touched by the receive thread
+    vector<uint8_t> batch;
+    int64_t firstNs;
+
+    // Guarded by gMutex
+    bool failed;
+    string error;
+    bool removed;
+
+    virtual void onData(Serial &, const uint8_t *data, size_t size)
+    {
+        if (batch.empty())
+            firstNs = nowNanos();
+        batch.insert(batch.end(), data, data + size);
+    }
+
+    virtual void onError(Serial &, const string &message);
+};
+
+}
+
+static SerialMultiplexer *gMultiplexer = NULL;
+static map<Serial *, ReceiveTarget *> gTargets;
+static pthread_mutex_t gMutex = PTHREAD_MUTEX_INITIALIZER;
+// Target whose upcall is running, it is freed by the receive thread
+static ReceiveTarget *gDelivering = NULL;
+static pthread_t gThread;
+
+void ReceiveTarget::onError(Serial &, const string &message)
+{
+    pthread_mutex_lock(&gMutex);
+    failed = true;
+    error = message;
+    pthread_mutex_unlock(&gMutex);
+}
+
+static void deleteTarget(JNIEnv *env, ReceiveTarget *target)
+{
+    env->DeleteGlobalRef(target->jlistener);
+    env->DeleteGlobalRef(target->jserial);
+    delete target;
+}
+
+/*
+ * Returns how long the receive thread may sleep before a batch is due, in
+ * milliseconds, or -1 when nothing is buffered.
+ */
+static int nextDeadline()
+{
+    int64_t now = nowNanos();
+    int64_t wait = -1;
+    pthread_mutex_lock(&gMutex);
+    for (map<Serial *, ReceiveTarget *>::iterator it = gTargets.begin(); it != gTargets.end(); ++it) {
+        ReceiveTarget *target = it->second;
+        if (target->failed) {
+            wait = 0;
+            break;
+        }
+        if (target->batch.empty())
+            continue;
+        int64_t left = target->firstNs + target->maxLatencyNs - now;
+        if (left < 0)
+            left = 0;
+        if (wait < 0 || left < wait)
+            wait = left;
+    }
+    pthread_mutex_unlock(&gMutex);
+    // Round up so we never wake just before the deadline
+    return wait < 0 ? -1 : (int)((wait + 999999) / 1000000);
+}
+
+static void deliver(JNIEnv *env, ReceiveTarget *target, bool failed, const string &error)
+{
+    if (!target->batch.empty()) {
+        jbyteArray jdata = env->NewByteArray(target->batch.size());
+        if (jdata) {
+            env->SetByteArrayRegion(jdata, 0, target->batch.size(), (const jbyte *)&target->batch[0]);
+            env->CallVoidMethod(target->jlistener, gOnReceiveMethod, target->jserial, jdata);
+            checkException(env);
+            env->DeleteLocalRef(jdata);
+        } else {
+            checkException(env);
+        }
+        target->batch.clear();
+    }
+    if (failed) {
+        jstring jerror = stdStringToJstring(env, error);
+        env->CallVoidMethod(target->jlistener, gOnReceiveErrorMethod, target->jserial, jerror);
+        checkException(env);
+        env->DeleteLocalRef(jerror);
+    }
+}
+
+/*
+ * Hands every batch that is full or old enough to Java, and reports
+ * failed ports.
+ */
+static void flushDue(JNIEnv *env)
+{
+    int64_t now = nowNanos();
+    vector<ReceiveTarget *> due;
+    pthread_mutex_lock(&gMutex);
+    for (map<Serial *, ReceiveTarget *>::iterator it = gTargets.begin(); it != gTargets.end(); ++it) {
+        ReceiveTarget *target = it->second;
+        if (target->failed
+            || target->batch.size() >= target->batchSize
+            || (!target->batch.empty() && now - target->firstNs >= target->maxLatencyNs))
+            due.push_back(target);
+    }
+    pthread_mutex_unlock(&gMutex);
+
+    for (size_t i = 0; i < due.size(); ++i) {
+        ReceiveTarget *target = due[i];
+        bool failed;
+        string error;
+        pthread_mutex_lock(&gMutex);
+        map<Serial *, ReceiveTarget *>::iterator it = gTargets.find(target->port);
+        if (it == gTargets.end() || it->second != target) {
+            // Removed by an earlier upcall of this round
+            pthread_mutex_unlock(&gMutex);
+            continue;
+        }
+        failed = target->failed;
+        error = target->error;
+        if (failed) {
+            // The multiplexer already dropped the port
+            gTargets.erase(it);
+            target->removed = true;
+        }
+        gDelivering = target;
+        pthread_mutex_unlock(&gMutex);
+
+        deliver(env, target, failed, error);
+
+        pthread_mutex_lock(&gMutex);
+        gDelivering = NULL;
+        bool removed = target->removed;
+        pthread_mutex_unlock(&gMutex);
+        if (removed)
+            deleteTarget(env, target);
+    }
+}
+
+static void *receiveThread(void *)
+{
+    JNIEnv *env = NULL;
+    JavaVMAttachArgs args;
+    args.version = JNI_VERSION_1_4;
+    args.name = "SerialReceive";
+    args.group = NULL;
+    if (getJavaVM()->AttachCurrentThreadAsDaemon(&env, &args) != JNI_OK) {
+        LOGE("Could not attach the receive thread");
+        return NULL;
+    }
+    while (true) {
+        _BEGIN_TRY
+            gMultiplexer->dispatch(nextDeadline());
+        _CATCH(std::exception)
+            LOGE("Receive thread stopped: %s", _ex.what());
+            break;
+        _END_TRY
+        flushDue(env);
+    }
+    getJavaVM()->DetachCurrentThread();
+    return NULL;
+}
+
+static void removeTarget(JNIEnv *env, Serial *port)
+{
+    // Waits for a running onData or onError, so it must not hold gMutex
+    gMultiplexer->remove(port);
+
+    pthread_mutex_lock(&gMutex);
+    map<Serial *, ReceiveTarget *>::iterator it = gTargets.find(port);
+    if (it == gTargets.end()) {
+        pthread_mutex_unlock(&gMutex);
+        return;
+    }
+    ReceiveTarget *target = it->second;
+    gTargets.erase(it);
+    if (gDelivering != target) {
+        pthread_mutex_unlock(&gMutex);
+        deleteTarget(env, target);
+        return;
+    }
+    // Its upcall is running.  Waiting for it could deadlock on a monitor
+    // the caller holds, so the receive thread frees it when it returns.
+    target->removed = true;
+    pthread_mutex_unlock(&gMutex);
+}
+
+static void native_setReceiveListener(JNIEnv *env, jobject, jlong ptr, jobject jserial, jobject jlistener, jint maxLatencyMs, jint batchSize)
+{
+    Serial * com = (Serial *)ptr;
+    if (jlistener && (maxLatencyMs < 0 || batchSize <= 0)) {
+        env->ThrowNew(gIllegalArgumentException, "maxLatencyMs must be >= 0 and batchSize > 0");
+        return;
+    }
+    if (gMultiplexer)
+        removeTarget(env, com);
+    if (!jlistener)
+        return;
+
+    _BEGIN_TRY
+        pthread_mutex_lock(&gMutex);
+        if (!gMultiplexer) {
+            gMultiplexer = new SerialMultiplexer();
+            int result = pthread_create(&gThread, NULL, receiveThread, NULL);
+            if (result) {
+                delete gMultiplexer;
+                gMultiplexer = NULL;
+                pthread_mutex_unlock(&gMutex);
+                THROW (IOException, result);
+            }
+        }
+        pthread_mutex_unlock(&gMutex);
+
+        ReceiveTarget *target = new ReceiveTarget();
+        target->port = com;
+        target->jserial = env->NewGlobalRef(jserial);
+        target->jlistener = env->NewGlobalRef(jlistener);
+        target->batchSize = (size_t)batchSize;
+        target->maxLatencyNs = (int64_t)maxLatencyMs * 1000000LL;
+        target->batch.reserve(target->batchSize);
+        target->firstNs = 0;
+        target->failed = false;
+        target->removed = false;
+        pthread_mutex_lock(&gMutex);
+        gTargets[com] = target;
+        pthread_mutex_unlock(&gMutex);
+        try {
+            gMultiplexer->add(com, target);
+        } catch (...) {
+            pthread_mutex_lock(&gMutex);
+            gTargets.erase(com);
+            pthread_mutex_unlock(&gMutex);
+            deleteTarget(env, target);
+            throw;
+        }
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gReceiveMethods[] = {
+    { "native_setReceiveListener", "(JLserial/Serial;Lserial/ReceiveListener;II)V", (void*) native_setReceiveListener },
+};
+
+int registerReceive(JNIEnv* env)
+{
+    ScopedLocalRef<jclass> listenerClass(env, findClass("serial/ReceiveListener"));
+    if (!listenerClass.get())
+        return -1;
+    gOnReceiveMethod = env->GetMethodID(listenerClass.get(), "onReceive", "(Lserial/Serial;[B)V");
+    gOnReceiveErrorMethod = env->GetMethodID(listenerClass.get(), "onReceiveError", "(Lserial/Serial;Ljava/lang/String;)V");
+    if (!gOnReceiveMethod || !gOnReceiveErrorMethod)
+        return -1;
+    return jniRegisterNativeMethods(env, "serial/Serial", gReceiveMethods, NELEM(gReceiveMethods));
+}
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,9 @@
 #include <nativehelper/JNIHelp.h>
 #include "jni_utility.h"
+#include "serial_jni.h"
 #include <serial/serial.h>
+#include <serial/histogram.h>
+#include <serial/trace.h>
 
 using namespace std;
 using namespace serial;
@@ -13,16 +16,9 @@ using namespace serial;
     env->ReleaseIntArrayElements((in), _array, JNI_ABORT)
 
 
-#define _BEGIN_TRY                              try {
-#define _CATCH(cpp_ex)                          } catch (cpp_ex& _ex) {
-#define _CATCH_AND_THROW(env, cpp_ex, java_ex)  } catch (cpp_ex& _ex) { \
-    LOGE("%s", _ex.what());\
-    (env)->ThrowNew(java_ex, _ex.what());
-#define _END_TRY                                }
-    
-static jclass gSerialExceptionClass = 0;
-static jclass gSerialIOExceptionClass = 0;
-static jclass gIllegalArgumentException = 0;
+jclass gSerialExceptionClass = 0;
+jclass gSerialIOExceptionClass = 0;
+jclass gIllegalArgumentException = 0;
 
 static jobjectArray native_listPorts(JNIEnv *env, jobject)
 {
@@ -119,30 +115,99 @@ static void native_waitByteTimes(JNIEnv *env, jobject, jlong ptr, jint count)
     com->waitByteTimes(count);    
 }
 
+// Checked before touching the port, so a bad region does not swallow data
+bool checkArrayRegion(JNIEnv *env, jbyteArray jarray, jint offset, jint size)
+{
+    jsize length = env->GetArrayLength(jarray);
+    if (offset < 0 || size < 0 || (jlong)offset + size > length) {
+        env->ThrowNew(gIllegalArgumentException, "region out of array bounds");
+        return false;
+    }
+    return true;
+}
+
+// Copying to and from Java arrays shows up in traces as its own section
+static void copyIn(JNIEnv *env, jbyteArray jarray, jint offset, jint size, uint8_t *buffer)
+{
+    ScopedTrace trace("serial jni copy in");
+    env->GetByteArrayRegion(jarray, offset, size, (jbyte *)buffer);
+}
+
+static void copyOut(JNIEnv *env, jbyteArray jarray, jint offset, jint size, const uint8_t *buffer)
+{
+    ScopedTrace trace("serial jni copy out");
+    env->SetByteArrayRegion(jarray, offset, size, (const jbyte *)buffer);
+}
+
 static jint native_read(JNIEnv *env, jobject, jlong ptr, jbyteArray jbuffer, jint offset, jint size)
 {
     LOGD("native_read(0x%08llx,%p,%d,%d)", ptr, jbuffer, offset, size);
     Serial * com = (Serial *)ptr;
-    jbyte* jarray = env->GetByteArrayElements(jbuffer, NULL);
-    if (jarray) {
-        uint8_t * buffer = (uint8_t *)(jarray + offset);
+    if (checkArrayRegion(env, jbuffer, offset, size)) {
         _BEGIN_TRY
-            int bytesRead = com->read(buffer, (size_t)size);
+            ScratchBuffer buffer((size_t)size);
+            int bytesRead = com->read(buffer.get(), (size_t)size);
             LOGD("bytes read = %d", bytesRead);
-            env->ReleaseByteArrayElements(jbuffer, jarray, 0);
+            copyOut(env, jbuffer, offset, bytesRead, buffer.get());
             return (jint)bytesRead;
         _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
-            env->ReleaseByteArrayElements(jbuffer, jarray, JNI_ABORT);
         _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
-            env->ReleaseByteArrayElements(jbuffer, jarray, JNI_ABORT);
         _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
-            env->ReleaseByteArrayElements(jbuffer, jarray, JNI_ABORT);
         _END_TRY
-        return -1;
     }
     return -1; // Failed
 }
 
+uint8_t * getDirectRegion(JNIEnv *env, jobject jbuffer, jint offset, jint size)
+{
+    uint8_t * address = (uint8_t *)env->GetDirectBufferAddress(jbuffer);
+    if (address == NULL) {
+        env->ThrowNew(gIllegalArgumentException, "buffer is not a direct buffer");
+        return NULL;
+    }
+    jlong capacity = env->GetDirectBufferCapacity(jbuffer);
+    if (offset < 0 || size < 0 || (jlong)offset + size > capacity) {
+        env->ThrowNew(gIllegalArgumentException, "region out of buffer bounds");
+        return NULL;
+    }
+    return address + offset;
+}
+
+static jint native_readDirect(JNIEnv *env, jobject, jlong ptr, jobject jbuffer, jint offset, jint size)
+{
+    LOGD("native_readDirect(0x%08llx,%p,%d,%d)", ptr, jbuffer, offset, size);
+    Serial * com = (Serial *)ptr;
+    uint8_t * buffer = getDirectRegion(env, jbuffer, offset, size);
+    if (buffer) {
+        _BEGIN_TRY
+            int bytesRead = com->read(buffer, (size_t)size);
+            LOGD("bytes read = %d", bytesRead);
+            return (jint)bytesRead;
+        _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+        _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+        _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+        _END_TRY
+    }
+    return -1;
+}
+
+static jint native_readAvailable(JNIEnv *env, jobject, jlong ptr, jbyteArray jbuffer, jint offset, jint size)
+{
+    LOGD("native_readAvailable(0x%08llx,%p,%d,%d)", ptr, jbuffer, offset, size);
+    Serial * com = (Serial *)ptr;
+    if (checkArrayRegion(env, jbuffer, offset, size)) {
+        _BEGIN_TRY
+            ScratchBuffer buffer((size_t)size);
+            int bytesRead = com->readAvailable(buffer.get(), (size_t)size);
+            copyOut(env, jbuffer, offset, bytesRead, buffer.get());
+            return (jint)bytesRead;
+        _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+        _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+        _END_TRY
+    }
+    return -1;
+}
+
 static jstring native_readline(JNIEnv *env, jobject, jlong ptr, jint size, jstring jeol)
 {
     Serial * com = (Serial *)ptr;
@@ -174,29 +239,59 @@ static jobjectArray native_readlines(JNIEnv *env, jobject, jlong ptr, jint size,
     return jlines;
 }
 
-static jint native_write(JNIEnv *env, jobject, jlong ptr, jbyteArray jdata, jint size)
+static jint native_write(JNIEnv *env, jobject, jlong ptr, jbyteArray jdata, jint offset, jint size)
+{
+    LOGD("native_write(0x%08llx,%p,%d,%d)", ptr, jdata, offset, size);
+    Serial * com = (Serial *)ptr;
+    if (checkArrayRegion(env, jdata, offset, size)) {
+        _BEGIN_TRY
+            ScratchBuffer data((size_t)size);
+            copyIn(env, jdata, offset, size, data.get());
+            int bytesWritten = com->write(data.get(), (size_t)size);
+            LOGD("bytes written = %d", bytesWritten);
+            return (jint)bytesWritten;
+        _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+        _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+        _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+        _END_TRY
+    }
+    return -1;
+}
+
+static jint native_writeDirect(JNIEnv *env, jobject, jlong ptr, jobject jdata, jint offset, jint size)
 {
-    LOGD("native_write(0x%08llx,%p,%d)", ptr, jdata, size);
+    LOGD("native_writeDirect(0x%08llx,%p,%d,%d)", ptr, jdata, offset, size);
     Serial * com = (Serial *)ptr;
-    jbyte* jarray = env->GetByteArrayElements(jdata, NULL);
-    if (jarray) {
-        uint8_t * data = (uint8_t *)jarray;
+    uint8_t * data = getDirectRegion(env, jdata, offset, size);
+    if (data) {
         _BEGIN_TRY
             int bytesWritten = com->write(data, (size_t)size);
             LOGD("bytes written = %d", bytesWritten);
-            env->ReleaseByteArrayElements(jdata, jarray, JNI_ABORT);
             return (jint)bytesWritten;
         _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
-            env->ReleaseByteArrayElements(jdata, jarray, JNI_ABORT);
         _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
-            env->ReleaseByteArrayElements(jdata, jarray, JNI_ABORT);
         _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
-            env->ReleaseByteArrayElements(jdata, jarray, JNI_ABORT);
         _END_TRY
     }
     return -1;
 }
 
+static void native_setContinuousReceive(JNIEnv *env, jobject, jlong ptr, jboolean enabled, jint bufferSize)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->setContinuousReceive((bool)enabled, (size_t)bufferSize);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+}
+
+static jboolean native_isContinuousReceive(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return com->isContinuousReceive() ? JNI_TRUE : JNI_FALSE;
+}
+
 static void native_setPort(JNIEnv *env, jobject, jlong ptr, jstring jport)
 {
     Serial * com = (Serial *)ptr;
@@ -211,6 +306,23 @@ static jstring native_getPort(JNIEnv *env, jobject, jlong ptr)
     return stdStringToJstring(port);
 }
 
+static void native_setReplay(JNIEnv *env, jobject, jlong ptr, jstring jcapture, jdouble speed)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->setReplay(jstringToStdString(env, jcapture), speed);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+}
+
+static jboolean native_isReplay(JNIEnv *, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return com->isReplay();
+}
+
 static void native_setBaudrate(JNIEnv *env, jobject, jlong ptr, jint baudrate)
 {
     Serial * com = (Serial *)ptr;
@@ -302,10 +414,160 @@ static jint native_getFlowcontrol(JNIEnv *env, jobject, jlong ptr)
     return (jint)com->getFlowcontrol();
 }
 
+static void native_setLatencyProfile(JNIEnv *env, jobject, jlong ptr, jint profile)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->setLatencyProfile(latency_profile_t(profile));
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+}
+
+static jint native_getLatencyProfile(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return (jint)com->getLatencyProfile();
+}
+
+static void native_setReadCoalescing(JNIEnv *env, jobject, jlong ptr, jint policy, jint maxWaitUs)
+{
+    Serial * com = (Serial *)ptr;
+    com->setReadCoalescing(coalesce_policy_t(policy), (uint32_t)maxWaitUs);
+}
+
+static jint native_getReadCoalescing(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return (jint)com->getReadCoalescing();
+}
+
+static jint native_getReadCoalescingMaxWait(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return (jint)com->getReadCoalescingMaxWait();
+}
+
+static void native_setWriteBatching(JNIEnv *env, jobject, jlong ptr, jint maxBytes, jint deadlineUs)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->setWriteBatching((size_t)maxBytes, (uint32_t)deadlineUs);
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+}
+
+static jint native_getWriteBatchSize(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return (jint)com->getWriteBatchSize();
+}
+
+static jint native_getWriteBatchDeadline(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return (jint)com->getWriteBatchDeadline();
+}
+
+static void native_flushWrites(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->flushWrites();
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+}
+
+static void native_getLatency(JNIEnv *env, jobject, jlong ptr, jint op, jlong histogramPtr, jboolean reset)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->getLatency(latency_op_t(op), *(LatencyHistogram *)histogramPtr, reset);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _END_TRY
+}
+
+static void native_resetLatency(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    com->resetLatency();
+}
+
+static void native_startCapture(JNIEnv *env, jobject, jlong ptr, jstring jpath)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->startCapture(jstringToStdString(env, jpath));
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
+}
+
+static void native_stopCapture(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    _BEGIN_TRY
+        com->stopCapture();
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+}
+
+static jboolean native_isCapturing(JNIEnv *, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return com->isCapturing();
+}
+
+static jboolean native_setTracingEnabled(JNIEnv *, jclass, jboolean enabled)
+{
+    return Trace::setEnabled(enabled);
+}
+
+static jboolean native_isTracingEnabled(JNIEnv *, jclass)
+{
+    return Trace::isEnabled();
+}
+
+static jlongArray native_getStats(JNIEnv *env, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    PortStats stats = com->getStats();
+    // Keep the order in sync with serial.SerialStats
+    jlong values[] = {
+        (jlong)stats.bytes_read,
+        (jlong)stats.bytes_written,
+        (jlong)stats.read_calls,
+        (jlong)stats.write_calls,
+        (jlong)stats.zero_reads,
+        (jlong)stats.partial_writes,
+        (jlong)stats.wait_wakeups,
+        (jlong)stats.wait_timeouts,
+        (jlong)stats.wait_ns,
+        (jlong)stats.reconfigurations,
+        (jlong)stats.read_lock_waits,
+        (jlong)stats.read_lock_wait_ns,
+        (jlong)stats.write_lock_waits,
+        (jlong)stats.write_lock_wait_ns,
+    };
+    jlongArray jvalues = env->NewLongArray(NELEM(values));
+    if (jvalues)
+        env->SetLongArrayRegion(jvalues, 0, NELEM(values), values);
+    return jvalues;
+}
+
 static void native_flush(JNIEnv *env, jobject, jlong ptr)
 {
     Serial * com = (Serial *)ptr;
-    com->flush();
+    _BEGIN_TRY
+        // Sends what write batching has queued first, which may fail
+        com->flush();
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _CATCH_AND_THROW(env, SerialException, gSerialExceptionClass)
+    _END_TRY
 }
 
 static void native_flushInput(JNIEnv *env, jobject, jlong ptr)
@@ -422,11 +684,18 @@ static JNINativeMethod gSerialMethods[] = {
     { "native_waitReadable", "(J)Z", (void*) native_waitReadable },
     { "native_waitByteTimes", "(JI)V", (void*) native_waitByteTimes },
     { "native_read", "(J[BII)I", (void*) native_read },
+    { "native_readDirect", "(JLjava/nio/ByteBuffer;II)I", (void*) native_readDirect },
+    { "native_readAvailable", "(J[BII)I", (void*) native_readAvailable },
     { "native_readline", "(JILjava/lang/String;)Ljava/lang/String;", (void*) native_readline },
     { "native_readlines", "(JILjava/lang/String;)[Ljava/lang/String;", (void*) native_readlines },
-    { "native_write", "(J[BI)I", (void*) native_write },
+    { "native_write", "(J[BII)I", (void*) native_write },
+    { "native_writeDirect", "(JLjava/nio/ByteBuffer;II)I", (void*) native_writeDirect },
+    { "native_setContinuousReceive", "(JZI)V", (void*) native_setContinuousReceive },
+    { "native_isContinuousReceive", "(J)Z", (void*) native_isContinuousReceive },
     { "native_setPort", "(JLjava/lang/String;)V", (void*) native_setPort },
     { "native_getPort", "(J)Ljava/lang/String;", (void*) native_getPort },
+    { "native_setReplay", "(JLjava/lang/String;D)V", (void*) native_setReplay },
+    { "native_isReplay", "(J)Z", (void*) native_isReplay },
     { "native_setBaudrate", "(JI)V", (void*) native_setBaudrate },
     { "native_getBaudrate", "(J)I", (void*) native_getBaudrate },
     { "native_setTimeout", "(J[I)V", (void*) native_setTimeout },
@@ -438,6 +707,23 @@ static JNINativeMethod gSerialMethods[] = {
     { "native_getStopbits", "(J)I", (void*) native_getStopbits },
     { "native_setFlowcontrol", "(JI)V", (void*) native_setFlowcontrol },
     { "native_getFlowcontrol", "(J)I", (void*) native_getFlowcontrol },
+    { "native_setLatencyProfile", "(JI)V", (void*) native_setLatencyProfile },
+    { "native_getLatencyProfile", "(J)I", (void*) native_getLatencyProfile },
+    { "native_setReadCoalescing", "(JII)V", (void*) native_setReadCoalescing },
+    { "native_getReadCoalescing", "(J)I", (void*) native_getReadCoalescing },
+    { "native_getReadCoalescingMaxWait", "(J)I", (void*) native_getReadCoalescingMaxWait },
+    { "native_setWriteBatching", "(JII)V", (void*) native_setWriteBatching },
+    { "native_getWriteBatchSize", "(J)I", (void*) native_getWriteBatchSize },
+    { "native_getWriteBatchDeadline", "(J)I", (void*) native_getWriteBatchDeadline },
+    { "native_flushWrites", "(J)V", (void*) native_flushWrites },
+    { "native_getStats", "(J)[J", (void*) native_getStats },
+    { "native_getLatency", "(JIJZ)V", (void*) native_getLatency },
+    { "native_resetLatency", "(J)V", (void*) native_resetLatency },
+    { "native_startCapture", "(JLjava/lang/String;)V", (void*) native_startCapture },
+    { "native_stopCapture", "(J)V", (void*) native_stopCapture },
+    { "native_isCapturing", "(J)Z", (void*) native_isCapturing },
+    { "native_setTracingEnabled", "(Z)Z", (void*) native_setTracingEnabled },
+    { "native_isTracingEnabled", "()Z", (void*) native_isTracingEnabled },
     { "native_flush", "(J)V", (void*) native_flush },
     { "native_flushInput", "(J)V", (void*) native_flushInput },
     { "native_flushOutput", "(J)V", (void*) native_flushOutput },
@@ -0,0 +1,178 @@
+#include <nativehelper/JNIHelp.h>
+#include <pthread.h>
+
+#include <deque>
+
+#include "jni_utility.h"
+#include "serial_jni.h"
+#include <serial/serial.h>
+
+using namespace std;
+using namespace serial;
+
+/*
+ * Reports writes queued with Serial.submitWrite to serial.WriteListener
+ * objects.
+ *
+ * The port's writer thread only moves a finished submission onto a queue
+ * here; one daemon thread, attached to the VM once for its whole life,
+ * makes the upcalls for all ports.  That keeps a slow listener from
+ * holding up the next write.
+ */
+
+static jmethodID gOnWriteCompleteMethod = 0;
+// WriteStatus constants, indexed by write_status_t
+static jobject gWriteStatusValues[4];
+
+namespace {
+
+struct PendingWrite : public WriteListener {
+    jobject jserial;
+    jobject jlistener;
+
+    // Set on completion
+    uint64_t id;
+    write_status_t status;
+    size_t written;
+
+    virtual void onWriteComplete(uint64_t id, write_status_t status, size_t written);
+};
+
+}
+
+static deque<PendingWrite *> gCompleted;
+static pthread_mutex_t gMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gCond = PTHREAD_COND_INITIALIZER;
+static bool gThreadStarted = false;
+
+void PendingWrite::onWriteComplete(uint64_t id, write_status_t status, size_t written)
+{
+    this->id = id;
+    this->status = status;
+    this->written = written;
+    pthread_mutex_lock(&gMutex);
+    gCompleted.push_back(this);
+    pthread_cond_signal(&gCond);
+    pthread_mutex_unlock(&gMutex);
+}
+
+static void deletePending(JNIEnv *env, PendingWrite *pending)
+{
+    env->DeleteGlobalRef(pending->jlistener);
+    env->DeleteGlobalRef(pending->jserial);
+    delete pending;
+}
+
+static void *completionThread(void *)
+{
+    JNIEnv *env = NULL;
+    JavaVMAttachArgs args;
+    args.version = JNI_VERSION_1_4;
+    args.name = "SerialWrite";
+    args.group = NULL;
+    if (getJavaVM()->AttachCurrentThreadAsDaemon(&env, &args) != JNI_OK) {
+        LOGE("Could not attach the write completion thread");
+        return NULL;
+    }
+    while (true) {
+        pthread_mutex_lock(&gMutex);
+        while (gCompleted.empty())
+            pthread_cond_wait(&gCond, &gMutex);
+        PendingWrite *pending = gCompleted.front();
+        gCompleted.pop_front();
+        pthread_mutex_unlock(&gMutex);
+
+        env->CallVoidMethod(pending->jlistener, gOnWriteCompleteMethod, pending->jserial,
+                (jlong)pending->id, gWriteStatusValues[pending->status], (jint)pending->written);
+        checkException(env);
+        deletePending(env, pending);
+    }
+    return NULL;
+}
+
+static jlong native_submitWrite(JNIEnv *env, jobject, jlong ptr, jobject jserial, jbyteArray jdata, jint offset, jint size, jint priority, jobject jlistener)
+{
+    Serial * com = (Serial *)ptr;
+    if (!checkArrayRegion(env, jdata, offset, size))
+        return 0;
+    PendingWrite *pending = NULL;
+    if (jlistener) {
+        pthread_mutex_lock(&gMutex);
+        if (!gThreadStarted) {
+            pthread_t thread;
+            int result = pthread_create(&thread, NULL, completionThread, NULL);
+            if (result) {
+                pthread_mutex_unlock(&gMutex);
+                env->ThrowNew(gSerialIOExceptionClass, "Could not start the write completion thread");
+                return 0;
+            }
+            pthread_detach(thread);
+            gThreadStarted = true;
+        }
+        pthread_mutex_unlock(&gMutex);
+        pending = new PendingWrite();
+        pending->jserial = env->NewGlobalRef(jserial);
+        pending->jlistener = env->NewGlobalRef(jlistener);
+    }
+    // submitWrite copies the bytes, so only the region crosses over
+    ScratchBuffer buffer((size_t)size);
+    env->GetByteArrayRegion(jdata, offset, size, (jbyte *)buffer.get());
+    _BEGIN_TRY
+        return (jlong)com->submitWrite(buffer.get(), (size_t)size,
+                (write_priority_t)priority, pending);
+    _CATCH_AND_THROW(env, invalid_argument, gIllegalArgumentException)
+    _CATCH_AND_THROW(env, PortNotOpenedException, gSerialExceptionClass)
+    _CATCH_AND_THROW(env, IOException, gSerialIOExceptionClass)
+    _END_TRY
+    if (pending)
+        deletePending(env, pending);
+    return 0;
+}
+
+static void native_cancelWrites(JNIEnv *, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    com->cancelWrites();
+}
+
+static jint native_getQueuedWrites(JNIEnv *, jobject, jlong ptr)
+{
+    Serial * com = (Serial *)ptr;
+    return (jint)com->getQueuedWrites();
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static JNINativeMethod gWriteMethods[] = {
+    { "native_submitWrite", "(JLserial/Serial;[BIIILserial/WriteListener;)J", (void*) native_submitWrite },
+    { "native_cancelWrites", "(J)V", (void*) native_cancelWrites },
+    { "native_getQueuedWrites", "(J)I", (void*) native_getQueuedWrites },
+};
+
+int registerWrite(JNIEnv* env)
+{
+    ScopedLocalRef<jclass> listenerClass(env, findClass("serial/WriteListener"));
+    if (!listenerClass.get())
+        return -1;
+    gOnWriteCompleteMethod = env->GetMethodID(listenerClass.get(), "onWriteComplete", "(Lserial/Serial;JLserial/WriteStatus;I)V");
+    if (!gOnWriteCompleteMethod)
+        return -1;
+
+    ScopedLocalRef<jclass> statusClass(env, findClass("serial/WriteStatus"));
+    if (!statusClass.get())
+        return -1;
+    static const char *names[] = { "Done", "TimedOut", "Failed", "Cancelled" };
+    for (size_t i = 0; i < NELEM(names); ++i) {
+        jfieldID field = env->GetStaticFieldID(statusClass.get(), names[i], "Lserial/WriteStatus;");
+        if (!field)
+            return -1;
+        ScopedLocalRef<jobject> value(env, env->GetStaticObjectField(statusClass.get(), field));
+        gWriteStatusValues[i] = env->NewGlobalRef(value.get());
+    }
+    return jniRegisterNativeMethods(env, "serial/Serial", gWriteMethods, NELEM(gWriteMethods));
+}
+#ifdef __cplusplus
+}
+#endif